@@ -0,0 +1,500 @@
+#include "accessLog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include "bool.h"
+
+#define ACCESS_LOG_MAX_RINGS 1024
+#define ACCESS_LOG_MAX_LINE 4096
+#define ACCESS_LOG_BATCH_BYTES (1 << 20)
+
+typedef struct AccessLogRing_t
+{
+    // producer and consumer indexes live on separate cache lines
+    size_t head __attribute__((aligned(64)));   // written by the owning thread
+    size_t tail __attribute__((aligned(64)));   // written by the drain thread
+    int owned __attribute__((aligned(64)));     // a live thread writes here
+    size_t mask;
+    char *data;
+} AccessLogRing;
+
+static struct
+{
+    bool enabled;
+    AccessLogConfig config;
+    char *path;
+    int fd;
+    size_t fileBytes;
+
+    AccessLogRing *rings[ACCESS_LOG_MAX_RINGS];
+    size_t ringCount;
+    pthread_mutex_t registerLock;
+    pthread_key_t ringKey;
+
+    char *batch;
+    size_t batchUsed;
+
+    pthread_t thread;
+    volatile sig_atomic_t reopen;
+    int stop;
+    pthread_mutex_t stopLock;
+    pthread_cond_t stopCond;
+
+    unsigned long dropped;
+    unsigned long ringsFreed;   // bumped each time a thread hands its ring back
+} accessLog = {
+    .enabled = false,
+    .fd = -1,
+    .registerLock = PTHREAD_MUTEX_INITIALIZER,
+    .stopLock = PTHREAD_MUTEX_INITIALIZER,
+    .stopCond = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread AccessLogRing *accessLogLocalRing = NULL;
+static __thread unsigned long accessLogMissed = 0;  // ringsFreed + 1 when no ring was left
+
+/**
+* accessLogReleaseRing: Thread exit destructor, hands the ring back so a
+*   thread started later can reuse it once it has been drained.
+*/
+static void accessLogReleaseRing(void *ring)
+{
+    __atomic_store_n(&((AccessLogRing *)ring)->owned, 0, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&accessLog.ringsFreed, 1, __ATOMIC_RELEASE);
+}
+
+/**
+* accessLogGetRing: Returns the calling thread's ring, claiming one on first use.
+*   Never waits: a thread that finds registerLock held, or found every ring
+*   taken and none handed back since, gets NULL and its line is dropped.
+* @return
+*   NULL if no ring could be claimed without waiting or an allocation failed
+*/
+static AccessLogRing *accessLogGetRing(void)
+{
+    if (accessLogLocalRing != NULL)
+    {
+        return accessLogLocalRing;
+    }
+    unsigned long freed = __atomic_load_n(&accessLog.ringsFreed, __ATOMIC_ACQUIRE);
+    if (accessLogMissed == freed + 1 || pthread_mutex_trylock(&accessLog.registerLock) != 0)
+    {
+        return NULL;
+    }
+
+        AccessLogRing *ring = NULL;
+        for (size_t i = 0; i < accessLog.ringCount; i++)
+        {
+            AccessLogRing *candidate = accessLog.rings[i];
+            if (!__atomic_load_n(&candidate->owned, __ATOMIC_ACQUIRE))
+            {
+                ring = candidate;
+                break;
+            }
+        }
+
+        if (ring == NULL && accessLog.ringCount < ACCESS_LOG_MAX_RINGS)
+        {
+            size_t size = 1;
+            while (size < accessLog.config.ringBytes)
+            {
+                size <<= 1;
+            }
+            ring = aligned_alloc(64, sizeof(*ring));
+            char *data = malloc(size);
+            if (ring == NULL || data == NULL)
+            {
+                free(ring);
+                free(data);
+                ring = NULL;
+            }
+            else
+            {
+                memset(ring, 0, sizeof(*ring));
+                ring->mask = size - 1;
+                ring->data = data;
+                __atomic_store_n(&accessLog.rings[accessLog.ringCount], ring, __ATOMIC_RELEASE);
+                __atomic_store_n(&accessLog.ringCount, accessLog.ringCount + 1, __ATOMIC_RELEASE);
+            }
+        }
+
+        if (ring != NULL)
+        {
+            ring->owned = 1;
+            pthread_setspecific(accessLog.ringKey, ring);
+        }
+    pthread_mutex_unlock(&accessLog.registerLock);
+
+    accessLogLocalRing = ring;
+    accessLogMissed = ring == NULL ? freed + 1 : 0;
+    return ring;
+}
+
+/**
+* accessLogEscape: Copies src into dst escaping characters that would break
+*   the line format. quote is the escape style ('"' for CLF, 'j' for JSON).
+* @return the number of bytes written (dst is always NUL terminated)
+*/
+static size_t accessLogEscape(char *dst, size_t size, const char *src, char quote)
+{
+    size_t used = 0;
+
+    if (src == NULL || src[0] == '\0')
+    {
+        src = quote == 'j' ? "" : "-";
+    }
+    for (; *src && used + 7 < size; src++)
+    {
+        unsigned char c = *src;
+        if (c == '"' || c == '\\')
+        {
+            dst[used++] = '\\';
+            dst[used++] = c;
+        }
+        else if (c < 0x20 || c == 0x7f)
+        {
+            used += snprintf(dst + used, size - used, quote == 'j' ? "\\u%04x" : "\\x%02x", c);
+        }
+        else
+        {
+            dst[used++] = c;
+        }
+    }
+    dst[used] = '\0';
+    return used;
+}
+
+/**
+* accessLogFormat: Renders entry as one log line (with the trailing newline).
+* @return the line length
+*/
+static int accessLogFormat(char *line, size_t size, const AccessLogEntry *entry)
+{
+    char date[64], uri[1024], referer[512], agent[512], bytes[32];
+    struct tm tm;
+    int len;
+
+    localtime_r(&entry->time, &tm);
+    accessLogEscape(uri, sizeof(uri), entry->uri, accessLog.config.format == LOG_FORMAT_JSON ? 'j' : '"');
+    if (entry->bytes < 0)
+    {
+        strcpy(bytes, accessLog.config.format == LOG_FORMAT_JSON ? "null" : "-");
+    }
+    else
+    {
+        snprintf(bytes, sizeof(bytes), "%ld", entry->bytes);
+    }
+
+    switch (accessLog.config.format)
+    {
+    case LOG_FORMAT_JSON:
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &tm);
+        accessLogEscape(referer, sizeof(referer), entry->referer, 'j');
+        accessLogEscape(agent, sizeof(agent), entry->userAgent, 'j');
+        len = snprintf(line, size,
+                       "{\"time\":\"%s\",\"client\":\"%s\",\"method\":\"%s\",\"uri\":\"%s\","
+                       "\"protocol\":\"%s\",\"status\":%d,\"bytes\":%s,\"referer\":\"%s\","
+                       "\"user_agent\":\"%s\",\"duration_us\":%ld}\n",
+                       date, entry->client, entry->method, uri, entry->version,
+                       entry->status, bytes, referer, agent, entry->durationUs);
+        break;
+    case LOG_FORMAT_COMBINED:
+        strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S %z", &tm);
+        accessLogEscape(referer, sizeof(referer), entry->referer, '"');
+        accessLogEscape(agent, sizeof(agent), entry->userAgent, '"');
+        len = snprintf(line, size, "%s - - [%s] \"%s %s %s\" %d %s \"%s\" \"%s\" %ld\n",
+                       entry->client, date, entry->method, uri, entry->version,
+                       entry->status, bytes, referer, agent, entry->durationUs);
+        break;
+    default:
+        strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S %z", &tm);
+        len = snprintf(line, size, "%s - - [%s] \"%s %s %s\" %d %s\n",
+                       entry->client, date, entry->method, uri, entry->version,
+                       entry->status, bytes);
+        break;
+    }
+
+    if (len >= (int)size)
+    {
+        // keep the line terminated even when truncated
+        len = size - 1;
+        line[len - 1] = '\n';
+    }
+    return len;
+}
+
+void accessLogWrite(const AccessLogEntry *entry)
+{
+    char line[ACCESS_LOG_MAX_LINE];
+
+    if (!__atomic_load_n(&accessLog.enabled, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    AccessLogRing *ring = accessLogGetRing();
+    if (ring == NULL)
+    {
+        __atomic_fetch_add(&accessLog.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    size_t len = accessLogFormat(line, sizeof(line), entry);
+    size_t head = ring->head;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (ring->mask + 1 - (head - tail) < len)
+    {
+        __atomic_fetch_add(&accessLog.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    size_t start = head & ring->mask;
+    size_t first = ring->mask + 1 - start;
+    if (first > len)
+    {
+        first = len;
+    }
+    memcpy(ring->data + start, line, first);
+    memcpy(ring->data, line + first, len - first);
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+}
+
+static int accessLogOpen(void)
+{
+    struct stat sbuf;
+
+    if (!strcmp(accessLog.path, ACCESS_LOG_STDOUT))
+    {
+        accessLog.fd = STDOUT_FILENO;
+        accessLog.fileBytes = 0;
+        return 0;
+    }
+
+    accessLog.fd = open(accessLog.path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (accessLog.fd < 0)
+    {
+        return -1;
+    }
+    accessLog.fileBytes = fstat(accessLog.fd, &sbuf) == 0 ? sbuf.st_size : 0;
+    return 0;
+}
+
+static void accessLogClose(void)
+{
+    if (accessLog.fd > STDERR_FILENO)
+    {
+        close(accessLog.fd);
+    }
+    accessLog.fd = -1;
+}
+
+/**
+* accessLogRotate: Shifts path.N-1 .. path.1 up by one, moves the live file to
+*   path.1 and starts a new one.
+*/
+static void accessLogRotate(void)
+{
+    size_t len = strlen(accessLog.path) + 16;
+    char from[len], to[len];
+
+    for (int i = accessLog.config.rotateKeep - 1; i >= 1; i--)
+    {
+        snprintf(from, len, "%s.%d", accessLog.path, i);
+        snprintf(to, len, "%s.%d", accessLog.path, i + 1);
+        rename(from, to);
+    }
+    if (accessLog.config.rotateKeep > 0)
+    {
+        snprintf(to, len, "%s.1", accessLog.path);
+        rename(accessLog.path, to);
+    }
+    else
+    {
+        unlink(accessLog.path);
+    }
+
+    accessLogClose();
+    if (accessLogOpen() < 0)
+    {
+        fprintf(stderr, "access log: could not reopen %s: %s\n", accessLog.path, strerror(errno));
+    }
+}
+
+static void accessLogFlush(void)
+{
+    size_t done = 0;
+
+    while (done < accessLog.batchUsed && accessLog.fd >= 0)
+    {
+        ssize_t n = write(accessLog.fd, accessLog.batch + done, accessLog.batchUsed - done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        done += n;
+    }
+    accessLog.fileBytes += done;
+    accessLog.batchUsed = 0;
+
+    if (accessLog.config.rotateBytes > 0 && accessLog.fd > STDERR_FILENO &&
+        accessLog.fileBytes >= accessLog.config.rotateBytes)
+    {
+        accessLogRotate();
+    }
+}
+
+/**
+* accessLogDrain: Moves everything queued in every ring to the file.
+*/
+static void accessLogDrain(void)
+{
+    size_t count = __atomic_load_n(&accessLog.ringCount, __ATOMIC_ACQUIRE);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        AccessLogRing *ring = __atomic_load_n(&accessLog.rings[i], __ATOMIC_ACQUIRE);
+        size_t tail = ring->tail;
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        while (tail != head)
+        {
+            if (accessLog.batchUsed == ACCESS_LOG_BATCH_BYTES)
+            {
+                accessLogFlush();
+            }
+            size_t start = tail & ring->mask;
+            size_t chunk = head - tail;
+            if (chunk > ring->mask + 1 - start)
+            {
+                chunk = ring->mask + 1 - start;
+            }
+            if (chunk > ACCESS_LOG_BATCH_BYTES - accessLog.batchUsed)
+            {
+                chunk = ACCESS_LOG_BATCH_BYTES - accessLog.batchUsed;
+            }
+            memcpy(accessLog.batch + accessLog.batchUsed, ring->data + start, chunk);
+            accessLog.batchUsed += chunk;
+            tail += chunk;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    accessLogFlush();
+}
+
+static void *accessLogMain(void *arg)
+{
+    unsigned long reportedDrops = 0;
+    int stop = 0;
+
+    while (!stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += accessLog.config.flushMs / 1000;
+        deadline.tv_nsec += (accessLog.config.flushMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&accessLog.stopLock);
+            if (!accessLog.stop)
+            {
+                pthread_cond_timedwait(&accessLog.stopCond, &accessLog.stopLock, &deadline);
+            }
+            stop = accessLog.stop;
+        pthread_mutex_unlock(&accessLog.stopLock);
+
+        if (accessLog.reopen)
+        {
+            accessLog.reopen = 0;
+            accessLogClose();
+            if (accessLogOpen() < 0)
+            {
+                fprintf(stderr, "access log: could not reopen %s: %s\n", accessLog.path, strerror(errno));
+            }
+        }
+        accessLogDrain();
+
+        unsigned long dropped = accessLogDropped();
+        if (dropped != reportedDrops)
+        {
+            fprintf(stderr, "access log: %lu entries dropped so far\n", dropped);
+            reportedDrops = dropped;
+        }
+    }
+    return arg;
+}
+
+int accessLogInit(const AccessLogConfig *config)
+{
+    if (config->path == NULL)
+    {
+        return 0;
+    }
+
+    accessLog.config = *config;
+    if (accessLog.config.flushMs <= 0)
+    {
+        accessLog.config.flushMs = 1;
+    }
+    if (accessLog.config.ringBytes < 2 * ACCESS_LOG_MAX_LINE)
+    {
+        accessLog.config.ringBytes = 2 * ACCESS_LOG_MAX_LINE;
+    }
+    accessLog.path = strdup(config->path);
+    accessLog.batch = malloc(ACCESS_LOG_BATCH_BYTES);
+    if (accessLog.path == NULL || accessLog.batch == NULL || accessLogOpen() < 0)
+    {
+        free(accessLog.path);
+        free(accessLog.batch);
+        return -1;
+    }
+    pthread_key_create(&accessLog.ringKey, accessLogReleaseRing);
+
+    if (pthread_create(&accessLog.thread, NULL, accessLogMain, NULL) != 0)
+    {
+        accessLogClose();
+        return -1;
+    }
+    __atomic_store_n(&accessLog.enabled, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void accessLogReopen(void)
+{
+    accessLog.reopen = 1;
+}
+
+unsigned long accessLogDropped(void)
+{
+    return __atomic_load_n(&accessLog.dropped, __ATOMIC_RELAXED);
+}
+
+void accessLogShutdown(void)
+{
+    if (!__atomic_load_n(&accessLog.enabled, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    __atomic_store_n(&accessLog.enabled, false, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&accessLog.stopLock);
+        accessLog.stop = 1;
+        pthread_cond_signal(&accessLog.stopCond);
+    pthread_mutex_unlock(&accessLog.stopLock);
+    pthread_join(accessLog.thread, NULL);
+
+    accessLogClose();
+}
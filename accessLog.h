@@ -0,0 +1,88 @@
+#ifndef ACCESS_LOG_H_
+#define ACCESS_LOG_H_
+
+#include <stddef.h>
+#include <time.h>
+
+/**
+* Access log
+*
+* Structured per-request logging that never blocks a worker. Each thread
+* formats its lines into its own single-producer/single-consumer ring buffer;
+* a background thread drains all rings into one large buffer and writes it out
+* with a single write() per flush interval (or whenever the buffer fills).
+* If a ring is full, or a thread cannot claim one without waiting (all are
+* taken, or another thread holds the lock that hands them out), the line is
+* dropped and counted instead; the count is shown on the debug endpoint (see
+* profile.h).
+*
+*   accessLogInit     - Opens the log and starts the drain thread.
+*   accessLogWrite    - Formats and queues one entry (lock free, never blocks).
+*   accessLogReopen   - Asks the drain thread to reopen the file (log rotation
+*                       by an external tool).
+*   accessLogDropped  - Number of lines dropped instead of waiting for a ring.
+*   accessLogShutdown - Drains everything that is queued and stops the thread.
+*/
+
+typedef enum AccessLogFormat_t {
+    LOG_FORMAT_COMMON,   // NCSA common log format
+    LOG_FORMAT_COMBINED, // common + referer, user agent and duration (us)
+    LOG_FORMAT_JSON      // one JSON object per line
+} AccessLogFormat;
+
+/** Path that selects standard output instead of a file */
+#define ACCESS_LOG_STDOUT "-"
+
+typedef struct AccessLogConfig_t {
+    const char *path;       // file to append to, ACCESS_LOG_STDOUT or NULL to disable
+    AccessLogFormat format;
+    int flushMs;            // how often queued lines are written out
+    size_t ringBytes;       // per-thread ring size, rounded up to a power of two
+    size_t rotateBytes;     // rotate once the file reaches this size, 0 = never
+    int rotateKeep;         // number of rotated files (path.1 .. path.N) to keep
+} AccessLogConfig;
+
+typedef struct AccessLogEntry_t {
+    char client[64];
+    time_t time;
+    const char *method;
+    const char *uri;
+    const char *version;
+    int status;
+    long bytes;             // body bytes sent, -1 if unknown
+    const char *referer;    // may be NULL
+    const char *userAgent;  // may be NULL
+    long durationUs;
+} AccessLogEntry;
+
+/**
+* accessLogInit: Opens the log described by config and starts the drain thread.
+* @return
+*   0 on success (or if logging is disabled)
+*   -1 if the log file could not be opened or the thread not started
+*/
+int accessLogInit(const AccessLogConfig *config);
+
+/**
+* accessLogWrite: Formats entry into the calling thread's ring.
+*   Never blocks: if the ring does not have room the entry is dropped.
+*/
+void accessLogWrite(const AccessLogEntry *entry);
+
+/**
+* accessLogReopen: Requests the log file to be reopened on the next drain.
+*   Async-signal-safe.
+*/
+void accessLogReopen(void);
+
+/**
+* accessLogDropped: Returns the number of entries dropped since startup.
+*/
+unsigned long accessLogDropped(void);
+
+/**
+* accessLogShutdown: Writes out everything queued and stops the drain thread.
+*/
+void accessLogShutdown(void);
+
+#endif // ACCESS_LOG_H_
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+static int affinityCpus[CPU_SETSIZE];
+static int affinityCount = 0;
+static pthread_once_t affinityOnce = PTHREAD_ONCE_INIT;
+
+int affinityNodeOfCpu(int cpu)
+{
+#ifdef HAVE_LIBNUMA
+    if (numa_available() >= 0)
+    {
+        int node = numa_node_of_cpu(cpu);
+        return node < 0 ? 0 : node;
+    }
+#endif
+    // sysfs exposes the node as a "nodeN" entry in the cpu directory
+    char path[64];
+    int node = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (sscanf(entry->d_name, "node%d", &node) == 1)
+        {
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+/**
+* affinityDiscover: Builds the placement order from the process's allowed
+*   CPUs, ordered by (node, cpu).
+*/
+static void affinityDiscover(void)
+{
+    cpu_set_t allowed;
+    int nodes[CPU_SETSIZE];
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+    {
+        affinityCpus[0] = 0;
+        affinityCount = 1;
+        return;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+        {
+            continue;
+        }
+        // insertion sort keeps the few dozen entries ordered by node
+        int node = affinityNodeOfCpu(cpu);
+        int i = affinityCount++;
+        while (i > 0 && nodes[i - 1] > node)
+        {
+            affinityCpus[i] = affinityCpus[i - 1];
+            nodes[i] = nodes[i - 1];
+            i--;
+        }
+        affinityCpus[i] = cpu;
+        nodes[i] = node;
+    }
+    if (affinityCount == 0)
+    {
+        affinityCpus[affinityCount++] = 0;
+    }
+}
+
+int affinityCpuCount(void)
+{
+    pthread_once(&affinityOnce, affinityDiscover);
+    return affinityCount;
+}
+
+int affinityCpuAt(int index)
+{
+    pthread_once(&affinityOnce, affinityDiscover);
+    return affinityCpus[index % affinityCount];
+}
+
+int affinityPinThread(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+int affinitySetAttr(pthread_attr_t *attr, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+void *affinityAllocLocal(size_t size)
+{
+#ifdef HAVE_LIBNUMA
+    if (numa_available() >= 0)
+    {
+        void *ptr = numa_alloc_local(size);
+        if (ptr != NULL)
+        {
+            memset(ptr, 0, size);
+        }
+        return ptr;
+    }
+#endif
+    // calloc from the pinned thread: first touch places the pages locally
+    return calloc(1, size);
+}
+
+void affinityFreeLocal(void *ptr, size_t size)
+{
+#ifdef HAVE_LIBNUMA
+    if (numa_available() >= 0)
+    {
+        numa_free(ptr, size);
+        return;
+    }
+#endif
+    (void)size;
+    free(ptr);
+}
@@ -0,0 +1,53 @@
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+* CPU and NUMA placement helpers
+*
+* CPUs are numbered in "placement order": the CPUs the process may run on,
+* grouped by NUMA node, so that consecutive placement slots share a node.
+* When built with HAVE_LIBNUMA memory is explicitly allocated on the local
+* node; otherwise the kernel's first-touch policy is relied on, which places
+* memory on the node of the (pinned) thread that first writes it.
+*
+*   affinityCpuCount   - Number of CPUs available for placement.
+*   affinityCpuAt      - The CPU id at a placement slot (wraps around).
+*   affinityNodeOfCpu  - The NUMA node a CPU belongs to.
+*   affinityPinThread  - Restricts a thread to a single CPU.
+*   affinitySetAttr    - Makes threads created with attr start on a CPU.
+*   affinityAllocLocal - Zeroed allocation on the calling thread's node.
+*   affinityFreeLocal  - Frees memory from affinityAllocLocal.
+*/
+
+int affinityCpuCount(void);
+
+/**
+* affinityCpuAt: Returns the CPU id at placement slot index modulo the CPU count.
+*/
+int affinityCpuAt(int index);
+
+/**
+* affinityNodeOfCpu: Returns the NUMA node of cpu, 0 if it can not be determined.
+*/
+int affinityNodeOfCpu(int cpu);
+
+/**
+* affinityPinThread: Pins thread to cpu.
+* @return 0 on success, an error number otherwise
+*/
+int affinityPinThread(pthread_t thread, int cpu);
+
+/**
+* affinitySetAttr: Sets the CPU affinity in attr so the thread is created
+*   directly on cpu (its stack is then first touched on the right node).
+* @return 0 on success, an error number otherwise
+*/
+int affinitySetAttr(pthread_attr_t *attr, int cpu);
+
+void *affinityAllocLocal(size_t size);
+void affinityFreeLocal(void *ptr, size_t size);
+
+#endif // AFFINITY_H_
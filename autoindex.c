@@ -0,0 +1,614 @@
+#include "autoindex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+/**
+* What a watched directory reports: its entries changing, or itself going
+* away. A file being written shows its size once closed, not on every write.
+*/
+#define AUTOINDEX_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                          IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+/** Column the dates start at, as in the usual listings */
+#define AUTOINDEX_NAME_COLUMN 51
+
+struct AutoindexPage_t
+{
+    int refs;
+    size_t len;
+    char data[];
+};
+
+typedef struct IndexEntry_t
+{
+    char *row;              // the rendered <a> line
+    size_t rowLen;
+    char name[];
+} IndexEntry;
+
+typedef struct IndexDir_t
+{
+    struct IndexDir_t *next;
+    char *path;
+    size_t hash;
+    int wd;                 // inotify watch, -1 when not watched
+    bool scanned;           // entries are current, or kept current by events
+    IndexEntry **entries;   // sorted by name
+    size_t count;
+    size_t capacity;
+    AutoindexPage page;     // NULL until rendered after the last change
+    unsigned long lastUsed;
+} IndexDir;
+
+static struct
+{
+    pthread_mutex_t mutex;
+    int inotifyFd;
+    int wakeFd;             // eventfd, stops the thread
+    pthread_t thread;
+    bool running;
+    IndexDir *dirs;
+    int dirCount;
+    int maxDirs;
+    unsigned long clock;
+    AutoindexStats stats;
+} autoindex = {.mutex = PTHREAD_MUTEX_INITIALIZER, .inotifyFd = -1, .wakeFd = -1};
+
+static size_t IndexHash(const char *text)
+{
+    size_t hash = 14695981039346656037ULL;
+    for (; *text != '\0'; text++)
+    {
+        hash = (hash ^ (unsigned char)*text) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+size_t autoindexEscape(char *out, size_t size, const char *text)
+{
+    size_t len = 0;
+
+    for (; *text != '\0'; text++)
+    {
+        const char *piece;
+        char plain[2] = {*text, '\0'};
+        switch (*text)
+        {
+        case '&': piece = "&amp;"; break;
+        case '<': piece = "&lt;"; break;
+        case '>': piece = "&gt;"; break;
+        case '"': piece = "&quot;"; break;
+        case '\'': piece = "&#39;"; break;
+        default: piece = plain; break;
+        }
+        size_t pieceLen = strlen(piece);
+        if (len + pieceLen >= size)
+        {
+            break;
+        }
+        memcpy(out + len, piece, pieceLen);
+        len += pieceLen;
+    }
+    if (size > 0)
+    {
+        out[len] = '\0';
+    }
+    return len;
+}
+
+/* Percent-encodes what a URL path segment may not hold as is */
+static size_t IndexUrlEncode(char *out, const char *name)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t len = 0;
+
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++)
+    {
+        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') ||
+            strchr("-._~!$()*+,;=:@", *p) != NULL)
+        {
+            out[len++] = *p;
+        }
+        else
+        {
+            out[len++] = '%';
+            out[len++] = hex[*p >> 4];
+            out[len++] = hex[*p & 15];
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/* Renders the row of name from its stat */
+static int IndexRender(IndexEntry *entry, const struct stat *sbuf)
+{
+    char href[3 * NAME_MAX + 2], text[6 * NAME_MAX + 2], date[32], size[24];
+    struct tm tm;
+    bool dir = S_ISDIR(sbuf->st_mode);
+
+    IndexUrlEncode(href, entry->name);
+    autoindexEscape(text, sizeof(text) - 1, entry->name);
+    if (dir)
+    {
+        strcat(href, "/");
+        strcat(text, "/");
+    }
+    gmtime_r(&sbuf->st_mtime, &tm);
+    strftime(date, sizeof(date), "%d-%b-%Y %H:%M", &tm);
+    if (dir)
+    {
+        strcpy(size, "-");
+    }
+    else
+    {
+        snprintf(size, sizeof(size), "%lld", (long long)sbuf->st_size);
+    }
+
+    // pad by the name as shown, not by its escaped length
+    int shown = strlen(entry->name) + dir;
+    int pad = shown < AUTOINDEX_NAME_COLUMN ? AUTOINDEX_NAME_COLUMN - shown : 1;
+    int len = snprintf(NULL, 0, "<a href=\"%s\">%s</a>%*s%s %19s\n", href, text, pad, "", date, size);
+    char *row = malloc(len + 1);
+    if (row == NULL)
+    {
+        return -1;
+    }
+    snprintf(row, len + 1, "<a href=\"%s\">%s</a>%*s%s %19s\n", href, text, pad, "", date, size);
+    free(entry->row);
+    entry->row = row;
+    entry->rowLen = len;
+    return 0;
+}
+
+/* Position of name in dir's entries, or where it would go; *found tells which */
+static size_t IndexFind(const IndexDir *dir, const char *name, bool *found)
+{
+    size_t low = 0, high = dir->count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        int order = strcmp(dir->entries[middle]->name, name);
+        if (order == 0)
+        {
+            *found = true;
+            return middle;
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    *found = false;
+    return low;
+}
+
+static void IndexFreeEntry(IndexEntry *entry)
+{
+    free(entry->row);
+    free(entry);
+}
+
+/* Drops the directory's reference to its page (the lock is held) */
+static void IndexStale(IndexDir *dir)
+{
+    if (dir->page != NULL && --dir->page->refs == 0)
+    {
+        free(dir->page);
+    }
+    dir->page = NULL;
+}
+
+static void IndexClear(IndexDir *dir)
+{
+    for (size_t i = 0; i < dir->count; i++)
+    {
+        IndexFreeEntry(dir->entries[i]);
+    }
+    dir->count = 0;
+    dir->scanned = false;
+    IndexStale(dir);
+}
+
+static IndexEntry *IndexNewEntry(const char *name)
+{
+    IndexEntry *entry = malloc(sizeof(IndexEntry) + strlen(name) + 1);
+    if (entry != NULL)
+    {
+        entry->row = NULL;
+        strcpy(entry->name, name);
+    }
+    return entry;
+}
+
+static int IndexCompare(const void *a, const void *b)
+{
+    return strcmp((*(IndexEntry *const *)a)->name, (*(IndexEntry *const *)b)->name);
+}
+
+/* Reads dir from scratch; hidden files are not listed */
+static int IndexScan(IndexDir *dir)
+{
+    DIR *stream = opendir(dir->path);
+    struct dirent *dent;
+    struct stat sbuf;
+
+    if (stream == NULL)
+    {
+        return -1;
+    }
+    IndexClear(dir);
+    while ((dent = readdir(stream)) != NULL)
+    {
+        if (dent->d_name[0] == '.' || fstatat(dirfd(stream), dent->d_name, &sbuf, 0) < 0)
+        {
+            continue;
+        }
+        if (dir->count == dir->capacity)
+        {
+            size_t capacity = dir->capacity == 0 ? 64 : 2 * dir->capacity;
+            IndexEntry **entries = realloc(dir->entries, capacity * sizeof(IndexEntry *));
+            if (entries == NULL)
+            {
+                break;
+            }
+            dir->entries = entries;
+            dir->capacity = capacity;
+        }
+        IndexEntry *entry = IndexNewEntry(dent->d_name);
+        if (entry == NULL || IndexRender(entry, &sbuf) < 0)
+        {
+            free(entry);
+            break;
+        }
+        dir->entries[dir->count++] = entry;
+    }
+    closedir(stream);
+    qsort(dir->entries, dir->count, sizeof(IndexEntry *), IndexCompare);
+    dir->scanned = true;
+    autoindex.stats.scans++;
+    return 0;
+}
+
+/* Brings the entry of name up to date after an event on it */
+static void IndexUpdate(IndexDir *dir, const char *name)
+{
+    char path[PATH_MAX];
+    struct stat sbuf;
+    bool found;
+    size_t at = IndexFind(dir, name, &found);
+
+    IndexStale(dir);
+    snprintf(path, sizeof(path), "%s%s", dir->path, name);
+    if (name[0] == '.' || stat(path, &sbuf) < 0)
+    {
+        if (found)
+        {
+            IndexFreeEntry(dir->entries[at]);
+            memmove(&dir->entries[at], &dir->entries[at + 1], (dir->count - at - 1) * sizeof(IndexEntry *));
+            dir->count--;
+        }
+        return;
+    }
+    if (found)
+    {
+        IndexRender(dir->entries[at], &sbuf);
+        return;
+    }
+
+    if (dir->count == dir->capacity)
+    {
+        size_t capacity = dir->capacity == 0 ? 64 : 2 * dir->capacity;
+        IndexEntry **entries = realloc(dir->entries, capacity * sizeof(IndexEntry *));
+        if (entries == NULL)
+        {
+            dir->scanned = false;   // read it again on the next hit
+            return;
+        }
+        dir->entries = entries;
+        dir->capacity = capacity;
+    }
+    IndexEntry *entry = IndexNewEntry(name);
+    if (entry == NULL || IndexRender(entry, &sbuf) < 0)
+    {
+        free(entry);
+        dir->scanned = false;
+        return;
+    }
+    memmove(&dir->entries[at + 1], &dir->entries[at], (dir->count - at) * sizeof(IndexEntry *));
+    dir->entries[at] = entry;
+    dir->count++;
+}
+
+static AutoindexPage IndexPage(IndexDir *dir)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < dir->count; i++)
+    {
+        len += dir->entries[i]->rowLen;
+    }
+    AutoindexPage page = malloc(sizeof(struct AutoindexPage_t) + len + 1);
+    if (page == NULL)
+    {
+        return NULL;
+    }
+    page->refs = 1;     // the directory's
+    page->len = len;
+    char *out = page->data;
+    for (size_t i = 0; i < dir->count; i++)
+    {
+        memcpy(out, dir->entries[i]->row, dir->entries[i]->rowLen);
+        out += dir->entries[i]->rowLen;
+    }
+    *out = '\0';
+    autoindex.stats.renders++;
+    return page;
+}
+
+static void IndexFreeDir(IndexDir *dir)
+{
+    if (dir->wd >= 0)
+    {
+        inotify_rm_watch(autoindex.inotifyFd, dir->wd);
+    }
+    IndexClear(dir);
+    free(dir->entries);
+    free(dir->path);
+    free(dir);
+    autoindex.dirCount--;
+}
+
+static IndexDir *IndexFindDir(const char *path, size_t hash)
+{
+    for (IndexDir *dir = autoindex.dirs; dir != NULL; dir = dir->next)
+    {
+        if (dir->hash == hash && !strcmp(dir->path, path))
+        {
+            return dir;
+        }
+    }
+    return NULL;
+}
+
+static IndexDir *IndexFindWatch(int wd)
+{
+    for (IndexDir *dir = autoindex.dirs; dir != NULL; dir = dir->next)
+    {
+        if (dir->wd == wd)
+        {
+            return dir;
+        }
+    }
+    return NULL;
+}
+
+static void IndexUnlink(IndexDir *dir)
+{
+    IndexDir **link = &autoindex.dirs;
+    while (*link != dir)
+    {
+        link = &(*link)->next;
+    }
+    *link = dir->next;
+}
+
+/* Makes room for one more directory by dropping the least recently listed */
+static void IndexEvict(void)
+{
+    IndexDir *oldest = NULL;
+    for (IndexDir *dir = autoindex.dirs; dir != NULL; dir = dir->next)
+    {
+        if (oldest == NULL || dir->lastUsed < oldest->lastUsed)
+        {
+            oldest = dir;
+        }
+    }
+    IndexUnlink(oldest);
+    IndexFreeDir(oldest);
+}
+
+static void IndexApply(const struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        // changes were lost: read every directory again when next listed
+        for (IndexDir *dir = autoindex.dirs; dir != NULL; dir = dir->next)
+        {
+            IndexClear(dir);
+        }
+        return;
+    }
+    IndexDir *dir = IndexFindWatch(event->wd);
+    if (dir == NULL)
+    {
+        return;
+    }
+    autoindex.stats.events++;
+    if (event->mask & IN_IGNORED)
+    {
+        // the directory is gone and the kernel dropped the watch
+        dir->wd = -1;
+        IndexUnlink(dir);
+        IndexFreeDir(dir);
+    }
+    else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+        IndexClear(dir);
+    }
+    else if (event->len > 0 && dir->scanned)
+    {
+        IndexUpdate(dir, event->name);
+    }
+}
+
+static void *IndexThread(void *arg)
+{
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {{autoindex.inotifyFd, POLLIN, 0}, {autoindex.wakeFd, POLLIN, 0}};
+
+    (void)arg;
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            continue;
+        }
+        if (fds[1].revents)
+        {
+            return NULL;
+        }
+        ssize_t n = read(autoindex.inotifyFd, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            continue;
+        }
+        // a burst of events (a whole directory copied in) is applied under one lock
+        pthread_mutex_lock(&autoindex.mutex);
+            for (char *p = buf; p < buf + n; )
+            {
+                const struct inotify_event *event = (const struct inotify_event *)p;
+                IndexApply(event);
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        pthread_mutex_unlock(&autoindex.mutex);
+    }
+}
+
+int autoindexInit(int maxDirs)
+{
+    autoindex.maxDirs = maxDirs;
+    if ((autoindex.inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) < 0 ||
+        (autoindex.wakeFd = eventfd(0, EFD_CLOEXEC)) < 0)
+    {
+        return -1;
+    }
+    if ((errno = pthread_create(&autoindex.thread, NULL, IndexThread, NULL)) != 0)
+    {
+        return -1;
+    }
+    autoindex.running = true;
+    return 0;
+}
+
+AutoindexPage autoindexGet(const char *path)
+{
+    size_t hash = IndexHash(path);
+    AutoindexPage page = NULL;
+
+    pthread_mutex_lock(&autoindex.mutex);
+        IndexDir *dir = IndexFindDir(path, hash);
+        if (dir == NULL)
+        {
+            if (autoindex.dirCount == autoindex.maxDirs)
+            {
+                IndexEvict();
+            }
+            if ((dir = calloc(1, sizeof(IndexDir))) == NULL || (dir->path = strdup(path)) == NULL)
+            {
+                free(dir);
+                pthread_mutex_unlock(&autoindex.mutex);
+                errno = ENOMEM;
+                return NULL;
+            }
+            dir->hash = hash;
+            dir->wd = -1;
+            dir->next = autoindex.dirs;
+            autoindex.dirs = dir;
+            autoindex.dirCount++;
+        }
+        dir->lastUsed = ++autoindex.clock;
+
+        if (!dir->scanned)
+        {
+            // watch first, so nothing changing during the scan is missed
+            if (dir->wd < 0 && autoindex.running)
+            {
+                dir->wd = inotify_add_watch(autoindex.inotifyFd, path, AUTOINDEX_EVENTS);
+            }
+            if (IndexScan(dir) < 0)
+            {
+                int error = errno;
+                IndexUnlink(dir);
+                IndexFreeDir(dir);
+                pthread_mutex_unlock(&autoindex.mutex);
+                errno = error;
+                return NULL;
+            }
+            // without a watch nothing keeps the entries current
+            dir->scanned = dir->wd >= 0;
+        }
+        if (dir->page == NULL)
+        {
+            dir->page = IndexPage(dir);
+        }
+        else
+        {
+            autoindex.stats.hits++;
+        }
+        if ((page = dir->page) != NULL)
+        {
+            page->refs++;
+        }
+    pthread_mutex_unlock(&autoindex.mutex);
+    if (page == NULL)
+    {
+        errno = ENOMEM;
+    }
+    return page;
+}
+
+const char *autoindexData(AutoindexPage page, size_t *len)
+{
+    *len = page->len;
+    return page->data;
+}
+
+void autoindexRelease(AutoindexPage page)
+{
+    bool last;
+    pthread_mutex_lock(&autoindex.mutex);
+        last = --page->refs == 0;
+    pthread_mutex_unlock(&autoindex.mutex);
+    if (last)
+    {
+        free(page);
+    }
+}
+
+void autoindexShutdown(void)
+{
+    uint64_t one = 1;
+
+    if (!autoindex.running)
+    {
+        return;
+    }
+    if (write(autoindex.wakeFd, &one, sizeof(one)) == sizeof(one))
+    {
+        pthread_join(autoindex.thread, NULL);
+    }
+    autoindex.running = false;
+}
+
+void autoindexStats(AutoindexStats *stats)
+{
+    pthread_mutex_lock(&autoindex.mutex);
+        *stats = autoindex.stats;
+    pthread_mutex_unlock(&autoindex.mutex);
+}
@@ -0,0 +1,72 @@
+#ifndef AUTOINDEX_H_
+#define AUTOINDEX_H_
+
+#include <stddef.h>
+#include "bool.h"
+
+/**
+* Directory listings
+*
+* Sites with autoindex on answer a directory without a home.html with a
+* listing of its files. The rows of each listed directory are rendered once
+* and kept, along with what they were rendered from, until the directory
+* changes.
+*
+* Changes arrive through inotify, one event per file, and are applied to the
+* kept entries one file at a time: a new or modified file costs a stat and
+* one rendered row, a removed one nothing, so a directory of 100k files is
+* read with readdir once and not again on every change or hit. The page is
+* put back together from the kept rows on the next hit. Only when the kernel
+* drops events (queue overflow) are the directories read again.
+*
+* Pages are reference counted, so a listing being sent stays valid while a
+* change replaces it.
+*
+*   autoindexInit     - Starts watching for changes.
+*   autoindexGet      - The listing rows of a directory.
+*   autoindexData     - The HTML of a listing.
+*   autoindexRelease  - Drops the reference taken by autoindexGet.
+*   autoindexEscape   - HTML-escapes text.
+*   autoindexShutdown - Stops watching.
+*   autoindexStats    - Counters for monitoring.
+*/
+
+typedef struct AutoindexStats_t {
+    unsigned long hits;         // listings sent as they were kept
+    unsigned long scans;        // directories read with readdir
+    unsigned long renders;      // pages put back together after a change
+    unsigned long events;       // inotify events applied
+} AutoindexStats;
+
+typedef struct AutoindexPage_t *AutoindexPage;
+
+/**
+* autoindexInit: Starts the thread applying changes; at most maxDirs
+*   directories are kept, the least recently listed making room.
+* @return 0 on success, -1 on error (errno set)
+*/
+int autoindexInit(int maxDirs);
+
+/**
+* autoindexGet: The listing of dir (a path on disk ending in '/').
+* @return the page, NULL when dir cannot be read (errno set)
+*/
+AutoindexPage autoindexGet(const char *dir);
+
+/** The rows of a listing, one <a> line per entry sorted by name */
+const char *autoindexData(AutoindexPage page, size_t *len);
+
+void autoindexRelease(AutoindexPage page);
+
+/**
+* autoindexEscape: Writes text to out with &, <, >, " and ' escaped,
+*   truncating to size.
+* @return the length written
+*/
+size_t autoindexEscape(char *out, size_t size, const char *text);
+
+void autoindexShutdown(void);
+
+void autoindexStats(AutoindexStats *stats);
+
+#endif // AUTOINDEX_H_
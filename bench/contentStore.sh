@@ -0,0 +1,98 @@
+#!/bin/bash
+#
+# Large files served from the content store against the per-request mmap
+# path, for 10, 100 and 500 MB objects: transparent huge pages with
+# sendfile(), hugetlbfs written from its mapping, and no store (mapped with
+# MAP_PRIVATE and 4 KB pages on every request). Reports the load generator's
+# numbers and the server's CPU time per request.
+#
+# Usage: contentStore.sh <server binary> <load binary> [port]
+#
+# hugetlbfs needs pages reserved first, e.g. sysctl vm.nr_hugepages=300 for
+# the 500 MB object; without them that row measures the THP fallback.
+#
+# On one CPU (4 threads, 4 clients, SECS=10, loopback, 400 huge pages):
+#
+#   10 MB
+#     mmap:     214 req/s  p50 17.93 ms  p99 31.19 ms  2140 MB/s  server CPU 2.2 ms/request
+#     thp:      261 req/s  p50 15.04 ms  p99 25.18 ms  2612 MB/s  server CPU 0.3 ms/request
+#     hugetlb:  281 req/s  p50 13.75 ms  p99 23.16 ms  2811 MB/s  server CPU 1.3 ms/request
+#   100 MB
+#     mmap:      24 req/s  p50 160.66 ms  p99 270.63 ms  2410 MB/s  server CPU 21.0 ms/request
+#     thp:       22 req/s  p50 176.18 ms  p99 238.40 ms  2190 MB/s  server CPU 3.2 ms/request
+#     hugetlb:   24 req/s  p50 156.51 ms  p99 230.12 ms  2390 MB/s  server CPU 17.4 ms/request
+#   500 MB
+#     mmap:       5 req/s  p50 749.82 ms  p99 889.17 ms  2600 MB/s  server CPU 99.8 ms/request
+#     thp:        4 req/s  p50 870.51 ms  p99 973.36 ms  2200 MB/s  server CPU 14.5 ms/request
+#     hugetlb:    5 req/s  p50 710.96 ms  p99 945.48 ms  2600 MB/s  server CPU 88.3 ms/request
+#
+# Over loopback on one CPU the clients' own copy sets the pace, so every mode
+# moves about the same megabytes per second. What the store changes is the
+# server's share: sendfile() from the THP memfd costs it about a seventh of
+# mapping, faulting and copying per request. hugetlbfs saves the faults and
+# most TLB misses but still copies every byte out of the mapping, which is
+# most of the cost; prefer it only where sendfile() cannot be used anyway.
+#
+SERVER=$1
+LOAD=$2
+PORT=${3:-18092}
+SECS=${SECS:-10}
+
+if [ ! -x "$SERVER" ] || [ ! -x "$LOAD" ]; then
+    echo "usage: $0 <server binary> <load binary> [port]" >&2
+    exit 2
+fi
+
+DIR=$(mktemp -d)
+cleanup()
+{
+    [ -n "$PID" ] && kill "$PID" 2>/dev/null && wait "$PID" 2>/dev/null
+    rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+# utime + stime of a process, in clock ticks
+CpuTicks()
+{
+    awk '{ print $14 + $15 }' /proc/$1/stat
+}
+
+mkdir -p "$DIR/root"
+for mb in 10 100 500; do
+    head -c $((mb * 1048576)) /dev/urandom > "$DIR/root/$mb.bin"
+done
+
+for mb in 10 100 500; do
+    echo "$mb MB"
+    for mode in mmap thp hugetlb; do
+        cat > "$DIR/server.conf" <<CONF
+port = $PORT
+document_root = $DIR/root
+access_log = off
+threads = 4
+queue_size = 256
+CONF
+        case $mode in
+            thp)        printf 'content_store = /%s.bin\ncontent_store_bytes = %d\n' $mb $((mb * 1048576)) ;;
+            hugetlb)    printf 'content_store = /%s.bin\ncontent_store_bytes = %d\ncontent_store_hugetlb = on\n' \
+                               $mb $((mb * 1048576)) ;;
+        esac >> "$DIR/server.conf"
+        "$SERVER" -c "$DIR/server.conf" > "$DIR/server.log" 2>&1 &
+        PID=$!
+        # copying 500 MB in takes a while; wait until the port answers
+        for i in $(seq 100); do
+            (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+            sleep 0.1
+        done
+        before=$(CpuTicks $PID)
+        result=$("$LOAD" $PORT 4 /$mb.bin $SECS)
+        after=$(CpuTicks $PID)
+        requests=$(echo "$result" | sed 's/.*(\([0-9]*\) requests).*/\1/')
+        printf "  %-9s %s  %s MB/s  server CPU %s ms/request\n" "$mode:" "${result%%  (*}" \
+            "$(awk "BEGIN { printf \"%.0f\", $requests * $mb / $SECS }")" \
+            "$(awk "BEGIN { if ($requests > 0) printf \"%.1f\", ($after - $before) * 1000 / $(getconf CLK_TCK) / $requests; else print \"-\" }")"
+        kill $PID
+        wait $PID 2>/dev/null
+        PID=
+    done
+done
@@ -0,0 +1,188 @@
+/*
+ * listBench.c: Times the list node slab against malloc, and the queue as the
+ * server uses it.
+ *
+ * To run, try:
+ *      ./listBench [iterations]
+ *
+ * Three measurements:
+ *
+ *   - alloc/free in one thread: a node taken and given back, from malloc as
+ *     the 24-byte nodes were before the slab, and from the slab.
+ *   - handoff: one thread allocates, CONSUMERS others free, as the acceptor
+ *     and the workers do with queued connections. The nodes travel through
+ *     a ring per consumer, timed with the ring alone subtracted.
+ *   - queue: listEnqueue by one thread, listDequeue by CONSUMERS, per request.
+ *
+ * list.c is compiled in so the slab can be called directly.
+ *
+ * One CPU, gcc -O2, 4000000 iterations:
+ *
+ *                               malloc     slab
+ *      alloc/free, one thread   11.2 ns    3.4 ns
+ *      handoff to 4 threads     28.8 ns    9.2 ns
+ *      queue, 4 consumers                355 ns per request
+ *
+ * Before magazines were refilled and spilled with one CAS per batch, the
+ * handoff cost 39 ns on the slab: every node crossed the shared free stack
+ * one CAS at a time each way, and lost to malloc. These numbers come from
+ * one core; with more, malloc's arenas are contended too.
+ */
+
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "../list.c"
+#include <sched.h>
+#include <stdio.h>
+
+#define CONSUMERS 4
+#define RING 256
+
+/* What a node was before the slab */
+typedef struct OldNode_t
+{
+    int data;
+    struct OldNode_t *next;
+    struct OldNode_t *previous;
+} OldNode;
+
+typedef struct Ring_t
+{
+    void *slots[RING];
+    unsigned long head __attribute__((aligned(64)));   // written by the producer
+    unsigned long tail __attribute__((aligned(64)));   // written by the consumer
+} Ring;
+
+static Ring rings[CONSUMERS];
+static long iterations;
+static int useSlab;         // 0 malloc, 1 slab, -1 neither (the ring alone)
+static List queue;
+
+static double Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void *Alloc(void)
+{
+    static OldNode dummy;
+    return useSlab > 0 ? (void *)listNodeAlloc() : useSlab == 0 ? malloc(sizeof(OldNode)) : &dummy;
+}
+
+static void Free(void *node)
+{
+    if (useSlab > 0)
+    {
+        listNodeFree(node);
+    }
+    else if (useSlab == 0)
+    {
+        free(node);
+    }
+}
+
+static double AllocFree(void)
+{
+    double start = Now();
+    for (long i = 0; i < iterations; i++)
+    {
+        void *node = Alloc();
+        *(volatile int *)node = (int)i;
+        Free(node);
+    }
+    return (Now() - start) * 1e9 / iterations;
+}
+
+static void *Consumer(void *arg)
+{
+    Ring *ring = arg;
+    for (long i = 0; i < iterations / CONSUMERS; i++)
+    {
+        while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail)
+        {
+            sched_yield();
+        }
+        Free(ring->slots[ring->tail % RING]);
+        __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static double Handoff(void)
+{
+    pthread_t threads[CONSUMERS];
+    memset(rings, 0, sizeof(rings));
+    double start = Now();
+    for (int c = 0; c < CONSUMERS; c++)
+    {
+        pthread_create(&threads[c], NULL, Consumer, &rings[c]);
+    }
+    for (long i = 0; i < iterations / CONSUMERS * CONSUMERS; i++)
+    {
+        Ring *ring = &rings[i % CONSUMERS];
+        while (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING)
+        {
+            sched_yield();
+        }
+        ring->slots[ring->head % RING] = Alloc();
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    }
+    for (int c = 0; c < CONSUMERS; c++)
+    {
+        pthread_join(threads[c], NULL);
+    }
+    return (Now() - start) * 1e9 / iterations;
+}
+
+static void *Dequeuer(void *arg)
+{
+    for (long i = 0; i < iterations / CONSUMERS; i++)
+    {
+        listDequeue(queue);
+    }
+    return NULL;
+}
+
+static double Queue(void)
+{
+    pthread_t threads[CONSUMERS];
+    queue = listCreate();
+    double start = Now();
+    for (int c = 0; c < CONSUMERS; c++)
+    {
+        pthread_create(&threads[c], NULL, Dequeuer, NULL);
+    }
+    for (long i = 0; i < iterations / CONSUMERS * CONSUMERS; i++)
+    {
+        listEnqueue(queue, (int)i);
+    }
+    for (int c = 0; c < CONSUMERS; c++)
+    {
+        pthread_join(threads[c], NULL);
+    }
+    double elapsed = (Now() - start) * 1e9 / iterations;
+    listDestroy(queue);
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    iterations = argc > 1 ? atol(argv[1]) : 4000000;
+    listReserve(RING * CONSUMERS + 2 * LIST_CHUNK_NODES);
+
+    double alloc[2], handoff[2];
+    useSlab = -1;
+    double ring = Handoff();
+    for (useSlab = 0; useSlab <= 1; useSlab++)
+    {
+        alloc[useSlab] = AllocFree();
+        handoff[useSlab] = Handoff() - ring;
+    }
+
+    printf("%-28s %8s %8s\n", "", "malloc", "slab");
+    printf("%-28s %5.1f ns %5.1f ns\n", "alloc/free, one thread", alloc[0], alloc[1]);
+    printf("%-28s %5.1f ns %5.1f ns\n", "handoff to 4 threads", handoff[0], handoff[1]);
+    printf("%-28s %8s %5.1f ns per request\n", "queue, 4 consumers", "", Queue());
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * load.c: A closed-loop HTTP load generator for the benchmark scripts.
+ *
+ * To run, try:
+ *      ./load 8090 16 /home.html 10
+ *      ./load 8090 16 /home.html 10 2 /big.bin 65536
+ *
+ * Keeps CONNS clients each sending "GET PATH HTTP/1.0" and reading the whole
+ * response, one request after the other, for SECS seconds, then prints the
+ * requests per second, the latency percentiles and the number of requests. With the
+ * last three arguments, SLOW more clients download SLOWPATH reading at most
+ * RATE bytes per second, each holding a worker for as long as it reads;
+ * they are not counted. With LOAD_FASTOPEN=1 in the environment requests go
+ * out with the SYN (TCP Fast Open, MSG_FASTOPEN).
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS 256
+#define MAX_SAMPLES 1000000
+
+static struct sockaddr_in server;
+static const char *path;
+static const char *slowPath;
+static long slowRate;
+static double endTime;
+static int fastOpen;
+
+static pthread_mutex_t samplesLock = PTHREAD_MUTEX_INITIALIZER;
+static double *samples;
+static long sampleCount;
+
+static double Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Sends one request for target and reads the response at most rate bytes/s (0 = as fast as it comes) */
+static int Fetch(const char *target, long rate)
+{
+    char buf[16384];
+    int len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.0\r\n\r\n", target);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fastOpen)
+    {
+        if (sendto(fd, buf, len, MSG_FASTOPEN, (struct sockaddr *)&server, sizeof(server)) != len)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else if (connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0 || write(fd, buf, len) != len)
+    {
+        close(fd);
+        return -1;
+    }
+
+    ssize_t n;
+    size_t chunk = rate > 0 && rate < (long)sizeof(buf) ? (size_t)rate : sizeof(buf);
+    while (Now() < endTime && (n = read(fd, buf, chunk)) > 0)
+    {
+        if (rate > 0)
+        {
+            usleep(1000000L * n / rate);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static void *Client(void *arg)
+{
+    while (Now() < endTime)
+    {
+        double start = Now();
+        if (Fetch(path, 0) == 0 && Now() < endTime)
+        {
+            pthread_mutex_lock(&samplesLock);
+            if (sampleCount < MAX_SAMPLES)
+            {
+                samples[sampleCount++] = Now() - start;
+            }
+            pthread_mutex_unlock(&samplesLock);
+        }
+    }
+    return NULL;
+}
+
+static void *SlowClient(void *arg)
+{
+    while (Now() < endTime)
+    {
+        Fetch(slowPath, slowRate);
+    }
+    return NULL;
+}
+
+static int Compare(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 5 && argc != 8)
+    {
+        fprintf(stderr, "Usage: %s <port> <conns> <path> <secs> [<slow conns> <slow path> <rate>]\n", argv[0]);
+        return 1;
+    }
+    int conns = atoi(argv[2]);
+    int slow = argc == 8 ? atoi(argv[5]) : 0;
+    if (conns < 1 || slow < 0 || conns + slow > MAX_CLIENTS)
+    {
+        fprintf(stderr, "at most %d clients\n", MAX_CLIENTS);
+        return 1;
+    }
+    server.sin_family = AF_INET;
+    server.sin_port = htons(atoi(argv[1]));
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    path = argv[3];
+    fastOpen = getenv("LOAD_FASTOPEN") != NULL && atoi(getenv("LOAD_FASTOPEN")) != 0;
+    int secs = atoi(argv[4]);
+    slowPath = slow > 0 ? argv[6] : NULL;
+    slowRate = slow > 0 ? atol(argv[7]) : 0;
+    samples = malloc(MAX_SAMPLES * sizeof(double));
+    if (samples == NULL)
+    {
+        return 1;
+    }
+
+    pthread_t threads[MAX_CLIENTS];
+    endTime = Now() + secs;
+    for (int i = 0; i < slow; i++)
+    {
+        pthread_create(&threads[i], NULL, SlowClient, NULL);
+    }
+    // let the slow clients take their workers first
+    usleep(slow > 0 ? 100000 : 0);
+    for (int i = slow; i < slow + conns; i++)
+    {
+        pthread_create(&threads[i], NULL, Client, NULL);
+    }
+    for (int i = 0; i < slow + conns; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (sampleCount == 0)
+    {
+        printf("0 req/s  (0 requests)\n");
+        return 0;
+    }
+    qsort(samples, sampleCount, sizeof(double), Compare);
+    printf("%.0f req/s  p50 %.2f ms  p99 %.2f ms  max %.2f ms  (%ld requests)\n",
+           sampleCount / (double)secs,
+           samples[sampleCount / 2] * 1e3,
+           samples[sampleCount * 99 / 100] * 1e3,
+           samples[sampleCount - 1] * 1e3,
+           sampleCount);
+    free(samples);
+    return 0;
+}
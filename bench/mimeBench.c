@@ -0,0 +1,104 @@
+/*
+ * mimeBench.c: Times mimeLookup against the strstr chains it replaced.
+ *
+ * To run, try:
+ *      ./mimeBench [iterations]
+ *
+ * Looks up the content type of a mix of request paths three ways: the
+ * original chain (.html, .gif, .jpg, else text/plain), a strstr chain over
+ * every extension of the built-in table (what growing that chain to the same
+ * coverage would cost), and the hashed table. mime.c is compiled in so both
+ * walk the same list.
+ *
+ * One CPU, gcc -O2, 2000000 iterations of the 12 paths:
+ *
+ *      3-type strstr chain       23.2 ns/lookup
+ *      full strstr chain        462.5 ns/lookup
+ *      mimeLookup                31.2 ns/lookup
+ *
+ * The table costs about what the three-type chain did while knowing every
+ * built-in type; a chain covering as many costs fifteen times more.
+ */
+
+#include "../mime.c"
+#include <time.h>
+
+static const char *paths[] = {
+    "/index.html",
+    "/favicon.ico",
+    "/css/site.css",
+    "/js/app.min.js",
+    "/img/logo.png",
+    "/img/photos/2024/holiday.jpg",
+    "/downloads/release-1.4.2.tar.gz",
+    "/docs/manual.pdf",
+    "/api/data.json",
+    "/video/intro.mp4",
+    "/README",
+    "/assets/fonts/inter.woff2",
+};
+#define PATHS (sizeof(paths) / sizeof(paths[0]))
+
+static double Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* The lookup request.c did before the table */
+static const char *ShortChain(const char *filename)
+{
+    if (strstr(filename, ".html"))
+        return "text/html";
+    else if (strstr(filename, ".gif"))
+        return "image/gif";
+    else if (strstr(filename, ".jpg"))
+        return "image/jpeg";
+    return "text/plain";
+}
+
+#define BUILTIN (sizeof(mimeBuiltin) / sizeof(mimeBuiltin[0]))
+static char patterns[BUILTIN][MIME_MAX_EXT + 1];
+
+/* The same chain grown to every built-in extension, patterns made up front */
+static const char *FullChain(const char *filename)
+{
+    for (size_t i = 0; i < BUILTIN; i++)
+    {
+        if (strstr(filename, patterns[i]))
+        {
+            return mimeBuiltin[i][1];
+        }
+    }
+    return MIME_DEFAULT_TYPE;
+}
+
+static void Run(const char *name, const char *(*lookup)(const char *), long iterations)
+{
+    volatile size_t sink = 0;
+    double start = Now();
+    for (long i = 0; i < iterations; i++)
+    {
+        for (size_t p = 0; p < PATHS; p++)
+        {
+            sink += (size_t)lookup(paths[p]);
+        }
+    }
+    double elapsed = Now() - start;
+    printf("%-20s %10.1f ns/lookup\n", name, elapsed * 1e9 / (iterations * PATHS));
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+    mimeInit(NULL);
+    for (size_t i = 0; i < BUILTIN; i++)
+    {
+        snprintf(patterns[i], sizeof(patterns[i]), ".%s", mimeBuiltin[i][0]);
+    }
+    Run("3-type strstr chain", ShortChain, iterations);
+    Run("full strstr chain", FullChain, iterations / 20 > 0 ? iterations / 20 : 1);
+    Run("mimeLookup", mimeLookup, iterations);
+    return 0;
+}
@@ -0,0 +1,640 @@
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+typedef enum ConfigType_t {
+    CONFIG_INT,
+    CONFIG_SIZE,
+    CONFIG_DOUBLE,
+    CONFIG_BOOL,
+    CONFIG_PATH,
+    CONFIG_SCHEDALG,
+    CONFIG_LOG_FORMAT,
+    CONFIG_ROUTE,           // appends a line to a ROUTE_TEXT_MAX buffer
+    CONFIG_PREWARM,
+    CONFIG_CONTENT,         // appends a URL path to a CONTENT_STORE_TEXT_MAX buffer
+    CONFIG_PRIORITY         // appends a class to a PRIORITY_TEXT_MAX buffer
+} ConfigType;
+
+typedef struct ConfigKey_t {
+    const char *name;
+    ConfigType type;
+    size_t offset;
+    double min;
+    double max;
+} ConfigKey;
+
+#define KEY(name, type, field, min, max) {name, type, offsetof(ServerConfig, field), min, max}
+#define VHOST_KEY(name, type, field, min, max) {name, type, offsetof(VhostConfig, field), min, max}
+
+static const ConfigKey configKeys[] = {
+    KEY("port", CONFIG_INT, port, 1, 65535),
+    KEY("document_root", CONFIG_PATH, documentRoot, 0, 0),
+    KEY("mime_types", CONFIG_PATH, mimeTypes, 0, 0),
+    KEY("route", CONFIG_ROUTE, routes, 0, 0),
+
+    KEY("threads", CONFIG_SIZE, threads, 1, 4096),
+    KEY("queue_size", CONFIG_SIZE, queueSize, 1, 1 << 24),
+    KEY("schedalg", CONFIG_SCHEDALG, schedAlg, 0, 0),
+    KEY("codel_target_ms", CONFIG_INT, codelTargetMs, 1, 60000),
+    KEY("codel_interval_ms", CONFIG_INT, codelIntervalMs, 1, 600000),
+    KEY("priority_class", CONFIG_PRIORITY, priorityClasses, 0, 0),
+    KEY("priority_default_weight", CONFIG_INT, priorityDefaultWeight, 1, 1000),
+    KEY("worker_batch", CONFIG_INT, workerBatch, 1, THREAD_POOL_MAX_BATCH),
+    KEY("queue_spin_us", CONFIG_INT, queueSpinUs, 0, 100000),
+    KEY("accept_batch", CONFIG_INT, acceptBatch, 1, CONFIG_MAX_ACCEPT_BATCH),
+    KEY("pin_workers", CONFIG_BOOL, placement.pinWorkers, 0, 1),
+    KEY("steer_by_cpu", CONFIG_BOOL, placement.steerByCpu, 0, 1),
+
+    KEY("static_max_age", CONFIG_INT, staticMaxAge, 0, 365 * 24 * 3600),
+    KEY("autoindex", CONFIG_BOOL, autoindex, 0, 1),
+    KEY("autoindex_cache_dirs", CONFIG_INT, autoindexCacheDirs, 1, 1 << 16),
+    KEY("request_line_timeout_ms", CONFIG_INT, requestLimits.requestLineTimeoutMs, 0, 3600000),
+    KEY("header_timeout_ms", CONFIG_INT, requestLimits.headerTimeoutMs, 0, 3600000),
+    KEY("body_timeout_ms", CONFIG_INT, requestLimits.bodyTimeoutMs, 0, 3600000),
+    KEY("max_headers", CONFIG_INT, requestLimits.maxHeaderCount, 1, 10000),
+    KEY("max_header_bytes", CONFIG_INT, requestLimits.maxHeaderBytes, 1024, 1 << 24),
+    KEY("max_body_bytes", CONFIG_SIZE, requestLimits.maxBodyBytes, 0, 1ULL << 40),
+    KEY("cgi_timeout_ms", CONFIG_INT, requestLimits.cgiTimeoutMs, 0, 3600000),
+    KEY("cgi_max_output_bytes", CONFIG_SIZE, requestLimits.cgiMaxOutputBytes, 0, 1ULL << 40),
+    KEY("timer_tick_ms", CONFIG_INT, timerTickMs, 1, 10000),
+    KEY("timer_slots", CONFIG_INT, timerSlots, 16, 1 << 20),
+    KEY("profile_timing", CONFIG_BOOL, profileTiming, 0, 1),
+
+    KEY("response_cache_bytes", CONFIG_SIZE, responseCache.maxBytes, 0, 1ULL << 40),
+    KEY("response_cache_entry_bytes", CONFIG_SIZE, responseCache.maxEntryBytes, 0, 1ULL << 32),
+    KEY("response_cache_ttl", CONFIG_INT, responseCache.defaultTtlSec, 0, 365 * 24 * 3600),
+    KEY("file_cache_bytes", CONFIG_SIZE, fileCache.maxBytes, 0, 1ULL << 40),
+    KEY("file_cache_entry_bytes", CONFIG_SIZE, fileCache.maxEntryBytes, 0, 1ULL << 32),
+    KEY("prewarm", CONFIG_PREWARM, prewarm, 0, 0),
+    KEY("prewarm_threads", CONFIG_INT, prewarmThreads, 0, 256),
+    KEY("content_store", CONFIG_CONTENT, contentStore.paths, 0, 0),
+    KEY("content_store_bytes", CONFIG_SIZE, contentStore.maxBytes, 0, 1ULL << 40),
+    KEY("content_store_hugetlb", CONFIG_BOOL, contentStore.hugetlb, 0, 1),
+    KEY("worker_processes", CONFIG_INT, workerProcesses, 0, PREFORK_MAX_WORKERS),
+    KEY("shared_cache_bytes", CONFIG_SIZE, sharedCache.maxBytes, 0, 1ULL << 40),
+    KEY("shared_cache_entry_bytes", CONFIG_SIZE, sharedCache.maxEntryBytes, 0, 1ULL << 30),
+
+    KEY("client_rate", CONFIG_DOUBLE, rateLimit.ratePerSec, 0, 1e9),
+    KEY("client_burst", CONFIG_DOUBLE, rateLimit.burst, 1, 1e9),
+    KEY("client_max_connections", CONFIG_INT, rateLimit.maxConnections, 0, 1 << 24),
+    KEY("client_idle_sec", CONFIG_INT, rateLimit.idleSec, 1, 86400),
+    KEY("client_table_size", CONFIG_SIZE, rateLimit.tableSize, 0, 1 << 26),
+
+    KEY("tcp_backlog", CONFIG_INT, tcp.backlog, 1, 1 << 20),
+    KEY("tcp_defer_accept", CONFIG_INT, tcp.deferAcceptSec, 0, 3600),
+    KEY("tcp_fast_open", CONFIG_INT, tcp.fastOpenQueue, 0, 1 << 20),
+    KEY("tcp_nodelay", CONFIG_BOOL, tcp.noDelay, 0, 1),
+    KEY("tcp_cork", CONFIG_BOOL, tcp.cork, 0, 1),
+    KEY("tcp_send_buffer", CONFIG_INT, tcp.sendBuffer, 0, 1 << 30),
+    KEY("tcp_receive_buffer", CONFIG_INT, tcp.receiveBuffer, 0, 1 << 30),
+    KEY("tcp_nonblocking", CONFIG_BOOL, tcp.nonBlocking, 0, 1),
+
+    KEY("tls_certificate", CONFIG_PATH, tls.certificate, 0, 0),
+    KEY("tls_key", CONFIG_PATH, tls.key, 0, 0),
+    KEY("tls_session_tickets", CONFIG_BOOL, tls.sessionTickets, 0, 1),
+    KEY("tls_session_cache", CONFIG_INT, tls.sessionCacheSize, 0, 1 << 24),
+    KEY("tls_ktls", CONFIG_BOOL, tls.ktls, 0, 1),
+
+    KEY("http2", CONFIG_BOOL, http2.enabled, 0, 1),
+    KEY("http2_max_streams", CONFIG_INT, http2.maxStreams, 1, 1 << 16),
+    KEY("http2_max_worker_streams", CONFIG_INT, http2.maxWorkerStreams, 0, 4096),
+    KEY("http2_window", CONFIG_INT, http2.streamWindow, 16384, 0x7fffffff),
+    KEY("http2_send_timeout_sec", CONFIG_INT, http2.sendTimeoutSec, 1, 3600),
+    KEY("http2_idle_timeout_sec", CONFIG_INT, http2.idleTimeoutSec, 1, 86400),
+
+    KEY("access_log", CONFIG_PATH, accessLogPath, 0, 0),
+    KEY("access_log_format", CONFIG_LOG_FORMAT, accessLog.format, 0, 0),
+    KEY("access_log_flush_ms", CONFIG_INT, accessLog.flushMs, 1, 60000),
+    KEY("access_log_ring_bytes", CONFIG_SIZE, accessLog.ringBytes, 8192, 1 << 30),
+    KEY("access_log_rotate_bytes", CONFIG_SIZE, accessLog.rotateBytes, 0, 1ULL << 40),
+    KEY("access_log_rotate_keep", CONFIG_INT, accessLog.rotateKeep, 0, 1000),
+};
+
+/* the settings a [vhost ...] section may override */
+static const ConfigKey vhostKeys[] = {
+    VHOST_KEY("document_root", CONFIG_PATH, documentRoot, 0, 0),
+    VHOST_KEY("route", CONFIG_ROUTE, routes, 0, 0),
+    VHOST_KEY("static_max_age", CONFIG_INT, staticMaxAge, 0, 365 * 24 * 3600),
+    VHOST_KEY("cgi", CONFIG_BOOL, cgi, 0, 1),
+    VHOST_KEY("autoindex", CONFIG_BOOL, autoindex, 0, 1),
+    VHOST_KEY("response_cache_bytes", CONFIG_SIZE, cacheBytes, 0, 1ULL << 40),
+};
+
+void configDefaults(ServerConfig *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->port = 8003;
+    strcpy(config->documentRoot, "./public");
+    strcpy(config->mimeTypes, "/etc/mime.types");
+
+    config->threads = 2;
+    config->queueSize = 5;
+    config->schedAlg = BLOCK;
+    config->codelTargetMs = CODEL_TARGET_MS;
+    config->codelIntervalMs = CODEL_INTERVAL_MS;
+    config->priorityDefaultWeight = 1;
+    config->workerBatch = THREAD_POOL_DEFAULT_BATCH;
+    config->acceptBatch = 16;
+    config->queueSpinUs = 50;
+    config->placement.pinWorkers = false;
+    config->placement.steerByCpu = false;
+
+    config->staticMaxAge = 0;
+    config->autoindex = false;
+    config->autoindexCacheDirs = 256;
+    config->requestLimits.requestLineTimeoutMs = 10000;
+    config->requestLimits.headerTimeoutMs = 20000;
+    config->requestLimits.bodyTimeoutMs = 60000;
+    config->requestLimits.maxHeaderCount = 100;
+    config->requestLimits.maxHeaderBytes = 32 * 1024;
+    config->requestLimits.maxBodyBytes = 16 * 1024 * 1024;
+    config->requestLimits.cgiTimeoutMs = 30000;
+    config->requestLimits.cgiMaxOutputBytes = 256 * 1024 * 1024;
+    config->timerTickMs = 100;
+    config->timerSlots = 1024;
+    config->profileTiming = false;
+
+    config->responseCache.maxBytes = 0;
+    config->responseCache.maxEntryBytes = 1024 * 1024;
+    config->responseCache.defaultTtlSec = 0;
+    config->fileCache.maxBytes = 64 * 1024 * 1024;
+    config->fileCache.maxEntryBytes = 4 * 1024 * 1024;
+    config->prewarm = PREWARM_OFF;
+    config->prewarmThreads = 0;
+    config->contentStore.maxBytes = 1024 * 1024 * 1024;
+    config->workerProcesses = 0;
+    config->sharedCache.maxBytes = 64 * 1024 * 1024;
+    config->sharedCache.maxEntryBytes = 256 * 1024;
+
+    config->rateLimit.ratePerSec = 0;
+    config->rateLimit.burst = 20;
+    config->rateLimit.maxConnections = 0;
+    config->rateLimit.idleSec = 60;
+    config->rateLimit.tableSize = 65536;
+
+    config->tcp.backlog = LISTENQ;
+    config->tcp.deferAcceptSec = 0;
+    config->tcp.fastOpenQueue = 0;
+    config->tcp.noDelay = true;
+    config->tcp.cork = true;
+    config->tcp.sendBuffer = 0;
+    config->tcp.receiveBuffer = 0;
+    config->tcp.nonBlocking = true;
+
+    config->tls.certificate[0] = '\0';
+    config->tls.key[0] = '\0';
+    config->tls.sessionTickets = true;
+    config->tls.sessionCacheSize = 20480;
+    config->tls.ktls = true;
+
+    config->http2.enabled = true;
+    config->http2.maxStreams = 100;
+    config->http2.maxWorkerStreams = 0;
+    config->http2.sendTimeoutSec = 10;
+    config->http2.streamWindow = 65535;
+    config->http2.idleTimeoutSec = 30;
+
+    strcpy(config->accessLogPath, ACCESS_LOG_STDOUT);
+    config->accessLog.path = NULL;
+    config->accessLog.format = LOG_FORMAT_COMMON;
+    config->accessLog.flushMs = 100;
+    config->accessLog.ringBytes = 256 * 1024;
+    config->accessLog.rotateBytes = 64 * 1024 * 1024;
+    config->accessLog.rotateKeep = 5;
+}
+
+int configParseSchedAlg(const char *name, SchedAlg *schedAlg)
+{
+    static const struct { const char *name; SchedAlg value; } names[] = {
+        {"block", BLOCK}, {"dt", DROP_TAIL}, {"dh", DROP_HEAD},
+        {"random", RANDOM_DROP}, {"codel", CODEL}, {"wfq", WFQ},
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (!strcasecmp(name, names[i].name))
+        {
+            *schedAlg = names[i].value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int configParseBool(const char *value, int *out)
+{
+    if (!strcasecmp(value, "on") || !strcasecmp(value, "yes") ||
+        !strcasecmp(value, "true") || !strcmp(value, "1"))
+    {
+        *out = true;
+        return 0;
+    }
+    if (!strcasecmp(value, "off") || !strcasecmp(value, "no") ||
+        !strcasecmp(value, "false") || !strcmp(value, "0"))
+    {
+        *out = false;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+* configParseNumber: Parses a number, integers with an optional K/M/G
+*   suffix (powers of 1024), and checks it against [min, max].
+*/
+static int configParseNumber(const char *value, const ConfigKey *key, double *out)
+{
+    char *end;
+    errno = 0;
+    double number = strtod(value, &end);
+    if (end == value || errno != 0)
+    {
+        return -1;
+    }
+    if (key->type != CONFIG_DOUBLE && *end != '\0')
+    {
+        switch (toupper((unsigned char)*end++))
+        {
+        case 'G': number *= 1024;   // fall through
+        case 'M': number *= 1024;   // fall through
+        case 'K': number *= 1024; break;
+        default: return -1;
+        }
+    }
+    if (*end != '\0' || number < key->min || number > key->max)
+    {
+        return -1;
+    }
+    if (key->type != CONFIG_DOUBLE && number != (double)(long long)number)
+    {
+        return -1;
+    }
+    *out = number;
+    return 0;
+}
+
+static const ConfigKey *configFindKey(const ConfigKey *keys, size_t count, const char *name)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!strcasecmp(name, keys[i].name))
+        {
+            return &keys[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+* configSet: Stores value into the field described by key, relative to base
+*   (the ServerConfig, or a VhostConfig for the keys of a section).
+* @return NULL on success, the reason otherwise
+*/
+static const char *configSet(void *base, const ConfigKey *key, const char *value)
+{
+    char *field = (char *)base + key->offset;
+    double number;
+
+    switch (key->type)
+    {
+    case CONFIG_PATH:
+        if (strlen(value) >= PATH_MAX)
+        {
+            return "path too long";
+        }
+        // "off" disables optional files such as the access log
+        strcpy(field, strcasecmp(value, "off") ? value : "");
+        return NULL;
+    case CONFIG_ROUTE:
+    {
+        const char *reason = routeParseLine(value);
+        size_t used = strlen(field);
+        if (reason != NULL)
+        {
+            return reason;
+        }
+        if (used + strlen(value) + 2 > ROUTE_TEXT_MAX)
+        {
+            return "too many routes";
+        }
+        sprintf(field + used, "%s%s", used > 0 ? "\n" : "", value);
+        return NULL;
+    }
+    case CONFIG_BOOL:
+        return configParseBool(value, (int *)field) < 0 ? "expected on or off" : NULL;
+    case CONFIG_PREWARM:
+        return prewarmParseMode(value, (PrewarmMode *)field) < 0 ? "expected off, roots or log" : NULL;
+    case CONFIG_CONTENT:
+    {
+        size_t used = strlen(field);
+        if (value[0] != '/')
+        {
+            return "expected a URL path";
+        }
+        if (used + strlen(value) + 2 > CONTENT_STORE_TEXT_MAX)
+        {
+            return "too many content_store files";
+        }
+        sprintf(field + used, "%s%s", used > 0 ? "\n" : "", value);
+        return NULL;
+    }
+    case CONFIG_PRIORITY:
+    {
+        const char *reason = priorityParseLine(value);
+        size_t used = strlen(field);
+        int classes = used > 0;
+        if (reason != NULL)
+        {
+            return reason;
+        }
+        for (const char *line = field; (line = strchr(line, '\n')) != NULL; line++)
+        {
+            classes++;
+        }
+        if (classes == PRIORITY_MAX_CLASSES || used + strlen(value) + 2 > PRIORITY_TEXT_MAX)
+        {
+            return "too many priority classes";
+        }
+        sprintf(field + used, "%s%s", used > 0 ? "\n" : "", value);
+        return NULL;
+    }
+    case CONFIG_SCHEDALG:
+        return configParseSchedAlg(value, (SchedAlg *)field) < 0
+               ? "expected block, dt, dh, random, codel or wfq" : NULL;
+    case CONFIG_LOG_FORMAT:
+        if (!strcasecmp(value, "common"))
+        {
+            *(AccessLogFormat *)field = LOG_FORMAT_COMMON;
+        }
+        else if (!strcasecmp(value, "combined"))
+        {
+            *(AccessLogFormat *)field = LOG_FORMAT_COMBINED;
+        }
+        else if (!strcasecmp(value, "json"))
+        {
+            *(AccessLogFormat *)field = LOG_FORMAT_JSON;
+        }
+        else
+        {
+            return "expected common, combined or json";
+        }
+        return NULL;
+    default:
+        break;
+    }
+
+    if (configParseNumber(value, key, &number) < 0)
+    {
+        return "invalid number or out of range";
+    }
+    switch (key->type)
+    {
+    case CONFIG_INT:
+        *(int *)field = (int)number;
+        break;
+    case CONFIG_SIZE:
+        *(size_t *)field = (size_t)number;
+        break;
+    default:
+        *(double *)field = number;
+        break;
+    }
+    return NULL;
+}
+
+static char *configTrim(char *text)
+{
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1]))
+    {
+        *--end = '\0';
+    }
+    return text;
+}
+
+/**
+* configVhostBegin: Starts the site of a "[vhost name ...]" header (brackets
+*   already stripped, text starting after "vhost").
+* @return NULL on success, the reason otherwise
+*/
+static const char *configVhostBegin(ServerConfig *config, char *names)
+{
+    if (config->vhostCount == VHOST_MAX)
+    {
+        return "too many [vhost] sections";
+    }
+    VhostConfig *site = &config->vhosts[config->vhostCount];
+    memset(site, 0, sizeof(*site));
+    site->staticMaxAge = -1;
+    site->cgi = true;
+    site->autoindex = -1;
+
+    size_t len = 0;
+    for (char *name = strtok(names, " \t"); name != NULL; name = strtok(NULL, " \t"))
+    {
+        size_t nameLen = strlen(name);
+        if (len + nameLen + 1 >= sizeof(site->names))
+        {
+            return "names too long";
+        }
+        if (len > 0)
+        {
+            site->names[len++] = ' ';
+        }
+        for (size_t i = 0; i < nameLen; i++)
+        {
+            site->names[len++] = tolower((unsigned char)name[i]);
+        }
+    }
+    if (len == 0)
+    {
+        return "expected [vhost name ...]";
+    }
+    config->vhostCount++;
+    return NULL;
+}
+
+/* Whether the space separated list [names, end) holds the len bytes of name */
+static bool configHasName(const char *names, const char *end, const char *name, size_t len)
+{
+    while (names < end)
+    {
+        size_t n = strcspn(names, " ");
+        if (n == len && !strncmp(names, name, len))
+        {
+            return true;
+        }
+        names += n;
+        names += *names == ' ';
+    }
+    return false;
+}
+
+/**
+* configVhostCheck: Every site needs its own document root, and a name may
+*   belong to one site only.
+* @return NULL when the sites are valid, the reason (in why) otherwise
+*/
+static const char *configVhostCheck(const ServerConfig *config, char *why, size_t whySize)
+{
+    for (int i = 0; i < config->vhostCount; i++)
+    {
+        const VhostConfig *site = &config->vhosts[i];
+        struct stat sbuf;
+        if (site->documentRoot[0] == '\0' ||
+            stat(site->documentRoot, &sbuf) < 0 || !S_ISDIR(sbuf.st_mode))
+        {
+            snprintf(why, whySize, "[vhost %s] needs a document_root directory", site->names);
+            return why;
+        }
+
+        for (const char *name = site->names; *name != '\0'; )
+        {
+            size_t len = strcspn(name, " ");
+            bool twice = configHasName(site->names, name, name, len);
+            for (int j = 0; j < i && !twice; j++)
+            {
+                const char *other = config->vhosts[j].names;
+                twice = configHasName(other, other + strlen(other), name, len);
+            }
+            if (twice)
+            {
+                snprintf(why, whySize, "vhost name %.*s is used twice", (int)len, name);
+                return why;
+            }
+            name += len;
+            name += *name == ' ';
+        }
+    }
+    return NULL;
+}
+
+int configLoad(const char *path, ServerConfig *config, char *error, size_t errorSize)
+{
+    char line[PATH_MAX + VHOST_NAMES_MAX];
+    int lineNumber = 0;
+    VhostConfig *site = NULL;   // the [vhost] section being read, NULL before the first
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        snprintf(error, errorSize, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+        char *text = configTrim(line);
+        if (*text == '\0')
+        {
+            continue;
+        }
+
+        if (*text == '[')
+        {
+            char *close = strchr(text, ']');
+            const char *reason = "expected [vhost name ...]";
+            if (close != NULL && close[1] == '\0' && !strncasecmp(text + 1, "vhost", 5) &&
+                isspace((unsigned char)text[6]))
+            {
+                *close = '\0';
+                reason = configVhostBegin(config, text + 6);
+            }
+            if (reason != NULL)
+            {
+                snprintf(error, errorSize, "%s:%d: %s", path, lineNumber, reason);
+                fclose(file);
+                return -1;
+            }
+            site = &config->vhosts[config->vhostCount - 1];
+            continue;
+        }
+
+        char *equals = strchr(text, '=');
+        if (equals == NULL)
+        {
+            snprintf(error, errorSize, "%s:%d: expected key = value", path, lineNumber);
+            fclose(file);
+            return -1;
+        }
+        *equals = '\0';
+        char *name = configTrim(text);
+        char *value = configTrim(equals + 1);
+
+        const ConfigKey *key;
+        if (site == NULL)
+        {
+            key = configFindKey(configKeys, sizeof(configKeys) / sizeof(configKeys[0]), name);
+        }
+        else if ((key = configFindKey(vhostKeys, sizeof(vhostKeys) / sizeof(vhostKeys[0]), name)) == NULL &&
+                 configFindKey(configKeys, sizeof(configKeys) / sizeof(configKeys[0]), name) != NULL)
+        {
+            snprintf(error, errorSize, "%s:%d: '%s' is global, set it before the first [vhost]",
+                     path, lineNumber, name);
+            fclose(file);
+            return -1;
+        }
+        if (key == NULL)
+        {
+            snprintf(error, errorSize, "%s:%d: unknown setting '%s'", path, lineNumber, name);
+            fclose(file);
+            return -1;
+        }
+
+        const char *reason = configSet(site != NULL ? (void *)site : (void *)config, key, value);
+        if (reason != NULL)
+        {
+            snprintf(error, errorSize, "%s:%d: %s: %s", path, lineNumber, name, reason);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+
+    struct stat sbuf;
+    if (stat(config->documentRoot, &sbuf) < 0 || !S_ISDIR(sbuf.st_mode))
+    {
+        snprintf(error, errorSize, "%s: document_root %s is not a directory", path, config->documentRoot);
+        return -1;
+    }
+    char why[VHOST_NAMES_MAX + 64];
+    const char *reason = configVhostCheck(config, why, sizeof(why));
+    if (reason != NULL)
+    {
+        snprintf(error, errorSize, "%s: %s", path, reason);
+        return -1;
+    }
+    if (config->placement.steerByCpu && !config->placement.pinWorkers)
+    {
+        config->placement.pinWorkers = true;
+    }
+    // path= and header= classes are matched when a connection is accepted:
+    // hold it back until the request line can have arrived
+    if (config->schedAlg == WFQ && config->tcp.deferAcceptSec == 0 && priorityPeeks(config->priorityClasses))
+    {
+        config->tcp.deferAcceptSec = (config->requestLimits.requestLineTimeoutMs + 999) / 1000;
+        if (config->tcp.deferAcceptSec == 0)
+        {
+            config->tcp.deferAcceptSec = 1;
+        }
+    }
+    return 0;
+}
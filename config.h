@@ -0,0 +1,141 @@
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stddef.h>
+#include <limits.h>
+#include "bool.h"
+#include "threadPool.h"
+#include "accessLog.h"
+#include "rateLimit.h"
+#include "tcpOptions.h"
+#include "request.h"
+#include "responseCache.h"
+#include "tls.h"
+#include "http2.h"
+#include "vhost.h"
+#include "fileCache.h"
+#include "prewarm.h"
+#include "contentStore.h"
+#include "sharedCache.h"
+#include "prefork.h"
+#include "priority.h"
+#include "profile.h"
+
+/**
+* Server configuration
+*
+* Settings come from compiled-in defaults, optionally overridden by a file of
+* "key = value" lines ('#' starts a comment). Sizes accept K, M and G
+* suffixes, booleans on/off, yes/no, true/false or 1/0. Every value is range
+* checked; a file with any invalid line is rejected as a whole.
+*
+* Virtual hosts follow the global settings, each in a section started by a
+* "[vhost name ...]" line. A section sets document_root (required) and may
+* override static_max_age, cgi, autoindex and response_cache_bytes (its own
+* cache partition) for its site.
+*
+* "route = PREFIX static|cgi DIR" and "route = PREFIX handler NAME" may be
+* repeated, globally for the default site or in a section for that site. A
+* static or cgi route may add cgi_timeout_ms=MS and cgi_max_output_bytes=SIZE
+* to give its programs their own limits.
+*
+* "prewarm = roots" loads the static files of every site into the file cache
+* before the listener opens; "prewarm = log" loads those the access log of the
+* last run asked for most, until file_cache_bytes is used up.
+*
+* "content_store = PATH" (repeatable) keeps the file the default site serves
+* for PATH on huge pages for good, for large files requested often.
+*
+* "schedalg = wfq" queues each connection in a priority class, given by
+* repeatable "priority_class = NAME WEIGHT QUEUE MATCH..." lines (see
+* priority.h); queue_size then bounds the class of everything else. Workers
+* then take one connection at a time, whatever worker_batch says. With a
+* path= or header= class, tcp_defer_accept left at 0 becomes the request line
+* timeout in seconds.
+*
+* "worker_processes = N" runs a master and N worker processes, each with its
+* own thread pool of "threads" threads, sharing the listening socket, the
+* caches filled before they start, a shared_cache_bytes segment of static
+* files and the client_* limits, which hold for a client across all the
+* workers together.
+*
+* "route = /debug handler debug" adds the local-only profiling endpoint of
+* profile.h to a site.
+*
+* On SIGHUP the file is read again. Settings marked (reload) below are applied
+* to the running server; changes to the others are reported and take effect on
+* the next restart.
+*
+*   configDefaults - Fills in the compiled-in defaults.
+*   configLoad     - Overrides settings from a file.
+*   configParseSchedAlg - Maps a policy name (block, dt, dh, random, codel, wfq).
+*/
+
+/** Upper bound of accept_batch */
+#define CONFIG_MAX_ACCEPT_BATCH 1024
+
+typedef struct ServerConfig_t {
+    int port;
+    char documentRoot[PATH_MAX];
+    char mimeTypes[PATH_MAX];             // "" = built-in table only
+    char routes[ROUTE_TEXT_MAX];          // "route" lines of the default site
+
+    size_t threads;                       // (reload)
+    size_t queueSize;                     // (reload)
+    SchedAlg schedAlg;                    // (reload)
+    int codelTargetMs;                    // (reload)
+    int codelIntervalMs;                  // (reload)
+    char priorityClasses[PRIORITY_TEXT_MAX]; // "priority_class" lines, for schedalg wfq
+    int priorityDefaultWeight;            // weight of the connections no class matches
+    int workerBatch;                      // (reload) requests a worker claims at once
+    int acceptBatch;                      // (reload) connections accepted per listener wakeup
+    int queueSpinUs;                      // (reload) idle workers' spin before blocking, 0 = off
+    ThreadPoolPlacement placement;
+
+    int staticMaxAge;                     // (reload) Cache-Control max-age of static files
+    bool autoindex;                       // list directories without home.html
+    int autoindexCacheDirs;               // directory listings kept up to date
+    RequestLimits requestLimits;          // (reload)
+    int timerTickMs;
+    int timerSlots;
+    bool profileTiming;                   // (reload) per-stage request timing, see profile.h
+
+    ResponseCacheConfig responseCache;    // (reload) dynamic GET responses, off by default
+    FileCacheConfig fileCache;            // (reload) static files kept mapped
+    PrewarmMode prewarm;                  // what to load into the file cache before accepting
+    int prewarmThreads;                   // 0 = as many as threads
+    ContentStoreConfig contentStore;      // large hot files kept on huge pages
+    int workerProcesses;                  // 0 = one process, else a master and this many workers
+    SharedCacheConfig sharedCache;        // static files shared by the worker processes
+
+    RateLimitConfig rateLimit;            // (reload) all but idleSec and tableSize
+    TcpOptions tcp;
+    TlsConfig tls;                        // HTTPS when a certificate is set
+    Http2Config http2;                    // h2c with prior knowledge, plaintext only
+
+    VhostConfig vhosts[VHOST_MAX];        // [vhost] sections, in file order
+    int vhostCount;
+
+    char accessLogPath[PATH_MAX];         // "" = off, "-" = stdout
+    AccessLogConfig accessLog;            // path is set from accessLogPath at startup
+} ServerConfig;
+
+void configDefaults(ServerConfig *config);
+
+/**
+* configLoad: Reads path on top of the values already in config.
+* @param error - Receives a "file:line: reason" message on failure.
+* @return
+*   0 on success
+*   -1 if the file could not be read or a line is invalid (config is then
+*      left partially updated; load into a copy to keep the old values)
+*/
+int configLoad(const char *path, ServerConfig *config, char *error, size_t errorSize);
+
+/**
+* configParseSchedAlg: Maps a policy name to its SchedAlg.
+* @return 0 on success, -1 for an unknown name
+*/
+int configParseSchedAlg(const char *name, SchedAlg *schedAlg);
+
+#endif // CONFIG_H_
@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include "contentStore.h"
+#include "route.h"
+#include "vhost.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+/** Size of a transparent huge page */
+#define STORE_THP_SIZE (2UL * 1024 * 1024)
+
+struct ContentStoreEntry_t
+{
+    int fd;                 // the memfd holding the copy
+    char *data;             // its mapping, read-only once filled
+    size_t mapped;          // size rounded up to whole huge pages
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    bool hugetlb;
+    int refs;               // the store's and every request sending it
+};
+
+typedef struct StoreSlot_t
+{
+    char path[PATH_MAX];        // the file name a request builds
+    ContentStoreEntry entry;    // NULL while being copied in again
+} StoreSlot;
+
+static struct
+{
+    pthread_mutex_t mutex;
+    ContentStoreConfig config;
+    StoreSlot slots[CONTENT_STORE_MAX_FILES];
+    int count;
+    off_t smallest;         // requests for smaller files skip the scan
+    size_t bytes;
+    unsigned long hits;
+    unsigned long reloads;
+} store = {PTHREAD_MUTEX_INITIALIZER};
+
+static bool StoreMatches(ContentStoreEntry entry, const struct stat *sbuf)
+{
+    return entry->ino == sbuf->st_ino && entry->dev == sbuf->st_dev && entry->size == sbuf->st_size &&
+           entry->mtime.tv_sec == sbuf->st_mtim.tv_sec && entry->mtime.tv_nsec == sbuf->st_mtim.tv_nsec;
+}
+
+static void StoreUnref(ContentStoreEntry entry)
+{
+    if (--entry->refs == 0)
+    {
+        munmap(entry->data, entry->mapped);
+        close(entry->fd);
+        free(entry);
+    }
+}
+
+/* Creates the memfd and maps size bytes of it, on hugetlbfs when asked and possible */
+static int StoreRegion(ContentStoreEntry entry, off_t size, bool hugetlb)
+{
+    struct stat sbuf;
+
+    if (hugetlb && (entry->fd = memfd_create("content-store", MFD_CLOEXEC | MFD_HUGETLB)) >= 0)
+    {
+        // st_blksize is the huge page size; the mapping reserves the pages
+        fstat(entry->fd, &sbuf);
+        entry->mapped = (size + sbuf.st_blksize - 1) / sbuf.st_blksize * sbuf.st_blksize;
+        if (ftruncate(entry->fd, entry->mapped) == 0 &&
+            (entry->data = mmap(NULL, entry->mapped, PROT_READ | PROT_WRITE, MAP_SHARED, entry->fd, 0)) != MAP_FAILED)
+        {
+            entry->hugetlb = true;
+            return 0;
+        }
+        close(entry->fd);
+    }
+
+    if ((entry->fd = memfd_create("content-store", MFD_CLOEXEC)) < 0)
+    {
+        return -1;
+    }
+    // whole huge pages, so the tail of the file is not left on small ones
+    entry->mapped = (size + STORE_THP_SIZE - 1) / STORE_THP_SIZE * STORE_THP_SIZE;
+    if (ftruncate(entry->fd, entry->mapped) < 0 ||
+        (entry->data = mmap(NULL, entry->mapped, PROT_READ | PROT_WRITE, MAP_SHARED, entry->fd, 0)) == MAP_FAILED)
+    {
+        close(entry->fd);
+        return -1;
+    }
+    // shmem takes huge pages for an advised mapping on fault (shmem_enabled
+    // "advise" or "always"); the copy below is what faults it in
+    madvise(entry->data, entry->mapped, MADV_HUGEPAGE);
+    return 0;
+}
+
+/* Copies path into a new region; errno is set when it returns NULL */
+static ContentStoreEntry StoreCopy(const char *path, size_t room)
+{
+    struct stat sbuf;
+    ContentStoreEntry entry;
+    int src = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (src < 0)
+    {
+        return NULL;
+    }
+    errno = 0;
+    if (fstat(src, &sbuf) < 0 || !S_ISREG(sbuf.st_mode) || sbuf.st_size == 0 || (size_t)sbuf.st_size > room)
+    {
+        if (errno == 0 || S_ISREG(sbuf.st_mode))
+        {
+            errno = sbuf.st_size == 0 ? EINVAL : EFBIG;
+        }
+        close(src);
+        return NULL;
+    }
+    if ((entry = calloc(1, sizeof(*entry))) == NULL || StoreRegion(entry, sbuf.st_size, store.config.hugetlb) < 0)
+    {
+        free(entry);
+        close(src);
+        return NULL;
+    }
+
+    for (off_t done = 0; done < sbuf.st_size;)
+    {
+        ssize_t n = pread(src, entry->data + done, sbuf.st_size - done, done);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            errno = n == 0 ? EIO : errno;   // shrank while being copied
+            entry->refs = 1;
+            StoreUnref(entry);
+            close(src);
+            return NULL;
+        }
+        done += n;
+    }
+    close(src);
+    mprotect(entry->data, entry->mapped, PROT_READ);
+
+    entry->size = sbuf.st_size;
+    entry->dev = sbuf.st_dev;
+    entry->ino = sbuf.st_ino;
+    entry->mtime = sbuf.st_mtim;
+    entry->refs = 1;    // the store's
+    return entry;
+}
+
+static void StoreUpdateSmallest(void)
+{
+    off_t smallest = -1;
+    for (int i = 0; i < store.count; i++)
+    {
+        ContentStoreEntry entry = store.slots[i].entry;
+        if (entry != NULL && (smallest < 0 || entry->size < smallest))
+        {
+            smallest = entry->size;
+        }
+    }
+    __atomic_store_n(&store.smallest, smallest < 0 ? 0 : smallest, __ATOMIC_RELAXED);
+}
+
+int contentStoreInit(const ContentStoreConfig *config)
+{
+    char line[CONTENT_STORE_TEXT_MAX], filename[PATH_MAX];
+
+    store.config = *config;
+    for (const char *p = config->paths; *p != '\0'; p += strcspn(p, "\n"), p += *p == '\n')
+    {
+        size_t len = strcspn(p, "\n");
+        memcpy(line, p, len);
+        line[len] = '\0';
+        if (routeStaticFile(vhostLookup("")->routes, line, filename, sizeof(filename)) == NULL)
+        {
+            fprintf(stderr, "Content store: %.*s is not a static file, skipped\n", (int)len, p);
+            continue;
+        }
+        if (store.count == CONTENT_STORE_MAX_FILES)
+        {
+            fprintf(stderr, "Content store: more than %d files, %s skipped\n", CONTENT_STORE_MAX_FILES, filename);
+            continue;
+        }
+
+        ContentStoreEntry entry = StoreCopy(filename, config->maxBytes - store.bytes);
+        if (entry == NULL)
+        {
+            fprintf(stderr, "Content store: %s skipped: %s\n", filename,
+                    errno == EFBIG ? "over content_store_bytes" :
+                    errno == EINVAL ? "empty or not a regular file" : strerror(errno));
+            continue;
+        }
+        if (config->hugetlb && !entry->hugetlb)
+        {
+            fprintf(stderr, "Content store: no huge pages reserved for %s (vm.nr_hugepages), "
+                    "using transparent huge pages\n", filename);
+        }
+        strcpy(store.slots[store.count].path, filename);
+        store.slots[store.count++].entry = entry;
+        store.bytes += entry->size;
+    }
+    StoreUpdateSmallest();
+    return store.count;
+}
+
+ContentStoreEntry contentStoreGet(const char *path, const struct stat *sbuf)
+{
+    StoreSlot *slot = NULL;
+    ContentStoreEntry entry, fresh;
+    size_t room;
+
+    if (store.count == 0 || sbuf->st_size < __atomic_load_n(&store.smallest, __ATOMIC_RELAXED))
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&store.mutex);
+        for (int i = 0; i < store.count && slot == NULL; i++)
+        {
+            if (!strcmp(store.slots[i].path, path))
+            {
+                slot = &store.slots[i];
+            }
+        }
+        if (slot == NULL || (entry = slot->entry) == NULL)
+        {
+            pthread_mutex_unlock(&store.mutex);
+            return NULL;
+        }
+        if (StoreMatches(entry, sbuf))
+        {
+            entry->refs++;
+            store.hits++;
+            pthread_mutex_unlock(&store.mutex);
+            return entry;
+        }
+        // changed on disk: this request copies it in again, the others are
+        // served from disk until it is done
+        slot->entry = NULL;
+        store.bytes -= entry->size;
+        room = store.config.maxBytes - store.bytes;
+        StoreUnref(entry);
+    pthread_mutex_unlock(&store.mutex);
+
+    fresh = StoreCopy(slot->path, room);
+    pthread_mutex_lock(&store.mutex);
+        entry = NULL;
+        if (fresh != NULL && store.bytes + fresh->size <= store.config.maxBytes)
+        {
+            slot->entry = fresh;
+            store.bytes += fresh->size;
+            store.reloads++;
+            if (StoreMatches(fresh, sbuf))
+            {
+                fresh->refs++;
+                entry = fresh;
+            }
+        }
+        else if (fresh != NULL)
+        {
+            StoreUnref(fresh);
+        }
+        StoreUpdateSmallest();
+    pthread_mutex_unlock(&store.mutex);
+    return entry;
+}
+
+ssize_t contentStoreSend(int fd, ContentStoreEntry entry, off_t offset, size_t len)
+{
+    if (entry->hugetlb)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return sendfile(fd, entry->fd, &offset, len);
+}
+
+const char *contentStoreData(ContentStoreEntry entry, size_t *len)
+{
+    *len = entry->size;
+    return entry->data;
+}
+
+void contentStoreRelease(ContentStoreEntry entry)
+{
+    pthread_mutex_lock(&store.mutex);
+        StoreUnref(entry);
+    pthread_mutex_unlock(&store.mutex);
+}
+
+void contentStoreStats(ContentStoreStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&store.mutex);
+        for (int i = 0; i < store.count; i++)
+        {
+            if (store.slots[i].entry != NULL)
+            {
+                stats->files++;
+                stats->hugetlbFiles += store.slots[i].entry->hugetlb;
+            }
+        }
+        stats->bytes = store.bytes;
+        stats->hits = store.hits;
+        stats->reloads = store.reloads;
+    pthread_mutex_unlock(&store.mutex);
+}
@@ -0,0 +1,91 @@
+#ifndef CONTENT_STORE_H_
+#define CONTENT_STORE_H_
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "bool.h"
+
+/**
+* Content store
+*
+* Keeps designated large, hot files in memory for the life of the server, so
+* serving one never maps it, sets up page tables or takes page faults. Each
+* file is copied once into its own memfd, backed by huge pages:
+*
+*   - transparent huge pages (the default): a shmem memfd advised with
+*     MADV_HUGEPAGE. Responses are sent with sendfile() straight from it.
+*   - hugetlbfs (content_store_hugetlb): pages reserved through
+*     vm.nr_hugepages. hugetlbfs cannot be sendfile()'d from, so responses
+*     are written from the region's own mapping, which 2 MB pages cover with
+*     a few TLB entries. Without reserved pages the store falls back to
+*     transparent huge pages.
+*
+* Files are named by URL path and resolved through the default site's
+* routes, so a request for one builds the same file name. Requests still stat
+* the file; when it changed, the first request to notice copies it in again
+* and the others are served from disk meanwhile. Entries are reference
+* counted, so a replaced copy stays mapped until the requests sending it end.
+*
+* bench/contentStore.sh compares both modes with mapping per request. Over
+* loopback the server's CPU per request drops about sevenfold with sendfile()
+* from transparent huge pages; hugetlbfs, still copying, saves far less.
+*
+*   contentStoreInit    - Loads the designated files.
+*   contentStoreGet     - Returns the stored copy of a file, if current.
+*   contentStoreSend    - Sends part of a stored file to a socket, zero-copy.
+*   contentStoreData    - The mapped contents of an entry.
+*   contentStoreRelease - Drops the reference taken by contentStoreGet.
+*   contentStoreStats   - Counters for monitoring.
+*/
+
+/** Most files the store holds */
+#define CONTENT_STORE_MAX_FILES 64
+/** Room for the "content_store" lines */
+#define CONTENT_STORE_TEXT_MAX 4096
+
+typedef struct ContentStoreConfig_t {
+    char paths[CONTENT_STORE_TEXT_MAX];   // URL paths, '\n' separated, "" = off
+    size_t maxBytes;                      // total size of the stored files
+    bool hugetlb;                         // hugetlbfs instead of transparent huge pages
+} ContentStoreConfig;
+
+typedef struct ContentStoreStats_t {
+    unsigned long files;
+    size_t bytes;
+    unsigned long hugetlbFiles;     // of files, backed by hugetlbfs
+    unsigned long hits;
+    unsigned long reloads;          // copies taken again after the file changed
+} ContentStoreStats;
+
+typedef struct ContentStoreEntry_t *ContentStoreEntry;
+
+/**
+* contentStoreInit: Copies in the files config names. Files that cannot be
+*   read, are not static or do not fit are reported on stderr and skipped.
+*   Call after vhostInit.
+* @return how many files were stored
+*/
+int contentStoreInit(const ContentStoreConfig *config);
+
+/**
+* contentStoreGet: The stored copy of path, whose current stat is sbuf.
+* @return the entry, NULL when path is not stored or is being copied in again
+*/
+ContentStoreEntry contentStoreGet(const char *path, const struct stat *sbuf);
+
+/**
+* contentStoreSend: Sends len bytes from offset with sendfile().
+* @return bytes sent (short only when fd would block), -1 with errno set;
+*   EINVAL when the entry cannot be sent this way (hugetlbfs): write it
+*   from contentStoreData instead
+*/
+ssize_t contentStoreSend(int fd, ContentStoreEntry entry, off_t offset, size_t len);
+
+const char *contentStoreData(ContentStoreEntry entry, size_t *len);
+
+void contentStoreRelease(ContentStoreEntry entry);
+
+void contentStoreStats(ContentStoreStats *stats);
+
+#endif // CONTENT_STORE_H_
@@ -0,0 +1,383 @@
+#include "fileCache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define FILE_CACHE_MIN_BUCKETS 1024
+/** Typical static file size, for sizing the table from maxBytes */
+#define FILE_CACHE_TYPICAL_FILE (16 * 1024)
+
+struct FileCacheEntry_t
+{
+    struct FileCacheEntry_t *hashNext;
+    struct FileCacheEntry_t *lruPrev;   // towards the most recently used
+    struct FileCacheEntry_t *lruNext;
+    size_t hash;
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    char *data;             // MAP_POPULATE'd mapping of size bytes
+    int refs;               // the table's and every request sending it
+    bool linked;
+};
+
+static struct
+{
+    pthread_mutex_t mutex;
+    FileCacheConfig config;
+    FileCacheEntry *buckets;
+    size_t bucketCount;     // a power of two
+    FileCacheEntry lruHead;
+    FileCacheEntry lruTail;
+    size_t bytes;
+    size_t entries;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} files = {PTHREAD_MUTEX_INITIALIZER};
+
+/* FNV-1a, as for the MIME table */
+static size_t FileHash(const char *path)
+{
+    size_t hash = 14695981039346656037ULL;
+    for (; *path != '\0'; path++)
+    {
+        hash = (hash ^ (unsigned char)*path) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool FileMatches(FileCacheEntry entry, const struct stat *sbuf)
+{
+    return entry->ino == sbuf->st_ino && entry->dev == sbuf->st_dev && entry->size == sbuf->st_size &&
+           entry->mtime.tv_sec == sbuf->st_mtim.tv_sec && entry->mtime.tv_nsec == sbuf->st_mtim.tv_nsec;
+}
+
+static void FileUnref(FileCacheEntry entry)
+{
+    if (--entry->refs == 0)
+    {
+        munmap(entry->data, entry->size);
+        free(entry->path);
+        free(entry);
+    }
+}
+
+static void FileLruRemove(FileCacheEntry entry)
+{
+    if (entry->lruPrev != NULL)
+    {
+        entry->lruPrev->lruNext = entry->lruNext;
+    }
+    else
+    {
+        files.lruHead = entry->lruNext;
+    }
+    if (entry->lruNext != NULL)
+    {
+        entry->lruNext->lruPrev = entry->lruPrev;
+    }
+    else
+    {
+        files.lruTail = entry->lruPrev;
+    }
+    entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void FileLruPushFront(FileCacheEntry entry)
+{
+    entry->lruPrev = NULL;
+    entry->lruNext = files.lruHead;
+    if (files.lruHead != NULL)
+    {
+        files.lruHead->lruPrev = entry;
+    }
+    files.lruHead = entry;
+    if (files.lruTail == NULL)
+    {
+        files.lruTail = entry;
+    }
+}
+
+/* Takes entry out of the table; it is unmapped once no request sends it */
+static void FileUnlink(FileCacheEntry entry)
+{
+    FileCacheEntry *link = &files.buckets[entry->hash & (files.bucketCount - 1)];
+    while (*link != entry)
+    {
+        link = &(*link)->hashNext;
+    }
+    *link = entry->hashNext;
+    FileLruRemove(entry);
+    entry->linked = false;
+    files.bytes -= entry->size;
+    files.entries--;
+    FileUnref(entry);
+}
+
+static FileCacheEntry FileFind(const char *path, size_t hash)
+{
+    FileCacheEntry entry = files.buckets[hash & (files.bucketCount - 1)];
+    for (; entry != NULL; entry = entry->hashNext)
+    {
+        if (entry->hash == hash && !strcmp(entry->path, path))
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Unmaps the least recently used files until the cache is within its bound */
+static void FileEvict(void)
+{
+    while (files.bytes > files.config.maxBytes && files.lruTail != NULL)
+    {
+        FileUnlink(files.lruTail);
+        files.evictions++;
+    }
+}
+
+static void FileInsert(FileCacheEntry entry)
+{
+    FileCacheEntry *bucket = &files.buckets[entry->hash & (files.bucketCount - 1)];
+    entry->hashNext = *bucket;
+    *bucket = entry;
+    entry->linked = true;
+    FileLruPushFront(entry);
+    files.bytes += entry->size;
+    files.entries++;
+    FileEvict();
+}
+
+/* A table of buckets for a cache of maxBytes */
+static FileCacheEntry *FileBuckets(size_t maxBytes, size_t *count)
+{
+    *count = FILE_CACHE_MIN_BUCKETS;
+    while (*count < maxBytes / FILE_CACHE_TYPICAL_FILE)
+    {
+        *count *= 2;
+    }
+    return calloc(*count, sizeof(FileCacheEntry));
+}
+
+/* Maps path (as it is now, described by sbuf) and faults it in, off the lock */
+static FileCacheEntry FileMap(const char *path, size_t hash, struct stat *sbuf)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    // one file larger than the whole cache would evict itself
+    if (fstat(fd, sbuf) < 0 || !S_ISREG(sbuf->st_mode) || sbuf->st_size == 0 ||
+        (size_t)sbuf->st_size > __atomic_load_n(&files.config.maxEntryBytes, __ATOMIC_RELAXED) ||
+        (size_t)sbuf->st_size > __atomic_load_n(&files.config.maxBytes, __ATOMIC_RELAXED))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    FileCacheEntry entry = calloc(1, sizeof(*entry));
+    if (entry == NULL || (entry->path = strdup(path)) == NULL)
+    {
+        free(entry);
+        close(fd);
+        return NULL;
+    }
+    // MAP_POPULATE reads the file in now, so no request takes the page faults
+    entry->data = mmap(NULL, sbuf->st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (entry->data == MAP_FAILED)
+    {
+        free(entry->path);
+        free(entry);
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->dev = sbuf->st_dev;
+    entry->ino = sbuf->st_ino;
+    entry->size = sbuf->st_size;
+    entry->mtime = sbuf->st_mtim;
+    entry->refs = 1;    // the table's
+    return entry;
+}
+
+int fileCacheInit(const FileCacheConfig *config)
+{
+    size_t count;
+
+    files.config = *config;
+    if (config->maxBytes == 0)
+    {
+        return 0;
+    }
+    if ((files.buckets = FileBuckets(config->maxBytes, &count)) == NULL)
+    {
+        return -1;
+    }
+    files.bucketCount = count;
+    return 0;
+}
+
+int fileCacheSetLimits(const FileCacheConfig *config)
+{
+    FileCacheEntry *buckets = NULL;
+    size_t count = 0;
+
+    // a cache off until now gets its table; one that shrinks keeps the one it has
+    if (__atomic_load_n(&files.buckets, __ATOMIC_ACQUIRE) == NULL && config->maxBytes > 0 &&
+        (buckets = FileBuckets(config->maxBytes, &count)) == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&files.mutex);
+        __atomic_store_n(&files.config.maxBytes, config->maxBytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&files.config.maxEntryBytes, config->maxEntryBytes, __ATOMIC_RELAXED);
+        if (buckets != NULL)
+        {
+            files.bucketCount = count;
+            __atomic_store_n(&files.buckets, buckets, __ATOMIC_RELEASE);
+        }
+        // files now over the entry bound would never be hit again
+        for (FileCacheEntry entry = files.lruHead, next; entry != NULL; entry = next)
+        {
+            next = entry->lruNext;
+            if ((size_t)entry->size > config->maxEntryBytes)
+            {
+                FileUnlink(entry);
+                files.evictions++;
+            }
+        }
+        FileEvict();
+    pthread_mutex_unlock(&files.mutex);
+    return 0;
+}
+
+FileCacheEntry fileCacheGet(const char *path, const struct stat *sbuf, bool *loaded)
+{
+    size_t hash;
+    FileCacheEntry entry, mapped;
+    struct stat current;
+
+    *loaded = false;
+    if (__atomic_load_n(&files.buckets, __ATOMIC_ACQUIRE) == NULL || sbuf->st_size == 0 ||
+        (size_t)sbuf->st_size > __atomic_load_n(&files.config.maxEntryBytes, __ATOMIC_RELAXED))
+    {
+        return NULL;
+    }
+    hash = FileHash(path);
+
+    pthread_mutex_lock(&files.mutex);
+        entry = FileFind(path, hash);
+        if (entry != NULL && FileMatches(entry, sbuf))
+        {
+            FileLruRemove(entry);
+            FileLruPushFront(entry);
+            entry->refs++;
+            files.hits++;
+            pthread_mutex_unlock(&files.mutex);
+            return entry;
+        }
+        files.misses++;
+    pthread_mutex_unlock(&files.mutex);
+
+    if ((mapped = FileMap(path, hash, &current)) == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&files.mutex);
+        // another request may have loaded it meanwhile, or an older version is in
+        entry = FileFind(path, hash);
+        if (entry != NULL && FileMatches(entry, &current))
+        {
+            FileUnref(mapped);
+        }
+        else
+        {
+            if (entry != NULL)
+            {
+                FileUnlink(entry);
+            }
+            FileInsert(mapped);
+            entry = mapped;
+            *loaded = true;
+        }
+        entry->refs++;
+    pthread_mutex_unlock(&files.mutex);
+    return entry;
+}
+
+int fileCacheLoad(const char *path)
+{
+    size_t hash = FileHash(path);
+    FileCacheEntry entry, loaded;
+    struct stat current;
+    int rc = 1;
+
+    if (files.buckets == NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&files.mutex);
+        entry = FileFind(path, hash);
+        bool full = files.bytes >= files.config.maxBytes;
+    pthread_mutex_unlock(&files.mutex);
+    if (entry != NULL)
+    {
+        return 0;
+    }
+    if (full || (loaded = FileMap(path, hash, &current)) == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&files.mutex);
+        // warming never evicts: what was loaded first is what was asked for most
+        if (FileFind(path, hash) != NULL)
+        {
+            FileUnref(loaded);
+            rc = 0;
+        }
+        else if (files.bytes + loaded->size > files.config.maxBytes)
+        {
+            FileUnref(loaded);
+            rc = -1;
+        }
+        else
+        {
+            FileInsert(loaded);
+        }
+    pthread_mutex_unlock(&files.mutex);
+    return rc;
+}
+
+const char *fileCacheData(FileCacheEntry entry, size_t *len)
+{
+    *len = entry->size;
+    return entry->data;
+}
+
+void fileCacheRelease(FileCacheEntry entry)
+{
+    pthread_mutex_lock(&files.mutex);
+        FileUnref(entry);
+    pthread_mutex_unlock(&files.mutex);
+}
+
+void fileCacheStats(FileCacheStats *stats)
+{
+    pthread_mutex_lock(&files.mutex);
+        stats->hits = files.hits;
+        stats->misses = files.misses;
+        stats->evictions = files.evictions;
+        stats->bytes = files.bytes;
+        stats->entries = files.entries;
+    pthread_mutex_unlock(&files.mutex);
+}
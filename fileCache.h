@@ -0,0 +1,75 @@
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include "bool.h"
+
+/**
+* File cache
+*
+* Keeps static files mapped and faulted in between requests, so a hit costs
+* neither open nor mmap nor page faults. Requests still stat the file; an
+* entry whose inode, size or modification time no longer match is replaced.
+* The least recently used files are unmapped to stay within the size bound.
+*
+* Entries are reference counted, so a file replaced or evicted while being
+* sent stays mapped until the request is done.
+*
+*   fileCacheInit    - Sets the limits.
+*   fileCacheSetLimits - Changes them in place (reload), evicting to fit.
+*   fileCacheGet     - Returns the mapped file, loading it on a miss.
+*   fileCacheLoad    - Loads a file ahead of any request (prewarm).
+*   fileCacheData    - The contents of an entry.
+*   fileCacheRelease - Drops the reference taken by fileCacheGet.
+*   fileCacheStats   - Counters for monitoring.
+*/
+
+typedef struct FileCacheConfig_t {
+    size_t maxBytes;        // total size of the mapped files, 0 = cache off
+    size_t maxEntryBytes;   // larger files are mapped per request
+} FileCacheConfig;
+
+typedef struct FileCacheStats_t {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t bytes;
+    size_t entries;
+} FileCacheStats;
+
+typedef struct FileCacheEntry_t *FileCacheEntry;
+
+int fileCacheInit(const FileCacheConfig *config);
+
+/**
+* fileCacheSetLimits: Applies new limits to a running cache. Files over the
+*   new entry bound go, then the least recently used until the rest fits;
+*   requests still sending them keep their mappings until done.
+* @return 0 on success, -1 if a cache that was off could not be turned on
+*/
+int fileCacheSetLimits(const FileCacheConfig *config);
+
+/**
+* fileCacheGet: The mapped contents of path, whose current stat is sbuf.
+* @param loaded - Set to true when this call mapped the file into the cache,
+*   false when it was there already.
+* @return the entry, NULL when the file is not cached (too large, empty,
+*   cache off or unreadable): the caller maps it itself
+*/
+FileCacheEntry fileCacheGet(const char *path, const struct stat *sbuf, bool *loaded);
+
+/**
+* fileCacheLoad: Maps path and faults it in unless it is cached already.
+* @return 1 when loaded, 0 when already cached, -1 when it does not fit (the
+*   cache is full or the file too large) or cannot be read
+*/
+int fileCacheLoad(const char *path);
+
+const char *fileCacheData(FileCacheEntry entry, size_t *len);
+
+void fileCacheRelease(FileCacheEntry entry);
+
+void fileCacheStats(FileCacheStats *stats);
+
+#endif // FILE_CACHE_H_
@@ -0,0 +1,635 @@
+#include "hpack.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct HpackCode_t
+{
+    unsigned int code;
+    unsigned char bits;
+} HpackCode;
+
+/* RFC 7541 Appendix B, indexed by symbol; 256 is end-of-string */
+static const HpackCode hpackHuffman[257] =
+{
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+/* RFC 7541 Appendix A */
+static const char *hpackStatic[][2] =
+{
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"},
+    {":status", "200"}, {":status", "204"}, {":status", "206"}, {":status", "304"},
+    {":status", "400"}, {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""},
+    {"accept", ""}, {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""},
+    {"authorization", ""}, {"cache-control", ""}, {"content-disposition", ""},
+    {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""},
+    {"cookie", ""}, {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""},
+    {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""},
+    {"proxy-authenticate", ""}, {"proxy-authorization", ""}, {"range", ""},
+    {"referer", ""}, {"refresh", ""}, {"retry-after", ""}, {"server", ""},
+    {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""},
+    {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""}
+};
+#define HPACK_STATIC_COUNT (sizeof(hpackStatic) / sizeof(hpackStatic[0]))
+
+/* a field costs its lengths plus this much in the table (RFC 7541 4.1) */
+#define HPACK_ENTRY_OVERHEAD 32
+#define HPACK_MAX_CODE_BITS 30
+
+typedef struct HpackField_t
+{
+    char *name;         // name and value share one allocation
+    size_t nameLen;
+    char *value;
+    size_t valueLen;
+} HpackField;
+
+struct HpackTable_t
+{
+    HpackField *ring;   // newest entry at first, older ones after it
+    size_t capacity;    // most entries that can fit in limit
+    size_t first;
+    size_t count;
+    size_t size;        // RFC 7541 size of the entries
+    size_t maxSize;
+    size_t limit;       // maxSize never goes above this
+    bool sizeUpdate;    // encoder: signal maxSize at the start of the next block
+};
+
+/* canonical decoding: codes of one length are consecutive, in symbol order */
+static struct
+{
+    pthread_once_t once;
+    unsigned int firstCode[HPACK_MAX_CODE_BITS + 1];
+    unsigned int count[HPACK_MAX_CODE_BITS + 1];
+    unsigned int offset[HPACK_MAX_CODE_BITS + 1];
+    unsigned short symbols[257];
+} hpackDecoder = {PTHREAD_ONCE_INIT};
+
+static void HpackBuildDecoder(void)
+{
+    unsigned int code = 0, index = 0;
+    for (int bits = 1; bits <= HPACK_MAX_CODE_BITS; bits++)
+    {
+        hpackDecoder.firstCode[bits] = code;
+        hpackDecoder.offset[bits] = index;
+        for (int sym = 0; sym < 257; sym++)
+        {
+            if (hpackHuffman[sym].bits == bits)
+            {
+                hpackDecoder.symbols[index++] = sym;
+                hpackDecoder.count[bits]++;
+            }
+        }
+        code = (code + hpackDecoder.count[bits]) << 1;
+    }
+}
+
+HpackTable hpackTableCreate(size_t maxSize)
+{
+    pthread_once(&hpackDecoder.once, HpackBuildDecoder);
+
+    HpackTable table = calloc(1, sizeof(*table));
+    if (table == NULL)
+    {
+        return NULL;
+    }
+    table->capacity = maxSize / HPACK_ENTRY_OVERHEAD + 1;
+    table->ring = calloc(table->capacity, sizeof(HpackField));
+    if (table->ring == NULL)
+    {
+        free(table);
+        return NULL;
+    }
+    table->maxSize = table->limit = maxSize;
+    return table;
+}
+
+static void HpackEvictOldest(HpackTable table)
+{
+    HpackField *oldest = &table->ring[(table->first + table->count - 1) % table->capacity];
+    table->size -= oldest->nameLen + oldest->valueLen + HPACK_ENTRY_OVERHEAD;
+    free(oldest->name);
+    oldest->name = NULL;
+    table->count--;
+}
+
+void hpackTableDestroy(HpackTable table)
+{
+    if (table == NULL)
+    {
+        return;
+    }
+    while (table->count > 0)
+    {
+        HpackEvictOldest(table);
+    }
+    free(table->ring);
+    free(table);
+}
+
+void hpackSetMaxSize(HpackTable table, size_t maxSize)
+{
+    table->maxSize = maxSize < table->limit ? maxSize : table->limit;
+    while (table->size > table->maxSize)
+    {
+        HpackEvictOldest(table);
+    }
+    table->sizeUpdate = true;
+}
+
+/* Adds a field; one larger than the whole table just empties it */
+static void HpackInsert(HpackTable table, const char *name, size_t nameLen,
+                        const char *value, size_t valueLen)
+{
+    size_t size = nameLen + valueLen + HPACK_ENTRY_OVERHEAD;
+    while (table->count > 0 && table->size + size > table->maxSize)
+    {
+        HpackEvictOldest(table);
+    }
+    if (size > table->maxSize)
+    {
+        return;
+    }
+    char *copy = malloc(nameLen + valueLen + 2);
+    if (copy == NULL)
+    {
+        return;     // the peer's table now differs: later blocks fail to decode
+    }
+    memcpy(copy, name, nameLen);
+    copy[nameLen] = '\0';
+    memcpy(copy + nameLen + 1, value, valueLen);
+    copy[nameLen + 1 + valueLen] = '\0';
+
+    table->first = (table->first + table->capacity - 1) % table->capacity;
+    HpackField *field = &table->ring[table->first];
+    field->name = copy;
+    field->nameLen = nameLen;
+    field->value = copy + nameLen + 1;
+    field->valueLen = valueLen;
+    table->count++;
+    table->size += size;
+}
+
+/**
+* HpackLookup: The field at a 1-based index of the combined address space,
+*   the static table first, then the dynamic one from its newest entry.
+* @return false for an index past both tables
+*/
+static bool HpackLookup(HpackTable table, size_t index, HpackField *field)
+{
+    if (index == 0)
+    {
+        return false;
+    }
+    if (index <= HPACK_STATIC_COUNT)
+    {
+        field->name = (char *)hpackStatic[index - 1][0];
+        field->nameLen = strlen(field->name);
+        field->value = (char *)hpackStatic[index - 1][1];
+        field->valueLen = strlen(field->value);
+        return true;
+    }
+    index -= HPACK_STATIC_COUNT + 1;
+    if (index >= table->count)
+    {
+        return false;
+    }
+    *field = table->ring[(table->first + index) % table->capacity];
+    return true;
+}
+
+/*
+* Decoding
+*/
+
+/* RFC 7541 5.1: an integer in the low prefixBits of the first byte, then 7 bits per byte */
+static int HpackDecodeInt(const unsigned char **in, const unsigned char *end, int prefixBits, size_t *value)
+{
+    size_t max = (1u << prefixBits) - 1;
+    if (*in >= end)
+    {
+        return -1;
+    }
+    *value = *(*in)++ & max;
+    if (*value < max)
+    {
+        return 0;
+    }
+    for (int shift = 0; shift <= 28; shift += 7)
+    {
+        if (*in >= end)
+        {
+            return -1;
+        }
+        unsigned char byte = *(*in)++;
+        *value += (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return 0;
+        }
+    }
+    return -1;      // longer than any length or index we could accept
+}
+
+static int HpackHuffmanDecode(const unsigned char *in, size_t len, char *out, size_t *outLen)
+{
+    unsigned int code = 0;
+    int bits = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            code = (code << 1) | ((in[i] >> bit) & 1);
+            bits++;
+            unsigned int rank = code - hpackDecoder.firstCode[bits];
+            if (rank < hpackDecoder.count[bits])
+            {
+                unsigned short sym = hpackDecoder.symbols[hpackDecoder.offset[bits] + rank];
+                if (sym == 256)
+                {
+                    return -1;      // EOS inside a string is an error
+                }
+                out[n++] = sym;
+                code = 0;
+                bits = 0;
+            }
+            else if (bits == HPACK_MAX_CODE_BITS)
+            {
+                return -1;
+            }
+        }
+    }
+    // padding: fewer than 8 bits, all ones (a prefix of EOS)
+    if (bits > 7 || code != (1u << bits) - 1)
+    {
+        return -1;
+    }
+    *outLen = n;
+    return 0;
+}
+
+/* Reads a string literal into a new allocation, NUL terminated */
+static int HpackDecodeString(const unsigned char **in, const unsigned char *end, char **out, size_t *outLen)
+{
+    size_t len;
+    bool huffman;
+
+    if (*in >= end)
+    {
+        return -1;
+    }
+    huffman = (**in & 0x80) != 0;
+    if (HpackDecodeInt(in, end, 7, &len) < 0 || len > (size_t)(end - *in))
+    {
+        return -1;
+    }
+    // the shortest code is 5 bits, so a Huffman string grows by at most 8/5
+    *out = malloc(huffman ? len * 8 / 5 + 1 : len + 1);
+    if (*out == NULL)
+    {
+        return -1;
+    }
+    if (huffman)
+    {
+        if (HpackHuffmanDecode(*in, len, *out, outLen) < 0)
+        {
+            free(*out);
+            return -1;
+        }
+    }
+    else
+    {
+        memcpy(*out, *in, len);
+        *outLen = len;
+    }
+    (*out)[*outLen] = '\0';
+    *in += len;
+    return 0;
+}
+
+int hpackDecode(HpackTable table, const unsigned char *in, size_t len, HpackFieldFn fn, void *arg)
+{
+    const unsigned char *end = in + len;
+    bool fieldSeen = false;
+
+    while (in < end)
+    {
+        unsigned char first = *in;
+        size_t index;
+        HpackField field;
+        int rc;
+
+        if (first & 0x80)
+        {
+            // indexed field
+            if (HpackDecodeInt(&in, end, 7, &index) < 0 || !HpackLookup(table, index, &field))
+            {
+                return -1;
+            }
+            if ((rc = fn(arg, field.name, field.nameLen, field.value, field.valueLen)) != 0)
+            {
+                return rc;
+            }
+            fieldSeen = true;
+            continue;
+        }
+
+        if ((first & 0xe0) == 0x20)
+        {
+            // dynamic table size update, only before the first field
+            if (fieldSeen || HpackDecodeInt(&in, end, 5, &index) < 0 || index > table->limit)
+            {
+                return -1;
+            }
+            hpackSetMaxSize(table, index);
+            table->sizeUpdate = false;
+            continue;
+        }
+
+        // literal: with incremental indexing (01), without (0000) or never indexed (0001)
+        bool insert = (first & 0xc0) == 0x40;
+        char *name = NULL, *value = NULL;
+        size_t nameLen, valueLen;
+        if (HpackDecodeInt(&in, end, insert ? 6 : 4, &index) < 0)
+        {
+            return -1;
+        }
+        if (index != 0)
+        {
+            if (!HpackLookup(table, index, &field) || (name = strdup(field.name)) == NULL)
+            {
+                return -1;
+            }
+            nameLen = field.nameLen;
+        }
+        else if (HpackDecodeString(&in, end, &name, &nameLen) < 0)
+        {
+            return -1;
+        }
+        if (HpackDecodeString(&in, end, &value, &valueLen) < 0)
+        {
+            free(name);
+            return -1;
+        }
+        if (insert)
+        {
+            HpackInsert(table, name, nameLen, value, valueLen);
+        }
+        rc = fn(arg, name, nameLen, value, valueLen);
+        free(name);
+        free(value);
+        if (rc != 0)
+        {
+            return rc;
+        }
+        fieldSeen = true;
+    }
+    return 0;
+}
+
+/*
+* Encoding
+*/
+
+static size_t HpackEncodeInt(unsigned char *out, size_t size, unsigned char flags, int prefixBits, size_t value)
+{
+    size_t max = (1u << prefixBits) - 1, n = 0;
+    if (size == 0)
+    {
+        return 0;
+    }
+    if (value < max)
+    {
+        out[n++] = flags | value;
+        return n;
+    }
+    out[n++] = flags | max;
+    value -= max;
+    while (value >= 0x80)
+    {
+        if (n == size)
+        {
+            return 0;
+        }
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    if (n == size)
+    {
+        return 0;
+    }
+    out[n++] = value;
+    return n;
+}
+
+static size_t HpackHuffmanLength(const char *s, size_t len)
+{
+    size_t bits = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        bits += hpackHuffman[(unsigned char)s[i]].bits;
+    }
+    return (bits + 7) / 8;
+}
+
+static size_t HpackEncodeString(unsigned char *out, size_t size, const char *s)
+{
+    size_t len = strlen(s), huffLen = HpackHuffmanLength(s, len);
+    bool huffman = huffLen < len;
+    size_t n = HpackEncodeInt(out, size, huffman ? 0x80 : 0, 7, huffman ? huffLen : len);
+
+    if (n == 0 || size - n < (huffman ? huffLen : len))
+    {
+        return 0;
+    }
+    if (!huffman)
+    {
+        memcpy(out + n, s, len);
+        return n + len;
+    }
+
+    unsigned long long pending = 0;   // bits not yet written, right aligned
+    int bits = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        HpackCode code = hpackHuffman[(unsigned char)s[i]];
+        pending = (pending << code.bits) | code.code;
+        bits += code.bits;
+        while (bits >= 8)
+        {
+            bits -= 8;
+            out[n++] = pending >> bits;
+        }
+    }
+    if (bits > 0)
+    {
+        // pad with the most significant bits of EOS, all ones
+        out[n++] = (pending << (8 - bits)) | ((1u << (8 - bits)) - 1);
+    }
+    return n;
+}
+
+/* index of name (and value, when fullMatch is set) in either table, 0 if absent */
+static size_t HpackFind(HpackTable table, const char *name, const char *value, bool *fullMatch)
+{
+    size_t nameIndex = 0;
+    for (size_t i = 0; i < HPACK_STATIC_COUNT; i++)
+    {
+        if (!strcmp(hpackStatic[i][0], name))
+        {
+            if (!strcmp(hpackStatic[i][1], value))
+            {
+                *fullMatch = true;
+                return i + 1;
+            }
+            if (nameIndex == 0)
+            {
+                nameIndex = i + 1;
+            }
+        }
+    }
+    for (size_t i = 0; i < table->count; i++)
+    {
+        HpackField *field = &table->ring[(table->first + i) % table->capacity];
+        if (!strcmp(field->name, name))
+        {
+            if (!strcmp(field->value, value))
+            {
+                *fullMatch = true;
+                return HPACK_STATIC_COUNT + 1 + i;
+            }
+            if (nameIndex == 0)
+            {
+                nameIndex = HPACK_STATIC_COUNT + 1 + i;
+            }
+        }
+    }
+    *fullMatch = false;
+    return nameIndex;
+}
+
+size_t hpackEncode(HpackTable table, unsigned char *out, size_t size,
+                   const char *name, const char *value, bool index)
+{
+    size_t n = 0, written;
+    bool fullMatch;
+
+    if (table->sizeUpdate)
+    {
+        if ((n = HpackEncodeInt(out, size, 0x20, 5, table->maxSize)) == 0)
+        {
+            return 0;
+        }
+    }
+
+    size_t found = HpackFind(table, name, value, &fullMatch);
+    if (fullMatch)
+    {
+        if ((written = HpackEncodeInt(out + n, size - n, 0x80, 7, found)) == 0)
+        {
+            return 0;
+        }
+        n += written;
+    }
+    else
+    {
+        // with incremental indexing (01) or without indexing (0000)
+        if ((written = HpackEncodeInt(out + n, size - n, index ? 0x40 : 0, index ? 6 : 4, found)) == 0)
+        {
+            return 0;
+        }
+        n += written;
+        if (found == 0)
+        {
+            if ((written = HpackEncodeString(out + n, size - n, name)) == 0)
+            {
+                return 0;
+            }
+            n += written;
+        }
+        if ((written = HpackEncodeString(out + n, size - n, value)) == 0)
+        {
+            return 0;
+        }
+        n += written;
+        if (index)
+        {
+            HpackInsert(table, name, strlen(name), value, strlen(value));
+        }
+    }
+    table->sizeUpdate = false;
+    return n;
+}
@@ -0,0 +1,60 @@
+#ifndef HPACK_H_
+#define HPACK_H_
+
+#include <stddef.h>
+#include "bool.h"
+
+/**
+* HPACK (RFC 7541)
+*
+* Header compression for HTTP/2. Each direction of a connection keeps its own
+* dynamic table of recently sent fields, so a header repeated on later
+* requests of the connection shrinks to a single byte. String literals are
+* Huffman coded whenever that is shorter.
+*
+*   hpackTableCreate  - Creates an (empty) dynamic table.
+*   hpackTableDestroy - Frees a table.
+*   hpackSetMaxSize   - Changes the table size limit (the peer's
+*                       SETTINGS_HEADER_TABLE_SIZE, for an encoding table).
+*   hpackDecode       - Decodes a header block, field by field.
+*   hpackEncode       - Appends one field to a header block.
+*/
+
+/** Default size of the dynamic table, and the largest one the decoder accepts */
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+
+typedef struct HpackTable_t *HpackTable;
+
+/**
+* Receives each decoded field. Names and values are not NUL terminated.
+* @return 0 to go on, anything else stops hpackDecode, which returns it
+*/
+typedef int (*HpackFieldFn)(void *arg, const char *name, size_t nameLen,
+                            const char *value, size_t valueLen);
+
+HpackTable hpackTableCreate(size_t maxSize);
+void hpackTableDestroy(HpackTable table);
+
+/**
+* hpackSetMaxSize: Lowers or raises the limit, evicting as needed. For an
+*   encoding table the change is signalled at the start of the next block.
+*/
+void hpackSetMaxSize(HpackTable table, size_t maxSize);
+
+/**
+* hpackDecode: Decodes the complete header block in, calling fn per field.
+* @return 0 on success, -1 if the block is malformed (a connection error),
+*   or what fn returned to stop early
+*/
+int hpackDecode(HpackTable table, const unsigned char *in, size_t len, HpackFieldFn fn, void *arg);
+
+/**
+* hpackEncode: Appends name: value to the header block at out. The name must
+*   be lower case. With index set the field goes into the dynamic table, for
+*   fields likely to repeat on the connection.
+* @return the bytes written, 0 if they do not fit in size
+*/
+size_t hpackEncode(HpackTable table, unsigned char *out, size_t size,
+                   const char *name, const char *value, bool index);
+
+#endif // HPACK_H_
@@ -0,0 +1,1669 @@
+#define _GNU_SOURCE
+#include "http2.h"
+#include "hpack.h"
+#include "rateLimit.h"
+#include "request.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* RFC 7540 frame types, flags, settings and error codes */
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+#define H2_END_STREAM 0x1
+#define H2_ACK 0x1
+#define H2_END_HEADERS 0x4
+#define H2_PADDED 0x8
+#define H2_PRIORITY_FLAG 0x20
+
+#define H2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_INTERNAL_ERROR 0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_STREAM_CLOSED 0x5
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_CANCEL 0x8
+#define H2_COMPRESSION_ERROR 0x9
+#define H2_ENHANCE_YOUR_CALM 0xb
+
+#define H2_FRAME_HEADER 9
+#define H2_DEFAULT_FRAME 16384          // largest frame either side starts with
+#define H2_DEFAULT_WINDOW 65535
+#define H2_MAX_WINDOW 0x7fffffffLL
+#define H2_CONNECTION_WINDOW (1 << 24)  // what we let a client send across all streams
+#define H2_MAX_HEADER_BLOCK (64 * 1024) // HEADERS plus CONTINUATION
+#define H2_MAX_RESPONSE_HEAD 16384      // a worker's response head
+#define H2_OUT_HIGH (256 * 1024)        // stop reading responses above this much unsent
+#define H2_OUT_LOW (64 * 1024)          // and start again below this
+
+static const char h2Preface[] = "\r\nSM\r\n\r\n";   // what follows "PRI * HTTP/2.0\r\n"
+
+typedef struct H2Conn_t H2Conn;
+
+/* a client address, IPv4 or IPv6 */
+typedef union H2Peer_t
+{
+    struct sockaddr sa;
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+} H2Peer;
+
+/* what an epoll event points at */
+typedef struct H2Source_t
+{
+    int fd;
+    bool isStream;
+    bool dead;          // closed, freed after the current batch of events
+    unsigned int watched; // events registered with epoll, 0 = not registered
+} H2Source;
+
+typedef struct H2Buffer_t
+{
+    unsigned char *data;
+    size_t len;
+    size_t size;
+} H2Buffer;
+
+typedef struct H2Stream_t
+{
+    H2Source source;        // our end of the socketpair to the worker
+    H2Conn *conn;
+    struct H2Stream_t *next;
+    unsigned int id;
+    long long sendWindow;   // how much DATA we may still send
+    long long recvWindow;   // how much DATA the client may still send
+    size_t uncredited;      // body bytes passed on and not yet returned to the window
+    bool chunked;           // the request body is chunk framed for the worker
+    bool requestDone;       // END_STREAM received
+    bool workerGone;        // the worker stopped reading the request
+    int workerFd;           // the worker's end while the stream waits its turn, -1 once queued
+    bool inWorker;          // counted in conn->working
+    time_t stalledSince;    // when the response last stopped moving, 0 while it moves
+    H2Buffer toWorker;      // request bytes not yet written to the worker
+    char head[H2_MAX_RESPONSE_HEAD];
+    size_t headLen;
+    bool headDone;          // HEADERS sent, the rest is body
+    unsigned char body[H2_DEFAULT_FRAME];
+    size_t bodyLen;         // response body read and not yet sent
+    bool workerEof;
+    bool paused;            // not reading the response: no window or output room
+} H2Stream;
+
+struct H2Conn_t
+{
+    H2Source source;        // the client socket
+    H2Peer peer;            // its address, which its streams are logged and limited by
+    socklen_t peerLen;
+    H2Conn *next;
+    H2Conn *prev;
+    H2Buffer in;            // received, not yet parsed
+    H2Buffer out;           // frames not yet sent
+    size_t outSent;
+    size_t prefaceLeft;     // bytes of h2Preface still expected
+    HpackTable decoder;
+    HpackTable encoder;
+    long long sendWindow;
+    long long recvUsed;     // DATA received since the window was last topped up
+    long long peerInitialWindow;
+    size_t peerMaxFrame;
+    unsigned int lastStreamId;
+    H2Stream *streams;
+    int streamCount;
+    int working;            // streams queued on the workers and not yet answered
+    H2Buffer block;         // header block being assembled from CONTINUATION frames
+    unsigned int blockStream;
+    bool blockEndStream;
+    bool goaway;            // no new streams, close once the last one is done
+    bool closing;           // close as soon as out is sent
+    time_t lastActive;
+};
+
+/* a stream's request while its header block is decoded */
+typedef struct H2Request_t
+{
+    char method[16];
+    char path[8192];
+    char authority[1024];
+    bool hasContentLength;
+    bool malformed;
+    H2Buffer head;          // the HTTP/1 header lines
+    size_t plainBytes;
+} H2Request;
+
+static struct
+{
+    Http2Config config;
+    ThreadPool pool;
+    bool enabled;
+    int epollFd;
+    H2Source wake;          // eventfd: adoptions queued, or shutdown
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    H2Conn *adopted;        // handed over, not yet picked up by the thread (under mutex)
+    bool stop;
+    H2Conn *conns;          // owned by the thread from here on
+    H2Source **graveyard;
+    size_t graveCount;
+    size_t graveSize;
+    Http2Stats stats;       // updated atomically
+    H2Peer *peers;          // by the worker's fd of a stream: the client it came from
+    size_t peerCount;
+} http2 = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+/*
+* Buffers and epoll
+*/
+
+static int H2Append(H2Buffer *buffer, const void *data, size_t len)
+{
+    if (buffer->len + len > buffer->size)
+    {
+        size_t size = buffer->size != 0 ? buffer->size : 4096;
+        while (size < buffer->len + len)
+        {
+            size *= 2;
+        }
+        unsigned char *grown = realloc(buffer->data, size);
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->size = size;
+    }
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    return 0;
+}
+
+static void H2Consume(H2Buffer *buffer, size_t len)
+{
+    memmove(buffer->data, buffer->data + len, buffer->len - len);
+    buffer->len -= len;
+}
+
+/* (Re)registers source for events, or takes it out of epoll for 0 */
+static void H2Watch(H2Source *source, unsigned int events)
+{
+    struct epoll_event ev = {.events = events, .data.ptr = source};
+    if (source->watched == events)
+    {
+        return;
+    }
+    if (events == 0)
+    {
+        epoll_ctl(http2.epollFd, EPOLL_CTL_DEL, source->fd, NULL);
+    }
+    else
+    {
+        epoll_ctl(http2.epollFd, source->watched == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, source->fd, &ev);
+    }
+    source->watched = events;
+}
+
+/* Closes source and frees it once the events already returned are handled */
+static void H2Bury(H2Source *source)
+{
+    H2Watch(source, 0);
+    close(source->fd);
+    source->dead = true;
+    if (http2.graveCount == http2.graveSize)
+    {
+        size_t size = http2.graveSize != 0 ? http2.graveSize * 2 : 64;
+        H2Source **grown = realloc(http2.graveyard, size * sizeof(*grown));
+        if (grown == NULL)
+        {
+            return;     // leaked rather than freed under a pending event
+        }
+        http2.graveyard = grown;
+        http2.graveSize = size;
+    }
+    http2.graveyard[http2.graveCount++] = source;
+}
+
+/*
+* Frames
+*/
+
+static void H2Frame(H2Conn *conn, int type, int flags, unsigned int stream, const void *payload, size_t len)
+{
+    unsigned char header[H2_FRAME_HEADER] = {
+        len >> 16, len >> 8, len, type, flags,
+        (stream >> 24) & 0x7f, stream >> 16, stream >> 8, stream
+    };
+    if (H2Append(&conn->out, header, sizeof(header)) < 0 ||
+        H2Append(&conn->out, payload, len) < 0)
+    {
+        conn->closing = true;
+    }
+}
+
+static void H2Put32(unsigned char *p, unsigned int value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static unsigned int H2Get32(const unsigned char *p)
+{
+    return (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void H2WindowUpdate(H2Conn *conn, unsigned int stream, unsigned int increment)
+{
+    unsigned char payload[4];
+    H2Put32(payload, increment);
+    H2Frame(conn, H2_WINDOW_UPDATE, 0, stream, payload, sizeof(payload));
+}
+
+static void H2Reset(H2Conn *conn, unsigned int stream, unsigned int code)
+{
+    unsigned char payload[4];
+    H2Put32(payload, code);
+    H2Frame(conn, H2_RST_STREAM, 0, stream, payload, sizeof(payload));
+}
+
+/* Connection error: GOAWAY, then close once it is sent */
+static void H2GoAway(H2Conn *conn, unsigned int code)
+{
+    unsigned char payload[8];
+    H2Put32(payload, conn->lastStreamId);
+    H2Put32(payload + 4, code);
+    H2Frame(conn, H2_GOAWAY, 0, 0, payload, sizeof(payload));
+    conn->goaway = true;
+    conn->closing = true;
+}
+
+/* Sends a header block as HEADERS and as many CONTINUATION frames as it takes */
+static void H2SendHeaders(H2Conn *conn, unsigned int stream, const unsigned char *block, size_t len, bool endStream)
+{
+    int type = H2_HEADERS;
+    do
+    {
+        size_t part = len < conn->peerMaxFrame ? len : conn->peerMaxFrame;
+        int flags = (part == len ? H2_END_HEADERS : 0) | (type == H2_HEADERS && endStream ? H2_END_STREAM : 0);
+        H2Frame(conn, type, flags, stream, block, part);
+        block += part;
+        len -= part;
+        type = H2_CONTINUATION;
+    } while (len > 0);
+}
+
+/*
+* Streams
+*/
+
+static H2Stream *H2FindStream(H2Conn *conn, unsigned int id)
+{
+    for (H2Stream *stream = conn->streams; stream != NULL; stream = stream->next)
+    {
+        if (stream->id == id)
+        {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+static void H2CloseStream(H2Stream *stream)
+{
+    H2Conn *conn = stream->conn;
+    H2Stream **link = &conn->streams;
+    while (*link != stream)
+    {
+        link = &(*link)->next;
+    }
+    *link = stream->next;
+    conn->streamCount--;
+    if (stream->workerFd >= 0)
+    {
+        rateLimitRelease(stream->workerFd);
+        close(stream->workerFd);
+    }
+    if (stream->inWorker)
+    {
+        // a worker still on it fails its next write once our end is closed
+        conn->working--;
+    }
+    free(stream->toWorker.data);
+    stream->toWorker.data = NULL;
+    H2Bury(&stream->source);
+}
+
+/* Answers a stream without a worker, e.g. when its response is unusable */
+static void H2Respond(H2Stream *stream, int status, bool endStream)
+{
+    unsigned char block[32];
+    char value[8];
+    snprintf(value, sizeof(value), "%d", status);
+    size_t len = hpackEncode(stream->conn->encoder, block, sizeof(block), ":status", value, false);
+    H2SendHeaders(stream->conn, stream->id, block, len, endStream);
+    stream->headDone = true;
+}
+
+static bool H2IndexResponseHeader(const char *name)
+{
+    // values that change from response to response would only churn the table
+    return strcmp(name, "content-length") && strcmp(name, "etag") &&
+           strcmp(name, "last-modified") && strcmp(name, "date") &&
+           strcmp(name, "expires") && strcmp(name, "location") &&
+           strcmp(name, "set-cookie");
+}
+
+/**
+* H2SendResponseHead: Turns the worker's HTTP/1 response head into HEADERS.
+*   Hop-by-hop headers are dropped, names lower cased.
+* @return 0, or -1 if the head is not a response
+*/
+static int H2SendResponseHead(H2Stream *stream, size_t headLen)
+{
+    H2Conn *conn = stream->conn;
+    unsigned char block[H2_MAX_RESPONSE_HEAD + 1024];
+    char *line = stream->head, *end = stream->head + headLen, *next;
+    size_t len = 0, written;
+    char status[4];
+
+    if (strncmp(line, "HTTP/1.", 7) || headLen < 12 || line[8] != ' ')
+    {
+        return -1;
+    }
+    memcpy(status, line + 9, 3);
+    status[3] = '\0';
+    if (status[0] < '1' || status[0] > '5')
+    {
+        return -1;
+    }
+    len += hpackEncode(conn->encoder, block, sizeof(block), ":status", status, true);
+
+    for (line = strstr(line, "\r\n") + 2; line < end; line = next)
+    {
+        char *eol = strstr(line, "\r\n"), *colon, *value;
+        if (eol == NULL || eol == line)
+        {
+            break;
+        }
+        next = eol + 2;
+        *eol = '\0';
+        if ((colon = strchr(line, ':')) == NULL)
+        {
+            continue;
+        }
+        *colon = '\0';
+        for (value = colon + 1; *value == ' ' || *value == '\t'; value++)
+        {
+        }
+        for (char *c = line; *c != '\0'; c++)
+        {
+            *c = tolower((unsigned char)*c);
+        }
+        if (!strcmp(line, "connection") || !strcmp(line, "keep-alive") ||
+            !strcmp(line, "proxy-connection") || !strcmp(line, "transfer-encoding") ||
+            !strcmp(line, "upgrade"))
+        {
+            continue;
+        }
+        written = hpackEncode(conn->encoder, block + len, sizeof(block) - len, line, value, H2IndexResponseHeader(line));
+        if (written == 0)
+        {
+            return -1;
+        }
+        len += written;
+    }
+
+    __atomic_fetch_add(&http2.stats.responseHeaderBytes, len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&http2.stats.responseHeaderPlain, headLen, __ATOMIC_RELAXED);
+    H2SendHeaders(conn, stream->id, block, len, false);
+    stream->headDone = true;
+    return 0;
+}
+
+/* Watches the stream's socket for what it is waiting on */
+static void H2StreamWatch(H2Stream *stream)
+{
+    unsigned int events = 0;
+    if (!stream->paused && !stream->workerEof)
+    {
+        events |= EPOLLIN;
+    }
+    if (stream->toWorker.len > 0)
+    {
+        events |= EPOLLOUT;
+    }
+    H2Watch(&stream->source, events);
+}
+
+/* Writes what it can of the request to the worker */
+static void H2FeedWorker(H2Stream *stream)
+{
+    H2Conn *conn = stream->conn;
+    while (stream->toWorker.len > 0 && !stream->workerGone)
+    {
+        ssize_t n = write(stream->source.fd, stream->toWorker.data, stream->toWorker.len);
+        if (n > 0)
+        {
+            H2Consume(&stream->toWorker, n);
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && errno == EAGAIN)
+        {
+            break;
+        }
+        else
+        {
+            // answered without reading all of the body: drop the rest
+            stream->workerGone = true;
+            stream->toWorker.len = 0;
+        }
+    }
+
+    // the buffer is bounded by the window: top it up once the worker took it all
+    if (stream->toWorker.len == 0 && !stream->requestDone && stream->uncredited > 0)
+    {
+        H2WindowUpdate(conn, stream->id, stream->uncredited);
+        stream->recvWindow += stream->uncredited;
+        stream->uncredited = 0;
+    }
+    if (stream->toWorker.len == 0 && stream->requestDone && !stream->workerGone)
+    {
+        shutdown(stream->source.fd, SHUT_WR);
+    }
+}
+
+/**
+* H2Pump: Moves the worker's response into frames as far as the flow-control
+*   windows and the connection's output room allow. Closes the stream when the
+*   response is complete.
+*/
+static void H2Pump(H2Stream *stream)
+{
+    H2Conn *conn = stream->conn;
+
+    while (!stream->headDone)
+    {
+        ssize_t n = read(stream->source.fd, stream->head + stream->headLen,
+                         sizeof(stream->head) - 1 - stream->headLen);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN)
+        {
+            H2StreamWatch(stream);
+            return;
+        }
+        if (n <= 0)
+        {
+            // the worker closed without a response (shed, or out of resources)
+            H2Respond(stream, 503, true);
+            H2CloseStream(stream);
+            return;
+        }
+        stream->headLen += n;
+        stream->head[stream->headLen] = '\0';
+        char *end = strstr(stream->head, "\r\n\r\n");
+        if (end == NULL)
+        {
+            if (stream->headLen == sizeof(stream->head) - 1)
+            {
+                H2Respond(stream, 502, true);
+                H2CloseStream(stream);
+                return;
+            }
+            continue;
+        }
+        size_t headLen = end + 4 - stream->head;
+        stream->bodyLen = stream->headLen - headLen;
+        memcpy(stream->body, stream->head + headLen, stream->bodyLen);
+        if (H2SendResponseHead(stream, headLen) < 0)
+        {
+            H2Respond(stream, 502, true);
+            H2CloseStream(stream);
+            return;
+        }
+    }
+
+    while (true)
+    {
+        long long room = conn->sendWindow < stream->sendWindow ? conn->sendWindow : stream->sendWindow;
+        if (room > (long long)conn->peerMaxFrame)
+        {
+            room = conn->peerMaxFrame;
+        }
+        if (room > (long long)sizeof(stream->body))
+        {
+            room = sizeof(stream->body);
+        }
+
+        if (stream->bodyLen == 0 && !stream->workerEof)
+        {
+            if (conn->out.len - conn->outSent > H2_OUT_HIGH)
+            {
+                break;
+            }
+            ssize_t n = read(stream->source.fd, stream->body, sizeof(stream->body));
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && errno == EAGAIN)
+            {
+                stream->paused = false;
+                H2StreamWatch(stream);
+                return;
+            }
+            if (n <= 0)
+            {
+                stream->workerEof = true;
+                if (stream->inWorker)
+                {
+                    stream->inWorker = false;
+                    conn->working--;
+                }
+            }
+            else
+            {
+                stream->bodyLen = n;
+            }
+        }
+
+        if (stream->bodyLen == 0 && stream->workerEof)
+        {
+            H2Frame(conn, H2_DATA, H2_END_STREAM, stream->id, NULL, 0);
+            if (!stream->requestDone)
+            {
+                // the response is complete: the rest of the request is not needed
+                H2Reset(conn, stream->id, H2_NO_ERROR);
+            }
+            H2CloseStream(stream);
+            return;
+        }
+        if (room <= 0)
+        {
+            break;
+        }
+        size_t part = stream->bodyLen < (size_t)room ? stream->bodyLen : (size_t)room;
+        H2Frame(conn, H2_DATA, 0, stream->id, stream->body, part);
+        conn->sendWindow -= part;
+        stream->sendWindow -= part;
+        stream->stalledSince = 0;
+        memmove(stream->body, stream->body + part, stream->bodyLen - part);
+        stream->bodyLen -= part;
+    }
+
+    // out of window or output room: wait for WINDOW_UPDATE or the socket to drain
+    stream->paused = true;
+    if (stream->stalledSince == 0)
+    {
+        stream->stalledSince = time(NULL);
+    }
+    H2StreamWatch(stream);
+}
+
+/* Gives the streams waiting for window or output room another go */
+static void H2Resume(H2Conn *conn)
+{
+    H2Stream *stream = conn->streams, *next;
+    for (; stream != NULL && conn->out.len - conn->outSent <= H2_OUT_HIGH; stream = next)
+    {
+        next = stream->next;
+        if (stream->paused && stream->headDone)
+        {
+            H2Pump(stream);
+        }
+    }
+}
+
+/*
+* Requests
+*/
+
+static int H2RequestField(void *arg, const char *name, size_t nameLen, const char *value, size_t valueLen)
+{
+    H2Request *request = arg;
+    char *target = NULL;
+    size_t targetSize = 0;
+
+    request->plainBytes += nameLen + valueLen + 4;
+    // the fields become HTTP/1 lines: nothing may end a line or hide in a name
+    if (memchr(value, '\r', valueLen) || memchr(value, '\n', valueLen) || memchr(value, '\0', valueLen))
+    {
+        request->malformed = true;
+        return 0;
+    }
+    for (size_t i = 0; i < nameLen; i++)
+    {
+        unsigned char c = name[i];
+        if ((c >= 'A' && c <= 'Z') || c <= ' ' || (c == ':' && i > 0) || c == 0x7f)
+        {
+            request->malformed = true;
+            return 0;
+        }
+    }
+
+    if (nameLen > 0 && name[0] == ':')
+    {
+        if (request->head.len > 0)
+        {
+            request->malformed = true;  // pseudo-headers come first
+        }
+        else if (nameLen == 7 && !memcmp(name, ":method", 7))
+        {
+            target = request->method;
+            targetSize = sizeof(request->method);
+        }
+        else if (nameLen == 5 && !memcmp(name, ":path", 5))
+        {
+            target = request->path;
+            targetSize = sizeof(request->path);
+        }
+        else if (nameLen == 10 && !memcmp(name, ":authority", 10))
+        {
+            target = request->authority;
+            targetSize = sizeof(request->authority);
+        }
+        else if (!(nameLen == 7 && !memcmp(name, ":scheme", 7)))
+        {
+            request->malformed = true;
+        }
+        if (target != NULL)
+        {
+            if (valueLen >= targetSize || target[0] != '\0')
+            {
+                request->malformed = true;
+                return 0;
+            }
+            memcpy(target, value, valueLen);
+            target[valueLen] = '\0';
+        }
+        return 0;
+    }
+
+    // connection-specific headers have no place in HTTP/2 (RFC 7540 8.1.2.2)
+    if ((nameLen == 10 && !memcmp(name, "connection", 10)) ||
+        (nameLen == 10 && !memcmp(name, "keep-alive", 10)) ||
+        (nameLen == 16 && !memcmp(name, "proxy-connection", 16)) ||
+        (nameLen == 17 && !memcmp(name, "transfer-encoding", 17)) ||
+        (nameLen == 7 && !memcmp(name, "upgrade", 7)))
+    {
+        request->malformed = true;
+        return 0;
+    }
+    // te: trailers is allowed but means nothing here; expect would make the
+    // worker answer 100 Continue into the stream
+    if ((nameLen == 2 && !memcmp(name, "te", 2)) || (nameLen == 6 && !memcmp(name, "expect", 6)) ||
+        (nameLen == 4 && !memcmp(name, "host", 4) && request->authority[0] != '\0'))
+    {
+        return 0;
+    }
+    if (nameLen == 14 && !memcmp(name, "content-length", 14))
+    {
+        request->hasContentLength = true;
+    }
+    if (request->head.len + nameLen + valueLen + 4 > H2_MAX_HEADER_BLOCK ||
+        H2Append(&request->head, name, nameLen) < 0 || H2Append(&request->head, ": ", 2) < 0 ||
+        H2Append(&request->head, value, valueLen) < 0 || H2Append(&request->head, "\r\n", 2) < 0)
+    {
+        request->malformed = true;
+    }
+    return 0;
+}
+
+/**
+* H2Dispatch: Queues the connection's waiting streams on the worker pool,
+*   oldest first, while fewer than maxWorkerStreams of them are there.
+*/
+static void H2Dispatch(H2Conn *conn)
+{
+    int cap = http2.config.maxWorkerStreams;
+    if (cap == 0)
+    {
+        cap = ThreadPoolSize(http2.pool) / 4 > 0 ? ThreadPoolSize(http2.pool) / 4 : 1;
+    }
+    while (conn->working < cap)
+    {
+        H2Stream *oldest = NULL;
+        for (H2Stream *stream = conn->streams; stream != NULL; stream = stream->next)
+        {
+            if (stream->workerFd >= 0 && (oldest == NULL || stream->id < oldest->id))
+            {
+                oldest = stream;
+            }
+        }
+        if (oldest == NULL)
+        {
+            return;
+        }
+        int fd = oldest->workerFd;
+        oldest->workerFd = -1;
+        oldest->inWorker = true;
+        conn->working++;
+        ThreadPoolAddRequest(http2.pool, fd);
+    }
+}
+
+/* Creates the stream for a request and queues it on the worker pool */
+static void H2StartStream(H2Conn *conn, unsigned int id, H2Request *request, bool endStream)
+{
+    char line[sizeof(request->path) + sizeof(request->authority) + 64];
+    int pair[2];
+
+    if (request->method[0] == '\0' || request->path[0] != '/' || strpbrk(request->path, " \t") != NULL)
+    {
+        H2Reset(conn, id, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    H2Stream *stream = calloc(1, sizeof(*stream));
+    if (stream == NULL || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+    {
+        free(stream);
+        H2Reset(conn, id, H2_REFUSED_STREAM);
+        return;
+    }
+    fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+    stream->source.fd = pair[0];
+    stream->source.isStream = true;
+    stream->workerFd = pair[1];
+    if ((size_t)pair[1] < http2.peerCount)
+    {
+        http2.peers[pair[1]] = conn->peer;
+    }
+    stream->conn = conn;
+    stream->id = id;
+    stream->sendWindow = conn->peerInitialWindow;
+    stream->recvWindow = http2.config.streamWindow;
+    stream->requestDone = endStream;
+    stream->next = conn->streams;
+    conn->streams = stream;
+    conn->streamCount++;
+
+    // the worker sees an HTTP/1 request; the version is what it logs and what
+    // CGI programs get as SERVER_PROTOCOL
+    snprintf(line, sizeof(line), "%s %s HTTP/2.0\r\n", request->method, request->path);
+    H2Append(&stream->toWorker, line, strlen(line));
+    if (request->authority[0] != '\0')
+    {
+        snprintf(line, sizeof(line), "Host: %s\r\n", request->authority);
+        H2Append(&stream->toWorker, line, strlen(line));
+    }
+    H2Append(&stream->toWorker, request->head.data, request->head.len);
+    if (!request->hasContentLength)
+    {
+        // a body of unknown length is relayed chunked, none at all declared empty
+        stream->chunked = !endStream;
+        H2Append(&stream->toWorker, endStream ? "Content-Length: 0\r\n" : "Transfer-Encoding: chunked\r\n",
+                 endStream ? 19 : 28);
+    }
+    if (H2Append(&stream->toWorker, "\r\n", 2) < 0)
+    {
+        H2Reset(conn, id, H2_INTERNAL_ERROR);
+        H2CloseStream(stream);
+        return;
+    }
+
+    __atomic_fetch_add(&http2.stats.streams, 1, __ATOMIC_RELAXED);
+    // a stream is charged to the client like a connection; turned away, it
+    // gets the 429 an HTTP/1 client would, relayed as its response
+    if (rateLimitAdmit(stream->workerFd, &conn->peer.sa, conn->peerLen) != RATE_LIMIT_ADMIT)
+    {
+        requestReject(stream->workerFd, 429);
+        close(stream->workerFd);
+        stream->workerFd = -1;
+    }
+    H2Dispatch(conn);
+    H2FeedWorker(stream);
+    H2Pump(stream);
+}
+
+/* A complete header block arrived: a new request, or trailers */
+static void H2HeaderBlockDone(H2Conn *conn)
+{
+    unsigned int id = conn->blockStream;
+    H2Stream *stream = H2FindStream(conn, id);
+    H2Request *request = calloc(1, sizeof(*request));
+
+    conn->blockStream = 0;
+    if (request == NULL)
+    {
+        H2GoAway(conn, H2_INTERNAL_ERROR);
+        return;
+    }
+    // decoded even when the stream is refused, to keep the tables in step
+    int rc = hpackDecode(conn->decoder, conn->block.data, conn->block.len, H2RequestField, request);
+    __atomic_fetch_add(&http2.stats.requestHeaderBytes, conn->block.len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&http2.stats.requestHeaderPlain, request->plainBytes, __ATOMIC_RELAXED);
+    conn->block.len = 0;
+
+    if (rc < 0)
+    {
+        H2GoAway(conn, H2_COMPRESSION_ERROR);
+    }
+    else if (stream != NULL)
+    {
+        // trailers: dropped, they only end the body
+        if (!conn->blockEndStream)
+        {
+            H2GoAway(conn, H2_PROTOCOL_ERROR);
+        }
+        else if (!stream->requestDone)
+        {
+            stream->requestDone = true;
+            if (stream->chunked)
+            {
+                H2Append(&stream->toWorker, "0\r\n\r\n", 5);
+            }
+            H2FeedWorker(stream);
+            H2StreamWatch(stream);
+        }
+    }
+    else if (id <= conn->lastStreamId)
+    {
+        H2Reset(conn, id, H2_STREAM_CLOSED);
+    }
+    else
+    {
+        conn->lastStreamId = id;
+        if (conn->goaway || conn->streamCount >= http2.config.maxStreams)
+        {
+            H2Reset(conn, id, H2_REFUSED_STREAM);
+        }
+        else if (request->malformed)
+        {
+            H2Reset(conn, id, H2_PROTOCOL_ERROR);
+        }
+        else
+        {
+            H2StartStream(conn, id, request, conn->blockEndStream);
+        }
+    }
+    free(request->head.data);
+    free(request);
+}
+
+/*
+* Frame handlers. Each gets the payload without padding where that applies.
+*/
+
+static void H2OnData(H2Conn *conn, unsigned int id, int flags, const unsigned char *data, size_t len, size_t frameLen)
+{
+    H2Stream *stream = H2FindStream(conn, id);
+    char size[24];
+
+    // the connection window is topped up as data arrives; streams bound the buffering
+    conn->recvUsed += frameLen;
+    if (conn->recvUsed >= H2_CONNECTION_WINDOW / 2)
+    {
+        H2WindowUpdate(conn, 0, conn->recvUsed);
+        conn->recvUsed = 0;
+    }
+
+    if (stream == NULL || stream->requestDone)
+    {
+        if (id > conn->lastStreamId)
+        {
+            H2GoAway(conn, H2_PROTOCOL_ERROR);
+        }
+        else
+        {
+            H2Reset(conn, id, H2_STREAM_CLOSED);
+        }
+        return;
+    }
+    stream->recvWindow -= frameLen;
+    if (stream->recvWindow < 0)
+    {
+        H2Reset(conn, id, H2_FLOW_CONTROL_ERROR);
+        H2CloseStream(stream);
+        return;
+    }
+    stream->uncredited += frameLen;
+
+    if (!stream->workerGone && len > 0)
+    {
+        if (stream->chunked)
+        {
+            snprintf(size, sizeof(size), "%zx\r\n", len);
+            H2Append(&stream->toWorker, size, strlen(size));
+        }
+        H2Append(&stream->toWorker, data, len);
+        if (stream->chunked)
+        {
+            H2Append(&stream->toWorker, "\r\n", 2);
+        }
+    }
+    if (flags & H2_END_STREAM)
+    {
+        stream->requestDone = true;
+        if (stream->chunked && !stream->workerGone)
+        {
+            H2Append(&stream->toWorker, "0\r\n\r\n", 5);
+        }
+    }
+    H2FeedWorker(stream);
+    H2StreamWatch(stream);
+}
+
+static void H2OnSettings(H2Conn *conn, int flags, const unsigned char *data, size_t len)
+{
+    if (flags & H2_ACK)
+    {
+        if (len != 0)
+        {
+            H2GoAway(conn, H2_FRAME_SIZE_ERROR);
+        }
+        return;
+    }
+    if (len % 6 != 0)
+    {
+        H2GoAway(conn, H2_FRAME_SIZE_ERROR);
+        return;
+    }
+    for (size_t i = 0; i < len; i += 6)
+    {
+        unsigned int id = data[i] << 8 | data[i + 1];
+        unsigned int value = H2Get32(data + i + 2);
+        switch (id)
+        {
+        case H2_SETTINGS_HEADER_TABLE_SIZE:
+            hpackSetMaxSize(conn->encoder, value);
+            break;
+        case H2_SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+            {
+                H2GoAway(conn, H2_PROTOCOL_ERROR);
+                return;
+            }
+            break;
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+        {
+            if (value > H2_MAX_WINDOW)
+            {
+                H2GoAway(conn, H2_FLOW_CONTROL_ERROR);
+                return;
+            }
+            long long delta = (long long)value - conn->peerInitialWindow;
+            for (H2Stream *stream = conn->streams; stream != NULL; stream = stream->next)
+            {
+                stream->sendWindow += delta;
+            }
+            conn->peerInitialWindow = value;
+            break;
+        }
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            if (value < H2_DEFAULT_FRAME || value > 0xffffff)
+            {
+                H2GoAway(conn, H2_PROTOCOL_ERROR);
+                return;
+            }
+            conn->peerMaxFrame = value;
+            break;
+        default:
+            break;  // unknown settings are ignored
+        }
+    }
+    H2Frame(conn, H2_SETTINGS, H2_ACK, 0, NULL, 0);
+    H2Resume(conn);
+}
+
+static void H2OnWindowUpdate(H2Conn *conn, unsigned int id, const unsigned char *data, size_t len)
+{
+    if (len != 4)
+    {
+        H2GoAway(conn, H2_FRAME_SIZE_ERROR);
+        return;
+    }
+    unsigned int increment = H2Get32(data) & 0x7fffffff;
+    if (id == 0)
+    {
+        if (increment == 0 || conn->sendWindow + increment > H2_MAX_WINDOW)
+        {
+            H2GoAway(conn, increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+            return;
+        }
+        conn->sendWindow += increment;
+        H2Resume(conn);
+        return;
+    }
+
+    H2Stream *stream = H2FindStream(conn, id);
+    if (stream == NULL)
+    {
+        return;     // for a stream that is already closed
+    }
+    if (increment == 0 || stream->sendWindow + increment > H2_MAX_WINDOW)
+    {
+        H2Reset(conn, id, increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+        H2CloseStream(stream);
+        return;
+    }
+    stream->sendWindow += increment;
+    if (stream->paused && stream->headDone)
+    {
+        H2Pump(stream);
+    }
+}
+
+/* Handles one complete frame */
+static void H2OnFrame(H2Conn *conn, int type, int flags, unsigned int id, const unsigned char *payload, size_t len)
+{
+    size_t frameLen = len;
+
+    // a header block must not be interleaved with any other frame
+    if (conn->blockStream != 0 && (type != H2_CONTINUATION || id != conn->blockStream))
+    {
+        H2GoAway(conn, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    if ((type == H2_DATA || type == H2_HEADERS) && (flags & H2_PADDED))
+    {
+        if (len < 1 || payload[0] >= len)
+        {
+            H2GoAway(conn, H2_PROTOCOL_ERROR);
+            return;
+        }
+        len -= 1 + payload[0];
+        payload++;
+    }
+
+    switch (type)
+    {
+    case H2_DATA:
+        if (id == 0)
+        {
+            H2GoAway(conn, H2_PROTOCOL_ERROR);
+            return;
+        }
+        H2OnData(conn, id, flags, payload, len, frameLen);
+        break;
+
+    case H2_HEADERS:
+        if (id == 0 || !(id & 1))
+        {
+            H2GoAway(conn, H2_PROTOCOL_ERROR);
+            return;
+        }
+        if (flags & H2_PRIORITY_FLAG)
+        {
+            if (len < 5)
+            {
+                H2GoAway(conn, H2_FRAME_SIZE_ERROR);
+                return;
+            }
+            payload += 5;
+            len -= 5;
+        }
+        conn->blockStream = id;
+        conn->blockEndStream = (flags & H2_END_STREAM) != 0;
+        conn->block.len = 0;
+        /* fall through */
+    case H2_CONTINUATION:
+        if (conn->blockStream == 0)
+        {
+            H2GoAway(conn, H2_PROTOCOL_ERROR);
+            return;
+        }
+        if (conn->block.len + len > H2_MAX_HEADER_BLOCK || H2Append(&conn->block, payload, len) < 0)
+        {
+            H2GoAway(conn, H2_ENHANCE_YOUR_CALM);
+            return;
+        }
+        if (flags & H2_END_HEADERS)
+        {
+            H2HeaderBlockDone(conn);
+        }
+        break;
+
+    case H2_PRIORITY:
+        if (len != 5)
+        {
+            H2GoAway(conn, H2_FRAME_SIZE_ERROR);
+        }
+        break;  // streams are served as workers get to them
+
+    case H2_RST_STREAM:
+    {
+        if (id == 0 || len != 4)
+        {
+            H2GoAway(conn, id == 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        H2Stream *stream = H2FindStream(conn, id);
+        if (stream != NULL)
+        {
+            H2CloseStream(stream);  // the worker's next write fails and it moves on
+        }
+        break;
+    }
+
+    case H2_SETTINGS:
+        if (id != 0)
+        {
+            H2GoAway(conn, H2_PROTOCOL_ERROR);
+            return;
+        }
+        H2OnSettings(conn, flags, payload, len);
+        break;
+
+    case H2_PUSH_PROMISE:
+        H2GoAway(conn, H2_PROTOCOL_ERROR);  // clients do not push
+        break;
+
+    case H2_PING:
+        if (id != 0 || len != 8)
+        {
+            H2GoAway(conn, id != 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        if (!(flags & H2_ACK))
+        {
+            H2Frame(conn, H2_PING, H2_ACK, 0, payload, 8);
+        }
+        break;
+
+    case H2_GOAWAY:
+        conn->goaway = true;    // finish what is open, take nothing new
+        break;
+
+    case H2_WINDOW_UPDATE:
+        H2OnWindowUpdate(conn, id, payload, len);
+        break;
+
+    default:
+        break;  // unknown frame types are ignored
+    }
+}
+
+/*
+* Connections
+*/
+
+static void H2CloseConn(H2Conn *conn)
+{
+    while (conn->streams != NULL)
+    {
+        H2CloseStream(conn->streams);
+    }
+    if (conn->prev != NULL)
+    {
+        conn->prev->next = conn->next;
+    }
+    else
+    {
+        http2.conns = conn->next;
+    }
+    if (conn->next != NULL)
+    {
+        conn->next->prev = conn->prev;
+    }
+    hpackTableDestroy(conn->decoder);
+    hpackTableDestroy(conn->encoder);
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn->block.data);
+    conn->in.data = conn->out.data = conn->block.data = NULL;
+    rateLimitRelease(conn->source.fd);
+    H2Bury(&conn->source);
+}
+
+/* Parses every complete frame in the input buffer */
+static void H2Process(H2Conn *conn)
+{
+    size_t used = 0;
+
+    if (conn->prefaceLeft > 0)
+    {
+        size_t n = conn->in.len < conn->prefaceLeft ? conn->in.len : conn->prefaceLeft;
+        size_t offset = sizeof(h2Preface) - 1 - conn->prefaceLeft;
+        if (memcmp(conn->in.data, h2Preface + offset, n))
+        {
+            conn->closing = true;
+            return;
+        }
+        conn->prefaceLeft -= n;
+        used = n;
+    }
+
+    while (!conn->closing && conn->prefaceLeft == 0 && conn->in.len - used >= H2_FRAME_HEADER)
+    {
+        const unsigned char *frame = conn->in.data + used;
+        size_t len = frame[0] << 16 | frame[1] << 8 | frame[2];
+        if (len > H2_DEFAULT_FRAME)
+        {
+            H2GoAway(conn, H2_FRAME_SIZE_ERROR);
+            break;
+        }
+        if (conn->in.len - used < H2_FRAME_HEADER + len)
+        {
+            break;
+        }
+        H2OnFrame(conn, frame[3], frame[4], H2Get32(frame + 5) & 0x7fffffff, frame + H2_FRAME_HEADER, len);
+        used += H2_FRAME_HEADER + len;
+    }
+    H2Consume(&conn->in, used);
+}
+
+/* Sends what the socket takes; closes the connection once it is done with */
+static int H2Send(H2Conn *conn)
+{
+    while (conn->outSent < conn->out.len)
+    {
+        ssize_t n = send(conn->source.fd, conn->out.data + conn->outSent,
+                         conn->out.len - conn->outSent, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            conn->outSent += n;
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && errno == EAGAIN)
+        {
+            break;
+        }
+        else
+        {
+            H2CloseConn(conn);
+            return -1;
+        }
+    }
+    if (conn->outSent == conn->out.len)
+    {
+        conn->out.len = conn->outSent = 0;
+        if (conn->closing || (conn->goaway && conn->streamCount == 0))
+        {
+            H2CloseConn(conn);
+            return -1;
+        }
+    }
+    else if (conn->outSent > H2_OUT_LOW)
+    {
+        H2Consume(&conn->out, conn->outSent);
+        conn->outSent = 0;
+    }
+    return 0;
+}
+
+/**
+* H2Flush: Sends what it can. While the socket keeps taking it all, the
+*   streams paused for output room refill the buffer.
+*/
+static void H2Flush(H2Conn *conn)
+{
+    size_t pending;
+    do
+    {
+        if (H2Send(conn) < 0)
+        {
+            return;
+        }
+        pending = conn->out.len - conn->outSent;
+        if (pending > H2_OUT_LOW)
+        {
+            break;
+        }
+        H2Resume(conn);
+    } while (conn->out.len - conn->outSent > pending);
+    H2Watch(&conn->source, conn->out.len > conn->outSent ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+static void H2OnConnEvent(H2Conn *conn, unsigned int events)
+{
+    if (events & EPOLLIN)
+    {
+        while (!conn->closing)
+        {
+            unsigned char buf[16384];
+            ssize_t n = read(conn->source.fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && errno == EAGAIN)
+            {
+                break;
+            }
+            if (n <= 0)
+            {
+                H2CloseConn(conn);
+                return;
+            }
+            conn->lastActive = time(NULL);
+            if (H2Append(&conn->in, buf, n) < 0)
+            {
+                H2CloseConn(conn);
+                return;
+            }
+            H2Process(conn);
+        }
+    }
+    else if (events & (EPOLLERR | EPOLLHUP))
+    {
+        H2CloseConn(conn);
+        return;
+    }
+    H2Dispatch(conn);
+    H2Flush(conn);
+}
+
+static void H2OnStreamEvent(H2Stream *stream, unsigned int events)
+{
+    H2Conn *conn = stream->conn;
+    if (events & EPOLLOUT)
+    {
+        H2FeedWorker(stream);
+    }
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+    {
+        H2Pump(stream);
+    }
+    else
+    {
+        H2StreamWatch(stream);
+    }
+    if (!conn->source.dead)
+    {
+        H2Dispatch(conn);
+        H2Flush(conn);
+    }
+}
+
+/* Picks up the connections workers handed over */
+static void H2TakeAdopted(void)
+{
+    eventfd_t count;
+    eventfd_read(http2.wake.fd, &count);
+
+    pthread_mutex_lock(&http2.mutex);
+        H2Conn *conn = http2.adopted;
+        http2.adopted = NULL;
+    pthread_mutex_unlock(&http2.mutex);
+
+    while (conn != NULL)
+    {
+        H2Conn *next = conn->next;
+        unsigned char settings[12];
+
+        conn->prev = NULL;
+        conn->next = http2.conns;
+        if (http2.conns != NULL)
+        {
+            http2.conns->prev = conn;
+        }
+        http2.conns = conn;
+        conn->lastActive = time(NULL);
+        fcntl(conn->source.fd, F_SETFL, fcntl(conn->source.fd, F_GETFL) | O_NONBLOCK);
+
+        // our preface: the stream limit and per-stream window, then room for
+        // bodies on all streams at once
+        settings[0] = 0;
+        settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+        H2Put32(settings + 2, http2.config.maxStreams);
+        settings[6] = 0;
+        settings[7] = H2_SETTINGS_INITIAL_WINDOW_SIZE;
+        H2Put32(settings + 8, http2.config.streamWindow);
+        H2Frame(conn, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+        H2WindowUpdate(conn, 0, H2_CONNECTION_WINDOW - H2_DEFAULT_WINDOW);
+
+        __atomic_fetch_add(&http2.stats.connections, 1, __ATOMIC_RELAXED);
+        H2Process(conn);
+        H2OnConnEvent(conn, EPOLLIN);
+        conn = next;
+    }
+}
+
+/**
+* H2CloseIdle: Resets the streams whose response has been stuck for
+*   sendTimeoutSec, freeing the workers blocked writing them, and closes the
+*   connections idle for idleTimeoutSec.
+*/
+static void H2CloseIdle(void)
+{
+    time_t now = time(NULL);
+    H2Conn *conn = http2.conns, *next;
+    for (; conn != NULL; conn = next)
+    {
+        next = conn->next;
+        H2Stream *stream = conn->streams, *nextStream;
+        bool reset = false;
+        for (; stream != NULL; stream = nextStream)
+        {
+            nextStream = stream->next;
+            if (stream->paused && stream->stalledSince != 0 &&
+                now - stream->stalledSince >= http2.config.sendTimeoutSec)
+            {
+                H2Reset(conn, stream->id, H2_CANCEL);
+                H2CloseStream(stream);
+                reset = true;
+            }
+        }
+        if (reset)
+        {
+            H2Dispatch(conn);
+            H2Flush(conn);
+        }
+        else if (conn->streamCount == 0 && now - conn->lastActive >= http2.config.idleTimeoutSec)
+        {
+            H2GoAway(conn, H2_NO_ERROR);
+            H2Flush(conn);
+        }
+    }
+}
+
+static void *Http2Loop(void *arg)
+{
+    struct epoll_event events[64];
+    time_t lastSweep = time(NULL);
+
+    while (!__atomic_load_n(&http2.stop, __ATOMIC_ACQUIRE))
+    {
+        int n = epoll_wait(http2.epollFd, events, 64, 1000);
+        for (int i = 0; i < n; i++)
+        {
+            H2Source *source = events[i].data.ptr;
+            if (source == &http2.wake)
+            {
+                H2TakeAdopted();
+            }
+            else if (source->dead)
+            {
+                continue;
+            }
+            else if (source->isStream)
+            {
+                H2OnStreamEvent((H2Stream *)source, events[i].events);
+            }
+            else
+            {
+                H2OnConnEvent((H2Conn *)source, events[i].events);
+            }
+        }
+
+        if (time(NULL) != lastSweep)
+        {
+            lastSweep = time(NULL);
+            H2CloseIdle();
+        }
+        for (size_t i = 0; i < http2.graveCount; i++)
+        {
+            free(http2.graveyard[i]);
+        }
+        http2.graveCount = 0;
+    }
+
+    // shutting down: tell every client, best effort, and let go of the streams
+    while (http2.conns != NULL)
+    {
+        H2Conn *conn = http2.conns;
+        H2GoAway(conn, H2_NO_ERROR);
+        send(conn->source.fd, conn->out.data + conn->outSent, conn->out.len - conn->outSent,
+             MSG_NOSIGNAL | MSG_DONTWAIT);
+        H2CloseConn(conn);
+    }
+    for (size_t i = 0; i < http2.graveCount; i++)
+    {
+        free(http2.graveyard[i]);
+    }
+    http2.graveCount = 0;
+    return NULL;
+}
+
+int http2Init(const Http2Config *config, ThreadPool pool)
+{
+    struct rlimit limit;
+
+    if (!config->enabled)
+    {
+        return 0;
+    }
+    http2.config = *config;
+    http2.pool = pool;
+    http2.peerCount = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    {
+        http2.peerCount = limit.rlim_cur;
+    }
+    if ((http2.peers = calloc(http2.peerCount, sizeof(H2Peer))) == NULL)
+    {
+        return -1;
+    }
+    if ((http2.epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        return -1;
+    }
+    if ((http2.wake.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+    {
+        close(http2.epollFd);
+        return -1;
+    }
+    H2Watch(&http2.wake, EPOLLIN);
+    if ((errno = pthread_create(&http2.thread, NULL, Http2Loop, NULL)) != 0)
+    {
+        close(http2.wake.fd);
+        close(http2.epollFd);
+        return -1;
+    }
+    http2.enabled = true;
+    return 0;
+}
+
+bool http2Enabled(void)
+{
+    return http2.enabled;
+}
+
+int http2PeerName(int fd, struct sockaddr *addr, socklen_t *len)
+{
+    socklen_t room = *len;
+
+    if (getpeername(fd, addr, len) < 0)
+    {
+        return -1;
+    }
+    // the worker's end of a stream: the client is the connection's
+    if (addr->sa_family == AF_UNIX && fd >= 0 && (size_t)fd < http2.peerCount &&
+        http2.peers[fd].sa.sa_family != AF_UNSPEC)
+    {
+        socklen_t size = http2.peers[fd].sa.sa_family == AF_INET ? sizeof(struct sockaddr_in)
+                                                                 : sizeof(struct sockaddr_in6);
+        memcpy(addr, &http2.peers[fd], room < size ? room : size);
+        *len = size;
+    }
+    return 0;
+}
+
+int http2Adopt(int fd, const char *buffered, size_t len)
+{
+    if (!http2.enabled)
+    {
+        return -1;
+    }
+    H2Conn *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL)
+    {
+        return -1;
+    }
+    conn->source.fd = fd;
+    conn->peerLen = sizeof(conn->peer);
+    if (getpeername(fd, &conn->peer.sa, &conn->peerLen) < 0)
+    {
+        conn->peerLen = 0;
+    }
+    conn->prefaceLeft = sizeof(h2Preface) - 1;
+    conn->sendWindow = H2_DEFAULT_WINDOW;
+    conn->peerInitialWindow = H2_DEFAULT_WINDOW;
+    conn->peerMaxFrame = H2_DEFAULT_FRAME;
+    conn->decoder = hpackTableCreate(HPACK_DEFAULT_TABLE_SIZE);
+    conn->encoder = hpackTableCreate(HPACK_DEFAULT_TABLE_SIZE);
+    if (conn->decoder == NULL || conn->encoder == NULL || H2Append(&conn->in, buffered, len) < 0)
+    {
+        hpackTableDestroy(conn->decoder);
+        hpackTableDestroy(conn->encoder);
+        free(conn->in.data);
+        free(conn);
+        return -1;
+    }
+
+    pthread_mutex_lock(&http2.mutex);
+        conn->next = http2.adopted;
+        http2.adopted = conn;
+    pthread_mutex_unlock(&http2.mutex);
+    eventfd_write(http2.wake.fd, 1);
+    return 0;
+}
+
+void http2Shutdown(void)
+{
+    if (!http2.enabled)
+    {
+        return;
+    }
+    __atomic_store_n(&http2.stop, true, __ATOMIC_RELEASE);
+    eventfd_write(http2.wake.fd, 1);
+    pthread_join(http2.thread, NULL);
+    http2.enabled = false;
+}
+
+void http2Stats(Http2Stats *stats)
+{
+    stats->connections = __atomic_load_n(&http2.stats.connections, __ATOMIC_RELAXED);
+    stats->streams = __atomic_load_n(&http2.stats.streams, __ATOMIC_RELAXED);
+    stats->requestHeaderBytes = __atomic_load_n(&http2.stats.requestHeaderBytes, __ATOMIC_RELAXED);
+    stats->requestHeaderPlain = __atomic_load_n(&http2.stats.requestHeaderPlain, __ATOMIC_RELAXED);
+    stats->responseHeaderBytes = __atomic_load_n(&http2.stats.responseHeaderBytes, __ATOMIC_RELAXED);
+    stats->responseHeaderPlain = __atomic_load_n(&http2.stats.responseHeaderPlain, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,86 @@
+#ifndef HTTP2_H_
+#define HTTP2_H_
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include "bool.h"
+#include "threadPool.h"
+
+/**
+* HTTP/2
+*
+* Cleartext HTTP/2 (h2c) for clients that start with the connection preface
+* ("prior knowledge"). A worker that reads the preface instead of a request
+* line hands the connection over to the HTTP/2 thread, which multiplexes any
+* number of requests over it.
+*
+* The HTTP/2 thread does only framing, HPACK and flow control. Each stream
+* becomes an ordinary HTTP/1 request, written to one end of a socketpair whose
+* other end is queued on the worker pool like an accepted connection, so
+* streams are served concurrently by the workers through the same code as
+* HTTP/1 (static files, CGI, the response cache, the access log). The response
+* read back from the socketpair goes out as HEADERS and DATA frames. The
+* worker learns the client's address through http2PeerName, so streams are
+* logged, classified and rate limited by it like connections are.
+*
+* So that one connection cannot take every worker, only maxWorkerStreams of
+* its streams are queued on the pool at a time; the others wait their turn in
+* the HTTP/2 thread. A stream whose response cannot move for sendTimeoutSec,
+* the client giving it no window or not reading at all, is reset, which also
+* frees the worker blocked writing it.
+*
+*   http2Init     - Starts the HTTP/2 thread.
+*   http2Enabled  - Whether connections may switch to HTTP/2.
+*   http2Adopt    - Takes a connection over after its preface line.
+*   http2PeerName - getpeername() that sees through a stream to its client.
+*   http2Shutdown - Closes every HTTP/2 connection and stops the thread.
+*   http2Stats    - Counters for monitoring.
+*/
+
+typedef struct Http2Config_t {
+    bool enabled;           // accept the h2c preface on the plaintext port
+    int maxStreams;         // SETTINGS_MAX_CONCURRENT_STREAMS per connection
+    int maxWorkerStreams;   // streams of a connection on the workers at once, 0 = a quarter of the threads
+    int sendTimeoutSec;     // a stream whose response is stuck this long is reset
+    int streamWindow;       // receive window per stream, bounds buffered request bodies
+    int idleTimeoutSec;     // a connection without open streams closes after this
+} Http2Config;
+
+typedef struct Http2Stats_t {
+    unsigned long connections;
+    unsigned long streams;
+    unsigned long long requestHeaderBytes;    // HPACK blocks received
+    unsigned long long requestHeaderPlain;    // the same headers in HTTP/1 form
+    unsigned long long responseHeaderBytes;   // HPACK blocks sent
+    unsigned long long responseHeaderPlain;
+} Http2Stats;
+
+/**
+* http2Init: Starts the HTTP/2 thread, which queues streams on pool.
+* @return 0 on success (or HTTP/2 off), -1 on error (errno set)
+*/
+int http2Init(const Http2Config *config, ThreadPool pool);
+
+bool http2Enabled(void);
+
+/**
+* http2PeerName: The address of the client on fd, as getpeername() gives it,
+*   except that for the worker's end of a stream it is the address of the
+*   HTTP/2 connection the stream came on.
+* @return 0 on success, -1 on error (errno set)
+*/
+int http2PeerName(int fd, struct sockaddr *addr, socklen_t *len);
+
+/**
+* http2Adopt: Hands fd over to the HTTP/2 thread once the request line of the
+*   preface ("PRI * HTTP/2.0") was read. buffered holds what was read past it.
+*   On success the caller must leave fd open; the HTTP/2 thread closes it.
+* @return 0 on success, -1 if the connection could not be taken over
+*/
+int http2Adopt(int fd, const char *buffered, size_t len);
+
+void http2Shutdown(void);
+
+void http2Stats(Http2Stats *stats);
+
+#endif // HTTP2_H_
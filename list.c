@@ -1,11 +1,214 @@
 #include "list.h"
+#include <time.h>
+#include <unistd.h>
 
+/* one node per cache line, so a producer and a consumer touching neighbouring
+   nodes do not share a line */
 struct Node_t
 {
     int data;
+    unsigned int slabIndex;        // position in the node slab
+    unsigned long long enqueuedNs;
     struct Node_t *next;
     struct Node_t *previous;
-};
+    unsigned long long freeNext;   // next free node while on the free stack
+} __attribute__((aligned(64)));
+
+/*
+* Node slab
+*
+* Nodes come from chunks of LIST_CHUNK_NODES preallocated nodes instead of
+* malloc. Free nodes sit on a global lock-free stack, addressed by slab index
+* with a tag next to it so a node popped and pushed back in between is not
+* mistaken for the old top (ABA). Each thread keeps a small magazine of free
+* nodes in front of the stack, so most allocations and frees touch no shared
+* state at all; magazines are refilled and spilled half at a time, with one
+* CAS for the whole batch. A thread's magazine goes back to the stack when the
+* thread exits.
+*/
+#define LIST_CHUNK_SHIFT 12
+#define LIST_CHUNK_NODES (1u << LIST_CHUNK_SHIFT)
+#define LIST_MAX_CHUNKS 1024
+#define LIST_MAGAZINE 32
+#define LIST_EMPTY 0xffffffffu
+
+typedef struct ListMagazine_t
+{
+    int count;
+    Node nodes[LIST_MAGAZINE];
+} ListMagazine;
+
+static struct
+{
+    unsigned long long freeTop;     // tag << 32 | index of the top free node
+    Node chunks[LIST_MAX_CHUNKS];
+    unsigned int chunkCount;
+    pthread_mutex_t growMutex;
+    pthread_once_t once;
+    pthread_key_t magazineKey;
+} listSlab = {LIST_EMPTY, {NULL}, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_ONCE_INIT, 0};
+
+static __thread ListMagazine *listMagazine;
+
+static Node listSlabNode(unsigned int index)
+{
+    return &listSlab.chunks[index >> LIST_CHUNK_SHIFT][index & (LIST_CHUNK_NODES - 1)];
+}
+
+static void listSlabPush(Node node)
+{
+    unsigned long long top = __atomic_load_n(&listSlab.freeTop, __ATOMIC_ACQUIRE), next;
+    do
+    {
+        node->freeNext = top;
+        next = ((top >> 32) + 1) << 32 | node->slabIndex;
+    } while (!__atomic_compare_exchange_n(&listSlab.freeTop, &top, next, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+/* pushes count nodes with one CAS, chained among themselves first */
+static void listSlabPushMany(Node *nodes, int count)
+{
+    for (int i = 0; i < count - 1; i++)
+    {
+        nodes[i]->freeNext = nodes[i + 1]->slabIndex;
+    }
+    Node last = nodes[count - 1];
+    unsigned long long top = __atomic_load_n(&listSlab.freeTop, __ATOMIC_ACQUIRE), next;
+    do
+    {
+        last->freeNext = top;
+        next = ((top >> 32) + 1) << 32 | nodes[0]->slabIndex;
+    } while (!__atomic_compare_exchange_n(&listSlab.freeTop, &top, next, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+/* pops up to max nodes into nodes with one CAS, returns how many */
+static int listSlabPopMany(Node *nodes, int max)
+{
+    unsigned long long top = __atomic_load_n(&listSlab.freeTop, __ATOMIC_ACQUIRE), next;
+    int count;
+    do
+    {
+        // every push and pop bumps the tag, so a CAS that succeeds proves the
+        // chain walked here was still the top of the stack; chunks are never
+        // freed and freeNext always holds an index, so a stale walk is harmless
+        unsigned int index = (unsigned int)top;
+        for (count = 0; count < max && index != LIST_EMPTY; count++)
+        {
+            nodes[count] = listSlabNode(index);
+            index = (unsigned int)__atomic_load_n(&nodes[count]->freeNext, __ATOMIC_RELAXED);
+        }
+        if (count == 0)
+        {
+            return 0;
+        }
+        next = ((top >> 32) + 1) << 32 | index;
+    } while (!__atomic_compare_exchange_n(&listSlab.freeTop, &top, next, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return count;
+}
+
+/* adds a chunk of nodes to the free stack, returns false when out of memory */
+static bool listSlabGrow()
+{
+    bool grown = false;
+    pthread_mutex_lock(&listSlab.growMutex);
+        unsigned int chunk = listSlab.chunkCount;
+        Node nodes = NULL;
+        if (chunk < LIST_MAX_CHUNKS &&
+            posix_memalign((void **)&nodes, 64, LIST_CHUNK_NODES * sizeof(struct Node_t)) == 0)
+        {
+            listSlab.chunks[chunk] = nodes;
+            __atomic_store_n(&listSlab.chunkCount, chunk + 1, __ATOMIC_RELEASE);
+            for (unsigned int i = 0; i < LIST_CHUNK_NODES; i++)
+            {
+                nodes[i].slabIndex = chunk << LIST_CHUNK_SHIFT | i;
+                listSlabPush(&nodes[i]);
+            }
+            grown = true;
+        }
+    pthread_mutex_unlock(&listSlab.growMutex);
+    return grown;
+}
+
+/* returns an exiting thread's cached nodes to the shared stack */
+static void listMagazineRelease(void *arg)
+{
+    ListMagazine *magazine = arg;
+    for (int i = 0; i < magazine->count; i++)
+    {
+        listSlabPush(magazine->nodes[i]);
+    }
+    free(magazine);
+}
+
+static void listSlabInit()
+{
+    pthread_key_create(&listSlab.magazineKey, listMagazineRelease);
+}
+
+static ListMagazine *listGetMagazine()
+{
+    if (listMagazine == NULL)
+    {
+        pthread_once(&listSlab.once, listSlabInit);
+        listMagazine = calloc(1, sizeof(*listMagazine));
+        if (listMagazine != NULL)
+        {
+            pthread_setspecific(listSlab.magazineKey, listMagazine);
+        }
+    }
+    return listMagazine;
+}
+
+static Node listNodeAlloc()
+{
+    ListMagazine *magazine = listGetMagazine();
+    if (magazine == NULL)
+    {
+        return NULL;
+    }
+    if (magazine->count == 0)
+    {
+        // refill half the magazine so frees right after do not spill at once
+        magazine->count = listSlabPopMany(magazine->nodes, LIST_MAGAZINE / 2);
+        if (magazine->count == 0 && listSlabGrow())
+        {
+            magazine->count = listSlabPopMany(magazine->nodes, LIST_MAGAZINE / 2);
+        }
+        if (magazine->count == 0)
+        {
+            return NULL;
+        }
+    }
+    return magazine->nodes[--magazine->count];
+}
+
+static void listNodeFree(Node node)
+{
+    ListMagazine *magazine = listGetMagazine();
+    if (magazine == NULL)
+    {
+        listSlabPush(node);
+        return;
+    }
+    if (magazine->count == LIST_MAGAZINE)
+    {
+        magazine->count = LIST_MAGAZINE / 2;
+        listSlabPushMany(magazine->nodes + magazine->count, LIST_MAGAZINE - magazine->count);
+    }
+    magazine->nodes[magazine->count++] = node;
+}
+
+void listReserve(size_t nodes)
+{
+    size_t capacity = (size_t)__atomic_load_n(&listSlab.chunkCount, __ATOMIC_ACQUIRE) * LIST_CHUNK_NODES;
+    while (capacity < nodes && listSlabGrow())
+    {
+        capacity += LIST_CHUNK_NODES;
+    }
+}
 
 struct List_t
 {
@@ -13,8 +216,16 @@ struct List_t
     Node tail;
     Node iterator;
     size_t size;
+    size_t waiters;     // threads blocked waiting for an element
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+
+    // spin-then-park (see listSetMaxSpin); the arrival statistics are
+    // updated under the mutex, the spin counters atomically
+    unsigned long long maxSpinNs;
+    unsigned long long lastArrivalNs;
+    unsigned long long avgGapNs;    // EWMA of the time between arrivals
+    ListWaitStats waitStats;
 };
 
 /**
@@ -65,6 +276,123 @@ static Node listGetNext(List list)
     return list->iterator;
 }
 
+static unsigned long long listNowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+* Spin-then-park
+*
+* A consumer that finds the list empty parks on the condition variable, so the
+* next element costs a futex wake and a context switch before it is served.
+* When elements have been arriving closer together than maxSpinNs, the
+* consumer instead polls the size for about twice the average gap first, and
+* only parks if nothing came. Sparse arrivals, or a single CPU where the
+* producer cannot run while we spin, skip the spin entirely.
+*/
+#define LIST_GAP_WEIGHT 8         // EWMA weight 1/8
+#define LIST_SPIN_CHECK 32        // pauses between clock reads
+
+static void listCpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* Called with the mutex held by whoever added count elements at nowNs */
+static void listNoteArrivals(List list, unsigned long long nowNs, int count)
+{
+    if (list->maxSpinNs == 0)
+    {
+        return;
+    }
+    if (list->lastArrivalNs != 0 && nowNs > list->lastArrivalNs)
+    {
+        long long gap = (long long)((nowNs - list->lastArrivalNs) / count);
+        long long avg = (long long)list->avgGapNs;
+        list->avgGapNs = (unsigned long long)(avg + (gap - avg) / LIST_GAP_WEIGHT);
+    }
+    list->lastArrivalNs = nowNs;
+}
+
+/**
+* listSpin: Polls the size without the lock for the adaptive budget.
+* @return true if an element showed up while spinning
+*/
+static bool listSpin(List list)
+{
+    unsigned long long maxSpin = __atomic_load_n(&list->maxSpinNs, __ATOMIC_RELAXED);
+    unsigned long long budget = 2 * __atomic_load_n(&list->avgGapNs, __ATOMIC_RELAXED);
+    if (maxSpin == 0 || budget == 0 || budget > maxSpin ||
+        __atomic_load_n(&list->size, __ATOMIC_RELAXED) > 0)
+    {
+        return false;
+    }
+
+    unsigned long long start = listNowNs(), now = start;
+    bool found = false;
+    while (!found && now - start < budget)
+    {
+        for (int i = 0; i < LIST_SPIN_CHECK; i++)
+        {
+            listCpuRelax();
+        }
+        found = __atomic_load_n(&list->size, __ATOMIC_RELAXED) > 0;
+        now = listNowNs();
+    }
+
+    __atomic_fetch_add(&list->waitStats.spinNs, now - start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(found ? &list->waitStats.spinHits : &list->waitStats.spinMisses, 1, __ATOMIC_RELAXED);
+    return found;
+}
+
+/* Returns with the mutex held and the list not empty; called with it held */
+static void listWaitNonEmpty(List list)
+{
+    if (list->size == 0)
+    {
+        pthread_mutex_unlock(&(list->mutex));
+        listSpin(list);
+        pthread_mutex_lock(&(list->mutex));
+    }
+    while (list->size == 0)
+    {
+        list->waiters++;
+        __atomic_fetch_add(&list->waitStats.parks, 1, __ATOMIC_RELAXED);
+        pthread_cond_wait(&(list->cond), &(list->mutex));
+        list->waiters--;
+    }
+}
+
+void listSetMaxSpin(List list, unsigned long long maxSpinNs)
+{
+    static long cpus = 0;
+    if (cpus == 0)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (list == NULL)
+    {
+        return;
+    }
+    // with one CPU the producer cannot run while we spin
+    __atomic_store_n(&list->maxSpinNs, cpus > 1 ? maxSpinNs : 0, __ATOMIC_RELAXED);
+}
+
+void listGetWaitStats(List list, ListWaitStats *stats)
+{
+    stats->spinHits = __atomic_load_n(&list->waitStats.spinHits, __ATOMIC_RELAXED);
+    stats->spinMisses = __atomic_load_n(&list->waitStats.spinMisses, __ATOMIC_RELAXED);
+    stats->parks = __atomic_load_n(&list->waitStats.parks, __ATOMIC_RELAXED);
+    stats->spinNs = __atomic_load_n(&list->waitStats.spinNs, __ATOMIC_RELAXED);
+}
+
 #define LIST_FOREACH(iterator, list) \
     for(Node iterator = listGetFirst(list) ; \
         iterator ;\
@@ -137,6 +465,11 @@ List listCreate()
     new_list->tail = NULL;
     new_list->iterator = NULL;
     new_list->size = 0;
+    new_list->waiters = 0;
+    new_list->maxSpinNs = 0;
+    new_list->lastArrivalNs = 0;
+    new_list->avgGapNs = 0;
+    memset(&new_list->waitStats, 0, sizeof(new_list->waitStats));
     pthread_mutex_init(&(new_list->mutex), NULL);
     pthread_cond_init(&(new_list->cond), NULL);
 
@@ -162,13 +495,14 @@ ListResult listAdd(List list, int data)
         return LIST_NULL_ARGUMENT;
     }
 
-    Node new_node = malloc(sizeof(*new_node));
+    Node new_node = listNodeAlloc();
     if (new_node == NULL)
     {
         return LIST_OUT_OF_MEMORY;
     }
 
     new_node->data = data;
+    new_node->enqueuedNs = listNowNs();
 
     // insert the new node in the end of the list
     pthread_mutex_lock(&(list->mutex));
@@ -177,6 +511,7 @@ ListResult listAdd(List list, int data)
         new_node->previous = list->tail;
         list->tail = new_node;
         (list->size)++;
+        listNoteArrivals(list, new_node->enqueuedNs, 1);
 
         if (new_node->previous != NULL) // if this is not the only element
         {
@@ -198,6 +533,73 @@ ListResult listEnqueue(List list, int data)
     return listAdd(list,data);
 }
 
+ListResult listEnqueueBatch(List list, const int *data, int count)
+{
+    if (list == NULL || (data == NULL && count > 0))
+    {
+        return LIST_NULL_ARGUMENT;
+    }
+    if (count <= 0)
+    {
+        return LIST_SUCCESS;
+    }
+
+    // chain the nodes up before taking the lock, then splice them in at once
+    Node first = NULL, last = NULL;
+    unsigned long long now = listNowNs();
+    for (int i = 0; i < count; i++)
+    {
+        Node new_node = listNodeAlloc();
+        if (new_node == NULL)
+        {
+            while (first != NULL)
+            {
+                Node next = first->next;
+                listNodeFree(first);
+                first = next;
+            }
+            return LIST_OUT_OF_MEMORY;
+        }
+        new_node->data = data[i];
+        new_node->enqueuedNs = now;
+        new_node->next = NULL;
+        new_node->previous = last;
+        if (last != NULL)
+        {
+            last->next = new_node;
+        }
+        else
+        {
+            first = new_node;
+        }
+        last = new_node;
+    }
+
+    pthread_mutex_lock(&(list->mutex));
+        first->previous = list->tail;
+        if (list->tail != NULL)
+        {
+            list->tail->next = first;
+        }
+        else
+        {
+            list->head = first;
+        }
+        list->tail = last;
+        list->size += count;
+        listNoteArrivals(list, now, count);
+
+        // one wakeup per element, but never more than there are waiters
+        size_t wakeups = (size_t)count < list->waiters ? (size_t)count : list->waiters;
+        for (size_t i = 0; i < wakeups; i++)
+        {
+            pthread_cond_signal(&(list->cond));
+        }
+    pthread_mutex_unlock(&(list->mutex));
+
+    return LIST_SUCCESS;
+}
+
 ListResult listRemove(List list, int to_remove)
 {
     if (list == NULL)
@@ -248,16 +650,44 @@ ListResult listRemove(List list, int to_remove)
                 node->next = NULL;
             }
 
-            free(node);
             (list->size)--;
         }
 
     pthread_mutex_unlock(&(list->mutex));
 
+    if (node != NULL)
+    {
+        listNodeFree(node);
+    }
     return result;
 }
 
-int listDequeue(List list)
+/**
+* listUnlinkHead: Removes the first node of a non empty list and returns it.
+*   Must be called with the list mutex held.
+*/
+static Node listUnlinkHead(List list)
+{
+    Node node = list->head;
+    // in case this is the first element but not the last
+    if (node->next != NULL)
+    {
+        // remove the elemnt from the top of the list and make the next one top of the list
+        node->next->previous = NULL;
+        list->head = node->next;
+        node->next = NULL;
+    }
+    // in case this is the last and first element
+    else
+    {
+        list->tail = NULL;
+        list->head = NULL;
+    }
+    (list->size)--;
+    return node;
+}
+
+int listDequeueTimed(List list, unsigned long long *enqueuedNs)
 {
     int res = -1;
     if(list == NULL)
@@ -266,31 +696,99 @@ int listDequeue(List list)
     }
 
     pthread_mutex_lock(&(list->mutex));
-        while (list->size == 0) 
-        {
-            pthread_cond_wait(&(list->cond), &(list->mutex));
-        }
+        listWaitNonEmpty(list);
         
-        Node node = list->head;
-        // in case this is the first element but not the last
-        if (node->next != NULL)
+        Node node = listUnlinkHead(list);
+    pthread_mutex_unlock(&(list->mutex));
+
+    res = node->data;
+    if (enqueuedNs != NULL)
+    {
+        *enqueuedNs = node->enqueuedNs;
+    }
+    listNodeFree(node);
+
+    return res;
+}
+
+int listDequeue(List list)
+{
+    return listDequeueTimed(list, NULL);
+}
+
+int listDequeueBatchTimed(List list, int *out, unsigned long long *enqueuedNs, int max)
+{
+    Node nodes = NULL;
+    int count = 0;
+    if (list == NULL || out == NULL || max <= 0)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&(list->mutex));
+        listWaitNonEmpty(list);
+
+        // leave an equal share for the threads still waiting, so a burst is
+        // spread over idle workers instead of queueing behind one of them
+        size_t share = (list->size + list->waiters) / (list->waiters + 1);
+        int take = share < (size_t)max ? (int)share : max;
+        Node last = NULL;
+        for (count = 0; count < take; count++)
         {
-            // remove the elemnt from the top of the list and make the next one top of the list
-            node->next->previous = NULL;
-            list->head = node->next;
+            Node node = listUnlinkHead(list);
             node->next = NULL;
+            if (last != NULL)
+            {
+                last->next = node;
+            }
+            else
+            {
+                nodes = node;
+            }
+            last = node;
         }
-        // in case this is the last and first element
-        else
+    pthread_mutex_unlock(&(list->mutex));
+
+    for (int i = 0; i < count; i++)
+    {
+        Node next = nodes->next;
+        out[i] = nodes->data;
+        if (enqueuedNs != NULL)
         {
-            list->tail = NULL;
-            list->head = NULL;
+            enqueuedNs[i] = nodes->enqueuedNs;
+        }
+        listNodeFree(nodes);
+        nodes = next;
+    }
+    return count;
+}
+
+int listDequeueBatch(List list, int *out, int max)
+{
+    return listDequeueBatchTimed(list, out, NULL, max);
+}
+
+int listTryDequeue(List list)
+{
+    Node node = NULL;
+    if(list == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&(list->mutex));
+        if (list->size > 0)
+        {
+            node = listUnlinkHead(list);
         }
-        res = node->data;
-        (list->size)--;
-        free(node);
     pthread_mutex_unlock(&(list->mutex));
 
+    if (node == NULL)
+    {
+        return -1;
+    }
+    int res = node->data;
+    listNodeFree(node);
     return res;
 }
 
@@ -309,7 +807,7 @@ ListResult listClear(List list)
             Node element_to_free = current_node;
             current_node = listGetNext(list);
 
-            free(element_to_free);
+            listNodeFree(element_to_free);
         }
 
         list->head = NULL;
@@ -21,6 +21,10 @@
 *   listDestroy		- Deallocates all the nodes and frees the list.
 *   listCopy		- Copies the data from each node and adds it to a new list
 *   listGetSize		- Returns the number of nodes in the given list.
+*   listDequeueTimed - Like listDequeue, also returns when the node was added.
+*   listTryDequeue  - Like listDequeue, but returns -1 instead of waiting.
+*   listDequeueBatch - Removes up to max elements under one lock acquisition.
+*   listEnqueueBatch - Adds several elements under one lock acquisition.
 *   listFind    	- Searches the list for a specific node using the comparePtr
 *                     (if found returns the first matching node)
 *                     function specified when the list was created.
@@ -36,6 +40,9 @@
 *	 				  the list using the destroyPtr function given at the creation.
 *   listGet         - Returns a pointer to the data of the given node.
 *   listContains    - Checks if the given node is one of the lists nodes.
+*   listReserve     - Preallocates nodes for all lists.
+*   listSetMaxSpin  - Lets consumers spin briefly before blocking.
+*   listGetWaitStats - How often waiting consumers spun or blocked.
 *
 * 	LIST_FOREACH	- A macro for iterating over the list's nodes.
 */
@@ -51,6 +58,14 @@ typedef enum ListResult_t {
 typedef struct Node_t* Node;
 typedef struct List_t* List;
 
+/** What consumers of an empty list did (see listSetMaxSpin) */
+typedef struct ListWaitStats_t {
+    unsigned long long spinHits;    // spins that saw an element arrive
+    unsigned long long spinMisses;  // spins that ran out and went on to block
+    unsigned long long parks;       // waits on the condition variable
+    unsigned long long spinNs;      // CPU time spent spinning
+} ListWaitStats;
+
 
 /**
 * listCreate: Allocates a new empty generic list.
@@ -60,6 +75,16 @@ typedef struct List_t* List;
 */
 List listCreate();
 
+/**
+* listReserve: Makes sure at least nodes list nodes are preallocated. Nodes of
+*   all lists come from one shared slab with a small cache per thread, so
+*   adding and removing elements does not go through malloc. The slab grows
+*   on demand; reserving up front keeps that off the request path.
+*
+* @param nodes - Number of nodes expected to be in use at once.
+*/
+void listReserve(size_t nodes);
+
 
 /**
 * listDestroy: Deallocates an existing list. Clears all elements.
@@ -96,6 +121,20 @@ ListResult listAdd(List list, int data);
 */
 ListResult listEnqueue(List list, int data);
 
+/**
+*	listEnqueueBatch: adds count elements, in order, with a single lock
+*	acquisition and wakeup.
+*
+* @param list - The list to which to add the data
+* @param data - The elements to add
+* @param count - Number of elements in data
+* @return
+*   LIST_NULL_ARGUMENT if one of the params is NULL
+* 	LIST_OUT_OF_MEMORY if a node could not be allocated (nothing is added)
+* 	LIST_SUCCESS if all the elements were inserted
+*/
+ListResult listEnqueueBatch(List list, const int *data, int count);
+
 
 
 /**
@@ -125,6 +164,64 @@ ListResult listRemove(List list, int to_remove);
 */
 int listDequeue(List list);
 
+/**
+*  listDequeueTimed: Same as listDequeue, and reports when the removed node
+*  was added to the list.
+*
+* @param list
+*   The list from which to remove the node.
+* @param enqueuedNs
+*   Set to the CLOCK_MONOTONIC time, in nanoseconds, at which the node was added.
+* @return the data of the node
+*/
+int listDequeueTimed(List list, unsigned long long *enqueuedNs);
+
+/**
+*  listDequeueBatch: Waits until the list is not empty, then removes up to max
+*  elements from its start under one lock acquisition. When other threads are
+*  waiting too, it takes only its share of the elements so they are not left
+*  idle.
+*
+* @param list
+*   The list from which to remove the nodes.
+* @param out
+*   Receives the data of the removed nodes, in order.
+* @param max
+*   Capacity of out.
+* @return the number of elements removed (at least 1), -1 if an argument is invalid
+*/
+int listDequeueBatch(List list, int *out, int max);
+
+/**
+*  listDequeueBatchTimed: Same as listDequeueBatch, and reports when each
+*  removed node was added (see listDequeueTimed). enqueuedNs may be NULL.
+*/
+int listDequeueBatchTimed(List list, int *out, unsigned long long *enqueuedNs, int max);
+
+/**
+*  listSetMaxSpin: Lets a consumer that finds the list empty spin (with a CPU
+*  pause) before blocking, for about twice the recent average time between
+*  arrivals. When that average is above maxSpinNs arrivals are too sparse to
+*  be worth spinning for, and consumers block at once. Spinning is always off
+*  on a single CPU.
+*
+* @param list - The list whose consumers spin
+* @param maxSpinNs - Upper bound of one spin, 0 to always block at once (default)
+*/
+void listSetMaxSpin(List list, unsigned long long maxSpinNs);
+
+void listGetWaitStats(List list, ListWaitStats *stats);
+
+/**
+*  listTryDequeue: Removes the first node from the list if there is one.
+*  Never waits.
+*
+* @param list
+*   The list from which to remove the node.
+* @return the data of the node, -1 if the list is empty or NULL
+*/
+int listTryDequeue(List list);
+
 
 
 /**
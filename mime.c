@@ -0,0 +1,269 @@
+#include "mime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "bool.h"
+
+#define MIME_MAX_EXT 16
+#define MIME_MAX_TYPE 128
+
+typedef struct MimeEntry_t
+{
+    char ext[MIME_MAX_EXT];
+    const char *type;
+} MimeEntry;
+
+struct MimeTable_t
+{
+    MimeEntry *slots;
+    size_t capacity; // always a power of two
+    size_t count;
+};
+
+static const char *mimeBuiltin[][2] = {
+    {"html", "text/html"}, {"htm", "text/html"}, {"shtml", "text/html"},
+    {"css", "text/css"}, {"csv", "text/csv"}, {"txt", "text/plain"},
+    {"text", "text/plain"}, {"log", "text/plain"}, {"md", "text/markdown"},
+    {"xml", "text/xml"}, {"ics", "text/calendar"}, {"vcf", "text/vcard"},
+    {"js", "text/javascript"}, {"mjs", "text/javascript"},
+    {"json", "application/json"}, {"map", "application/json"},
+    {"jsonld", "application/ld+json"}, {"webmanifest", "application/manifest+json"},
+    {"wasm", "application/wasm"}, {"pdf", "application/pdf"},
+    {"rtf", "application/rtf"}, {"ps", "application/postscript"},
+    {"eps", "application/postscript"}, {"ai", "application/postscript"},
+    {"xhtml", "application/xhtml+xml"}, {"rss", "application/rss+xml"},
+    {"atom", "application/atom+xml"}, {"xsl", "application/xslt+xml"},
+    {"zip", "application/zip"}, {"gz", "application/gzip"},
+    {"tgz", "application/gzip"}, {"bz2", "application/x-bzip2"},
+    {"xz", "application/x-xz"}, {"zst", "application/zstd"},
+    {"7z", "application/x-7z-compressed"}, {"rar", "application/vnd.rar"},
+    {"tar", "application/x-tar"}, {"jar", "application/java-archive"},
+    {"war", "application/java-archive"}, {"class", "application/java-vm"},
+    {"bin", "application/octet-stream"}, {"exe", "application/octet-stream"},
+    {"dll", "application/octet-stream"}, {"so", "application/octet-stream"},
+    {"iso", "application/octet-stream"}, {"img", "application/octet-stream"},
+    {"dmg", "application/octet-stream"}, {"deb", "application/vnd.debian.binary-package"},
+    {"rpm", "application/x-rpm"}, {"apk", "application/vnd.android.package-archive"},
+    {"doc", "application/msword"}, {"dot", "application/msword"},
+    {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"xls", "application/vnd.ms-excel"},
+    {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"odt", "application/vnd.oasis.opendocument.text"},
+    {"ods", "application/vnd.oasis.opendocument.spreadsheet"},
+    {"odp", "application/vnd.oasis.opendocument.presentation"},
+    {"epub", "application/epub+zip"}, {"swf", "application/x-shockwave-flash"},
+    {"sh", "application/x-sh"}, {"csh", "application/x-csh"},
+    {"pl", "application/x-perl"}, {"py", "text/x-python"},
+    {"c", "text/x-c"}, {"h", "text/x-c"}, {"cc", "text/x-c"},
+    {"cpp", "text/x-c"}, {"java", "text/x-java-source"},
+    {"yaml", "application/yaml"}, {"yml", "application/yaml"},
+    {"toml", "application/toml"}, {"sql", "application/sql"},
+    {"gif", "image/gif"}, {"jpg", "image/jpeg"}, {"jpeg", "image/jpeg"},
+    {"jpe", "image/jpeg"}, {"png", "image/png"}, {"apng", "image/apng"},
+    {"webp", "image/webp"}, {"avif", "image/avif"}, {"heic", "image/heic"},
+    {"heif", "image/heif"}, {"bmp", "image/bmp"}, {"ico", "image/x-icon"},
+    {"cur", "image/x-icon"}, {"svg", "image/svg+xml"}, {"svgz", "image/svg+xml"},
+    {"tif", "image/tiff"}, {"tiff", "image/tiff"}, {"jxl", "image/jxl"},
+    {"psd", "image/vnd.adobe.photoshop"},
+    {"mp3", "audio/mpeg"}, {"ogg", "audio/ogg"}, {"oga", "audio/ogg"},
+    {"opus", "audio/opus"}, {"wav", "audio/wav"}, {"flac", "audio/flac"},
+    {"aac", "audio/aac"}, {"m4a", "audio/mp4"}, {"mid", "audio/midi"},
+    {"midi", "audio/midi"}, {"weba", "audio/webm"},
+    {"mp4", "video/mp4"}, {"m4v", "video/mp4"}, {"mpeg", "video/mpeg"},
+    {"mpg", "video/mpeg"}, {"webm", "video/webm"}, {"ogv", "video/ogg"},
+    {"mov", "video/quicktime"}, {"avi", "video/x-msvideo"},
+    {"wmv", "video/x-ms-wmv"}, {"flv", "video/x-flv"}, {"mkv", "video/x-matroska"},
+    {"3gp", "video/3gpp"}, {"ts", "video/mp2t"}, {"m3u8", "application/vnd.apple.mpegurl"},
+    {"woff", "font/woff"}, {"woff2", "font/woff2"}, {"ttf", "font/ttf"},
+    {"otf", "font/otf"}, {"eot", "application/vnd.ms-fontobject"},
+};
+
+static struct MimeTable_t mimeTable = {NULL, 0, 0};
+static pthread_once_t mimeOnce = PTHREAD_ONCE_INIT;
+
+/**
+* mimeHash: FNV-1a over the (already lower-cased) extension
+*/
+static size_t mimeHash(const char *ext)
+{
+    size_t hash = 2166136261u;
+    for (; *ext; ext++)
+    {
+        hash ^= (unsigned char)*ext;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+* mimeFindSlot: Returns the slot holding ext, or the empty slot where it
+*   would be inserted.
+*/
+static MimeEntry *mimeFindSlot(struct MimeTable_t *table, const char *ext)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = mimeHash(ext) & mask;
+
+    while (table->slots[i].type != NULL && strcmp(table->slots[i].ext, ext))
+    {
+        i = (i + 1) & mask;
+    }
+    return &table->slots[i];
+}
+
+static bool mimeGrow(struct MimeTable_t *table)
+{
+    size_t capacity = table->capacity ? table->capacity * 2 : 1024;
+    MimeEntry *old = table->slots;
+    size_t oldCapacity = table->capacity;
+
+    table->slots = calloc(capacity, sizeof(*table->slots));
+    if (table->slots == NULL)
+    {
+        table->slots = old;
+        return false;
+    }
+    table->capacity = capacity;
+    for (size_t i = 0; i < oldCapacity; i++)
+    {
+        if (old[i].type != NULL)
+        {
+            *mimeFindSlot(table, old[i].ext) = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+/**
+* mimeInsert: Adds or replaces the type of ext. type must outlive the table.
+*/
+static bool mimeInsert(struct MimeTable_t *table, const char *ext, const char *type)
+{
+    char key[MIME_MAX_EXT];
+    size_t len = strlen(ext);
+
+    if (len == 0 || len >= MIME_MAX_EXT)
+    {
+        return false;
+    }
+    for (size_t i = 0; i <= len; i++)
+    {
+        key[i] = tolower((unsigned char)ext[i]);
+    }
+
+    // keep the load factor under 1/4 so probe sequences stay short
+    if ((table->count + 1) * 4 > table->capacity && !mimeGrow(table))
+    {
+        return false;
+    }
+
+    MimeEntry *slot = mimeFindSlot(table, key);
+    if (slot->type == NULL)
+    {
+        table->count++;
+        strcpy(slot->ext, key);
+    }
+    slot->type = type;
+    return true;
+}
+
+static void mimeBuildBuiltin(void)
+{
+    for (size_t i = 0; i < sizeof(mimeBuiltin) / sizeof(mimeBuiltin[0]); i++)
+    {
+        mimeInsert(&mimeTable, mimeBuiltin[i][0], mimeBuiltin[i][1]);
+    }
+}
+
+static int mimeLoadFile(const char *typesFile)
+{
+    char line[1024];
+    FILE *file = fopen(typesFile, "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char *save = NULL;
+        char *type = strtok_r(line, " \t\r\n", &save);
+        if (type == NULL || type[0] == '#' || strlen(type) >= MIME_MAX_TYPE)
+        {
+            continue;
+        }
+
+        char *ext = strtok_r(NULL, " \t\r\n;", &save);
+        if (ext == NULL)
+        {
+            continue;
+        }
+        // types from the file live as long as the table, which is forever
+        char *stored = strdup(type);
+        if (stored == NULL)
+        {
+            break;
+        }
+        for (; ext != NULL; ext = strtok_r(NULL, " \t\r\n;", &save))
+        {
+            mimeInsert(&mimeTable, ext, stored);
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+int mimeInit(const char *typesFile)
+{
+    pthread_once(&mimeOnce, mimeBuildBuiltin);
+    if (typesFile == NULL)
+    {
+        return 0;
+    }
+    return mimeLoadFile(typesFile);
+}
+
+const char *mimeLookup(const char *filename)
+{
+    char key[MIME_MAX_EXT];
+    const char *ext = NULL;
+    size_t len = 0;
+
+    pthread_once(&mimeOnce, mimeBuildBuiltin);
+
+    // extension of the last path component only, so "a.d/file" has none
+    for (const char *p = filename; *p; p++)
+    {
+        if (*p == '/')
+        {
+            ext = NULL;
+        }
+        else if (*p == '.')
+        {
+            ext = p + 1;
+        }
+    }
+    if (ext == NULL || mimeTable.capacity == 0)
+    {
+        return MIME_DEFAULT_TYPE;
+    }
+
+    for (; ext[len]; len++)
+    {
+        if (len + 1 >= MIME_MAX_EXT)
+        {
+            return MIME_DEFAULT_TYPE;
+        }
+        key[len] = tolower((unsigned char)ext[len]);
+    }
+    key[len] = '\0';
+
+    MimeEntry *slot = mimeFindSlot(&mimeTable, key);
+    return slot->type != NULL ? slot->type : MIME_DEFAULT_TYPE;
+}
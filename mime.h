@@ -0,0 +1,47 @@
+#ifndef MIME_H_
+#define MIME_H_
+
+#include <stddef.h>
+
+/**
+* MIME type table
+*
+* Maps file extensions to content types. The table is seeded with a built-in
+* list and may be extended from a mime.types style file ("type ext ext ...")
+* at startup. Lookups hash the extension into an open-addressed table that is
+* kept at most a quarter full, so lookup cost does not grow with the number of
+* types.
+*
+* The table is built once before the worker threads start and is read-only
+* afterwards, so lookups take no locks.
+*
+*   mimeInit    - Builds the table, optionally extending it from a file.
+*   mimeLookup  - Returns the content type of a file name.
+*/
+
+/** Content type returned for unknown or missing extensions */
+#define MIME_DEFAULT_TYPE "text/plain"
+
+/**
+* mimeInit: Builds the lookup table from the built-in list and, if typesFile is
+* not NULL, from a mime.types style file. Entries from the file override the
+* built-in ones.
+*
+* @param typesFile - Path of a mime.types file, or NULL.
+* @return
+*   0 on success
+*   -1 if the file could not be read (the built-in table is still usable)
+*/
+int mimeInit(const char *typesFile);
+
+/**
+* mimeLookup: Returns the content type for filename based on its extension
+*   (the text after the last '.' of the last path component).
+*   Matching is case-insensitive. Safe to call before mimeInit, in which case
+*   the table is built lazily from the built-in list.
+* @return
+*   The content type, MIME_DEFAULT_TYPE if the extension is unknown.
+*/
+const char *mimeLookup(const char *filename);
+
+#endif // MIME_H_
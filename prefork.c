@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include "prefork.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+
+/** A worker that dies sooner than this after starting is not started again */
+#define PREFORK_MIN_LIFE_SEC 1
+
+/* A worker's slot of the shared segment, on cache lines of its own */
+typedef struct PreforkSlot_t
+{
+    PreforkStats stats __attribute__((aligned(64)));
+} PreforkSlot;
+
+static struct
+{
+    PreforkSlot *slots;     // shared by every process
+    int count;
+    int self;               // the slot of this process
+    time_t started[PREFORK_MAX_WORKERS];    // kept by the master
+} prefork;
+
+int preforkInit(int workers)
+{
+    prefork.count = workers > 0 ? workers : 1;
+    prefork.slots = mmap(NULL, prefork.count * sizeof(PreforkSlot), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (prefork.slots == MAP_FAILED)
+    {
+        prefork.slots = NULL;
+        return -1;
+    }
+    prefork.slots[0].stats.pid = getpid();
+    prefork.slots[0].stats.starts = 1;
+    return 0;
+}
+
+/* Forks worker index; returns its pid in the master, -1 when fork failed */
+static pid_t PreforkStart(int index, PreforkWorker worker, void *arg, int masterfd)
+{
+    pid_t master = getpid();
+    pid_t pid = fork();
+    sigset_t child;
+
+    if (pid != 0)
+    {
+        if (pid > 0)
+        {
+            __atomic_store_n(&prefork.slots[index].stats.pid, pid, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&prefork.slots[index].stats.starts, 1, __ATOMIC_RELAXED);
+            prefork.started[index] = time(NULL);
+        }
+        return pid;
+    }
+
+    // the worker: stops with the master, even when it is killed outright
+    close(masterfd);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != master)
+    {
+        exit(0);
+    }
+    sigemptyset(&child);
+    sigaddset(&child, SIGCHLD);
+    pthread_sigmask(SIG_UNBLOCK, &child, NULL);
+    prefork.self = index;
+    worker(index, arg);
+    exit(0);
+}
+
+static void PreforkSignal(int signo)
+{
+    for (int i = 0; i < prefork.count; i++)
+    {
+        pid_t pid = __atomic_load_n(&prefork.slots[i].stats.pid, __ATOMIC_RELAXED);
+        if (pid > 0)
+        {
+            kill(pid, signo);
+        }
+    }
+}
+
+static int PreforkIndex(pid_t pid)
+{
+    for (int i = 0; i < prefork.count; i++)
+    {
+        if (prefork.slots[i].stats.pid == pid)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Reaps the workers that ended and starts them again unless stopping */
+static void PreforkReap(PreforkWorker worker, void *arg, int masterfd, int stopping, int *running)
+{
+    pid_t pid;
+    int status, index;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        if ((index = PreforkIndex(pid)) < 0)
+        {
+            continue;
+        }
+        __atomic_store_n(&prefork.slots[index].stats.pid, 0, __ATOMIC_RELAXED);
+        (*running)--;
+        if (stopping)
+        {
+            continue;
+        }
+
+        if (WIFSIGNALED(status))
+        {
+            fprintf(stderr, "Worker %d (pid %d) killed by signal %d\n", index, pid, WTERMSIG(status));
+        }
+        else
+        {
+            fprintf(stderr, "Worker %d (pid %d) exited with status %d\n", index, pid, WEXITSTATUS(status));
+        }
+        // one that cannot even start would be restarted in a tight loop
+        if (time(NULL) - prefork.started[index] < PREFORK_MIN_LIFE_SEC)
+        {
+            fprintf(stderr, "Worker %d failed right after starting, not restarting it\n", index);
+        }
+        else if (PreforkStart(index, worker, arg, masterfd) > 0)
+        {
+            (*running)++;
+        }
+    }
+}
+
+int preforkRun(int workers, PreforkWorker worker, void *arg)
+{
+    struct signalfd_siginfo info;
+    sigset_t signals;
+    int masterfd, running = 0, stopping = 0;
+
+    // the workers' own signals stay with them: the master reads its own
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if ((masterfd = signalfd(-1, &signals, SFD_CLOEXEC)) < 0)
+    {
+        return -1;
+    }
+    prefork.slots[0].stats.pid = 0;
+    prefork.slots[0].stats.starts = 0;
+    for (int i = 0; i < workers; i++)
+    {
+        running += PreforkStart(i, worker, arg, masterfd) > 0;
+    }
+    if (running == 0)
+    {
+        close(masterfd);
+        return -1;
+    }
+
+    while (running > 0)
+    {
+        if (read(masterfd, &info, sizeof(info)) != sizeof(info))
+        {
+            continue;
+        }
+        if (info.ssi_signo == SIGCHLD)
+        {
+            PreforkReap(worker, arg, masterfd, stopping, &running);
+        }
+        else if (info.ssi_signo == SIGHUP)
+        {
+            PreforkSignal(SIGHUP);
+        }
+        else
+        {
+            stopping = 1;
+            PreforkSignal(SIGTERM);
+        }
+    }
+    close(masterfd);
+    return 0;
+}
+
+void preforkRecord(int status, long bytes)
+{
+    if (prefork.slots == NULL)
+    {
+        return;
+    }
+    PreforkStats *stats = &prefork.slots[prefork.self].stats;
+    int class = status / 100;
+    __atomic_fetch_add(&stats->requests, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->status[class >= 2 && class <= 5 ? class : 0], 1, __ATOMIC_RELAXED);
+    if (bytes > 0)
+    {
+        __atomic_fetch_add(&stats->bytes, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void preforkStats(int index, PreforkStats *stats)
+{
+    const PreforkStats *slot = &prefork.slots[index].stats;
+
+    stats->pid = __atomic_load_n(&slot->pid, __ATOMIC_RELAXED);
+    stats->starts = __atomic_load_n(&slot->starts, __ATOMIC_RELAXED);
+    stats->requests = __atomic_load_n(&slot->requests, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+    for (int i = 0; i < 6; i++)
+    {
+        stats->status[i] = __atomic_load_n(&slot->status[i], __ATOMIC_RELAXED);
+    }
+}
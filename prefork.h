@@ -0,0 +1,64 @@
+#ifndef PREFORK_H_
+#define PREFORK_H_
+
+#include <sys/types.h>
+
+/**
+* Prefork
+*
+* Runs the server as a master process and worker processes, as nginx does.
+* The master sets up everything the workers share (the listening socket, the
+* caches, the stats segment), forks the workers and then only supervises:
+* a worker that dies is started again, SIGHUP is passed on to every worker
+* and SIGTERM or SIGINT stops them all. Each worker runs its own thread pool
+* and accepts from the shared socket, so a crash takes down one worker and
+* the connections it held, never the others.
+*
+* Every worker has a slot in a shared stats segment. Only the worker writes
+* to it, so recording is a relaxed atomic add on its own cache lines, and
+* anyone may read it without a lock.
+*
+*   preforkInit   - Maps the stats segment.
+*   preforkRun    - Starts the workers and supervises them until stopped.
+*   preforkRecord - Counts a response in the calling worker's slot.
+*   preforkStats  - Reads a worker's slot.
+*/
+
+/** Most worker processes */
+#define PREFORK_MAX_WORKERS 256
+
+typedef struct PreforkStats_t {
+    pid_t pid;                  // 0 when not running
+    unsigned long starts;       // 1 + restarts after a crash
+    unsigned long requests;
+    unsigned long long bytes;   // body bytes sent
+    unsigned long status[6];    // by class: [2] 2xx to [5] 5xx, [0] anything else
+} PreforkStats;
+
+/**
+* PreforkWorker: Serves requests as worker index until told to stop, then
+*   returns. Runs in the child with every signal mask the master had, minus
+*   SIGCHLD.
+*/
+typedef void (*PreforkWorker)(int index, void *arg);
+
+/**
+* preforkInit: Maps the stats segment for workers slots (1 when the server
+*   runs as a single process); call before forking.
+* @return 0 on success, -1 on error
+*/
+int preforkInit(int workers);
+
+/**
+* preforkRun: Forks workers running worker(index, arg) and supervises them.
+*   Returns in the master once SIGTERM or SIGINT stopped them all; the
+*   workers never return from it.
+* @return 0, -1 when no worker could be started
+*/
+int preforkRun(int workers, PreforkWorker worker, void *arg);
+
+void preforkRecord(int status, long bytes);
+
+void preforkStats(int index, PreforkStats *stats);
+
+#endif // PREFORK_H_
@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+#include "prewarm.h"
+#include "fileCache.h"
+#include "route.h"
+#include "vhost.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/** Most paths taken from an access log */
+#define PREWARM_MAX_PATHS (1 << 20)
+
+typedef struct PrewarmList_t
+{
+    char **paths;
+    size_t count;
+    size_t capacity;
+} PrewarmList;
+
+typedef struct PrewarmCount_t
+{
+    char *path;             // NULL for an empty slot
+    unsigned long count;
+} PrewarmCount;
+
+/* Shared by the loading threads */
+static struct
+{
+    PrewarmList *list;
+    size_t next;            // taken with an atomic add
+    unsigned long cached;
+    unsigned long readAhead;
+    size_t bytes;
+} work;
+
+/* The list nftw fills; nftw has no argument for its callback */
+static PrewarmList *walked;
+
+int prewarmParseMode(const char *name, PrewarmMode *mode)
+{
+    static const struct { const char *name; PrewarmMode value; } names[] = {
+        {"off", PREWARM_OFF}, {"roots", PREWARM_ROOTS}, {"log", PREWARM_ACCESS_LOG},
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (!strcasecmp(name, names[i].name))
+        {
+            *mode = names[i].value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int PrewarmAdd(PrewarmList *list, const char *path)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity == 0 ? 256 : 2 * list->capacity;
+        char **paths = realloc(list->paths, capacity * sizeof(char *));
+        if (paths == NULL)
+        {
+            return -1;
+        }
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    if ((list->paths[list->count] = strdup(path)) == NULL)
+    {
+        return -1;
+    }
+    list->count++;
+    return 0;
+}
+
+static void PrewarmFree(PrewarmList *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+}
+
+static double PrewarmNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+/* Page cache only, for a file the file cache has no room for */
+static void PrewarmReadAhead(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat sbuf;
+
+    if (fd < 0)
+    {
+        return;
+    }
+    if (fstat(fd, &sbuf) == 0 && S_ISREG(sbuf.st_mode))
+    {
+        readahead(fd, 0, sbuf.st_size);
+        __atomic_fetch_add(&work.readAhead, 1, __ATOMIC_RELAXED);
+    }
+    close(fd);
+}
+
+static void *PrewarmThread(void *arg)
+{
+    size_t i;
+
+    (void)arg;
+    // the list is in priority order, and each thread takes the next file
+    while ((i = __atomic_fetch_add(&work.next, 1, __ATOMIC_RELAXED)) < work.list->count)
+    {
+        const char *path = work.list->paths[i];
+        int rc = fileCacheLoad(path);
+        if (rc > 0)
+        {
+            struct stat sbuf;
+            __atomic_fetch_add(&work.cached, 1, __ATOMIC_RELAXED);
+            if (stat(path, &sbuf) == 0)
+            {
+                __atomic_fetch_add(&work.bytes, sbuf.st_size, __ATOMIC_RELAXED);
+            }
+        }
+        else if (rc < 0)
+        {
+            PrewarmReadAhead(path);
+        }
+    }
+    return NULL;
+}
+
+/* Loads the files of list on threads threads and fills stats in */
+static void PrewarmLoad(PrewarmList *list, int threads, double started, PrewarmStats *stats)
+{
+    pthread_t ids[threads];
+    int running = 0;
+
+    memset(&work, 0, sizeof(work));
+    work.list = list;
+    for (; running < threads; running++)
+    {
+        if (pthread_create(&ids[running], NULL, PrewarmThread, NULL) != 0)
+        {
+            break;
+        }
+    }
+    if (running == 0)
+    {
+        PrewarmThread(NULL);
+    }
+    for (int i = 0; i < running; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+
+    stats->files = list->count;
+    stats->cached = work.cached;
+    stats->readAhead = work.readAhead;
+    stats->bytes = work.bytes;
+    stats->threads = running > 0 ? running : 1;
+    stats->ms = PrewarmNow() - started;
+}
+
+static int PrewarmVisit(const char *path, const struct stat *sbuf, int type, struct FTW *ftw)
+{
+    (void)ftw;
+    // hidden files are not served as content anyone asks for
+    const char *name = strrchr(path, '/');
+    if (name != NULL && name[1] == '.')
+    {
+        return type == FTW_D ? FTW_SKIP_SUBTREE : FTW_CONTINUE;
+    }
+    if (type == FTW_F && S_ISREG(sbuf->st_mode) && sbuf->st_size > 0 && PrewarmAdd(walked, path) < 0)
+    {
+        return FTW_STOP;
+    }
+    return FTW_CONTINUE;
+}
+
+int prewarmRoots(const char *const *dirs, int count, int threads, PrewarmStats *stats)
+{
+    PrewarmList list = {NULL, 0, 0};
+    double started = PrewarmNow();
+    int rc = 0;
+
+    walked = &list;
+    for (int i = 0; i < count; i++)
+    {
+        if (nftw(dirs[i], PrewarmVisit, 32, FTW_PHYS | FTW_ACTIONRETVAL) != 0)
+        {
+            rc = -1;
+        }
+    }
+    PrewarmLoad(&list, threads, started, stats);
+    PrewarmFree(&list);
+    return rc;
+}
+
+/* Finds the request of a log line: common, combined or JSON */
+static int PrewarmParseLine(char *line, char **uri)
+{
+    char method[16];
+    int status;
+
+    if (line[0] == '{')
+    {
+        char *m = strstr(line, "\"method\":\""), *u = strstr(line, "\"uri\":\""), *s = strstr(line, "\"status\":");
+        if (m == NULL || u == NULL || s == NULL || sscanf(s + 9, "%d", &status) != 1)
+        {
+            return -1;
+        }
+        m += 10;
+        u += 7;
+        if (strncmp(m, "GET\"", 4) != 0 || status != 200)
+        {
+            return -1;
+        }
+        *strchr(u, '"') = '\0';     // the escaper leaves no bare quote inside
+        *uri = u;
+        return 0;
+    }
+
+    char *request = strchr(line, '"');
+    if (request == NULL)
+    {
+        return -1;
+    }
+    char *space = strchr(request + 1, ' ');
+    char *end = space == NULL ? NULL : strchr(space + 1, ' ');
+    if (end == NULL || sscanf(request + 1, "%15s", method) != 1 || strcmp(method, "GET") != 0)
+    {
+        return -1;
+    }
+    *end = '\0';
+    if (sscanf(strchr(end + 1, '"') == NULL ? "" : strchr(end + 1, '"') + 1, "%d", &status) != 1 ||
+        status != 200)
+    {
+        return -1;
+    }
+    *uri = space + 1;
+    return 0;
+}
+
+/* FNV-1a, as for the MIME table */
+static size_t PrewarmHash(const char *path)
+{
+    size_t hash = 14695981039346656037ULL;
+    for (; *path != '\0'; path++)
+    {
+        hash = (hash ^ (unsigned char)*path) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* The counter of path in an open-addressing table kept at most half full */
+static PrewarmCount *PrewarmCountPath(PrewarmCount **table, size_t *size, size_t *used, const char *path)
+{
+    if (2 * (*used + 1) > *size)
+    {
+        size_t grown = *size == 0 ? 1024 : 2 * *size;
+        PrewarmCount *bigger = calloc(grown, sizeof(PrewarmCount));
+        if (bigger == NULL)
+        {
+            return NULL;
+        }
+        for (size_t i = 0; i < *size; i++)
+        {
+            if ((*table)[i].path != NULL)
+            {
+                size_t j = PrewarmHash((*table)[i].path) & (grown - 1);
+                while (bigger[j].path != NULL)
+                {
+                    j = (j + 1) & (grown - 1);
+                }
+                bigger[j] = (*table)[i];
+            }
+        }
+        free(*table);
+        *table = bigger;
+        *size = grown;
+    }
+    size_t i = PrewarmHash(path) & (*size - 1);
+    while ((*table)[i].path != NULL && strcmp((*table)[i].path, path) != 0)
+    {
+        i = (i + 1) & (*size - 1);
+    }
+    if ((*table)[i].path == NULL)
+    {
+        if (*used == PREWARM_MAX_PATHS || ((*table)[i].path = strdup(path)) == NULL)
+        {
+            return NULL;
+        }
+        (*used)++;
+    }
+    return &(*table)[i];
+}
+
+static int PrewarmByCount(const void *a, const void *b)
+{
+    unsigned long x = ((const PrewarmCount *)a)->count, y = ((const PrewarmCount *)b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* The file the default site serves for path, NULL for anything not a static file */
+static const char *PrewarmFile(char *path, char *filename, size_t size)
+{
+    char *query = strchr(path, '?');
+
+    if (query != NULL)
+    {
+        *query = '\0';
+    }
+    return routeStaticFile(vhostLookup("")->routes, path, filename, size);
+}
+
+int prewarmAccessLog(const char *logPath, int threads, PrewarmStats *stats)
+{
+    char line[16 * 1024], filename[PATH_MAX], *uri;
+    PrewarmCount *table = NULL;
+    PrewarmList list = {NULL, 0, 0};
+    size_t size = 0, used = 0, n = 0;
+    double started = PrewarmNow();
+    FILE *file = fopen(logPath, "r");
+
+    if (file == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        PrewarmCount *counted;
+        if (PrewarmParseLine(line, &uri) == 0 && strchr(uri, '\\') == NULL &&
+            (counted = PrewarmCountPath(&table, &size, &used, uri)) != NULL)
+        {
+            counted->count++;
+        }
+    }
+    fclose(file);
+
+    // the hottest paths first, so they are the ones that fit
+    for (size_t i = 0; i < size; i++)
+    {
+        if (table[i].path != NULL)
+        {
+            table[n++] = table[i];
+        }
+    }
+    qsort(table, n, sizeof(PrewarmCount), PrewarmByCount);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (PrewarmFile(table[i].path, filename, sizeof(filename)) != NULL)
+        {
+            PrewarmAdd(&list, filename);
+        }
+        free(table[i].path);
+    }
+    free(table);
+
+    PrewarmLoad(&list, threads, started, stats);
+    PrewarmFree(&list);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef PREWARM_H_
+#define PREWARM_H_
+
+#include <stddef.h>
+
+/**
+* Prewarm
+*
+* Loads static files into the file cache at startup, before the listener
+* accepts, so the first requests after a restart do not pay for cold stat,
+* open and page faults. The files come either from walking the static
+* directories of every site, or from the previous run's access log, most
+* requested first, until the file cache is full. Files that do not fit are
+* still read ahead into the page cache. Several threads load at once, since
+* on a cold disk most of the time is spent waiting for reads.
+*
+*   prewarmParseMode - Maps a mode name (off, roots, log).
+*   prewarmRoots     - Loads every file under the given directories.
+*   prewarmAccessLog - Loads the files an access log asked for most.
+*/
+
+typedef enum PrewarmMode_t {
+    PREWARM_OFF,
+    PREWARM_ROOTS,          // walk the document roots and static routes
+    PREWARM_ACCESS_LOG      // replay the hottest paths of the access log
+} PrewarmMode;
+
+typedef struct PrewarmStats_t {
+    unsigned long files;        // files considered
+    unsigned long cached;       // loaded into the file cache
+    unsigned long readAhead;    // did not fit, read into the page cache only
+    size_t bytes;               // of the cached files
+    int threads;
+    double ms;                  // wall time of the whole phase
+} PrewarmStats;
+
+/**
+* prewarmParseMode: Maps a mode name to its PrewarmMode.
+* @return 0 on success, -1 for an unknown name
+*/
+int prewarmParseMode(const char *name, PrewarmMode *mode);
+
+/**
+* prewarmRoots: Loads the regular files under the count directories, using
+*   threads threads.
+* @return 0 on success, -1 when a directory could not be walked
+*/
+int prewarmRoots(const char *const *dirs, int count, int threads, PrewarmStats *stats);
+
+/**
+* prewarmAccessLog: Loads the files behind the paths GET requests in the
+*   access log at logPath (any format) got a 200 for, most requested first.
+*   Paths are mapped to files through the default site's routes.
+* @return 0 on success, -1 when the log could not be read
+*/
+int prewarmAccessLog(const char *logPath, int threads, PrewarmStats *stats);
+
+#endif // PREWARM_H_
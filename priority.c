@@ -0,0 +1,640 @@
+#define _GNU_SOURCE
+#include "priority.h"
+#include "route.h"
+#include "http2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/** Matches one class may have */
+#define PRIORITY_MAX_MATCHES 8
+/** Longest path prefix, header name or header value of a match */
+#define PRIORITY_MATCH_MAX 128
+/** What classification peeks at: the request line and the first headers */
+#define PRIORITY_PEEK_BYTES 4096
+#define PRIORITY_MAX_WEIGHT 1000
+#define PRIORITY_MAX_QUEUE (1 << 24)
+#define PRIORITY_MAX_LIMIT 4096
+
+typedef enum PriorityMatchKind_t {
+    MATCH_PATH,
+    MATCH_HEADER,
+    MATCH_SUBNET
+} PriorityMatchKind;
+
+typedef struct PriorityMatch_t
+{
+    PriorityMatchKind kind;
+    char text[PRIORITY_MATCH_MAX];      // path prefix or header name
+    char value[PRIORITY_MATCH_MAX];     // header value, "" for any
+    uint32_t network;                   // host order, already masked
+    uint32_t mask;
+} PriorityMatch;
+
+typedef struct PriorityEntry_t
+{
+    int fd;
+    unsigned long long enqueuedNs;
+} PriorityEntry;
+
+typedef struct PriorityClass_t
+{
+    char name[32];
+    int weight;
+    size_t queueSize;
+    int limit;
+    PriorityMatch matches[PRIORITY_MAX_MATCHES];
+    int matchCount;
+
+    PriorityEntry *ring;        // grows up to the class bound
+    size_t capacity;
+    size_t head;
+    size_t count;
+    long deficit;               // requests it may still send this round
+    int busy;                   // taken by workers and not yet done
+
+    unsigned long queued;
+    unsigned long served;
+    unsigned long dropped;
+    unsigned long wait[PRIORITY_LATENCY_BUCKETS];
+    unsigned long total[PRIORITY_LATENCY_BUCKETS];
+} PriorityClass;
+
+static struct
+{
+    PriorityClass classes[PRIORITY_MAX_CLASSES + 1];    // the default class last
+    int count;
+    int current;                // whose turn it is
+    bool peek;                  // some class matches on the request
+    bool peer;                  // some class matches on the client address
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;       // a connection may be taken
+    int sleepers;
+} priority = { .mutex = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER };
+
+static unsigned long long PriorityNowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static bool PriorityNumber(const char *text, long min, long max, long *out)
+{
+    char *end;
+    errno = 0;
+    long number = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || number < min || number > max)
+    {
+        return false;
+    }
+    *out = number;
+    return true;
+}
+
+/* header names are tokens: letters, digits and a few marks */
+static bool PriorityHeaderName(const char *name, size_t len)
+{
+    if (len == 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isalnum((unsigned char)name[i]) && !strchr("!#$%&'*+-.^_`|~", name[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char *PriorityParseMatch(char *word, PriorityClass *cls)
+{
+    PriorityMatch *match = &cls->matches[cls->matchCount];
+    char *value = strchr(word, '=');
+    long number;
+
+    if (value == NULL)
+    {
+        return "expected path=, header=, subnet= or limit=";
+    }
+    *value++ = '\0';
+    if (!strcasecmp(word, "limit"))
+    {
+        if (!PriorityNumber(value, 1, PRIORITY_MAX_LIMIT, &number))
+        {
+            return "invalid limit";
+        }
+        cls->limit = (int)number;
+        return NULL;
+    }
+    if (cls->matchCount == PRIORITY_MAX_MATCHES)
+    {
+        return "too many matches";
+    }
+
+    memset(match, 0, sizeof(*match));
+    if (!strcasecmp(word, "path"))
+    {
+        size_t len = strlen(value);
+        if (value[0] != '/' || len >= PRIORITY_MATCH_MAX)
+        {
+            return "expected path=/PREFIX";
+        }
+        strcpy(match->text, value);
+        if (routeNormalize(match->text) != 0)
+        {
+            return "invalid path";
+        }
+        // matched by whole segments, like route prefixes
+        len = strlen(match->text);
+        if (len > 1 && match->text[len - 1] == '/')
+        {
+            match->text[len - 1] = '\0';
+        }
+        match->kind = MATCH_PATH;
+    }
+    else if (!strcasecmp(word, "header"))
+    {
+        char *colon = strchr(value, ':');
+        size_t nameLen = colon != NULL ? (size_t)(colon - value) : strlen(value);
+        if (!PriorityHeaderName(value, nameLen) || nameLen >= PRIORITY_MATCH_MAX ||
+            (colon != NULL && (colon[1] == '\0' || strlen(colon + 1) >= PRIORITY_MATCH_MAX)))
+        {
+            return "expected header=NAME or header=NAME:VALUE";
+        }
+        memcpy(match->text, value, nameLen);
+        if (colon != NULL)
+        {
+            strcpy(match->value, colon + 1);
+        }
+        match->kind = MATCH_HEADER;
+    }
+    else if (!strcasecmp(word, "subnet"))
+    {
+        char *slash = strchr(value, '/');
+        struct in_addr addr;
+        long bits = 32;
+        if (slash != NULL)
+        {
+            *slash++ = '\0';
+        }
+        if (inet_pton(AF_INET, value, &addr) != 1 ||
+            (slash != NULL && !PriorityNumber(slash, 0, 32, &bits)))
+        {
+            return "expected subnet=ADDR/BITS";
+        }
+        match->mask = bits == 0 ? 0 : 0xffffffffu << (32 - bits);
+        match->network = ntohl(addr.s_addr) & match->mask;
+        match->kind = MATCH_SUBNET;
+    }
+    else
+    {
+        return "expected path=, header=, subnet= or limit=";
+    }
+    cls->matchCount++;
+    return NULL;
+}
+
+/* Parses "NAME WEIGHT QUEUE MATCH..." into cls */
+static const char *PriorityParse(const char *line, PriorityClass *cls)
+{
+    char copy[PRIORITY_TEXT_MAX];
+    char *save;
+    long number;
+
+    if (strlen(line) >= sizeof(copy))
+    {
+        return "line too long";
+    }
+    strcpy(copy, line);
+    memset(cls, 0, sizeof(*cls));
+
+    char *name = strtok_r(copy, " \t", &save);
+    char *weight = strtok_r(NULL, " \t", &save);
+    char *queue = strtok_r(NULL, " \t", &save);
+    if (name == NULL || weight == NULL || queue == NULL)
+    {
+        return "expected NAME WEIGHT QUEUE MATCH...";
+    }
+    if (strlen(name) >= sizeof(cls->name) || !PriorityHeaderName(name, strlen(name)) ||
+        !strcasecmp(name, "default"))
+    {
+        return "invalid class name";
+    }
+    strcpy(cls->name, name);
+    if (!PriorityNumber(weight, 1, PRIORITY_MAX_WEIGHT, &number))
+    {
+        return "weight out of range";
+    }
+    cls->weight = (int)number;
+    if (!PriorityNumber(queue, 1, PRIORITY_MAX_QUEUE, &number))
+    {
+        return "queue size out of range";
+    }
+    cls->queueSize = (size_t)number;
+
+    for (char *word = strtok_r(NULL, " \t", &save); word != NULL; word = strtok_r(NULL, " \t", &save))
+    {
+        const char *reason = PriorityParseMatch(word, cls);
+        if (reason != NULL)
+        {
+            return reason;
+        }
+    }
+    return cls->matchCount > 0 ? NULL : "a class needs at least one match";
+}
+
+const char *priorityParseLine(const char *line)
+{
+    PriorityClass cls;
+    return PriorityParse(line, &cls);
+}
+
+bool priorityPeeks(const char *lines)
+{
+    char line[PRIORITY_TEXT_MAX];
+    PriorityClass cls;
+
+    while (*lines != '\0')
+    {
+        size_t len = strcspn(lines, "\n");
+        memcpy(line, lines, len);
+        line[len] = '\0';
+        lines += len + (lines[len] == '\n');
+
+        if (PriorityParse(line, &cls) != NULL)
+        {
+            continue;
+        }
+        for (int i = 0; i < cls.matchCount; i++)
+        {
+            if (cls.matches[i].kind != MATCH_SUBNET)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int priorityInit(const char *lines, int defaultWeight)
+{
+    char line[PRIORITY_TEXT_MAX];
+    int count = 0;
+
+    while (*lines != '\0' && count < PRIORITY_MAX_CLASSES)
+    {
+        size_t len = strcspn(lines, "\n");
+        memcpy(line, lines, len);
+        line[len] = '\0';
+        lines += len + (lines[len] == '\n');
+
+        PriorityClass *cls = &priority.classes[count];
+        if (PriorityParse(line, cls) != NULL)
+        {
+            continue;
+        }
+        for (int i = 0; i < cls->matchCount; i++)
+        {
+            priority.peek |= cls->matches[i].kind != MATCH_SUBNET;
+            priority.peer |= cls->matches[i].kind == MATCH_SUBNET;
+        }
+        count++;
+    }
+
+    PriorityClass *fallback = &priority.classes[count];
+    memset(fallback, 0, sizeof(*fallback));
+    strcpy(fallback->name, "default");
+    fallback->weight = defaultWeight;
+    priority.count = count + 1;
+    priority.current = 0;
+    return 0;
+}
+
+/**
+* PriorityPath: Copies the normalized path of the request line at the start
+*   of request into path.
+* @return false when there is no whole request line yet, or it is not HTTP
+*/
+static bool PriorityPath(const char *request, char *path, size_t size)
+{
+    const char *target = strchr(request, ' ');
+    if (target == NULL || *++target != '/')
+    {
+        return false;
+    }
+    size_t len = strcspn(target, " ?#\r\n");
+    if (target[len] != ' ' && target[len] != '?' && target[len] != '#')
+    {
+        return false;
+    }
+    if (len >= size)
+    {
+        return false;
+    }
+    memcpy(path, target, len);
+    path[len] = '\0';
+    return routeNormalize(path) == 0;
+}
+
+static bool PriorityPathMatches(const char *prefix, const char *path)
+{
+    size_t len = strlen(prefix);
+    if (len == 1)
+    {
+        return true;
+    }
+    return !strncmp(path, prefix, len) && (path[len] == '\0' || path[len] == '/');
+}
+
+/* Whether the headers of request hold match's header (with its value, if any) */
+static bool PriorityHeaderMatches(const PriorityMatch *match, const char *request)
+{
+    size_t nameLen = strlen(match->text);
+    const char *line = strstr(request, "\r\n");
+
+    while (line != NULL && line[2] != '\r' && line[2] != '\0')
+    {
+        line += 2;
+        const char *end = strstr(line, "\r\n");
+        if (end == NULL)
+        {
+            // cut off by the peek: not a whole header
+            return false;
+        }
+        if (!strncasecmp(line, match->text, nameLen) && line[nameLen] == ':')
+        {
+            const char *value = line + nameLen + 1;
+            while (*value == ' ' || *value == '\t')
+            {
+                value++;
+            }
+            size_t valueLen = end - value;
+            while (valueLen > 0 && (value[valueLen - 1] == ' ' || value[valueLen - 1] == '\t'))
+            {
+                valueLen--;
+            }
+            if (match->value[0] == '\0' ||
+                (valueLen == strlen(match->value) && !strncasecmp(value, match->value, valueLen)))
+            {
+                return true;
+            }
+        }
+        line = end;
+    }
+    return false;
+}
+
+/* The class of fd: the first with a matching match, the default class otherwise */
+static int PriorityClassify(int fd)
+{
+    char request[PRIORITY_PEEK_BYTES + 1];
+    char path[ROUTE_PATH_MAX + 1];
+    bool havePath = false, haveRequest = false, haveAddr = false;
+    uint32_t addr = 0;
+
+    if (priority.peek)
+    {
+        // nothing is consumed: the worker reads the request as if unpeeked
+        ssize_t got = recv(fd, request, PRIORITY_PEEK_BYTES, MSG_PEEK | MSG_DONTWAIT);
+        request[got > 0 ? got : 0] = '\0';
+        haveRequest = got > 0;
+        havePath = haveRequest && PriorityPath(request, path, sizeof(path));
+    }
+    if (priority.peer)
+    {
+        struct sockaddr_in peer;
+        socklen_t len = sizeof(peer);
+        if (http2PeerName(fd, (struct sockaddr *)&peer, &len) == 0 && peer.sin_family == AF_INET)
+        {
+            addr = ntohl(peer.sin_addr.s_addr);
+            haveAddr = true;
+        }
+    }
+
+    for (int i = 0; i < priority.count - 1; i++)
+    {
+        const PriorityClass *cls = &priority.classes[i];
+        for (int j = 0; j < cls->matchCount; j++)
+        {
+            const PriorityMatch *match = &cls->matches[j];
+            if ((match->kind == MATCH_PATH && havePath && PriorityPathMatches(match->text, path)) ||
+                (match->kind == MATCH_HEADER && haveRequest && PriorityHeaderMatches(match, request)) ||
+                (match->kind == MATCH_SUBNET && haveAddr && (addr & match->mask) == match->network))
+            {
+                return i;
+            }
+        }
+    }
+    return priority.count - 1;
+}
+
+/* Makes room for one more entry in the ring of cls, keeping it under bound */
+static int PriorityGrow(PriorityClass *cls, size_t bound)
+{
+    if (cls->count < cls->capacity)
+    {
+        return 0;
+    }
+    size_t capacity = cls->capacity > 0 ? cls->capacity * 2 : 16;
+    if (capacity > bound)
+    {
+        capacity = bound;
+    }
+    PriorityEntry *ring = malloc(capacity * sizeof(*ring));
+    if (ring == NULL)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < cls->count; i++)
+    {
+        ring[i] = cls->ring[(cls->head + i) % cls->capacity];
+    }
+    free(cls->ring);
+    cls->ring = ring;
+    cls->capacity = capacity;
+    cls->head = 0;
+    return 0;
+}
+
+int priorityEnqueue(int fd, size_t defaultQueue)
+{
+    int index = PriorityClassify(fd);
+    PriorityClass *cls = &priority.classes[index];
+    size_t bound = index == priority.count - 1 ? defaultQueue : cls->queueSize;
+    int result = 0;
+
+    pthread_mutex_lock(&priority.mutex);
+        if (cls->count >= bound || PriorityGrow(cls, bound) < 0)
+        {
+            cls->dropped++;
+            result = -1;
+        }
+        else
+        {
+            PriorityEntry *entry = &cls->ring[(cls->head + cls->count) % cls->capacity];
+            entry->fd = fd;
+            entry->enqueuedNs = PriorityNowNs();
+            cls->count++;
+            cls->queued++;
+            if (priority.sleepers > 0)
+            {
+                pthread_cond_signal(&priority.ready);
+            }
+        }
+    pthread_mutex_unlock(&priority.mutex);
+    return result;
+}
+
+static bool PriorityEligible(const PriorityClass *cls)
+{
+    return cls->count > 0 && (cls->limit == 0 || cls->busy < cls->limit);
+}
+
+/**
+* PriorityPick: Deficit round robin, a request being the unit of cost: a
+*   class gets its weight in credit each time its turn comes with requests
+*   waiting, and keeps the turn until the credit or the requests run out.
+* @return the class to take from, -1 when none may send anything
+*/
+static int PriorityPick(void)
+{
+    bool any = false;
+    for (int i = 0; i < priority.count; i++)
+    {
+        any |= PriorityEligible(&priority.classes[i]);
+    }
+    if (!any)
+    {
+        return -1;
+    }
+
+    for (;;)
+    {
+        PriorityClass *cls = &priority.classes[priority.current];
+        if (PriorityEligible(cls) && cls->deficit > 0)
+        {
+            return priority.current;
+        }
+        if (cls->count == 0)
+        {
+            // an idle class does not bank the turns it skipped
+            cls->deficit = 0;
+        }
+        priority.current = (priority.current + 1) % priority.count;
+        cls = &priority.classes[priority.current];
+        if (PriorityEligible(cls))
+        {
+            cls->deficit += cls->weight;
+        }
+    }
+}
+
+int priorityDequeue(unsigned long long *enqueuedNs, int *cls)
+{
+    PriorityEntry entry;
+    int index;
+
+    pthread_mutex_lock(&priority.mutex);
+        while ((index = PriorityPick()) < 0)
+        {
+            priority.sleepers++;
+            pthread_cond_wait(&priority.ready, &priority.mutex);
+            priority.sleepers--;
+        }
+        PriorityClass *picked = &priority.classes[index];
+        entry = picked->ring[picked->head];
+        picked->head = (picked->head + 1) % picked->capacity;
+        picked->count--;
+        picked->deficit--;
+        picked->busy++;
+    pthread_mutex_unlock(&priority.mutex);
+
+    *enqueuedNs = entry.enqueuedNs;
+    *cls = index;
+    return entry.fd;
+}
+
+static int PriorityBucket(unsigned long long ns)
+{
+    unsigned long long us = ns / 1000;
+    int bucket = 0;
+    while (bucket < PRIORITY_LATENCY_BUCKETS - 1 && us >= (64ULL << bucket))
+    {
+        bucket++;
+    }
+    return bucket;
+}
+
+void priorityDone(int index, unsigned long long enqueuedNs, unsigned long long startNs)
+{
+    PriorityClass *cls = &priority.classes[index];
+    int wait = PriorityBucket(startNs - enqueuedNs);
+    int total = PriorityBucket(PriorityNowNs() - enqueuedNs);
+
+    pthread_mutex_lock(&priority.mutex);
+        cls->busy--;
+        cls->served++;
+        cls->wait[wait]++;
+        cls->total[total]++;
+        if (priority.sleepers > 0 && cls->limit > 0)
+        {
+            pthread_cond_signal(&priority.ready);
+        }
+    pthread_mutex_unlock(&priority.mutex);
+}
+
+int priorityStats(int index, PriorityStats *stats)
+{
+    if (index < 0 || index >= priority.count)
+    {
+        return priority.count;
+    }
+    const PriorityClass *cls = &priority.classes[index];
+    pthread_mutex_lock(&priority.mutex);
+        strcpy(stats->name, cls->name);
+        stats->weight = cls->weight;
+        stats->queueSize = cls->queueSize;
+        stats->limit = cls->limit;
+        stats->queued = cls->queued;
+        stats->served = cls->served;
+        stats->dropped = cls->dropped;
+        memcpy(stats->wait, cls->wait, sizeof(stats->wait));
+        memcpy(stats->total, cls->total, sizeof(stats->total));
+    pthread_mutex_unlock(&priority.mutex);
+    return priority.count;
+}
+
+long priorityPercentile(const unsigned long *histogram, double fraction)
+{
+    unsigned long count = 0, seen = 0;
+
+    for (int i = 0; i < PRIORITY_LATENCY_BUCKETS; i++)
+    {
+        count += histogram[i];
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+    for (int i = 0; i < PRIORITY_LATENCY_BUCKETS - 1; i++)
+    {
+        seen += histogram[i];
+        if (seen >= fraction * count)
+        {
+            return 64L << i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,126 @@
+#ifndef PRIORITY_H_
+#define PRIORITY_H_
+
+#include <stddef.h>
+#include "bool.h"
+
+/**
+* Priority classes
+*
+* Sorts new connections into classes, each with its own bounded queue, and
+* picks the next one to serve across the classes by deficit round robin: on
+* its turn a class may send as many requests to the workers as its weight, so
+* while every class has work waiting, each gets a share of the workers in
+* proportion to its weight, and a class with nothing waiting lends its share
+* to the others. A full class turns its own new connections away with 503;
+* the other classes do not notice.
+*
+* A class is configured as "priority_class = NAME WEIGHT QUEUE MATCH..." with
+* any of these matches, the first class with one matching winning:
+*
+*   path=PREFIX          the normalized request path, by whole segments
+*   header=NAME[:VALUE]  a request header, optionally with this value
+*   subnet=ADDR/BITS     the client's IPv4 network
+*   limit=N              (not a match) most workers the class may hold at once
+*
+* Path and header matches look at the request with MSG_PEEK before any
+* worker reads it, so nothing is consumed. So that the request is there to
+* look at, a listener with such a class defers accepting each connection
+* until its first data arrives (TCP_DEFER_ACCEPT, for as long as the request
+* line may take when tcp_defer_accept is not set). A request whose line comes
+* in several pieces, or that is encrypted, is classified by subnet only.
+* Connections no class matches go to the "default" class, bounded by
+* queue_size.
+*
+* A limit is what keeps one class from holding every worker: with a bulk
+* class limited below the number of threads, a health check always finds a
+* worker within one request time, however many downloads are queued.
+*
+*   priorityParseLine - Checks one priority_class line.
+*   priorityPeeks     - Whether any class matches on the request itself.
+*   priorityInit      - Builds the classes.
+*   priorityEnqueue   - Classifies a connection and queues it.
+*   priorityDequeue   - Takes the next connection to serve.
+*   priorityDone      - Records that a connection was served.
+*   priorityStats     - Counters and latency histograms of a class.
+*   priorityPercentile - Reads a percentile off a histogram.
+*/
+
+/** Most configured classes; the default class comes on top */
+#define PRIORITY_MAX_CLASSES 8
+/** Room for the "priority_class" lines */
+#define PRIORITY_TEXT_MAX 2048
+/** Histogram buckets: bucket i counts latencies under 64 << i us, the last one the rest */
+#define PRIORITY_LATENCY_BUCKETS 20
+
+typedef struct PriorityStats_t {
+    char name[32];
+    int weight;
+    size_t queueSize;                   // 0 for the default class: queue_size applies
+    int limit;                          // 0 = no limit
+    unsigned long queued;
+    unsigned long served;
+    unsigned long dropped;              // turned away with the class queue full
+    unsigned long wait[PRIORITY_LATENCY_BUCKETS];   // accepted to taken by a worker
+    unsigned long total[PRIORITY_LATENCY_BUCKETS];  // accepted to served
+} PriorityStats;
+
+/**
+* priorityParseLine: Checks one "NAME WEIGHT QUEUE MATCH..." line.
+* @return NULL when valid, the reason otherwise
+*/
+const char *priorityParseLine(const char *line);
+
+/**
+* priorityPeeks: Whether any of lines ('\n' separated) has a path= or
+*   header= match, which needs the request to have arrived when accepted.
+*/
+bool priorityPeeks(const char *lines);
+
+/**
+* priorityInit: Builds the classes of lines ('\n' separated, already
+*   checked) plus the default class, whose weight is defaultWeight.
+* @return 0 on success, -1 if out of memory
+*/
+int priorityInit(const char *lines, int defaultWeight);
+
+/**
+* priorityEnqueue: Classifies fd and queues it in its class. defaultQueue
+*   bounds the default class.
+* @return 0 when queued, -1 when the class queue is full (the connection is
+*   then still the caller's)
+*/
+int priorityEnqueue(int fd, size_t defaultQueue);
+
+/**
+* priorityDequeue: Takes the connection deficit round robin picks, waiting
+*   while every queued one belongs to a class at its limit. Call once for
+*   every connection priorityEnqueue queued.
+* @param enqueuedNs - Receives when the connection was queued (CLOCK_MONOTONIC).
+* @param cls - Receives its class, to pass to priorityDone.
+* @return the connection
+*/
+int priorityDequeue(unsigned long long *enqueuedNs, int *cls);
+
+/**
+* priorityDone: Records that the connection priorityDequeue returned was
+*   served and frees its place under the class limit.
+* @param startNs - When the worker started on it.
+*/
+void priorityDone(int cls, unsigned long long enqueuedNs, unsigned long long startNs);
+
+/**
+* priorityStats: Reads class cls, 0 .. count - 1, the default class last
+*   (stats is left alone for any other cls).
+* @return the number of classes, 0 before priorityInit
+*/
+int priorityStats(int cls, PriorityStats *stats);
+
+/**
+* priorityPercentile: The bucket bound under which fraction of the latencies
+*   in histogram fall, in microseconds; 0 for an empty histogram and -1 when
+*   it is in the last, unbounded bucket.
+*/
+long priorityPercentile(const unsigned long *histogram, double fraction);
+
+#endif // PRIORITY_H_
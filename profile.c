@@ -0,0 +1,585 @@
+#define _GNU_SOURCE
+#include "profile.h"
+#include "request.h"
+#include "http2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_HAVE_TSC
+#endif
+
+#define PROFILE_DEFAULT_HZ 99
+#define PROFILE_MAX_HZ 10000
+/** Frames of the signal handler and the kernel's return trampoline atop each sample */
+#define PROFILE_SKIP_FRAMES 2
+
+static const char *const profileStageNames[PROFILE_STAGES] = {
+    "read", "parse", "stat", "open", "write", "cgi", "log",
+};
+
+/* A thread's stage counters; only it writes them */
+typedef struct ProfileThread_t
+{
+    unsigned long long ticks[PROFILE_STAGES] __attribute__((aligned(64)));
+    unsigned long calls[PROFILE_STAGES];
+    unsigned epoch;                 // the reset the counters count from
+    pid_t tid;
+    struct ProfileThread_t *next;
+} ProfileThread;
+
+typedef struct ProfileSample_t
+{
+    int depth;                      // 0 until the sample is complete
+    void *frames[PROFILE_MAX_DEPTH];    // innermost first
+} ProfileSample;
+
+static struct
+{
+    bool timing;
+    unsigned epoch;                 // bumped by every reset
+    unsigned long long startTicks;  // at profileInit, for converting ticks to time
+    unsigned long long startNs;
+    pthread_mutex_t mutex;          // threads and the retired counters
+    ProfileThread *threads;
+    unsigned long long retiredTicks[PROFILE_STAGES];    // threads that exited since the reset
+    unsigned long retiredCalls[PROFILE_STAGES];
+    pthread_key_t threadKey;
+
+    pthread_mutex_t sampling;       // starting, stopping and reading samples
+    ProfileSample *samples;         // PROFILE_MAX_SAMPLES, mapped once and kept
+    unsigned long taken;            // samples claimed, may pass PROFILE_MAX_SAMPLES
+    int hz;                         // 0 = stopped
+    int worker;                     // this worker process, of workers (0 = none)
+    int workers;
+} profile = { .mutex = PTHREAD_MUTEX_INITIALIZER, .sampling = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread ProfileThread *profileLocal;
+
+static unsigned long long ProfileNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static unsigned long long ProfileTicks(void)
+{
+#ifdef PROFILE_HAVE_TSC
+    return __rdtsc();
+#else
+    return ProfileNs();
+#endif
+}
+
+/* TSC ticks per nanosecond, measured over the server's life so far */
+static double ProfileTicksPerNs(void)
+{
+    unsigned long long ns = ProfileNs() - profile.startNs;
+    unsigned long long ticks = ProfileTicks() - profile.startTicks;
+    return ns > 0 && ticks > 0 ? (double)ticks / ns : 1.0;
+}
+
+/* Adds the counters of an exiting thread to the retired ones and frees them */
+static void ProfileThreadDetach(void *arg)
+{
+    ProfileThread *local = arg;
+
+    pthread_mutex_lock(&profile.mutex);
+        if (local->epoch == profile.epoch)
+        {
+            for (int i = 0; i < PROFILE_STAGES; i++)
+            {
+                profile.retiredTicks[i] += local->ticks[i];
+                profile.retiredCalls[i] += local->calls[i];
+            }
+        }
+        ProfileThread **link = &profile.threads;
+        while (*link != local)
+        {
+            link = &(*link)->next;
+        }
+        *link = local->next;
+    pthread_mutex_unlock(&profile.mutex);
+    free(local);
+}
+
+static ProfileThread *ProfileThreadAttach(void)
+{
+    ProfileThread *local = aligned_alloc(64, (sizeof(ProfileThread) + 63) & ~(size_t)63);
+    if (local == NULL)
+    {
+        return NULL;
+    }
+    memset(local, 0, sizeof(*local));
+    local->tid = gettid();
+
+    pthread_mutex_lock(&profile.mutex);
+        local->epoch = profile.epoch;
+        local->next = profile.threads;
+        profile.threads = local;
+    pthread_mutex_unlock(&profile.mutex);
+    pthread_setspecific(profile.threadKey, local);
+    profileLocal = local;
+    return local;
+}
+
+static void ProfileSignal(int signo)
+{
+    int saved = errno;
+    unsigned long index = __atomic_fetch_add(&profile.taken, 1, __ATOMIC_RELAXED);
+    ProfileSample *samples = __atomic_load_n(&profile.samples, __ATOMIC_ACQUIRE);
+    void *frames[PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES];
+
+    (void)signo;
+    if (samples != NULL && index < PROFILE_MAX_SAMPLES)
+    {
+        int depth = backtrace(frames, PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES) - PROFILE_SKIP_FRAMES;
+        if (depth > 0)
+        {
+            memcpy(samples[index].frames, frames + PROFILE_SKIP_FRAMES, depth * sizeof(void *));
+            __atomic_store_n(&samples[index].depth, depth, __ATOMIC_RELEASE);
+        }
+    }
+    errno = saved;
+}
+
+int profileInit(bool timing, int worker, int workers)
+{
+    struct sigaction action;
+    void *frame;
+
+    profile.worker = worker;
+    profile.workers = workers;
+    profile.startNs = ProfileNs();
+    profile.startTicks = ProfileTicks();
+    pthread_key_create(&profile.threadKey, ProfileThreadDetach);
+    // the first backtrace loads the unwinder, which a signal handler must not do
+    backtrace(&frame, 1);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = ProfileSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) < 0)
+    {
+        return -1;
+    }
+    profileSetTiming(timing);
+    return 0;
+}
+
+unsigned long long profileBegin(void)
+{
+    return __atomic_load_n(&profile.timing, __ATOMIC_RELAXED) ? ProfileTicks() : 0;
+}
+
+void profileEnd(ProfileStage stage, unsigned long long begin)
+{
+    if (begin == 0)
+    {
+        return;
+    }
+    unsigned long long elapsed = ProfileTicks() - begin;
+    ProfileThread *local = profileLocal != NULL ? profileLocal : ProfileThreadAttach();
+    if (local == NULL)
+    {
+        return;
+    }
+
+    // the first count after a reset starts the thread's counters over
+    unsigned epoch = __atomic_load_n(&profile.epoch, __ATOMIC_RELAXED);
+    if (local->epoch != epoch)
+    {
+        for (int i = 0; i < PROFILE_STAGES; i++)
+        {
+            __atomic_store_n(&local->ticks[i], 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&local->calls[i], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&local->epoch, epoch, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&local->ticks[stage], local->ticks[stage] + elapsed, __ATOMIC_RELAXED);
+    __atomic_store_n(&local->calls[stage], local->calls[stage] + 1, __ATOMIC_RELAXED);
+}
+
+void profileSetTiming(bool on)
+{
+    __atomic_store_n(&profile.timing, on, __ATOMIC_RELAXED);
+}
+
+static void ProfileTimingReset(void)
+{
+    pthread_mutex_lock(&profile.mutex);
+        __atomic_store_n(&profile.epoch, profile.epoch + 1, __ATOMIC_RELAXED);
+        memset(profile.retiredTicks, 0, sizeof(profile.retiredTicks));
+        memset(profile.retiredCalls, 0, sizeof(profile.retiredCalls));
+    pthread_mutex_unlock(&profile.mutex);
+}
+
+/* Writes the stage table, in total and then per thread, to out */
+static void ProfileTimingReport(FILE *out)
+{
+    unsigned long long ticks[PROFILE_STAGES];
+    unsigned long calls[PROFILE_STAGES];
+    double ticksPerUs = ProfileTicksPerNs() * 1000;
+
+    fprintf(out, "stage timing %s\n\n%-8s %12s %12s %10s\n", profile.timing ? "on" : "off",
+            "stage", "calls", "total ms", "mean us");
+    pthread_mutex_lock(&profile.mutex);
+        memcpy(ticks, profile.retiredTicks, sizeof(ticks));
+        memcpy(calls, profile.retiredCalls, sizeof(calls));
+        for (ProfileThread *thread = profile.threads; thread != NULL; thread = thread->next)
+        {
+            if (__atomic_load_n(&thread->epoch, __ATOMIC_RELAXED) != profile.epoch)
+            {
+                continue;
+            }
+            for (int i = 0; i < PROFILE_STAGES; i++)
+            {
+                ticks[i] += __atomic_load_n(&thread->ticks[i], __ATOMIC_RELAXED);
+                calls[i] += __atomic_load_n(&thread->calls[i], __ATOMIC_RELAXED);
+            }
+        }
+        for (int i = 0; i < PROFILE_STAGES; i++)
+        {
+            fprintf(out, "%-8s %12lu %12.1f %10.1f\n", profileStageNames[i], calls[i],
+                    ticks[i] / ticksPerUs / 1000, calls[i] > 0 ? ticks[i] / ticksPerUs / calls[i] : 0.0);
+        }
+
+        fprintf(out, "\nmean us per call, by thread\n%-8s", "tid");
+        for (int i = 0; i < PROFILE_STAGES; i++)
+        {
+            fprintf(out, " %8s", profileStageNames[i]);
+        }
+        fprintf(out, "\n");
+        for (ProfileThread *thread = profile.threads; thread != NULL; thread = thread->next)
+        {
+            if (__atomic_load_n(&thread->epoch, __ATOMIC_RELAXED) != profile.epoch)
+            {
+                continue;
+            }
+            fprintf(out, "%-8d", thread->tid);
+            for (int i = 0; i < PROFILE_STAGES; i++)
+            {
+                unsigned long n = __atomic_load_n(&thread->calls[i], __ATOMIC_RELAXED);
+                unsigned long long t = __atomic_load_n(&thread->ticks[i], __ATOMIC_RELAXED);
+                fprintf(out, " %8.1f", n > 0 ? t / ticksPerUs / n : 0.0);
+            }
+            fprintf(out, "\n");
+        }
+    pthread_mutex_unlock(&profile.mutex);
+}
+
+static int ProfileSetTimer(int hz)
+{
+    struct itimerval timer;
+
+    memset(&timer, 0, sizeof(timer));
+    if (hz > 0)
+    {
+        timer.it_interval.tv_usec = 1000000 / hz;
+        timer.it_value = timer.it_interval;
+    }
+    return setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/* Starts sampling at hz, or changes the rate; call with sampling held */
+static int ProfileStart(int hz)
+{
+    if (profile.samples == NULL)
+    {
+        ProfileSample *samples = mmap(NULL, PROFILE_MAX_SAMPLES * sizeof(ProfileSample),
+                                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (samples == MAP_FAILED)
+        {
+            return -1;
+        }
+        __atomic_store_n(&profile.samples, samples, __ATOMIC_RELEASE);
+    }
+    if (ProfileSetTimer(hz) < 0)
+    {
+        return -1;
+    }
+    profile.hz = hz;
+    return 0;
+}
+
+/* Forgets the samples taken; call with sampling held */
+static void ProfileSamplesReset(void)
+{
+    if (profile.hz > 0)
+    {
+        ProfileSetTimer(0);
+    }
+    if (profile.samples != NULL)
+    {
+        for (unsigned long i = 0; i < PROFILE_MAX_SAMPLES; i++)
+        {
+            __atomic_store_n(&profile.samples[i].depth, 0, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&profile.taken, 0, __ATOMIC_RELAXED);
+    if (profile.hz > 0)
+    {
+        ProfileSetTimer(profile.hz);
+    }
+}
+
+static int ProfileCompareSamples(const void *a, const void *b)
+{
+    const ProfileSample *x = *(const ProfileSample *const *)a;
+    const ProfileSample *y = *(const ProfileSample *const *)b;
+
+    if (x->depth != y->depth)
+    {
+        return x->depth < y->depth ? -1 : 1;
+    }
+    return memcmp(x->frames, y->frames, x->depth * sizeof(void *));
+}
+
+/* Writes the name of the function at address, "module+0xOFF" when not exported */
+static void ProfileFrameName(FILE *out, void *address)
+{
+    Dl_info info;
+
+    if (dladdr(address, &info) == 0 || info.dli_fname == NULL)
+    {
+        fprintf(out, "%p", address);
+    }
+    else if (info.dli_sname != NULL)
+    {
+        fprintf(out, "%s", info.dli_sname);
+    }
+    else
+    {
+        const char *module = strrchr(info.dli_fname, '/');
+        fprintf(out, "%s+0x%lx", module != NULL ? module + 1 : info.dli_fname,
+                (unsigned long)((char *)address - (char *)info.dli_fbase));
+    }
+}
+
+/**
+* ProfileFold: Writes the complete samples as folded stacks, outermost frame
+*   first, one line per distinct stack with the number of samples that had
+*   it. Call with sampling held.
+*/
+static int ProfileFold(FILE *out)
+{
+    unsigned long taken = __atomic_load_n(&profile.taken, __ATOMIC_RELAXED);
+    unsigned long count = 0;
+
+    if (profile.samples == NULL || taken == 0)
+    {
+        return 0;
+    }
+    if (taken > PROFILE_MAX_SAMPLES)
+    {
+        taken = PROFILE_MAX_SAMPLES;
+    }
+    ProfileSample **sorted = malloc(taken * sizeof(*sorted));
+    if (sorted == NULL)
+    {
+        return -1;
+    }
+    for (unsigned long i = 0; i < taken; i++)
+    {
+        if (__atomic_load_n(&profile.samples[i].depth, __ATOMIC_ACQUIRE) > 0)
+        {
+            sorted[count++] = &profile.samples[i];
+        }
+    }
+    qsort(sorted, count, sizeof(*sorted), ProfileCompareSamples);
+
+    for (unsigned long i = 0, same; i < count; i += same)
+    {
+        same = 1;
+        while (i + same < count && ProfileCompareSamples(&sorted[i], &sorted[i + same]) == 0)
+        {
+            same++;
+        }
+        for (int frame = sorted[i]->depth - 1; frame >= 0; frame--)
+        {
+            // return addresses point past the call: step back into it
+            void *address = sorted[i]->frames[frame];
+            ProfileFrameName(out, frame > 0 ? (char *)address - 1 : address);
+            fputc(frame > 0 ? ';' : ' ', out);
+        }
+        fprintf(out, "%lu\n", same);
+    }
+    free(sorted);
+    return 0;
+}
+
+/* Whether the peer of fd is on this host */
+static bool ProfileLoopback(int fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if (http2PeerName(fd, (struct sockaddr *)&addr, &len) < 0)
+    {
+        return false;
+    }
+    if (addr.ss_family == AF_INET)
+    {
+        return (ntohl(((struct sockaddr_in *)&addr)->sin_addr.s_addr) >> 24) == 127;
+    }
+    if (addr.ss_family == AF_INET6)
+    {
+        const struct in6_addr *ip = &((struct sockaddr_in6 *)&addr)->sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(ip) || (IN6_IS_ADDR_V4MAPPED(ip) && ip->s6_addr[12] == 127);
+    }
+    return false;
+}
+
+/**
+* ProfileCommand: Carries out the query of a timing or profile request.
+* @return NULL on success, the reason otherwise
+*/
+static const char *ProfileCommand(bool timing, const char *query)
+{
+    char *end;
+    long hz = PROFILE_DEFAULT_HZ;
+
+    if (query[0] == '\0')
+    {
+        return NULL;
+    }
+    if (timing)
+    {
+        if (!strcmp(query, "on") || !strcmp(query, "off"))
+        {
+            profileSetTiming(!strcmp(query, "on"));
+        }
+        else if (!strcmp(query, "reset"))
+        {
+            ProfileTimingReset();
+        }
+        else
+        {
+            return "expected ?on, ?off or ?reset\n";
+        }
+        return NULL;
+    }
+
+    if (!strncmp(query, "start", 5) && (query[5] == '\0' || query[5] == '='))
+    {
+        if (query[5] == '=' && ((hz = strtol(query + 6, &end, 10)) < 1 || hz > PROFILE_MAX_HZ || *end != '\0'))
+        {
+            return "expected ?start=HZ, 1 to 10000\n";
+        }
+        return ProfileStart((int)hz) < 0 ? "could not start the profiling timer\n" : NULL;
+    }
+    if (!strcmp(query, "stop"))
+    {
+        ProfileSetTimer(0);
+        profile.hz = 0;
+    }
+    else if (!strcmp(query, "reset"))
+    {
+        ProfileSamplesReset();
+    }
+    else
+    {
+        return "expected ?start, ?start=HZ, ?stop or ?reset\n";
+    }
+    return NULL;
+}
+
+void profileHandler(int fd, AccessLogEntry *entry, const char *path, const char *query)
+{
+    static const char forbidden[] = "the debug endpoint only answers local requests\n";
+    const char *name = strrchr(path, '/') + 1;
+    const char *reason = NULL, *status = "400 Bad Request";
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out;
+
+    if (!ProfileLoopback(fd))
+    {
+        requestSendText(fd, entry, "403 Forbidden", forbidden, sizeof(forbidden) - 1);
+        return;
+    }
+    if ((out = open_memstream(&text, &len)) == NULL)
+    {
+        requestSendText(fd, entry, "500 Internal Server Error", "", 0);
+        return;
+    }
+
+    pthread_mutex_lock(&profile.sampling);
+        if (!strcmp(name, "timing"))
+        {
+            if ((reason = ProfileCommand(true, query)) == NULL)
+            {
+                ProfileTimingReport(out);
+            }
+        }
+        else if (!strcmp(name, "profile"))
+        {
+            if (profile.workers > 0)
+            {
+                status = "409 Conflict";
+                reason = "sampling is per process and this server runs worker processes, which take "
+                         "requests in turn: profile with worker_processes = 0\n";
+            }
+            else if ((reason = ProfileCommand(false, query)) == NULL && ProfileFold(out) < 0)
+            {
+                reason = "out of memory\n";
+            }
+        }
+        else
+        {
+            unsigned long taken = __atomic_load_n(&profile.taken, __ATOMIC_RELAXED);
+            if (profile.workers > 0)
+            {
+                fprintf(out, "worker process %d of %d (pid %d): timing counts and switches this process only\n",
+                        profile.worker + 1, profile.workers, (int)getpid());
+            }
+            fprintf(out, "stage timing: %s (timing?on, timing?off, timing?reset)\n",
+                    profile.timing ? "on" : "off");
+            fprintf(out, "sampling: ");
+            if (profile.workers > 0)
+            {
+                fprintf(out, "unavailable with worker_processes\n");
+            }
+            else
+            {
+                if (profile.hz > 0)
+                {
+                    fprintf(out, "at %d Hz", profile.hz);
+                }
+                else
+                {
+                    fprintf(out, "stopped");
+                }
+                fprintf(out, ", %lu samples kept, %lu past the limit (profile?start[=HZ], profile?stop, profile?reset)\n",
+                        taken < PROFILE_MAX_SAMPLES ? taken : PROFILE_MAX_SAMPLES,
+                        taken > PROFILE_MAX_SAMPLES ? taken - PROFILE_MAX_SAMPLES : 0);
+            }
+            fprintf(out, "access log: %lu entries dropped on a full ring since startup\n", accessLogDropped());
+        }
+    pthread_mutex_unlock(&profile.sampling);
+
+    fclose(out);
+    if (reason != NULL)
+    {
+        requestSendText(fd, entry, status, reason, strlen(reason));
+    }
+    else
+    {
+        requestSendText(fd, entry, "200 OK", text, len);
+    }
+    free(text);
+}
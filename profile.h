@@ -0,0 +1,90 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stddef.h>
+#include "bool.h"
+#include "accessLog.h"
+
+/**
+* Profiling
+*
+* Two ways to see where request time goes in a running server, both off by
+* default and switched on and off through the debug endpoint without a
+* restart:
+*
+*   - Stage timing: requestHandle marks the stages of a request (reading it,
+*     parsing it, stat, open or cache lookup, writing the response, running
+*     a CGI program, logging). Each thread adds the time of every stage to
+*     counters of its own, read with the TSC where there is one, so a stage
+*     costs two counter reads and no lock. Off, it costs a relaxed load.
+*   - Sampling: SIGPROF, on a timer of the CPU time the process uses, takes
+*     a backtrace of whichever thread is running. The stacks are kept as
+*     taken and folded only when asked for, one "outer;...;inner count" line
+*     per distinct stack, the input flamegraph.pl and speedscope expect.
+*     Frames of functions the binary does not export show as "module+0xOFF";
+*     addr2line -f -e server 0xOFF names them.
+*
+* The endpoint is a built-in handler, enabled with "route = /debug handler
+* debug", that only answers requests from a loopback address:
+*
+*   /debug/            what is running, and access log entries dropped
+*   /debug/timing      the stage table, in total and per thread
+*                      ?on, ?off, ?reset
+*   /debug/profile     the folded stacks taken so far
+*                      ?start (99 Hz), ?start=HZ, ?stop, ?reset
+*
+* With worker_processes, each worker has its own stage counters and the
+* endpoint reports, and switches, those of the one that accepted the request;
+* /debug/ says which that was. Sampling is refused there: the SIGPROF timer and
+* the samples belong to one process, and ?start, ?stop and reading the stacks
+* could each land on a different worker. Profile with worker_processes = 0.
+*
+*   profileInit     - Sets up the profiler; timing may start on.
+*   profileBegin    - Starts timing a stage.
+*   profileEnd      - Adds the time since profileBegin to a stage.
+*   profileSetTiming - Turns stage timing on or off.
+*   profileHandler  - The debug endpoint.
+*/
+
+typedef enum ProfileStage_t {
+    PROFILE_READ,       // TLS handshake, request line and headers
+    PROFILE_PARSE,      // method, site, path and body checks
+    PROFILE_STAT,
+    PROFILE_OPEN,       // content store, shared and file cache lookups, open and mmap
+    PROFILE_WRITE,      // headers and body of a static response
+    PROFILE_CGI,        // fork, exec and relaying a CGI program's output
+    PROFILE_LOG,        // the access log entry
+    PROFILE_STAGES
+} ProfileStage;
+
+/** Most samples kept between resets; later ones are counted, not kept */
+#define PROFILE_MAX_SAMPLES 16384
+/** Deepest stack a sample keeps */
+#define PROFILE_MAX_DEPTH 48
+
+/**
+* profileInit: Sets up the profiler and starts stage timing if timing.
+* @param worker  - Which worker process this is, 0 without them.
+* @param workers - worker_processes; sampling is only offered when 0.
+* @return 0 on success, -1 if the SIGPROF handler could not be installed
+*/
+int profileInit(bool timing, int worker, int workers);
+
+/**
+* profileBegin: Starts timing a stage.
+* @return the value to pass to profileEnd, 0 while timing is off
+*/
+unsigned long long profileBegin(void);
+
+/**
+* profileEnd: Adds the time since begin to stage in the calling thread's
+*   counters. Does nothing for a begin of 0.
+*/
+void profileEnd(ProfileStage stage, unsigned long long begin);
+
+void profileSetTiming(bool on);
+
+/** The "debug" route handler (see routeRegisterHandler) */
+void profileHandler(int fd, AccessLogEntry *entry, const char *path, const char *query);
+
+#endif // PROFILE_H_
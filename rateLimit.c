@@ -0,0 +1,366 @@
+#include "rateLimit.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#define RATE_LIMIT_SHARDS 64
+#define RATE_LIMIT_SWEEP 8              // slots aged per admission
+#define RATE_LIMIT_TOKEN 1000000ULL     // tokens are kept in millionths
+
+typedef struct RateLimitEntry_t
+{
+    unsigned char key[16];   // IPv6 address, IPv4 as ::ffff:a.b.c.d
+    bool used;
+    int connections;
+    unsigned long long tokens;
+    unsigned long long lastNs;
+} RateLimitEntry;
+
+typedef struct RateLimitShard_t
+{
+    pthread_mutex_t mutex;      // robust and process-shared
+    RateLimitEntry *slots;
+} __attribute__((aligned(64))) RateLimitShard;
+
+/* What every process updates, at the start of the segment */
+typedef struct RateLimitShared_t
+{
+    size_t sweepCursor;
+    unsigned long rejectedRate;
+    unsigned long rejectedConnections;
+    unsigned long untracked;
+} __attribute__((aligned(64))) RateLimitShared;
+
+typedef struct RateLimitFd_t
+{
+    unsigned char key[16];
+    bool tracked;
+} RateLimitFd;
+
+static struct
+{
+    bool enabled;
+    RateLimitConfig config;
+    RateLimitShared *shared;    // the segment, mapped before the workers fork
+    RateLimitShard *shards;     // RATE_LIMIT_SHARDS of them, in the segment
+    size_t shardSize;           // slots per shard, a power of two
+    RateLimitFd *fdTables;      // one table per process, in the segment
+    int processes;
+    RateLimitFd *fds;           // this process's, indexed by fd
+    size_t fdCount;
+} rateLimit = {.enabled = false};
+
+static unsigned long long rateLimitNowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static size_t rateLimitHash(const unsigned char *key)
+{
+    unsigned long long a, b;
+    memcpy(&a, key, 8);
+    memcpy(&b, key + 8, 8);
+    unsigned long long h = (a ^ (b * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    return (size_t)(h ^ (h >> 31));
+}
+
+static bool rateLimitKey(const struct sockaddr *addr, socklen_t addrlen, unsigned char *key)
+{
+    memset(key, 0, 16);
+    if (addr->sa_family == AF_INET && addrlen >= sizeof(struct sockaddr_in))
+    {
+        key[10] = key[11] = 0xff;
+        memcpy(key + 12, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+        return true;
+    }
+    if (addr->sa_family == AF_INET6 && addrlen >= sizeof(struct sockaddr_in6))
+    {
+        memcpy(key, &((const struct sockaddr_in6 *)addr)->sin6_addr, 16);
+        return true;
+    }
+    return false;
+}
+
+/**
+* rateLimitRemoveSlot: Backward-shift deletion for linear probing, so no
+*   tombstones build up. Called with the shard locked.
+*/
+static void rateLimitRemoveSlot(RateLimitShard *shard, size_t hole)
+{
+    size_t mask = rateLimit.shardSize - 1;
+    size_t i = hole;
+
+    shard->slots[hole].used = false;
+    while (true)
+    {
+        i = (i + 1) & mask;
+        if (!shard->slots[i].used)
+        {
+            return;
+        }
+        size_t home = (rateLimitHash(shard->slots[i].key) / RATE_LIMIT_SHARDS) & mask;
+        // move the entry into the hole unless its home lies cyclically in (hole, i]
+        bool stays = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!stays)
+        {
+            shard->slots[hole] = shard->slots[i];
+            shard->slots[i].used = false;
+            hole = i;
+        }
+    }
+}
+
+static bool rateLimitIdle(const RateLimitEntry *entry, unsigned long long now)
+{
+    return entry->connections == 0 &&
+           now - entry->lastNs > (unsigned long long)rateLimit.config.idleSec * 1000000000ULL;
+}
+
+static void rateLimitLock(RateLimitShard *shard)
+{
+    if (pthread_mutex_lock(&shard->mutex) == EOWNERDEAD)
+    {
+        // a worker died changing the shard: its clients start afresh
+        memset(shard->slots, 0, rateLimit.shardSize * sizeof(RateLimitEntry));
+        pthread_mutex_consistent(&shard->mutex);
+    }
+}
+
+/**
+* rateLimitSweep: Ages out a few slots per call, cycling over the whole table.
+*/
+static void rateLimitSweep(unsigned long long now)
+{
+    for (int n = 0; n < RATE_LIMIT_SWEEP; n++)
+    {
+        // every acceptor and HTTP/2 thread admits
+        size_t cursor = __atomic_fetch_add(&rateLimit.shared->sweepCursor, 1, __ATOMIC_RELAXED) %
+                        (RATE_LIMIT_SHARDS * rateLimit.shardSize);
+        RateLimitShard *shard = &rateLimit.shards[cursor / rateLimit.shardSize];
+        size_t slot = cursor % rateLimit.shardSize;
+
+        rateLimitLock(shard);
+            if (shard->slots[slot].used && rateLimitIdle(&shard->slots[slot], now))
+            {
+                rateLimitRemoveSlot(shard, slot);
+            }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+int rateLimitInit(const RateLimitConfig *config, int processes)
+{
+    struct rlimit limit;
+    pthread_mutexattr_t attr;
+
+    rateLimit.config = *config;
+    if (config->tableSize == 0)
+    {
+        return 0;
+    }
+
+    rateLimit.shardSize = 16;
+    while (rateLimit.shardSize * RATE_LIMIT_SHARDS < config->tableSize)
+    {
+        rateLimit.shardSize <<= 1;
+    }
+    rateLimit.fdCount = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    {
+        rateLimit.fdCount = limit.rlim_cur;
+    }
+    rateLimit.processes = processes > 0 ? processes : 1;
+
+    size_t shardBytes = RATE_LIMIT_SHARDS * sizeof(RateLimitShard);
+    size_t slotBytes = RATE_LIMIT_SHARDS * rateLimit.shardSize * sizeof(RateLimitEntry);
+    size_t fdBytes = rateLimit.processes * rateLimit.fdCount * sizeof(RateLimitFd);
+    // anonymous shared memory stays shared across fork, and starts zeroed
+    char *segment = mmap(NULL, sizeof(RateLimitShared) + shardBytes + slotBytes + fdBytes,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED)
+    {
+        return -1;
+    }
+    rateLimit.shared = (RateLimitShared *)segment;
+    rateLimit.shards = (RateLimitShard *)(segment + sizeof(RateLimitShared));
+    RateLimitEntry *slots = (RateLimitEntry *)(segment + sizeof(RateLimitShared) + shardBytes);
+    rateLimit.fdTables = (RateLimitFd *)((char *)slots + slotBytes);
+    rateLimit.fds = rateLimit.fdTables;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    for (int i = 0; i < RATE_LIMIT_SHARDS; i++)
+    {
+        pthread_mutex_init(&rateLimit.shards[i].mutex, &attr);
+        rateLimit.shards[i].slots = slots + i * rateLimit.shardSize;
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    rateLimit.enabled = true;
+    return 0;
+}
+
+void rateLimitAttach(int process)
+{
+    if (!rateLimit.enabled || process < 0 || process >= rateLimit.processes)
+    {
+        return;
+    }
+    rateLimit.fds = rateLimit.fdTables + (size_t)process * rateLimit.fdCount;
+    // a worker started again gives back what the one before it still held
+    for (size_t fd = 0; fd < rateLimit.fdCount; fd++)
+    {
+        rateLimitRelease((int)fd);
+    }
+}
+
+void rateLimitSetLimits(double ratePerSec, double burst, int maxConnections)
+{
+    rateLimit.config.ratePerSec = ratePerSec;
+    rateLimit.config.burst = burst;
+    rateLimit.config.maxConnections = maxConnections;
+}
+
+RateLimitResult rateLimitAdmit(int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+    unsigned char key[16];
+
+    if (!rateLimit.enabled || fd < 0 || (size_t)fd >= rateLimit.fdCount ||
+        (rateLimit.config.ratePerSec <= 0 && rateLimit.config.maxConnections <= 0) ||
+        !rateLimitKey(addr, addrlen, key))
+    {
+        return RATE_LIMIT_ADMIT;
+    }
+
+    unsigned long long now = rateLimitNowNs();
+    unsigned long long burst = rateLimit.config.burst < 1 ? RATE_LIMIT_TOKEN
+                                                          : rateLimit.config.burst * RATE_LIMIT_TOKEN;
+    size_t hash = rateLimitHash(key);
+    RateLimitShard *shard = &rateLimit.shards[hash % RATE_LIMIT_SHARDS];
+    size_t mask = rateLimit.shardSize - 1;
+    size_t i = (hash / RATE_LIMIT_SHARDS) & mask;
+    RateLimitResult result = RATE_LIMIT_ADMIT;
+    bool tracked = false;
+
+    rateLimitLock(shard);
+        size_t probes = 0;
+        while (shard->slots[i].used && memcmp(shard->slots[i].key, key, 16) && probes < rateLimit.shardSize)
+        {
+            i = (i + 1) & mask;
+            probes++;
+        }
+
+        if (probes < rateLimit.shardSize)
+        {
+            RateLimitEntry *entry = &shard->slots[i];
+            if (!entry->used)
+            {
+                memcpy(entry->key, key, 16);
+                entry->used = true;
+                entry->connections = 0;
+                entry->tokens = burst;
+                entry->lastNs = now;
+            }
+
+            if (rateLimit.config.ratePerSec > 0)
+            {
+                entry->tokens += (now - entry->lastNs) * rateLimit.config.ratePerSec / 1000;
+                if (entry->tokens > burst)
+                {
+                    entry->tokens = burst;
+                }
+            }
+            entry->lastNs = now;
+
+            if (rateLimit.config.ratePerSec > 0 && entry->tokens < RATE_LIMIT_TOKEN)
+            {
+                result = RATE_LIMIT_TOO_FAST;
+            }
+            else if (rateLimit.config.maxConnections > 0 && entry->connections >= rateLimit.config.maxConnections)
+            {
+                result = RATE_LIMIT_TOO_MANY_CONNECTIONS;
+            }
+            else
+            {
+                if (rateLimit.config.ratePerSec > 0)
+                {
+                    entry->tokens -= RATE_LIMIT_TOKEN;
+                }
+                entry->connections++;
+                tracked = true;
+            }
+        }
+    pthread_mutex_unlock(&shard->mutex);
+
+    switch (result)
+    {
+    case RATE_LIMIT_TOO_FAST:
+        __atomic_fetch_add(&rateLimit.shared->rejectedRate, 1, __ATOMIC_RELAXED);
+        break;
+    case RATE_LIMIT_TOO_MANY_CONNECTIONS:
+        __atomic_fetch_add(&rateLimit.shared->rejectedConnections, 1, __ATOMIC_RELAXED);
+        break;
+    default:
+        if (!tracked)
+        {
+            // table full: fail open rather than refuse a client we can not see
+            __atomic_fetch_add(&rateLimit.shared->untracked, 1, __ATOMIC_RELAXED);
+        }
+        break;
+    }
+
+    rateLimit.fds[fd].tracked = tracked;
+    if (tracked)
+    {
+        memcpy(rateLimit.fds[fd].key, key, 16);
+    }
+    rateLimitSweep(now);
+    return result;
+}
+
+void rateLimitRelease(int fd)
+{
+    if (!rateLimit.enabled || fd < 0 || (size_t)fd >= rateLimit.fdCount || !rateLimit.fds[fd].tracked)
+    {
+        return;
+    }
+    rateLimit.fds[fd].tracked = false;
+
+    const unsigned char *key = rateLimit.fds[fd].key;
+    size_t hash = rateLimitHash(key);
+    RateLimitShard *shard = &rateLimit.shards[hash % RATE_LIMIT_SHARDS];
+    size_t mask = rateLimit.shardSize - 1;
+    size_t i = (hash / RATE_LIMIT_SHARDS) & mask;
+
+    rateLimitLock(shard);
+        for (size_t probes = 0; probes < rateLimit.shardSize && shard->slots[i].used; probes++)
+        {
+            if (!memcmp(shard->slots[i].key, key, 16))
+            {
+                shard->slots[i].connections--;
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+void rateLimitStats(RateLimitStats *stats)
+{
+    if (rateLimit.shared == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    stats->rejectedRate = __atomic_load_n(&rateLimit.shared->rejectedRate, __ATOMIC_RELAXED);
+    stats->rejectedConnections = __atomic_load_n(&rateLimit.shared->rejectedConnections, __ATOMIC_RELAXED);
+    stats->untracked = __atomic_load_n(&rateLimit.shared->untracked, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,94 @@
+#ifndef RATE_LIMIT_H_
+#define RATE_LIMIT_H_
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include "bool.h"
+
+/**
+* Per-client admission control
+*
+* Keeps, for every source address, a token bucket limiting the rate of new
+* connections and a count of the connections currently open. Entries live in
+* a fixed-size hash table split into independently locked shards, so the
+* acceptor and the workers releasing connections rarely meet on a lock and
+* nothing is allocated after startup. Idle entries are aged out a few slots at
+* a time as part of admission.
+*
+* The table is one shared memory segment mapped before the worker processes
+* fork, so with worker_processes a client's limits hold across all of them
+* rather than once per process. The shard locks are robust: when a worker
+* dies holding one, the next process to take it forgets that shard's
+* clients. Each process records the connections it admitted in its own
+* table in the segment, and a worker started again gives back those its
+* predecessor left open.
+*
+* Each HTTP/2 stream is admitted like a connection of the client it came on,
+* by the HTTP/2 thread: it takes a token and counts against
+* client_max_connections while it is open, as the HTTP/1 request it stands
+* for would.
+*
+*   rateLimitInit    - Sizes the table and sets the limits.
+*   rateLimitAttach  - Picks the calling worker process's connections.
+*   rateLimitAdmit   - Decides whether a newly accepted connection may proceed.
+*   rateLimitRelease - Records that an admitted connection was closed.
+*   rateLimitStats   - Counters for rejected connections.
+*/
+
+typedef struct RateLimitConfig_t {
+    double ratePerSec;     // sustained new connections per second per client, 0 = unlimited
+    double burst;          // bucket depth (connections that may arrive at once)
+    int maxConnections;    // concurrent connections per client, 0 = unlimited
+    int idleSec;           // forget clients idle for this long
+    size_t tableSize;      // number of clients tracked, rounded up per shard
+} RateLimitConfig;
+
+typedef enum RateLimitResult_t {
+    RATE_LIMIT_ADMIT,
+    RATE_LIMIT_TOO_FAST,          // bucket empty
+    RATE_LIMIT_TOO_MANY_CONNECTIONS
+} RateLimitResult;
+
+typedef struct RateLimitStats_t {
+    unsigned long rejectedRate;
+    unsigned long rejectedConnections;
+    unsigned long untracked;      // admitted without tracking because the table was full
+} RateLimitStats;
+
+/**
+* rateLimitInit: Maps the table for processes worker processes (0 when the
+*   server runs as one), before they fork; unless tableSize is 0, which
+*   disables admission control for good. While both limits are 0 every
+*   connection is admitted without being tracked.
+* @return 0 on success, -1 if the mapping failed
+*/
+int rateLimitInit(const RateLimitConfig *config, int processes);
+
+/**
+* rateLimitAttach: Makes the calling process worker process (0 ..
+*   processes - 1), releasing whatever a previous one of that index left.
+*/
+void rateLimitAttach(int process);
+
+/**
+* rateLimitSetLimits: Changes the rate, burst and connection limits in place.
+*   Must be called from the acceptor; the HTTP/2 thread admitting a stream
+*   meanwhile may still apply the old limits.
+*/
+void rateLimitSetLimits(double ratePerSec, double burst, int maxConnections);
+
+/**
+* rateLimitAdmit: Charges one token to the client at addr and, if admitted,
+*   counts fd as one of its open connections.
+*/
+RateLimitResult rateLimitAdmit(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+/**
+* rateLimitRelease: Must be called for every admitted fd before it is closed.
+*   Does nothing for fds that were not admitted through rateLimitAdmit.
+*/
+void rateLimitRelease(int fd);
+
+void rateLimitStats(RateLimitStats *stats);
+
+#endif // RATE_LIMIT_H_
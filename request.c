@@ -2,11 +2,112 @@
 // request.c: Does the bulk of the work for the web server.
 // 
 
+#define _GNU_SOURCE
 #include "segel.h"
 #include "request.h"
+#include "mime.h"
+#include "accessLog.h"
+#include "tcpOptions.h"
+#include "timerWheel.h"
+#include "responseCache.h"
+#include "tls.h"
+#include "http2.h"
+#include "vhost.h"
+#include "route.h"
+#include "autoindex.h"
+#include "fileCache.h"
+#include "contentStore.h"
+#include "sharedCache.h"
+#include "prefork.h"
+#include "profile.h"
+#include <time.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 
-// requestError(      fd,    filename,        "404",    "Not found", "OS-HW3 Server could not find this file");
-void requestError(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) 
+// Request headers the server acts on or logs
+typedef struct {
+   char ifNoneMatch[MAXLINE];   // empty when absent
+   time_t ifModifiedSince;      // -1 when absent or unparsable
+   char referer[MAXLINE];       // empty when absent
+   char userAgent[MAXLINE];     // empty when absent
+   char contentType[MAXLINE];   // empty when absent
+   char host[MAXLINE];          // empty when absent, the first one counts
+   long long contentLength;     // -1 when absent, -2 when malformed
+   int chunked;                 // 1 for chunked, -1 for a coding we do not support
+   int expectContinue;          // client waits for 100 Continue before the body
+} requestHdrs_t;
+
+// The request line; owned by requestHandle so the access log entry can point
+// into it after requestServe returns
+typedef struct {
+   char method[MAXLINE];
+   char uri[MAXLINE];
+   char version[MAXLINE];
+} requestLine_t;
+
+// max-age advertised in Cache-Control for static content, unless the site sets its own
+static int requestStaticMaxAge = 0;
+
+// How long and how much a client may take to send its request
+static RequestLimits requestLimits = {
+   .requestLineTimeoutMs = 10000,
+   .headerTimeoutMs = 20000,
+   .bodyTimeoutMs = 60000,
+   .maxHeaderCount = 100,
+   .maxHeaderBytes = 32 * 1024,
+   .maxBodyBytes = 16 * 1024 * 1024,
+   .cgiTimeoutMs = 30000,
+   .cgiMaxOutputBytes = 256 * 1024 * 1024,
+};
+
+// Reasons reading the request can fail, besides the client going away
+#define REQUEST_CLOSED -1
+// The CGI program exited or closed its stdin before taking the whole body
+#define REQUEST_HANDLER_DONE -2
+
+void requestSetLimits(const RequestLimits *limits)
+{
+   requestLimits = *limits;
+}
+
+void requestSetStaticMaxAge(int maxAge)
+{
+   requestStaticMaxAge = maxAge;
+}
+
+//
+// Writes to the client, tolerating a client that went away: the response
+// is simply cut short instead of taking the server down
+//
+static void requestWrite(int fd, void *buf, size_t n)
+{
+   if (rio_writen(fd, buf, n) != n && errno != EPIPE && errno != ECONNRESET)
+      unix_error("Rio_writen error");
+}
+
+//
+// Appends to the string of *len bytes in buf, of size bytes, as much as fits;
+// *len follows, so a response head is built without rescanning it
+//
+static void requestAppend(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+   va_list ap;
+   int n;
+
+   if (*len + 1 >= size)
+      return;
+   va_start(ap, fmt);
+   n = vsnprintf(buf + *len, size - *len, fmt, ap);
+   va_end(ap);
+   if (n > 0)
+      *len = *len + n < size ? *len + n : size - 1;
+}
+
+// requestError(      fd,  &entry,  filename,        "404",    "Not found", "OS-HW3 Server could not find this file");
+void requestError(int fd, AccessLogEntry *entry, char *cause, char *errnum, char *shortmsg, char *longmsg) 
 {
    char buf[MAXLINE], body[MAXBUF];
 
@@ -18,180 +119,1307 @@ void requestError(int fd, char *cause, char *errnum, char *shortmsg, char *longm
    sprintf(body, "%s<hr>OS-HW3 Web Server\r\n", body);
 
    // Write out the header information for this response
+   tcpResponseBegin(fd);
    sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-   Rio_writen(fd, buf, strlen(buf));
-   printf("%s", buf);
+   requestWrite(fd, buf, strlen(buf));
 
    sprintf(buf, "Content-Type: text/html\r\n");
-   Rio_writen(fd, buf, strlen(buf));
-   printf("%s", buf);
+   requestWrite(fd, buf, strlen(buf));
 
    sprintf(buf, "Content-Length: %lu\r\n\r\n", strlen(body));
-   Rio_writen(fd, buf, strlen(buf));
-   printf("%s", buf);
+   requestWrite(fd, buf, strlen(buf));
 
    // Write out the content
-   Rio_writen(fd, body, strlen(body));
-   printf("%s", body);
+   requestWrite(fd, body, strlen(body));
+   tcpResponseEnd(fd);
+
+   entry->status = atoi(errnum);
+   entry->bytes = strlen(body);
+}
+
+// Sends a whole text/plain response, for built-in route handlers
+void requestSendText(int fd, AccessLogEntry *entry, const char *status, const char *body, size_t len)
+{
+   char head[MAXLINE];
 
+   snprintf(head, sizeof(head), "HTTP/1.0 %s\r\n"
+            "Server: OS-HW3 Web Server\r\n"
+            "Content-Length: %zu\r\n"
+            "Content-Type: text/plain; charset=utf-8\r\n"
+            "Cache-Control: no-store\r\n\r\n", status, len);
+   tcpResponseBegin(fd);
+   requestWrite(fd, head, strlen(head));
+   requestWrite(fd, (void *)body, len);
+   tcpResponseEnd(fd);
+   entry->status = atoi(status);
+   entry->bytes = len;
 }
 
 
 //
-// Reads and discards everything up to an empty text line
+// Returns a pointer to the value of header line buf if its name is name,
+// NULL otherwise. Trailing CRLF is stripped in place.
 //
-void requestReadhdrs(rio_t *rp)
+static char *requestHeaderValue(char *buf, const char *name)
 {
-   char buf[MAXLINE];
+   size_t len = strlen(name);
+   char *value, *end;
+
+   if (strncasecmp(buf, name, len) || buf[len] != ':')
+      return NULL;
+   value = buf + len + 1;
+   while (*value == ' ' || *value == '\t')
+      value++;
+   end = value + strlen(value);
+   while (end > value && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' '))
+      *--end = '\0';
+   return value;
+}
 
-   Rio_readlineb(rp, buf, MAXLINE);
-   while (strcmp(buf, "\r\n")) {
-      Rio_readlineb(rp, buf, MAXLINE);
+//
+// Parses an HTTP-date (RFC 7231 IMF-fixdate), returns -1 on failure
+//
+static time_t requestParseDate(const char *value)
+{
+   struct tm tm;
+
+   memset(&tm, 0, sizeof(tm));
+   if (strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL)
+      return -1;
+   return timegm(&tm);
+}
+
+//
+// Reads one line of the request into buf and its length into len. Returns 0,
+// REQUEST_CLOSED if the client went away, or the status to answer with:
+// 408 if the deadline armed on timer passed, tooLong if the line does not
+// fit in buf.
+//
+static int requestReadline(rio_t *rp, Timer *timer, char *buf, int tooLong, int *len)
+{
+   ssize_t n = rio_readlineb(rp, buf, MAXLINE);
+
+   if (n <= 0 || buf[n - 1] != '\n') {
+      if (timerExpired(timer))
+         return 408;
+      if (n <= 0 || n < MAXLINE - 1)
+         return REQUEST_CLOSED;
+      return tooLong;
    }
-   return;
+   *len = n;
+   return 0;
 }
 
 //
-// Return 1 if static, 0 if dynamic content
-// Calculates filename (and cgiargs, for dynamic) from uri
+// Reads everything up to an empty text line, keeping the headers the server
+// acts on. Returns 0, REQUEST_CLOSED, or the error status to answer with
+// (408 on timeout, 431 when over the header count or size limits).
 //
-int requestParseURI(char *uri, char *filename, char *cgiargs) 
+int requestReadhdrs(rio_t *rp, Timer *timer, requestHdrs_t *hdrs)
 {
-   char *ptr;
+   char buf[MAXLINE], *value;
+   int n, rc, count = 0, bytes = 0;
+
+   hdrs->ifNoneMatch[0] = '\0';
+   hdrs->ifModifiedSince = -1;
+   hdrs->referer[0] = '\0';
+   hdrs->userAgent[0] = '\0';
+   hdrs->contentType[0] = '\0';
+   hdrs->host[0] = '\0';
+   hdrs->contentLength = -1;
+   hdrs->chunked = 0;
+   hdrs->expectContinue = 0;
+
+   while (true) {
+      if ((rc = requestReadline(rp, timer, buf, 431, &n)) != 0)
+         return rc;
+      if (!strcmp(buf, "\r\n") || !strcmp(buf, "\n"))
+         return 0;
+      bytes += n;
+      if (++count > requestLimits.maxHeaderCount || bytes > requestLimits.maxHeaderBytes)
+         return 431;
 
-   if (strstr(uri, "..")) {
-      sprintf(filename, "./public/home.html");
-      return 1;
+      if ((value = requestHeaderValue(buf, "If-None-Match")) != NULL) {
+         strncpy(hdrs->ifNoneMatch, value, MAXLINE - 1);
+         hdrs->ifNoneMatch[MAXLINE - 1] = '\0';
+      } else if ((value = requestHeaderValue(buf, "If-Modified-Since")) != NULL) {
+         hdrs->ifModifiedSince = requestParseDate(value);
+      } else if ((value = requestHeaderValue(buf, "Referer")) != NULL) {
+         strcpy(hdrs->referer, value);
+      } else if ((value = requestHeaderValue(buf, "User-Agent")) != NULL) {
+         strcpy(hdrs->userAgent, value);
+      } else if ((value = requestHeaderValue(buf, "Content-Type")) != NULL) {
+         strcpy(hdrs->contentType, value);
+      } else if ((value = requestHeaderValue(buf, "Host")) != NULL) {
+         if (hdrs->host[0] == '\0')
+            strcpy(hdrs->host, value);
+      } else if ((value = requestHeaderValue(buf, "Content-Length")) != NULL) {
+         char *end;
+         long long length = strtoll(value, &end, 10);
+         // a second, different length is a smuggling attempt as much as garbage is
+         if (end == value || *end != '\0' || length < 0 ||
+             (hdrs->contentLength != -1 && hdrs->contentLength != length))
+            hdrs->contentLength = -2;
+         else
+            hdrs->contentLength = length;
+      } else if ((value = requestHeaderValue(buf, "Transfer-Encoding")) != NULL) {
+         hdrs->chunked = strcasecmp(value, "chunked") ? -1 : 1;
+      } else if ((value = requestHeaderValue(buf, "Expect")) != NULL) {
+         hdrs->expectContinue = !strcasecmp(value, "100-continue");
+      }
    }
+}
+
+//
+// Strong validator built from inode, modification time and size
+//
+static void requestMakeETag(struct stat *sbuf, char *etag, size_t len)
+{
+   snprintf(etag, len, "\"%lx-%lx-%lx\"", (unsigned long)sbuf->st_ino,
+            (unsigned long)sbuf->st_mtime, (unsigned long)sbuf->st_size);
+}
 
-   if (!strstr(uri, "cgi")) {
-      // static
-      strcpy(cgiargs, "");
-      sprintf(filename, "./public/%s", uri);
-      if (uri[strlen(uri)-1] == '/') {
-         strcat(filename, "home.html");
+//
+// Returns 1 if etag appears in the If-None-Match list (or the list is "*").
+// Weak comparison is used, as RFC 7232 requires for If-None-Match.
+//
+static int requestETagMatches(const char *list, const char *etag)
+{
+   size_t len = strlen(etag);
+   const char *p = list;
+
+   while (*p) {
+      while (*p == ' ' || *p == '\t' || *p == ',')
+         p++;
+      if (*p == '*')
+         return 1;
+      if (!strncmp(p, "W/", 2))
+         p += 2;
+      if (!strncmp(p, etag, len) && (p[len] == '\0' || p[len] == ',' || p[len] == ' '))
+         return 1;
+      while (*p && *p != ',')
+         p++;
+   }
+   return 0;
+}
+
+//
+// Returns 1 if the client's cached copy is still fresh (respond with 304)
+//
+static int requestNotModified(requestHdrs_t *hdrs, struct stat *sbuf, const char *etag)
+{
+   // If-None-Match takes precedence over If-Modified-Since
+   if (hdrs->ifNoneMatch[0])
+      return requestETagMatches(hdrs->ifNoneMatch, etag);
+   if (hdrs->ifModifiedSince != -1)
+      return sbuf->st_mtime <= hdrs->ifModifiedSince;
+   return 0;
+}
+
+//
+// Appends the validator and caching headers for a static file to buf
+//
+static void requestCacheHeaders(char *buf, size_t size, size_t *len, struct stat *sbuf, const char *etag, int maxAge)
+{
+   char date[64];
+   struct tm tm;
+
+   gmtime_r(&sbuf->st_mtime, &tm);
+   strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+   requestAppend(buf, size, len, "ETag: %s\r\nLast-Modified: %s\r\nCache-Control: public, max-age=%d\r\n",
+                 etag, date, maxAge);
+}
+
+//
+// Answers a successful revalidation with a single header write
+//
+void requestServeNotModified(int fd, AccessLogEntry *entry, struct stat *sbuf, const char *etag, int maxAge)
+{
+   char buf[MAXBUF];
+   size_t len = 0;
+
+   requestAppend(buf, sizeof(buf), &len, "HTTP/1.0 304 Not Modified\r\nServer: OS-HW3 Web Server\r\n");
+   requestCacheHeaders(buf, sizeof(buf), &len, sbuf, etag, maxAge);
+   requestAppend(buf, sizeof(buf), &len, "\r\n");
+
+   requestWrite(fd, buf, len);
+   entry->status = 304;
+   entry->bytes = 0;
+}
+
+// What requestParseURI found a request path to be
+#define REQUEST_DYNAMIC 0
+#define REQUEST_STATIC 1
+#define REQUEST_BUILTIN 2
+
+//
+// Routes uri on the site: normalizes its path into path, finds the route and
+// builds filename from it (cgiargs gets the query). Returns REQUEST_STATIC,
+// REQUEST_DYNAMIC or REQUEST_BUILTIN (route is then set), or 400/414 when
+// the path is malformed or too long
+//
+static int requestParseURI(const Vhost *vhost, const char *uri, char *path, char *filename, char *cgiargs,
+                           const Route **route)
+{
+   const char *query = strchr(uri, '?'), *rest;
+   size_t len = query ? (size_t)(query - uri) : strlen(uri);
+   int rc;
+
+   // uri stays as sent for the access log
+   memcpy(path, uri, len);
+   path[len] = '\0';
+   snprintf(cgiargs, MAXLINE, "%s", query ? query + 1 : "");
+   if ((rc = routeNormalize(path)) != 0)
+      return rc;
+
+   *route = routeLookup(vhost->routes, path, &rest);
+   if ((*route)->kind == ROUTE_HANDLER)
+      return REQUEST_BUILTIN;
+   len = strlen(path);
+   if (snprintf(filename, MAXLINE, "%s%s%s", (*route)->dir, rest, path[len - 1] == '/' ? "home.html" : "") >= MAXLINE)
+      return 414;
+
+   // static directories hold their programs too, named *.cgi
+   if ((*route)->kind == ROUTE_CGI || (len > 4 && !strcmp(path + len - 4, ".cgi")))
+      return REQUEST_DYNAMIC;
+   return REQUEST_STATIC;
+}
+
+//
+// Fills in the filetype given the filename
+//
+void requestGetFiletype(char *filename, char *filetype)
+{
+   strcpy(filetype, mimeLookup(filename));
+}
+
+//
+// Answers a request that could not be read within the limits
+//
+static void requestReadError(int fd, AccessLogEntry *entry, int status)
+{
+   if (status == 408)
+      requestError(fd, entry, "", "408", "Request Timeout", "OS-HW3 Server timed out waiting for the request");
+   else if (status == 414)
+      requestError(fd, entry, "", "414", "URI Too Long", "OS-HW3 Server request line is too long");
+   else if (status == 400)
+      requestError(fd, entry, "", "400", "Bad Request", "OS-HW3 Server could not parse the request body framing");
+   else if (status == 411)
+      requestError(fd, entry, "", "411", "Length Required", "OS-HW3 Server needs a Content-Length or chunked body");
+   else if (status == 413)
+      requestError(fd, entry, "", "413", "Content Too Large", "OS-HW3 Server request body is too large");
+   else if (status == 501)
+      requestError(fd, entry, "", "501", "Not Implemented", "OS-HW3 Server does not implement this transfer coding");
+   else
+      requestError(fd, entry, "", "431", "Request Header Fields Too Large", "OS-HW3 Server request headers are too large");
+}
+
+//
+// Waits until fd is ready for events or the deadline passes (a zero deadline
+// never passes). Returns 1 when ready, 0 on timeout. The body deadline shuts
+// the socket down for reading, which ends a wait for the client too.
+//
+static int requestWaitFd(int fd, short events, struct timespec *deadline)
+{
+   struct pollfd pfd = {fd, events, 0};
+   struct timespec now;
+   long timeout;
+   int rc;
+
+   do {
+      timeout = -1;
+      if (deadline->tv_sec != 0) {
+         clock_gettime(CLOCK_MONOTONIC, &now);
+         timeout = (deadline->tv_sec - now.tv_sec) * 1000L + (deadline->tv_nsec - now.tv_nsec) / 1000000L;
+         if (timeout < 0)
+            timeout = 0;
       }
-      return 1;
-   } else {
-      // dynamic
-      ptr = index(uri, '?');
-      if (ptr) {
-         strcpy(cgiargs, ptr+1);
-         *ptr = '\0';
-      } else {
-         strcpy(cgiargs, "");
+      rc = poll(&pfd, 1, timeout);
+   } while (rc < 0 && errno == EINTR);
+   return rc > 0;
+}
+
+//
+// Writes all of buf to the (non-blocking) pipe to the CGI program. Returns 0,
+// REQUEST_HANDLER_DONE if the program closed its stdin, or 504 past the deadline.
+//
+static int requestPipeWrite(int out, char *buf, size_t n, struct timespec *deadline)
+{
+   ssize_t moved;
+
+   while (n > 0) {
+      if ((moved = write(out, buf, n)) > 0) {
+         buf += moved;
+         n -= moved;
+      } else if (moved < 0 && errno == EAGAIN) {
+         if (!requestWaitFd(out, POLLOUT, deadline))
+            return 504;
+      } else if (moved < 0 && errno != EINTR) {
+         return REQUEST_HANDLER_DONE;
+      }
+   }
+   return 0;
+}
+
+//
+// Moves n body bytes into the CGI program's stdin. What rio already buffered
+// is written out, the rest is spliced from the socket into the pipe without
+// passing through user space. A TLS socket the kernel does not decrypt is
+// read through rio instead. Returns 0, REQUEST_CLOSED, REQUEST_HANDLER_DONE,
+// 408, or 504 if the program stops reading its input past the deadline.
+//
+static int requestBodyCopy(rio_t *rp, Timer *timer, int out, long long n, struct timespec *deadline)
+{
+   char buf[MAXBUF];
+   ssize_t moved;
+   int rc;
+
+   if (!tlsRawReadable(rp->rio_fd)) {
+      while (n > 0) {
+         if ((moved = rio_readnb(rp, buf, n < MAXBUF ? n : MAXBUF)) <= 0)
+            return timerExpired(timer) ? 408 : REQUEST_CLOSED;
+         if ((rc = requestPipeWrite(out, buf, moved, deadline)) != 0)
+            return rc;
+         n -= moved;
       }
-      sprintf(filename, "./public/%s", uri);
       return 0;
    }
+
+   // the pipe is still empty here and rio holds less than a pipe's worth
+   if (n > 0 && rp->rio_cnt > 0) {
+      moved = rp->rio_cnt < n ? rp->rio_cnt : n;
+      if (rio_writen(out, rp->rio_bufptr, moved) != moved)
+         return REQUEST_HANDLER_DONE;
+      rp->rio_bufptr += moved;
+      rp->rio_cnt -= moved;
+      n -= moved;
+   }
+
+   while (n > 0) {
+      moved = splice(rp->rio_fd, NULL, out, NULL, n < (1 << 16) ? n : (1 << 16), SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (moved > 0) {
+         n -= moved;
+      } else if (moved < 0 && errno == EINTR) {
+         continue;
+      } else if (moved < 0 && errno == EAGAIN) {
+         // either the pipe is full or the socket is empty: wait for both
+         if (!requestWaitFd(out, POLLOUT, deadline))
+            return 504;
+         requestWaitFd(rp->rio_fd, POLLIN, &(struct timespec){0, 0});
+      } else if (moved < 0 && errno == EPIPE) {
+         return REQUEST_HANDLER_DONE;
+      } else {
+         return timerExpired(timer) ? 408 : REQUEST_CLOSED;
+      }
+   }
+   return 0;
 }
 
 //
-// Fills in the filetype given the filename
+// Decodes a chunked body into the CGI program's stdin, chunk data going
+// through requestBodyCopy. Trailers are read and dropped. Returns as
+// requestBodyCopy does, or 400 on bad framing and 413 past the size limit.
 //
-void requestGetFiletype(char *filename, char *filetype)
+static int requestBodyChunked(rio_t *rp, Timer *timer, int out, struct timespec *deadline)
 {
-   if (strstr(filename, ".html")) 
-      strcpy(filetype, "text/html");
-   else if (strstr(filename, ".gif")) 
-      strcpy(filetype, "image/gif");
-   else if (strstr(filename, ".jpg")) 
-      strcpy(filetype, "image/jpeg");
-   else 
-      strcpy(filetype, "text/plain");
+   char buf[MAXLINE], *end;
+   long long size, total = 0;
+   int rc, len;
+
+   while (true) {
+      if ((rc = requestReadline(rp, timer, buf, 400, &len)) != 0)
+         return rc;
+      size = strtoll(buf, &end, 16);
+      if (end == buf || size < 0 || (*end != ';' && *end != '\r' && *end != '\n'))
+         return 400;
+      if (size == 0)
+         break;
+      if (size > (long long)requestLimits.maxBodyBytes - total)
+         return 413;
+      total += size;
+      if ((rc = requestBodyCopy(rp, timer, out, size, deadline)) != 0)
+         return rc;
+      if ((rc = requestReadline(rp, timer, buf, 400, &len)) != 0)
+         return rc;
+      if (strcmp(buf, "\r\n") && strcmp(buf, "\n"))
+         return 400;
+   }
+
+   do {
+      if ((rc = requestReadline(rp, timer, buf, 431, &len)) != 0)
+         return rc;
+   } while (strcmp(buf, "\r\n") && strcmp(buf, "\n"));
+   return 0;
 }
 
-void requestServeDynamic(int fd, char *filename, char *cgiargs)
+//
+// Reads the program's header block (up to the empty line) into buf, which
+// may also receive the first body bytes. Sets *len to the bytes read and
+// *headLen to the length of the header block. Returns 0, 502 if the program
+// exits or writes too much before finishing its headers, or 504 on timeout.
+//
+static int requestCgiReadHead(int out, struct timespec *deadline, char *buf, size_t size,
+                              size_t *len, size_t *headLen)
 {
-   char buf[MAXLINE], *emptylist[] = {NULL};
+   char *end;
+   ssize_t n;
 
-   // The server does only a little bit of the header.  
-   // The CGI script has to finish writing out the header.
-   sprintf(buf, "HTTP/1.0 200 OK\r\n");
-   sprintf(buf, "%sServer: OS-HW3 Web Server\r\n", buf);
+   *len = 0;
+   while (true) {
+      if (!requestWaitFd(out, POLLIN, deadline))
+         return 504;
+      if ((n = read(out, buf + *len, size - 1 - *len)) < 0) {
+         if (errno == EINTR)
+            continue;
+         return 502;
+      }
+      if (n == 0)
+         return 502;
+      *len += n;
+      buf[*len] = '\0';
 
-   Rio_writen(fd, buf, strlen(buf));
+      if (!strncmp(buf, "\r\n", 2) || buf[0] == '\n') {
+         *headLen = buf[0] == '\n' ? 1 : 2;
+         return 0;
+      }
+      if ((end = strstr(buf, "\n\r\n")) != NULL) {
+         *headLen = end - buf + 3;
+         return 0;
+      }
+      if ((end = strstr(buf, "\n\n")) != NULL) {
+         *headLen = end - buf + 2;
+         return 0;
+      }
+      if (*len == size - 1)
+         return 502;
+   }
+}
+
+//
+// Reads how long a response may be cached from its Cache-Control value:
+// s-maxage over max-age, 0 when it must not be stored, -1 when not stated.
+//
+static int requestCacheMaxAge(char *value)
+{
+   char *token, *save;
+   int maxAge = -1, shared = -1;
+
+   for (token = strtok_r(value, ", ", &save); token != NULL; token = strtok_r(NULL, ", ", &save)) {
+      if (!strcasecmp(token, "no-store") || !strcasecmp(token, "no-cache") || !strcasecmp(token, "private"))
+         return 0;
+      if (!strncasecmp(token, "s-maxage=", 9))
+         shared = atoi(token + 9);
+      else if (!strncasecmp(token, "max-age=", 8))
+         maxAge = atoi(token + 8);
+   }
+   return shared >= 0 ? shared : maxAge;
+}
 
-   if (Fork() == 0) {
+//
+// Turns the program's header block into the response head. A Status: header
+// sets the status line, a Location: without one makes it a redirect, and
+// Content-Length is kept so the body can be relayed as is. Hop-by-hop
+// headers are the server's business and are dropped. *maxAge is set as
+// requestCacheMaxAge does; a response setting cookies is never stored.
+//
+static void requestCgiParseHead(char *head, char *status, char *headers, long long *contentLength, int *maxAge)
+{
+   char *line, *next, *value, cacheControl[MAXLINE];
+   size_t len;
+   int location = 0;
+
+   strcpy(status, "200 OK");
+   headers[0] = '\0';
+   *contentLength = -1;
+   *maxAge = -1;
+   for (line = head; *line != '\0'; line = next) {
+      // the head ends with a blank line, but a last line without one still ends it
+      if ((next = strchr(line, '\n')) != NULL)
+         *next++ = '\0';
+      else
+         next = line + strlen(line);
+      if ((len = strlen(line)) > 0 && line[len - 1] == '\r')
+         line[len - 1] = '\0';
+      if (*line == '\0')
+         break;
+
+      if ((value = requestHeaderValue(line, "Status")) != NULL) {
+         snprintf(status, MAXLINE, "%s", value);
+         location = -1;
+         continue;
+      }
+      if ((value = requestHeaderValue(line, "Content-Length")) != NULL) {
+         *contentLength = strtoll(value, NULL, 10);
+      } else if ((value = requestHeaderValue(line, "Cache-Control")) != NULL) {
+         snprintf(cacheControl, sizeof(cacheControl), "%s", value);
+         if (*maxAge != 0)
+            *maxAge = requestCacheMaxAge(cacheControl);
+      } else if (requestHeaderValue(line, "Set-Cookie") != NULL) {
+         *maxAge = 0;
+      } else if (requestHeaderValue(line, "Location") != NULL && location == 0) {
+         location = 1;
+      } else if (requestHeaderValue(line, "Transfer-Encoding") != NULL ||
+                 requestHeaderValue(line, "Connection") != NULL) {
+         continue;
+      }
+      if (strlen(headers) + strlen(line) + 2 < MAXBUF)
+         sprintf(headers + strlen(headers), "%s\r\n", line);
+   }
+   if (location == 1)
+      strcpy(status, "302 Found");
+}
+
+// Copy of a response body kept while it is relayed, to fill the response cache
+typedef struct {
+   int active;      // cleared for good once the body outgrows max
+   char *data;
+   size_t len;
+   size_t size;
+   size_t max;
+} requestCapture_t;
+
+//
+// Sends n bytes of the program's output as one chunk (or as is) and counts
+// them in *sent. Returns 0, or 502 once the output cap max is passed.
+//
+static int requestCgiSend(int fd, char *buf, size_t n, int chunked, long long *sent, size_t max)
+{
+   char head[32];
+
+   if (max > 0 && *sent + n > max)
+      return 502;
+   if (chunked) {
+      sprintf(head, "%zx\r\n", n);
+      requestWrite(fd, head, strlen(head));
+   }
+   requestWrite(fd, buf, n);
+   if (chunked)
+      requestWrite(fd, "\r\n", 2);
+   *sent += n;
+   return 0;
+}
+
+//
+// Returns room for n more bytes of the copy, or NULL once capturing was given
+// up because the response outgrew the cache's entry limit
+//
+static char *requestCaptureReserve(requestCapture_t *capture, size_t n)
+{
+   char *data;
+   size_t size;
+
+   if (!capture->active)
+      return NULL;
+   if (capture->len + n > capture->max)
+      goto give_up;
+   if (capture->len + n > capture->size) {
+      size = capture->size != 0 ? capture->size : 16384;
+      while (size < capture->len + n)
+         size *= 2;
+      if ((data = realloc(capture->data, size)) == NULL)
+         goto give_up;
+      capture->data = data;
+      capture->size = size;
+   }
+   return capture->data + capture->len;
+
+give_up:
+   capture->active = 0;
+   free(capture->data);
+   capture->data = NULL;
+   return NULL;
+}
+
+//
+// Relays the rest of the program's output to the client until EOF, length
+// bytes (when length is not -1), the deadline or the output cap max. Data is
+// spliced from the pipe to the socket; when chunked, FIONREAD sizes each
+// chunk to what the pipe holds so its header can go first. While capture is
+// active the data is read through user space instead, keeping a copy.
+// Returns 0, REQUEST_CLOSED, 502 (cap passed or output short of length) or 504.
+//
+static int requestCgiRelay(int out, int fd, int chunked, long long length, struct timespec *deadline,
+                           long long *sent, size_t max, requestCapture_t *capture)
+{
+   char head[32], copy[MAXBUF], *space;
+   int raw = tlsRawWritable(fd);
+   ssize_t moved;
+   long long n;
+   int avail, rc;
+
+   while (length < 0 || *sent < length) {
+      if (!requestWaitFd(out, POLLIN, deadline))
+         return 504;
+      if (ioctl(out, FIONREAD, &avail) < 0)
+         return 502;
+      if (avail == 0)
+         break;   // readable with nothing in it: the program closed its stdout
+      n = avail;
+      if (length >= 0 && n > length - *sent)
+         n = length - *sent;
+      if (max > 0 && *sent + n > (long long)max)
+         return 502;
+
+      // a TLS socket the kernel does not encrypt for is written from user space
+      if ((space = requestCaptureReserve(capture, n)) == NULL && !raw) {
+         space = copy;
+         n = n < MAXBUF ? n : MAXBUF;
+      }
+      if (space != NULL) {
+         if ((moved = read(out, space, n)) < 0 && errno == EINTR)
+            continue;
+         if (moved <= 0)
+            return 502;
+         if (space != copy)
+            capture->len += moved;
+         if ((rc = requestCgiSend(fd, space, moved, chunked, sent, max)) != 0)
+            return rc;
+         continue;
+      }
+      if (chunked) {
+         sprintf(head, "%llx\r\n", n);
+         requestWrite(fd, head, strlen(head));
+      }
+      while (n > 0) {
+         moved = splice(out, NULL, fd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+         if (moved > 0) {
+            n -= moved;
+            *sent += moved;
+         } else if (moved < 0 && errno == EINTR) {
+            continue;
+         } else if (moved < 0 && errno == EAGAIN) {
+            if (!requestWaitFd(fd, POLLOUT, deadline))
+               return 504;
+         } else {
+            return REQUEST_CLOSED;
+         }
+      }
+      if (chunked)
+         requestWrite(fd, "\r\n", 2);
+   }
+
+   if (length >= 0 && *sent < length)
+      return 502;
+   if (chunked)
+      requestWrite(fd, "0\r\n\r\n", 5);
+   return 0;
+}
+
+//
+// Fills the response cache with a complete HTTP/1.0 response built from the
+// program's head and the captured body, so a hit is a single write
+//
+static void requestCacheStore(ResponseCacheEntry ticket, char *status, char *headers,
+                              long long contentLength, requestCapture_t *capture, int ttl)
+{
+   char head[MAXBUF + MAXLINE], *data;
+   size_t headLen;
+
+   headLen = 0;
+   requestAppend(head, sizeof(head), &headLen, "HTTP/1.0 %s\r\nServer: OS-HW3 Web Server\r\n%s", status, headers);
+   if (contentLength < 0)
+      requestAppend(head, sizeof(head), &headLen, "Content-Length: %zu\r\n", capture->len);
+   requestAppend(head, sizeof(head), &headLen, "Connection: close\r\n\r\n");
+
+   if ((data = malloc(headLen + capture->len)) == NULL) {
+      responseCacheAbandon(ticket, 0);
+      return;
+   }
+   memcpy(data, head, headLen);
+   memcpy(data + headLen, capture->data, capture->len);
+   responseCacheFill(ticket, data, headLen + capture->len, headLen, ttl);
+}
+
+//
+// Answers from a cache hit
+//
+static void requestServeCached(int fd, AccessLogEntry *entry, ResponseCacheEntry cached)
+{
+   size_t len, headLen;
+   const char *data = responseCacheData(cached, &len, &headLen);
+
+   tcpResponseBegin(fd);
+   requestWrite(fd, (void *)data, len);
+   tcpResponseEnd(fd);
+   entry->status = 200;
+   entry->bytes = len - headLen;
+}
+
+//
+// Lists a directory that has no home.html; dir is its path on disk, ending
+// in '/'. Only the rows come from the kept listing, the title is the path
+// the client asked for.
+//
+static void requestServeIndex(int fd, AccessLogEntry *entry, char *path, const char *dir)
+{
+   static const char bottom[] = "</pre><hr></body></html>\n";
+   // top holds the title twice, so a long escaped path still fits whole
+   char head[MAXBUF], top[2 * MAXLINE + 128], title[MAXLINE];
+   AutoindexPage page;
+   const char *rows;
+   size_t rowsLen, len;
+
+   if ((page = autoindexGet(dir)) == NULL) {
+      if (errno == ENOENT || errno == ENOTDIR)
+         requestError(fd, entry, path, "404", "Not found", "OS-HW3 Server could not find this file");
+      else
+         requestError(fd, entry, path, "403", "Forbidden", "OS-HW3 Server could not list this directory");
+      return;
+   }
+   rows = autoindexData(page, &rowsLen);
+   autoindexEscape(title, sizeof(title), path);
+   snprintf(top, sizeof(top), "<html><head><title>Index of %s</title></head><body>\n"
+            "<h1>Index of %s</h1><hr><pre>%s", title, title, strcmp(path, "/") ? "<a href=\"../\">../</a>\n" : "");
+   len = strlen(top) + rowsLen + sizeof(bottom) - 1;
+   snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+            "Server: OS-HW3 Web Server\r\n"
+            "Content-Length: %zu\r\n"
+            "Content-Type: text/html\r\n"
+            "Cache-Control: no-cache\r\n\r\n", len);
+
+   tcpResponseBegin(fd);
+   requestWrite(fd, head, strlen(head));
+   requestWrite(fd, top, strlen(top));
+   requestWrite(fd, (void *)rows, rowsLen);
+   requestWrite(fd, (void *)bottom, sizeof(bottom) - 1);
+   tcpResponseEnd(fd);
+   autoindexRelease(page);
+   entry->status = 200;
+   entry->bytes = len;
+}
+
+//
+// Sends a listed directory asked for without its trailing slash to the URI
+// with one, so the relative links of the listing resolve
+//
+static void requestRedirectDirectory(int fd, AccessLogEntry *entry, const char *uri)
+{
+   char buf[MAXBUF];
+   const char *query = strchr(uri, '?');
+   int len = query ? (int)(query - uri) : (int)strlen(uri);
+
+   snprintf(buf, sizeof(buf), "HTTP/1.0 301 Moved Permanently\r\n"
+            "Server: OS-HW3 Web Server\r\n"
+            "Location: %.*s/%s\r\n"
+            "Content-Length: 0\r\n\r\n", len, uri, query ? query : "");
+   requestWrite(fd, buf, strlen(buf));
+   entry->status = 301;
+   entry->bytes = 0;
+}
+
+//
+// Reaps the program, giving it until the deadline to exit on its own once
+// its output is complete (it may still be finishing up), killing it after.
+//
+static void requestCgiReap(pid_t pid, struct timespec *deadline, int kill_)
+{
+   int pidfd;
+
+   if (!kill_ && waitpid(pid, NULL, WNOHANG) == pid)
+      return;
+   if (!kill_ && (pidfd = syscall(SYS_pidfd_open, pid, 0)) >= 0) {
+      kill_ = !requestWaitFd(pidfd, POLLIN, deadline);
+      close(pidfd);
+   }
+   if (kill_)
+      kill(pid, SIGKILL);
+   while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+      ;
+}
+
+void requestServeDynamic(int fd, AccessLogEntry *entry, char *filename, char *cgiargs, char *method,
+                         requestHdrs_t *hdrs, rio_t *rp, Timer *timer, const Route *route, int cachePartition)
+{
+   char buf[MAXBUF], head[MAXBUF + MAXLINE], status[MAXLINE], headers[MAXBUF], length[32], key[2 * MAXLINE];
+   char *emptylist[] = {NULL}, *space;
+   int body = hdrs->contentLength > 0 || hdrs->chunked == 1;
+   int chunked, bodyPipe[2], outPipe[2], rc = 0, maxAge, ttl = 0;
+   long long contentLength, sent = 0;
+   size_t len, headLen, responseLen;
+   struct timespec deadline = {0, 0};
+   ResponseCacheEntry ticket = NULL;
+   requestCapture_t capture = {0, NULL, 0, 0, 0};
+   pid_t pid;
+   // the route running the program may set its own limits
+   int timeoutMs = route->cgiTimeoutMs >= 0 ? route->cgiTimeoutMs : requestLimits.cgiTimeoutMs;
+   size_t maxOutput = route->cgiMaxOutputBytes >= 0 ? (size_t)route->cgiMaxOutputBytes
+                                                    : requestLimits.cgiMaxOutputBytes;
+
+   // Idempotent requests may be answered from the response cache; on a miss
+   // this request runs the program and the same ones arriving meanwhile wait
+   if (!strcasecmp(method, "GET") && !body) {
+      snprintf(key, sizeof(key), "%s?%s", filename, cgiargs);
+      switch (responseCacheLookup(cachePartition, key, &ticket)) {
+      case RESPONSE_CACHE_HIT:
+         requestServeCached(fd, entry, ticket);
+         responseCacheRelease(ticket);
+         return;
+      case RESPONSE_CACHE_MISS:
+         break;
+      default:
+         ticket = NULL;
+         break;
+      }
+   }
+
+   if (timeoutMs > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      deadline.tv_sec += timeoutMs / 1000;
+      deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+         deadline.tv_sec++;
+         deadline.tv_nsec -= 1000000000L;
+      }
+   }
+   if (pipe2(outPipe, O_CLOEXEC) < 0 || (body && pipe2(bodyPipe, O_CLOEXEC) < 0))
+      unix_error("pipe error");
+
+   // the client holds the body back until told to go ahead
+   if (body && hdrs->expectContinue)
+      requestWrite(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+
+   if ((pid = Fork()) == 0) {
       /* Child process */
+      /* The program gets default signal handling, not the server's blocked
+         HUP/TERM/INT (taken by a signalfd) and ignored SIGPIPE, which exec keeps */
+      sigset_t none;
+      sigemptyset(&none);
+      sigprocmask(SIG_SETMASK, &none, NULL);
+      signal(SIGPIPE, SIG_DFL);
       Setenv("QUERY_STRING", cgiargs, 1);
-      /* When the CGI process writes to stdout, it will instead go to the socket */
-      Dup2(fd, STDOUT_FILENO);
+      Setenv("REQUEST_METHOD", method, 1);
+      Setenv("SERVER_PROTOCOL", entry->version, 1);
+      if (hdrs->contentType[0] != '\0')
+         Setenv("CONTENT_TYPE", hdrs->contentType, 1);
+      /* A chunked body has no length up front: the program reads to EOF */
+      if (hdrs->contentLength >= 0 && hdrs->chunked != 1) {
+         sprintf(length, "%lld", hdrs->contentLength);
+         Setenv("CONTENT_LENGTH", length, 1);
+      }
+      if (body)
+         Dup2(bodyPipe[0], STDIN_FILENO);
+      /* The program's output comes back to the server through a pipe */
+      Dup2(outPipe[1], STDOUT_FILENO);
       Execve(filename, emptylist, environ);
    }
-   Wait(NULL);
+   Close(outPipe[1]);
+
+   if (body) {
+      Close(bodyPipe[0]);
+      fcntl(bodyPipe[1], F_SETFL, O_NONBLOCK);
+      timerArm(timer, fd, requestLimits.bodyTimeoutMs);
+      if (hdrs->chunked == 1)
+         rc = requestBodyChunked(rp, timer, bodyPipe[1], &deadline);
+      else
+         rc = requestBodyCopy(rp, timer, bodyPipe[1], hdrs->contentLength, &deadline);
+      timerCancel(timer);
+      Close(bodyPipe[1]);
+      if (rc == REQUEST_HANDLER_DONE)
+         rc = 0;
+   }
+
+   // nothing has been sent yet, so a failure still gets a proper reply
+   if (rc == 0)
+      rc = requestCgiReadHead(outPipe[0], &deadline, buf, sizeof(buf), &len, &headLen);
+   if (rc != 0) {
+      requestCgiReap(pid, &deadline, 1);
+      Close(outPipe[0]);
+      if (ticket != NULL)
+         responseCacheAbandon(ticket, 0);
+      if (rc == 502)
+         requestError(fd, entry, filename, "502", "Bad Gateway", "OS-HW3 Server got no valid response from this CGI program");
+      else if (rc == 504)
+         requestError(fd, entry, filename, "504", "Gateway Timeout", "OS-HW3 Server timed out waiting for this CGI program");
+      else if (rc > 0)
+         requestReadError(fd, entry, rc);
+      return;
+   }
+
+   memcpy(head, buf, headLen);
+   head[headLen] = '\0';
+   requestCgiParseHead(head, status, headers, &contentLength, &maxAge);
+   if (ticket != NULL) {
+      ttl = responseCacheTtl(maxAge);
+      capture.max = responseCacheMaxEntry();
+      capture.active = 1;
+      if (atoi(status) != 200 || ttl <= 0 || contentLength > (long long)capture.max) {
+         // not cacheable: requests waiting for it may run the program themselves
+         responseCacheAbandon(ticket, 1);
+         ticket = NULL;
+         capture.active = 0;
+      }
+   }
+   if (maxOutput > 0 && contentLength > (long long)maxOutput) {
+      requestCgiReap(pid, &deadline, 1);
+      Close(outPipe[0]);
+      if (ticket != NULL)
+         responseCacheAbandon(ticket, 0);
+      requestError(fd, entry, filename, "502", "Bad Gateway", "OS-HW3 Server CGI program response is too large");
+      return;
+   }
+
+   // Without a length the body is framed by chunks for HTTP/1.1 clients;
+   // older ones read until the connection closes
+   chunked = contentLength < 0 && !strcasecmp(entry->version, "HTTP/1.1");
+   responseLen = 0;
+   requestAppend(head, sizeof(head), &responseLen, "%s %s\r\n", chunked ? "HTTP/1.1" : "HTTP/1.0", status);
+   requestAppend(head, sizeof(head), &responseLen, "Server: OS-HW3 Web Server\r\n%s", headers);
+   if (chunked)
+      requestAppend(head, sizeof(head), &responseLen, "Transfer-Encoding: chunked\r\n");
+   requestAppend(head, sizeof(head), &responseLen, "Connection: close\r\n\r\n");
+
+   tcpResponseBegin(fd);
+   requestWrite(fd, head, responseLen);
+   if (len > headLen) {
+      size_t extra = len - headLen;
+      if (contentLength >= 0 && (long long)extra > contentLength)
+         extra = contentLength;
+      if ((space = requestCaptureReserve(&capture, extra)) != NULL) {
+         memcpy(space, buf + headLen, extra);
+         capture.len += extra;
+      }
+      rc = requestCgiSend(fd, buf + headLen, extra, chunked, &sent, maxOutput);
+   }
+   if (rc == 0)
+      rc = requestCgiRelay(outPipe[0], fd, chunked, contentLength, &deadline, &sent, maxOutput, &capture);
+   tcpResponseEnd(fd);
+
+   Close(outPipe[0]);
+   requestCgiReap(pid, &deadline, rc != 0);
+   if (ticket != NULL) {
+      if (rc == 0 && capture.active)
+         requestCacheStore(ticket, status, headers, contentLength, &capture, ttl);
+      else
+         responseCacheAbandon(ticket, rc == 0);   // complete but too large to keep
+   }
+   free(capture.data);
+   // a response cut short is logged with what went wrong
+   entry->status = rc > 0 ? rc : atoi(status);
+   entry->bytes = sent;
 }
 
+//
+// Sends n bytes of a content store entry: with sendfile() from its memfd when
+// the socket may be written directly, else from its mapping (TLS in user
+// space, or hugetlbfs, which sendfile cannot read from)
+//
+static void requestSendStored(int fd, ContentStoreEntry stored, size_t n)
+{
+   struct timespec noDeadline = {0, 0};
+   off_t offset = 0;
+   ssize_t sent;
+   size_t len;
 
-void requestServeStatic(int fd, char *filename, int filesize) 
+   while (tlsRawWritable(fd) && offset < (off_t)n) {
+      sent = contentStoreSend(fd, stored, offset, n - offset);
+      if (sent > 0)
+         offset += sent;
+      else if (sent < 0 && errno == EINTR)
+         continue;
+      else if (sent < 0 && errno == EAGAIN)
+         requestWaitFd(fd, POLLOUT, &noDeadline);
+      else if (sent < 0 && errno == EINVAL)
+         break;
+      else
+         return;   // the client went away
+   }
+   requestWrite(fd, (char *)contentStoreData(stored, &len) + offset, n - offset);
+}
+
+void requestServeStatic(int fd, AccessLogEntry *entry, char *filename, struct stat *sbuf, const char *etag,
+                        int maxAge)
 {
+   int filesize = sbuf->st_size;
    int srcfd;
    char *srcp, filetype[MAXLINE], buf[MAXBUF];
+   size_t cachedSize, len = 0;
+   FileCacheEntry cached = NULL;
+   bool loaded = false;
+   unsigned long long stage = profileBegin();
+   ContentStoreEntry stored = contentStoreGet(filename, sbuf);
+   const char *shared = NULL;
 
    requestGetFiletype(filename, filetype);
 
-   srcfd = Open(filename, O_RDONLY, 0);
+   if (stored != NULL) {
+      // kept on huge pages for good: sent from there, never mapped per request
+      srcp = (char *)contentStoreData(stored, &cachedSize);
+      filesize = cachedSize;
+   } else if ((shared = sharedCacheRead(filename, sbuf, &cachedSize)) != NULL) {
+      // copied out of the cache all worker processes share
+      srcp = (char *)shared;
+      filesize = cachedSize;
+   } else if ((cached = fileCacheGet(filename, sbuf, &loaded)) != NULL) {
+      // already mapped and faulted in by an earlier request or the prewarm
+      srcp = (char *)fileCacheData(cached, &cachedSize);
+      filesize = cachedSize;     // the file may have changed since the stat
+   } else {
+      srcfd = Open(filename, O_RDONLY, 0);
 
-   // Rather than call read() to read the file into memory, 
-   // which would require that we allocate a buffer, we memory-map the file
-   srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
-   Close(srcfd);
+      // Rather than call read() to read the file into memory, 
+      // which would require that we allocate a buffer, we memory-map the file
+      srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
+      Close(srcfd);
+   }
+   profileEnd(PROFILE_OPEN, stage);
+   stage = profileBegin();
 
    // put together response
-   sprintf(buf, "HTTP/1.0 200 OK\r\n");
-   sprintf(buf, "%sServer: OS-HW3 Web Server\r\n", buf);
-   sprintf(buf, "%sContent-Length: %d\r\n", buf, filesize);
-   sprintf(buf, "%sContent-Type: %s\r\n\r\n", buf, filetype);
+   requestAppend(buf, sizeof(buf), &len, "HTTP/1.0 200 OK\r\nServer: OS-HW3 Web Server\r\n"
+                 "Content-Length: %d\r\nContent-Type: %s\r\n", filesize, filetype);
+   requestCacheHeaders(buf, sizeof(buf), &len, sbuf, etag, maxAge);
+   requestAppend(buf, sizeof(buf), &len, "\r\n");
 
-   Rio_writen(fd, buf, strlen(buf));
+   tcpResponseBegin(fd);
+   requestWrite(fd, buf, len);
 
    //  Writes out to the client socket the memory-mapped file 
-   Rio_writen(fd, srcp, filesize);
-   Munmap(srcp, filesize);
+   if (stored != NULL)
+      requestSendStored(fd, stored, filesize);
+   else
+      requestWrite(fd, srcp, filesize);
+   tcpResponseEnd(fd);
+   profileEnd(PROFILE_WRITE, stage);
+   // the other workers find it in the shared cache from now on; a file cache
+   // hit was stored when its entry was made, and may have been evicted since
+   if (stored == NULL && shared == NULL && (cached == NULL || loaded))
+      sharedCacheStore(filename, sbuf, srcp, filesize);
+   if (stored != NULL)
+      contentStoreRelease(stored);
+   else if (cached != NULL)
+      fileCacheRelease(cached);
+   else if (shared == NULL)
+      Munmap(srcp, filesize);
+
+   entry->status = 200;
+   entry->bytes = filesize;
+}
+
+//
+// Fills in the client address of the log entry from the connected socket
+//
+static void requestClientAddr(int fd, AccessLogEntry *entry)
+{
+   struct sockaddr_storage addr;
+   socklen_t len = sizeof(addr);
+
+   strcpy(entry->client, "-");
+   if (http2PeerName(fd, (SA *)&addr, &len) < 0)
+      return;
+   if (addr.ss_family == AF_INET)
+      inet_ntop(AF_INET, &((struct sockaddr_in *)&addr)->sin_addr, entry->client, sizeof(entry->client));
+   else if (addr.ss_family == AF_INET6)
+      inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&addr)->sin6_addr, entry->client, sizeof(entry->client));
+}
+
+static long requestElapsedUs(struct timespec *start)
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
 
+// check a request body's framing before reading it; 0 or the status to answer with
+static int requestCheckBody(char *method, requestHdrs_t *hdrs)
+{
+   int hasBody = strcasecmp(method, "GET") != 0;
+
+   if (hdrs->chunked == -1)
+      return 501;
+   // both framings at once is how requests get smuggled past proxies
+   if (hdrs->contentLength == -2 || (hdrs->chunked == 1 && hdrs->contentLength != -1))
+      return 400;
+   if (hasBody && hdrs->chunked == 0 && hdrs->contentLength == -1)
+      return 411;
+   if (hdrs->contentLength > (long long)requestLimits.maxBodyBytes)
+      return 413;
+   return 0;
 }
 
-// handle a request
-void requestHandle(int fd)
+// serve a request, recording the outcome in entry
+static bool requestServe(int fd, AccessLogEntry *entry, requestLine_t *line, requestHdrs_t *hdrs, Timer *timer)
 {
 
-   int is_static;
+   int kind, rc, len;
    struct stat sbuf;
-   char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-   char filename[MAXLINE], cgiargs[MAXLINE];
+   char buf[MAXLINE], *method = line->method, *uri = line->uri, *version = line->version;
+   char path[MAXLINE], filename[MAXLINE], cgiargs[MAXLINE], etag[64];
+   const Vhost *vhost;
+   const Route *route;
    rio_t rio;
+   unsigned long long stage = profileBegin();
+
+   method[0] = uri[0] = version[0] = '\0';
+   entry->method = method;
+   entry->uri = uri;
+   entry->version = version;
 
+   // the handshake counts against the time allowed for the request line
+   timerArm(timer, fd, requestLimits.requestLineTimeoutMs);
+   if (tlsAccept(fd) < 0)
+      return false;
    Rio_readinitb(&rio, fd);
-   Rio_readlineb(&rio, buf, MAXLINE);
+   if ((rc = requestReadline(&rio, timer, buf, 414, &len)) != 0) {
+      if (rc != REQUEST_CLOSED)
+         requestReadError(fd, entry, rc);
+      return false;
+   }
    sscanf(buf, "%s %s %s", method, uri, version);
 
-   printf("%s %s %s\n", method, uri, version);
+   // an HTTP/2 client with prior knowledge opens with "PRI * HTTP/2.0": the
+   // connection goes to the HTTP/2 thread along with whatever was read past it
+   if (!strcmp(method, "PRI") && !strcmp(uri, "*") && !strcmp(version, "HTTP/2.0") &&
+       http2Enabled() && !tlsEnabled()) {
+      timerCancel(timer);
+      if (http2Adopt(fd, rio.rio_bufptr, rio.rio_cnt) == 0)
+         return true;
+      requestError(fd, entry, method, "503", "Service Unavailable", "OS-HW3 Server could not take the HTTP/2 connection");
+      return false;
+   }
 
-   if (strcasecmp(method, "GET")) {
-      requestError(fd, method, "501", "Not Implemented", "OS-HW3 Server does not implement this method");
-      return;
+   if (strcasecmp(method, "GET") && strcasecmp(method, "POST") && strcasecmp(method, "PUT")) {
+      requestError(fd, entry, method, "501", "Not Implemented", "OS-HW3 Server does not implement this method");
+      return false;
+   }
+   timerArm(timer, fd, requestLimits.headerTimeoutMs);
+   if ((rc = requestReadhdrs(&rio, timer, hdrs)) != 0) {
+      if (rc != REQUEST_CLOSED)
+         requestReadError(fd, entry, rc);
+      return false;
+   }
+   timerCancel(timer);
+   profileEnd(PROFILE_READ, stage);
+   stage = profileBegin();
+   if ((rc = requestCheckBody(method, hdrs)) != 0) {
+      requestReadError(fd, entry, rc);
+      return false;
    }
-   requestReadhdrs(&rio);
 
-   is_static = requestParseURI(uri, filename, cgiargs);
-   if (stat(filename, &sbuf) < 0) {
-      requestError(fd, filename, "404", "Not found", "OS-HW3 Server could not find this file");
-      return;
+   // the Host header picks the site: its document root, policies and cache partition
+   vhost = vhostLookup(hdrs->host);
+   kind = requestParseURI(vhost, uri, path, filename, cgiargs, &route);
+   if (kind == 400) {
+      requestError(fd, entry, uri, "400", "Bad Request", "OS-HW3 Server could not parse the request path");
+      return false;
+   }
+   if (kind == 414) {
+      requestReadError(fd, entry, kind);
+      return false;
+   }
+   if (kind == REQUEST_BUILTIN) {
+      route->handler(fd, entry, path, cgiargs);
+      return false;
+   }
+   profileEnd(PROFILE_PARSE, stage);
+   stage = profileBegin();
+   rc = stat(filename, &sbuf);
+   profileEnd(PROFILE_STAT, stage);
+   if (rc < 0) {
+      // a directory without home.html is listed when the site allows it
+      if (kind == REQUEST_STATIC && vhost->autoindex && path[strlen(path) - 1] == '/' &&
+          !strcasecmp(method, "GET")) {
+         filename[strlen(filename) - strlen("home.html")] = '\0';
+         requestServeIndex(fd, entry, path, filename);
+         return false;
+      }
+      requestError(fd, entry, filename, "404", "Not found", "OS-HW3 Server could not find this file");
+      return false;
+   }
+   if (kind == REQUEST_STATIC && vhost->autoindex && S_ISDIR(sbuf.st_mode) && !strcasecmp(method, "GET")) {
+      requestRedirectDirectory(fd, entry, uri);
+      return false;
    }
 
-   if (is_static) {
+   if (kind == REQUEST_STATIC) {
+      if (strcasecmp(method, "GET")) {
+         requestError(fd, entry, method, "405", "Method Not Allowed", "OS-HW3 Server only serves static files with GET");
+         return false;
+      }
       if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
-         requestError(fd, filename, "403", "Forbidden", "OS-HW3 Server could not read this file");
-         return;
+         requestError(fd, entry, filename, "403", "Forbidden", "OS-HW3 Server could not read this file");
+         return false;
+      }
+      requestMakeETag(&sbuf, etag, sizeof(etag));
+      if (requestNotModified(hdrs, &sbuf, etag)) {
+         requestServeNotModified(fd, entry, &sbuf, etag,
+                                 vhost->staticMaxAge >= 0 ? vhost->staticMaxAge : requestStaticMaxAge);
+         return false;
       }
-      requestServeStatic(fd, filename, sbuf.st_size);
+      requestServeStatic(fd, entry, filename, &sbuf, etag,
+                         vhost->staticMaxAge >= 0 ? vhost->staticMaxAge : requestStaticMaxAge);
    } else {
+      if (!vhost->cgi) {
+         requestError(fd, entry, uri, "403", "Forbidden", "OS-HW3 Server does not run CGI programs for this site");
+         return false;
+      }
       if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
-         requestError(fd, filename, "403", "Forbidden", "OS-HW3 Server could not run this CGI program");
-         return;
+         requestError(fd, entry, filename, "403", "Forbidden", "OS-HW3 Server could not run this CGI program");
+         return false;
       }
-      requestServeDynamic(fd, filename, cgiargs);
+      stage = profileBegin();
+      requestServeDynamic(fd, entry, filename, cgiargs, method, hdrs, &rio, timer, route, vhost->cachePartition);
+      profileEnd(PROFILE_CGI, stage);
    }
+   return false;
+}
+
+//
+// Sheds a request that was never read with a fixed reply: 503 when the
+// server is overloaded, 429 when the client is over its limits. The socket
+// is written without blocking since a shed client may not be reading any more.
+//
+void requestReject(int fd, int status)
+{
+   static const char unavailable[] = "HTTP/1.0 503 Service Unavailable\r\n"
+                                     "Retry-After: 1\r\n"
+                                     "Content-Length: 0\r\n\r\n";
+   static const char tooMany[] = "HTTP/1.0 429 Too Many Requests\r\n"
+                                 "Retry-After: 1\r\n"
+                                 "Content-Length: 0\r\n\r\n";
+
+   // before the handshake a TLS client could not read the reply anyway
+   if (tlsEnabled())
+      return;
+   if (status == 429)
+      send(fd, tooMany, sizeof(tooMany) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+   else
+      send(fd, unavailable, sizeof(unavailable) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// handle a request; returns true when the connection was handed over to
+// HTTP/2 and must be left open
+bool requestHandle(int fd)
+{
+   AccessLogEntry entry;
+   requestLine_t line;
+   requestHdrs_t hdrs;
+   struct timespec start;
+   Timer timer;
+   unsigned long long stage;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   entry.time = time(NULL);
+   entry.status = 0;
+   entry.bytes = -1;
+   hdrs.referer[0] = hdrs.userAgent[0] = '\0';
+   timerInit(&timer);
+   requestClientAddr(fd, &entry);
+
+   if (requestServe(fd, &entry, &line, &hdrs, &timer))
+      return true;
+   timerCancel(&timer);
+   if (entry.status == 0)
+      return false;   // the client left without sending a request
+
+   entry.referer = hdrs.referer;
+   entry.userAgent = hdrs.userAgent;
+   entry.durationUs = requestElapsedUs(&start);
+   stage = profileBegin();
+   accessLogWrite(&entry);
+   profileEnd(PROFILE_LOG, stage);
+   preforkRecord(entry.status, entry.bytes);
+   return false;
 }
 
 
@@ -1,5 +1,29 @@
 #ifndef __REQUEST_H__
+#define __REQUEST_H__
 
-void requestHandle(int fd);
+#include <stddef.h>
+#include "bool.h"
+#include "accessLog.h"
+
+// Deadlines and size limits for reading a request (slow client protection)
+typedef struct RequestLimits_t {
+    int requestLineTimeoutMs;
+    int headerTimeoutMs;
+    int bodyTimeoutMs;
+    int maxHeaderCount;
+    int maxHeaderBytes;
+    size_t maxBodyBytes;      // POST/PUT bodies above this get 413
+    int cgiTimeoutMs;         // a CGI program's whole run, 0 = unlimited
+    size_t cgiMaxOutputBytes; // cut a CGI response off past this, 0 = unlimited
+} RequestLimits;
+
+void requestSetLimits(const RequestLimits *limits);
+void requestSetStaticMaxAge(int maxAge);
+bool requestHandle(int fd);
+void requestReject(int fd, int status);
+
+// Sends a whole text/plain response, status being e.g. "200 OK"; for
+// built-in route handlers
+void requestSendText(int fd, AccessLogEntry *entry, const char *status, const char *body, size_t len);
 
 #endif
@@ -0,0 +1,426 @@
+#include "responseCache.h"
+#include "bool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define RESPONSE_CACHE_MIN_BUCKETS 1024
+
+typedef enum EntryState_t
+{
+    ENTRY_PENDING,  // a request is running the program to fill it
+    ENTRY_READY,    // holds a response
+    ENTRY_PASS      // the response was not cacheable, bypass until it expires
+} EntryState;
+
+struct ResponseCacheEntry_t
+{
+    struct ResponseCacheEntry_t *hashNext;
+    struct ResponseCacheEntry_t *lruPrev;   // towards the most recently used
+    struct ResponseCacheEntry_t *lruNext;
+    size_t hash;
+    char *key;
+    char *data;
+    size_t len;
+    size_t headLen;
+    size_t size;            // what the entry counts against its partition's quota
+    int partition;
+    time_t expires;         // CLOCK_MONOTONIC seconds
+    EntryState state;
+    int refs;               // the table holds one while linked
+    bool linked;
+};
+
+/* each partition has its own quota and LRU order; the table is shared */
+typedef struct CachePartition_t
+{
+    ResponseCacheEntry lruHead;
+    ResponseCacheEntry lruTail;
+    size_t bytes;
+    size_t maxBytes;        // 0 = the partition is not cached
+} CachePartition;
+
+static struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t filled;  // a pending entry was filled or abandoned
+    ResponseCacheConfig config;
+    ResponseCacheEntry *buckets;
+    size_t bucketCount;     // a power of two
+    CachePartition partitions[RESPONSE_CACHE_MAX_PARTITIONS];
+    size_t bytes;
+    size_t entries;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long coalesced;
+    unsigned long evictions;
+} cache = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static time_t CacheNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec;
+}
+
+/* FNV-1a, as for the MIME table */
+static size_t CacheHash(const char *key)
+{
+    size_t hash = 14695981039346656037ULL;
+    for (; *key != '\0'; key++)
+    {
+        hash = (hash ^ (unsigned char)*key) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void CacheFree(ResponseCacheEntry entry)
+{
+    free(entry->key);
+    free(entry->data);
+    free(entry);
+}
+
+static void CacheUnref(ResponseCacheEntry entry)
+{
+    if (--entry->refs == 0)
+    {
+        CacheFree(entry);
+    }
+}
+
+static void LruRemove(ResponseCacheEntry entry)
+{
+    CachePartition *partition = &cache.partitions[entry->partition];
+    if (entry->lruPrev != NULL)
+    {
+        entry->lruPrev->lruNext = entry->lruNext;
+    }
+    else
+    {
+        partition->lruHead = entry->lruNext;
+    }
+    if (entry->lruNext != NULL)
+    {
+        entry->lruNext->lruPrev = entry->lruPrev;
+    }
+    else
+    {
+        partition->lruTail = entry->lruPrev;
+    }
+    entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void LruPushFront(ResponseCacheEntry entry)
+{
+    CachePartition *partition = &cache.partitions[entry->partition];
+    entry->lruPrev = NULL;
+    entry->lruNext = partition->lruHead;
+    if (partition->lruHead != NULL)
+    {
+        partition->lruHead->lruPrev = entry;
+    }
+    partition->lruHead = entry;
+    if (partition->lruTail == NULL)
+    {
+        partition->lruTail = entry;
+    }
+}
+
+/**
+* CacheUnlink: Takes entry out of the table (and the LRU list once it has a
+*   size) and drops the table's reference. Called with the mutex held.
+*/
+static void CacheUnlink(ResponseCacheEntry entry)
+{
+    ResponseCacheEntry *link = &cache.buckets[entry->hash & (cache.bucketCount - 1)];
+    while (*link != entry)
+    {
+        link = &(*link)->hashNext;
+    }
+    *link = entry->hashNext;
+
+    if (entry->state != ENTRY_PENDING)
+    {
+        LruRemove(entry);
+        cache.partitions[entry->partition].bytes -= entry->size;
+        cache.bytes -= entry->size;
+    }
+    cache.entries--;
+    entry->linked = false;
+    CacheUnref(entry);
+}
+
+/* Accounts a new ready or pass entry and evicts down to its partition's quota */
+static void CacheInsert(ResponseCacheEntry entry)
+{
+    CachePartition *partition = &cache.partitions[entry->partition];
+    LruPushFront(entry);
+    partition->bytes += entry->size;
+    cache.bytes += entry->size;
+    while (partition->bytes > partition->maxBytes && partition->lruTail != NULL)
+    {
+        CacheUnlink(partition->lruTail);
+        cache.evictions++;
+    }
+}
+
+static void CacheEvict(int partition)
+{
+    CachePartition *evicted = &cache.partitions[partition];
+    while (evicted->bytes > evicted->maxBytes && evicted->lruTail != NULL)
+    {
+        CacheUnlink(evicted->lruTail);
+        cache.evictions++;
+    }
+}
+
+static ResponseCacheEntry CacheFind(int partition, const char *key, size_t hash)
+{
+    ResponseCacheEntry entry = cache.buckets[hash & (cache.bucketCount - 1)];
+    for (; entry != NULL; entry = entry->hashNext)
+    {
+        if (entry->hash == hash && entry->partition == partition && !strcmp(entry->key, key))
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* doubles the bucket array once there are more entries than buckets */
+static void CacheGrow(void)
+{
+    size_t count = cache.bucketCount * 2;
+    ResponseCacheEntry *buckets = calloc(count, sizeof(ResponseCacheEntry));
+    if (buckets == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < cache.bucketCount; i++)
+    {
+        ResponseCacheEntry entry = cache.buckets[i], next;
+        for (; entry != NULL; entry = next)
+        {
+            next = entry->hashNext;
+            entry->hashNext = buckets[entry->hash & (count - 1)];
+            buckets[entry->hash & (count - 1)] = entry;
+        }
+    }
+    free(cache.buckets);
+    cache.buckets = buckets;
+    cache.bucketCount = count;
+}
+
+int responseCacheInit(const ResponseCacheConfig *config)
+{
+    cache.buckets = calloc(RESPONSE_CACHE_MIN_BUCKETS, sizeof(ResponseCacheEntry));
+    if (cache.buckets == NULL)
+    {
+        return -1;
+    }
+    cache.bucketCount = RESPONSE_CACHE_MIN_BUCKETS;
+    cache.config = *config;
+    cache.partitions[0].maxBytes = config->maxBytes;
+    return 0;
+}
+
+void responseCacheSetLimits(const ResponseCacheConfig *config)
+{
+    pthread_mutex_lock(&cache.mutex);
+        cache.config = *config;
+        cache.partitions[0].maxBytes = config->maxBytes;
+        CacheEvict(0);
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+void responseCacheSetQuota(int partition, size_t maxBytes)
+{
+    if (partition <= 0 || partition >= RESPONSE_CACHE_MAX_PARTITIONS)
+    {
+        return;
+    }
+    pthread_mutex_lock(&cache.mutex);
+        cache.partitions[partition].maxBytes = maxBytes;
+        CacheEvict(partition);
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+size_t responseCacheMaxEntry(void)
+{
+    size_t max;
+    pthread_mutex_lock(&cache.mutex);
+        max = cache.config.maxEntryBytes;
+    pthread_mutex_unlock(&cache.mutex);
+    return max;
+}
+
+int responseCacheTtl(int maxAge)
+{
+    int ttl;
+    pthread_mutex_lock(&cache.mutex);
+        ttl = maxAge >= 0 ? maxAge : cache.config.defaultTtlSec;
+    pthread_mutex_unlock(&cache.mutex);
+    return ttl;
+}
+
+ResponseCacheResult responseCacheLookup(int partition, const char *key, ResponseCacheEntry *entry)
+{
+    // the same key in two partitions (sites) lands in different buckets
+    size_t hash = CacheHash(key) ^ ((size_t)partition * 0x9e3779b97f4a7c15ULL);
+    ResponseCacheResult result;
+    bool waited = false;
+
+    pthread_mutex_lock(&cache.mutex);
+        while (true)
+        {
+            if (cache.buckets == NULL || partition < 0 || partition >= RESPONSE_CACHE_MAX_PARTITIONS ||
+                cache.partitions[partition].maxBytes == 0)
+            {
+                result = RESPONSE_CACHE_BYPASS;
+                break;
+            }
+
+            ResponseCacheEntry found = CacheFind(partition, key, hash);
+            if (found != NULL && found->state != ENTRY_PENDING && found->expires <= CacheNow())
+            {
+                CacheUnlink(found);
+                found = NULL;
+            }
+
+            if (found == NULL)
+            {
+                // become the one request that runs the program for this key
+                found = calloc(1, sizeof(*found));
+                if (found == NULL || (found->key = strdup(key)) == NULL)
+                {
+                    free(found);
+                    result = RESPONSE_CACHE_BYPASS;
+                    break;
+                }
+                found->hash = hash;
+                found->partition = partition;
+                found->state = ENTRY_PENDING;
+                found->refs = 2;
+                found->linked = true;
+                found->hashNext = cache.buckets[hash & (cache.bucketCount - 1)];
+                cache.buckets[hash & (cache.bucketCount - 1)] = found;
+                if (++cache.entries > cache.bucketCount)
+                {
+                    CacheGrow();
+                }
+                cache.misses++;
+                *entry = found;
+                result = RESPONSE_CACHE_MISS;
+                break;
+            }
+
+            if (found->state == ENTRY_PASS)
+            {
+                result = RESPONSE_CACHE_BYPASS;
+                break;
+            }
+            if (found->state == ENTRY_READY)
+            {
+                found->refs++;
+                LruRemove(found);
+                LruPushFront(found);
+                cache.hits++;
+                *entry = found;
+                result = RESPONSE_CACHE_HIT;
+                break;
+            }
+
+            // pending: wait for the fill, then look again (it may have been abandoned)
+            if (!waited)
+            {
+                cache.coalesced++;
+                waited = true;
+            }
+            found->refs++;
+            while (found->state == ENTRY_PENDING && found->linked)
+            {
+                pthread_cond_wait(&cache.filled, &cache.mutex);
+            }
+            CacheUnref(found);
+        }
+    pthread_mutex_unlock(&cache.mutex);
+
+    return result;
+}
+
+const char *responseCacheData(ResponseCacheEntry entry, size_t *len, size_t *headLen)
+{
+    // a ready entry's data never changes, so no lock is needed to read it
+    *len = entry->len;
+    *headLen = entry->headLen;
+    return entry->data;
+}
+
+void responseCacheRelease(ResponseCacheEntry entry)
+{
+    pthread_mutex_lock(&cache.mutex);
+        CacheUnref(entry);
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+void responseCacheFill(ResponseCacheEntry entry, char *data, size_t len, size_t headLen, int ttlSec)
+{
+    pthread_mutex_lock(&cache.mutex);
+        size_t size = sizeof(*entry) + strlen(entry->key) + len;
+        // the limits may have changed while the program ran
+        if (entry->linked && ttlSec > 0 && len <= cache.config.maxEntryBytes &&
+            size <= cache.partitions[entry->partition].maxBytes)
+        {
+            entry->data = data;
+            entry->len = len;
+            entry->headLen = headLen;
+            entry->size = size;
+            entry->expires = CacheNow() + ttlSec;
+            entry->state = ENTRY_READY;
+            CacheInsert(entry);
+        }
+        else
+        {
+            free(data);
+            if (entry->linked)
+            {
+                CacheUnlink(entry);
+            }
+        }
+        pthread_cond_broadcast(&cache.filled);
+        CacheUnref(entry);
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+void responseCacheAbandon(ResponseCacheEntry entry, int pass)
+{
+    pthread_mutex_lock(&cache.mutex);
+        if (entry->linked && pass)
+        {
+            entry->size = sizeof(*entry) + strlen(entry->key);
+            entry->expires = CacheNow() + RESPONSE_CACHE_PASS_SEC;
+            entry->state = ENTRY_PASS;
+            CacheInsert(entry);
+        }
+        else if (entry->linked)
+        {
+            CacheUnlink(entry);
+        }
+        pthread_cond_broadcast(&cache.filled);
+        CacheUnref(entry);
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+void responseCacheStats(ResponseCacheStats *stats)
+{
+    pthread_mutex_lock(&cache.mutex);
+        stats->hits = cache.hits;
+        stats->misses = cache.misses;
+        stats->coalesced = cache.coalesced;
+        stats->evictions = cache.evictions;
+        stats->bytes = cache.bytes;
+        stats->entries = cache.entries;
+    pthread_mutex_unlock(&cache.mutex);
+}
@@ -0,0 +1,112 @@
+#ifndef RESPONSE_CACHE_H_
+#define RESPONSE_CACHE_H_
+
+#include <stddef.h>
+
+/**
+* Response cache
+*
+* Opt-in cache of complete dynamic responses, keyed by program path and query
+* string. Only responses the program marks cacheable (Cache-Control max-age,
+* or a configured default TTL) are stored; entries expire after their TTL and
+* the least recently used ones are evicted to stay within the size bound.
+*
+* Concurrent misses on one key are coalesced: the first lookup gets a fill
+* ticket and runs the program, the others wait for it and then hit. A response
+* that turns out not to be cacheable leaves a short-lived pass marker so later
+* requests run the program in parallel instead of queueing behind each other.
+*
+* The table can be split into partitions, one per virtual host, each with its
+* own quota and LRU order, so one site filling its share never evicts another
+* site's responses. Partition 0 is the default site and gets maxBytes.
+*
+* Entries are reference counted, so an evicted entry stays valid until every
+* request sending it is done.
+*
+*   responseCacheInit      - Sets up the table with the given limits.
+*   responseCacheSetLimits - Changes the limits while running (evicts as needed).
+*   responseCacheSetQuota  - Sets the size bound of one partition.
+*   responseCacheLookup    - Returns a hit, a fill ticket or a bypass.
+*   responseCacheFill      - Stores the response for a fill ticket.
+*   responseCacheAbandon   - Gives a fill ticket up.
+*   responseCacheRelease   - Drops the reference taken by a hit.
+*   responseCacheStats     - Counters for monitoring.
+*/
+
+typedef struct ResponseCacheConfig_t {
+    size_t maxBytes;        // size of partition 0's stored responses, 0 = not cached
+    size_t maxEntryBytes;   // larger responses are not stored
+    int defaultTtlSec;      // TTL of responses without max-age, 0 = store only with max-age
+} ResponseCacheConfig;
+
+typedef enum ResponseCacheResult_t {
+    RESPONSE_CACHE_HIT,     // entry holds the response
+    RESPONSE_CACHE_MISS,    // entry is a fill ticket: run the program, then fill or abandon
+    RESPONSE_CACHE_BYPASS   // cache off or key marked uncacheable: just run the program
+} ResponseCacheResult;
+
+typedef struct ResponseCacheStats_t {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long coalesced;    // lookups that waited for another request's fill
+    unsigned long evictions;
+    size_t bytes;
+    size_t entries;
+} ResponseCacheStats;
+
+typedef struct ResponseCacheEntry_t *ResponseCacheEntry;
+
+/** Partitions: the default site and one per virtual host */
+#define RESPONSE_CACHE_MAX_PARTITIONS 33
+
+/** How long a response that could not be stored marks its key as uncacheable */
+#define RESPONSE_CACHE_PASS_SEC 5
+
+int responseCacheInit(const ResponseCacheConfig *config);
+void responseCacheSetLimits(const ResponseCacheConfig *config);
+
+/**
+* responseCacheSetQuota: Bounds partition (1 .. RESPONSE_CACHE_MAX_PARTITIONS - 1)
+*   to maxBytes, 0 turning it off. Partition 0 follows maxBytes of the limits.
+*/
+void responseCacheSetQuota(int partition, size_t maxBytes);
+
+/** Largest response the cache stores in any partition */
+size_t responseCacheMaxEntry(void);
+
+/**
+* responseCacheTtl: How long to keep a response given its max-age (-1 when it
+*   states none, 0 when it must not be stored).
+* @return the TTL in seconds, 0 for do not store
+*/
+int responseCacheTtl(int maxAge);
+
+/**
+* responseCacheLookup: Looks key up in partition, waiting if another request
+*   is filling it. Always a bypass when the partition's quota is 0.
+* @param entry - Receives the entry on HIT and the fill ticket on MISS.
+*/
+ResponseCacheResult responseCacheLookup(int partition, const char *key, ResponseCacheEntry *entry);
+
+/**
+* responseCacheData: The stored response of a hit.
+* @param headLen - Receives the length of the response head before the body.
+*/
+const char *responseCacheData(ResponseCacheEntry entry, size_t *len, size_t *headLen);
+void responseCacheRelease(ResponseCacheEntry entry);
+
+/**
+* responseCacheFill: Completes a fill ticket with a response the cache takes
+*   ownership of (malloc'd), valid for ttlSec seconds. Wakes the waiters.
+*/
+void responseCacheFill(ResponseCacheEntry entry, char *data, size_t len, size_t headLen, int ttlSec);
+
+/**
+* responseCacheAbandon: Gives a fill ticket up. With pass set the key is marked
+*   uncacheable for RESPONSE_CACHE_PASS_SEC; otherwise a waiter retries.
+*/
+void responseCacheAbandon(ResponseCacheEntry entry, int pass);
+
+void responseCacheStats(ResponseCacheStats *stats);
+
+#endif // RESPONSE_CACHE_H_
@@ -0,0 +1,450 @@
+#include "route.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/** Most built-in handlers that can be registered */
+#define ROUTE_MAX_HANDLERS 16
+
+typedef struct RouteNode_t
+{
+    unsigned char byte;
+    int child;              // first child, -1 for none
+    int sibling;            // next child of the parent, -1 for none
+    int route;              // route ending at this byte, -1 for none
+} RouteNode;
+
+struct RouteTable_t
+{
+    Route *routes;
+    int routeCount;
+    RouteNode *nodes;       // nodes[0] is the root, holding the "/" route
+    int nodeCount;
+};
+
+static struct
+{
+    const char *name;
+    RouteHandler handler;
+} handlers[ROUTE_MAX_HANDLERS];
+static int handlerCount = 0;
+
+static int RouteHexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+int routeNormalize(char *path)
+{
+    const char *read = path;
+    char *write = path;
+
+    if (*path != '/')
+    {
+        return 400;
+    }
+
+    // read runs ahead of write: decoding and dropping segments only shrink
+    while (*read == '/')
+    {
+        while (*read == '/')
+        {
+            read++;
+        }
+        char *segment = write;
+        *write++ = '/';
+        while (*read != '/' && *read != '\0')
+        {
+            char c = *read++;
+            if (c == '%')
+            {
+                int high = RouteHexDigit(read[0]);
+                int low = high < 0 ? -1 : RouteHexDigit(read[1]);
+                if (low < 0)
+                {
+                    return 400;
+                }
+                c = (char)(high << 4 | low);
+                read += 2;
+                // an encoded slash would hide a segment from the checks below
+                if (c == '\0' || c == '/')
+                {
+                    return 400;
+                }
+            }
+            *write++ = c;
+        }
+        if (read - path > ROUTE_PATH_MAX)
+        {
+            return 414;
+        }
+
+        size_t len = write - segment - 1;
+        if (len == 1 && segment[1] == '.')
+        {
+            write = segment;
+        }
+        else if (len == 2 && segment[1] == '.' && segment[2] == '.')
+        {
+            if (segment == path)
+            {
+                return 400;     // above the root
+            }
+            write = segment - 1;
+            while (*write != '/')
+            {
+                write--;
+            }
+        }
+        else
+        {
+            continue;
+        }
+        // a dropped last segment leaves the directory it was in: "/a/b/.." is "/a/"
+        if (*read == '\0')
+        {
+            write++;
+        }
+    }
+
+    if (write == path)
+    {
+        *write++ = '/';
+    }
+    *write = '\0';
+    return 0;
+}
+
+int routeRegisterHandler(const char *name, RouteHandler handler)
+{
+    if (handlerCount == ROUTE_MAX_HANDLERS)
+    {
+        return -1;
+    }
+    handlers[handlerCount].name = name;
+    handlers[handlerCount].handler = handler;
+    handlerCount++;
+    return 0;
+}
+
+static RouteHandler RouteFindHandler(const char *name)
+{
+    for (int i = 0; i < handlerCount; i++)
+    {
+        if (!strcmp(handlers[i].name, name))
+        {
+            return handlers[i].handler;
+        }
+    }
+    return NULL;
+}
+
+/* Splits "PREFIX KIND TARGET" into prefix, kind and target (PATH_MAX each) */
+/* A number up to max, with an optional K, M or G suffix as in the config file */
+static bool RouteNumber(const char *text, unsigned long long max, long long *out)
+{
+    char *end;
+    errno = 0;
+    unsigned long long number = strtoull(text, &end, 10);
+    if (end == text || !isdigit((unsigned char)*text) || errno != 0)
+    {
+        return false;
+    }
+    if (*end != '\0')
+    {
+        switch (toupper((unsigned char)*end++))
+        {
+        case 'G': number *= 1024;   // fall through
+        case 'M': number *= 1024;   // fall through
+        case 'K': number *= 1024; break;
+        default: return false;
+        }
+    }
+    if (*end != '\0' || number > max)
+    {
+        return false;
+    }
+    *out = (long long)number;
+    return true;
+}
+
+/**
+* RouteSplit: Splits a route line into its fields and the CGI limits it
+*   overrides (-1 where it keeps the global ones).
+* @return NULL when valid, the reason otherwise
+*/
+static const char *RouteSplit(const char *line, char *prefix, RouteKind *kind, char *target,
+                              int *cgiTimeoutMs, long long *cgiMaxOutputBytes)
+{
+    char kindName[16], option[64];
+    char format[64];
+    int used;
+    long long number;
+
+    snprintf(format, sizeof(format), "%%%ds %%15s %%%ds%%n", PATH_MAX - 1, PATH_MAX - 1);
+    if (sscanf(line, format, prefix, kindName, target, &used) != 3)
+    {
+        return "expected PREFIX static|cgi|handler TARGET [cgi_timeout_ms=MS] [cgi_max_output_bytes=SIZE]";
+    }
+    if (!strcmp(kindName, "static"))
+    {
+        *kind = ROUTE_STATIC;
+    }
+    else if (!strcmp(kindName, "cgi"))
+    {
+        *kind = ROUTE_CGI;
+    }
+    else if (!strcmp(kindName, "handler"))
+    {
+        *kind = ROUTE_HANDLER;
+    }
+    else
+    {
+        return "expected static, cgi or handler";
+    }
+
+    *cgiTimeoutMs = -1;
+    *cgiMaxOutputBytes = -1;
+    for (line += used; sscanf(line, " %63s%n", option, &used) == 1; line += used)
+    {
+        char *value = strchr(option, '=');
+        if (value == NULL)
+        {
+            return "expected cgi_timeout_ms=MS or cgi_max_output_bytes=SIZE after the target";
+        }
+        *value++ = '\0';
+        if (*kind == ROUTE_HANDLER)
+        {
+            return "CGI limits apply to static and cgi routes only";
+        }
+        if (!strcmp(option, "cgi_timeout_ms"))
+        {
+            if (!RouteNumber(value, 3600000, &number))
+            {
+                return "cgi_timeout_ms: expected 0 to 3600000";
+            }
+            *cgiTimeoutMs = (int)number;
+        }
+        else if (!strcmp(option, "cgi_max_output_bytes"))
+        {
+            if (!RouteNumber(value, 1ULL << 40, &number))
+            {
+                return "cgi_max_output_bytes: expected a size up to 1T";
+            }
+            *cgiMaxOutputBytes = number;
+        }
+        else
+        {
+            return "unknown option, expected cgi_timeout_ms or cgi_max_output_bytes";
+        }
+    }
+    return NULL;
+}
+
+const char *routeParseLine(const char *line)
+{
+    char prefix[PATH_MAX], normal[PATH_MAX], target[PATH_MAX];
+    RouteKind kind;
+    int cgiTimeoutMs;
+    long long cgiMaxOutputBytes;
+    const char *reason = RouteSplit(line, prefix, &kind, target, &cgiTimeoutMs, &cgiMaxOutputBytes);
+
+    if (reason != NULL)
+    {
+        return reason;
+    }
+    strcpy(normal, prefix);
+    if (routeNormalize(normal) != 0 || strcmp(normal, prefix) != 0 ||
+        (prefix[1] != '\0' && prefix[strlen(prefix) - 1] == '/'))
+    {
+        return "the prefix must be a normalized path without a trailing slash";
+    }
+
+    struct stat sbuf;
+    if (kind != ROUTE_HANDLER && (stat(target, &sbuf) < 0 || !S_ISDIR(sbuf.st_mode)))
+    {
+        return "the target is not a directory";
+    }
+    return NULL;
+}
+
+static int RouteInsert(RouteTable *table, const char *prefix)
+{
+    int node = 0;
+
+    // "/" is the root itself; "/a/b" hangs off it byte by byte from the first slash
+    for (const unsigned char *p = (const unsigned char *)prefix; prefix[1] != '\0' && *p != '\0'; p++)
+    {
+        int child = table->nodes[node].child;
+        while (child >= 0 && table->nodes[child].byte != *p)
+        {
+            child = table->nodes[child].sibling;
+        }
+        if (child < 0)
+        {
+            child = table->nodeCount++;
+            table->nodes[child].byte = *p;
+            table->nodes[child].child = -1;
+            table->nodes[child].route = -1;
+            table->nodes[child].sibling = table->nodes[node].child;
+            table->nodes[node].child = child;
+        }
+        node = child;
+    }
+    return node;
+}
+
+static int RouteAdd(RouteTable *table, const char *prefix, RouteKind kind, const char *target,
+                    int cgiTimeoutMs, long long cgiMaxOutputBytes)
+{
+    Route *route = &table->routes[table->routeCount];
+
+    route->prefix = strdup(prefix);
+    route->kind = kind;
+    route->dir = NULL;
+    route->handler = NULL;
+    route->cgiTimeoutMs = cgiTimeoutMs;
+    route->cgiMaxOutputBytes = cgiMaxOutputBytes;
+    if (route->prefix == NULL)
+    {
+        return -1;
+    }
+    if (kind == ROUTE_HANDLER)
+    {
+        if ((route->handler = RouteFindHandler(target)) == NULL)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+    }
+    else if ((route->dir = strdup(target)) == NULL)
+    {
+        return -1;
+    }
+    table->nodes[RouteInsert(table, prefix)].route = table->routeCount++;
+    return 0;
+}
+
+RouteTable *routeTableCreate(const char *root, const char *routes)
+{
+    char line[ROUTE_TEXT_MAX], prefix[PATH_MAX], target[PATH_MAX];
+    int lines = 0, cgiTimeoutMs;
+    long long cgiMaxOutputBytes;
+    RouteKind kind;
+
+    for (const char *p = routes; *p != '\0'; p++)
+    {
+        lines += *p == '\n';
+    }
+    lines++;
+
+    RouteTable *table = calloc(1, sizeof(RouteTable));
+    if (table == NULL)
+    {
+        return NULL;
+    }
+    table->routes = calloc(lines + 1, sizeof(Route));
+    table->nodes = malloc((strlen(routes) + 1) * sizeof(RouteNode));
+    if (table->routes == NULL || table->nodes == NULL)
+    {
+        return NULL;
+    }
+    table->nodes[0].child = table->nodes[0].sibling = table->nodes[0].route = -1;
+    table->nodeCount = 1;
+
+    if (RouteAdd(table, "/", ROUTE_STATIC, root, -1, -1) < 0)
+    {
+        return NULL;
+    }
+    for (const char *p = routes; *p != '\0'; )
+    {
+        size_t len = strcspn(p, "\n");
+        snprintf(line, sizeof(line), "%.*s", (int)len, p);
+        p += len;
+        p += *p == '\n';
+        if (line[0] != '\0' &&
+            (RouteSplit(line, prefix, &kind, target, &cgiTimeoutMs, &cgiMaxOutputBytes) != NULL ||
+             RouteAdd(table, prefix, kind, target, cgiTimeoutMs, cgiMaxOutputBytes) < 0))
+        {
+            return NULL;
+        }
+    }
+    return table;
+}
+
+int routeStaticDirs(const RouteTable *table, const char **dirs, int max)
+{
+    int count = 0;
+    for (int i = 0; i < table->routeCount && count < max; i++)
+    {
+        if (table->routes[i].kind == ROUTE_STATIC)
+        {
+            dirs[count++] = table->routes[i].dir;
+        }
+    }
+    return count;
+}
+
+const char *routeStaticFile(const RouteTable *table, char *path, char *filename, size_t size)
+{
+    const char *rest;
+
+    if (strlen(path) >= ROUTE_PATH_MAX || routeNormalize(path) != 0)
+    {
+        return NULL;
+    }
+    const Route *route = routeLookup(table, path, &rest);
+    size_t len = strlen(path);
+    if (route->kind != ROUTE_STATIC || (len > 4 && !strcmp(path + len - 4, ".cgi")) ||
+        snprintf(filename, size, "%s%s%s", route->dir, rest, path[len - 1] == '/' ? "home.html" : "") >= (int)size)
+    {
+        return NULL;
+    }
+    return filename;
+}
+
+const Route *routeLookup(const RouteTable *table, const char *path, const char **rest)
+{
+    const RouteNode *nodes = table->nodes;
+    int best = nodes[0].route;
+    const char *bestRest = path;
+    int node = 0;
+
+    for (const char *p = path; *p != '\0'; p++)
+    {
+        int child = nodes[node].child;
+        while (child >= 0 && nodes[child].byte != (unsigned char)*p)
+        {
+            child = nodes[child].sibling;
+        }
+        if (child < 0)
+        {
+            break;
+        }
+        node = child;
+        // whole segments only: "/cgi" routes "/cgi/x" but not "/cgi-bin"
+        if (nodes[node].route >= 0 && (p[1] == '/' || p[1] == '\0'))
+        {
+            best = nodes[node].route;
+            bestRest = p + 1;
+        }
+    }
+    *rest = bestRest;
+    return &table->routes[best];
+}
@@ -0,0 +1,118 @@
+#ifndef ROUTE_H_
+#define ROUTE_H_
+
+#include <stddef.h>
+#include "bool.h"
+#include "accessLog.h"
+
+/**
+* Routing
+*
+* Maps the path of a request to what serves it. Every site has a routing
+* table: its document root at "/" plus the configured "route" lines, each
+* binding a path prefix to a directory of static files, a directory of CGI
+* programs or a built-in handler. The longest matching prefix wins; prefixes
+* match whole segments only ("/cgi" does not match "/cgi-bin"). A static or
+* cgi route may follow its directory with cgi_timeout_ms=MS and
+* cgi_max_output_bytes=SIZE, overriding the global limits for the programs
+* it runs.
+*
+* Paths are normalized before routing: percent-decoded, "." and ".." segments
+* resolved and repeated slashes merged, in place and in one pass. A path that
+* would climb above "/", or that decodes to a NUL or a slash, is rejected
+* rather than rewritten, so nothing outside a route's directory is reachable.
+*
+* The prefixes are kept in a byte trie, so a lookup walks the path once
+* whatever the number of routes, and neither step allocates.
+*
+*   routeNormalize       - Normalizes a request path in place.
+*   routeRegisterHandler - Makes a built-in handler available to routes.
+*   routeTableCreate     - Builds the table of one site.
+*   routeLookup          - Finds the route serving a normalized path.
+*   routeStaticDirs      - Lists the directories of static routes.
+*   routeStaticFile      - The file a path is served from, outside a request.
+*/
+
+/** Longest path accepted, before or after decoding */
+#define ROUTE_PATH_MAX 4096
+/** Room for the route lines of one site */
+#define ROUTE_TEXT_MAX 2048
+
+typedef enum RouteKind_t {
+    ROUTE_STATIC,           // files under dir; programs named *.cgi run as CGI
+    ROUTE_CGI,              // every file under dir is a CGI program
+    ROUTE_HANDLER           // answered by a built-in handler
+} RouteKind;
+
+/**
+* RouteHandler: Serves a request routed to it and fills entry in.
+* @param path  - The normalized path.
+* @param query - What followed '?', "" when nothing did.
+*/
+typedef void (*RouteHandler)(int fd, AccessLogEntry *entry, const char *path, const char *query);
+
+typedef struct Route_t {
+    const char *prefix;     // normalized, no trailing slash except for "/"
+    RouteKind kind;
+    const char *dir;        // ROUTE_STATIC and ROUTE_CGI
+    RouteHandler handler;   // ROUTE_HANDLER
+    int cgiTimeoutMs;       // -1 = cgi_timeout_ms
+    long long cgiMaxOutputBytes;    // -1 = cgi_max_output_bytes
+} Route;
+
+typedef struct RouteTable_t RouteTable;
+
+/**
+* routeNormalize: Normalizes the path in place (it only ever shrinks).
+* @return 0 on success, 400 for a malformed path, 414 when longer than
+*   ROUTE_PATH_MAX
+*/
+int routeNormalize(char *path);
+
+/**
+* routeRegisterHandler: Lets "route = PREFIX handler NAME" lines use handler.
+*   Handlers must be registered before the tables are created.
+* @return 0 on success, -1 when the registry is full
+*/
+int routeRegisterHandler(const char *name, RouteHandler handler);
+
+/**
+* routeParseLine: Checks one "PREFIX KIND TARGET [OPTION=VALUE...]" route
+*   line (KIND static, cgi or handler; the options CGI limits).
+* @return NULL when valid, the reason otherwise
+*/
+const char *routeParseLine(const char *line);
+
+/**
+* routeTableCreate: Builds a table serving root at "/" and the route lines in
+*   routes ('\n' separated, already checked with routeParseLine). A later line
+*   for the same prefix replaces an earlier one.
+* @return the table, NULL when out of memory or a handler is unknown (errno
+*   ENOMEM or ENOENT)
+*/
+RouteTable *routeTableCreate(const char *root, const char *routes);
+
+/**
+* routeLookup: The route with the longest prefix of path (normalized).
+* @param rest - Receives the part of path after the prefix: "" or "/...".
+* @return the route, never NULL
+*/
+const Route *routeLookup(const RouteTable *table, const char *path, const char **rest);
+
+/**
+* routeStaticDirs: Stores the directory of each static route of table
+*   (the root first) into dirs, up to max.
+* @return how many were stored
+*/
+int routeStaticDirs(const RouteTable *table, const char **dirs, int max);
+
+/**
+* routeStaticFile: Normalizes path in place and stores the file table serves
+*   for it into filename, as a request would build it ("home.html" for a
+*   directory).
+* @return filename, NULL when the path is malformed, too long or not served
+*   as a static file (CGI programs and handlers)
+*/
+const char *routeStaticFile(const RouteTable *table, char *path, char *filename, size_t size);
+
+#endif // ROUTE_H_
@@ -1,4 +1,5 @@
 #include "segel.h"
+#include <poll.h>
 
 /************************** 
  * Error-handling functions
@@ -260,6 +261,33 @@ struct hostent *Gethostbyaddr(const char *addr, int len, int type)
 /*********************************************************************
  * The Rio package - robust I/O functions
  **********************************************************************/
+static ssize_t (*rio_readfn)(int, void *, size_t) = read;
+static ssize_t (*rio_writefn)(int, const void *, size_t) = write;
+
+void rio_settransport(ssize_t (*readfn)(int, void *, size_t),
+                      ssize_t (*writefn)(int, const void *, size_t))
+{
+    rio_readfn = readfn;
+    rio_writefn = writefn;
+}
+
+/*
+ * rio_wait - block until a non-blocking descriptor is ready, so the Rio
+ *    functions behave the same on blocking and non-blocking sockets
+ */
+static int rio_wait(int fd, short events)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
 /*
  * rio_readn - robustly read n bytes (unbuffered)
  */
@@ -271,9 +299,11 @@ ssize_t rio_readn(int fd, void *usrbuf, size_t n)
     char *bufp = usrbuf;
 
     while (nleft > 0) {
-        if ((nread = read(fd, bufp, nleft)) < 0) {
+        if ((nread = rio_readfn(fd, bufp, nleft)) < 0) {
             if (errno == EINTR) /* interrupted by sig handler return */
                 nread = 0;      /* and call read() again */
+            else if (errno == EAGAIN && rio_wait(fd, POLLIN) == 0)
+                nread = 0;      /* non-blocking descriptor became readable */
             else
                 return -1;      /* errno set by read() */ 
         } 
@@ -297,9 +327,11 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
     char *bufp = usrbuf;
 
     while (nleft > 0) {
-        if ((nwritten = write(fd, bufp, nleft)) <= 0) {
+        if ((nwritten = rio_writefn(fd, bufp, nleft)) <= 0) {
             if (errno == EINTR)  /* interrupted by sig handler return */
                 nwritten = 0;    /* and call write() again */
+            else if (errno == EAGAIN && rio_wait(fd, POLLOUT) == 0)
+                nwritten = 0;    /* non-blocking descriptor became writable */
             else
                 return -1;       /* errorno set by write() */
         }
@@ -325,10 +357,14 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
     int cnt;
 
     while (rp->rio_cnt <= 0) {  /* refill if buf is empty */
-        rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
+        rp->rio_cnt = rio_readfn(rp->rio_fd, rp->rio_buf, 
                            sizeof(rp->rio_buf));
         if (rp->rio_cnt < 0) {
-            if (errno != EINTR) /* interrupted by sig handler return */
+            if (errno == EAGAIN) {
+                if (rio_wait(rp->rio_fd, POLLIN) < 0)
+                    return -1;
+            }
+            else if (errno != EINTR) /* interrupted by sig handler return */
                 return -1;
         }
         else if (rp->rio_cnt == 0)  /* EOF */
@@ -102,7 +102,12 @@ struct hostent *Gethostbyaddr(const char *addr, int len, int type);
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
-void rio_readinitb(rio_t *rp, int fd); 
+void rio_readinitb(rio_t *rp, int fd);
+
+/* Replaces read() and write() under the Rio functions, for a transport
+   layered on the socket (TLS); the replacements handle every descriptor */
+void rio_settransport(ssize_t (*readfn)(int, void *, size_t),
+                      ssize_t (*writefn)(int, const void *, size_t)); 
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 
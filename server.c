@@ -1,60 +1,530 @@
 #include "segel.h"
 #include "request.h"
 #include "threadPool.h"
+#include "mime.h"
+#include "accessLog.h"
+#include "affinity.h"
+#include "rateLimit.h"
+#include "tcpOptions.h"
+#include "timerWheel.h"
+#include "config.h"
+#include "responseCache.h"
+#include "tls.h"
+#include "http2.h"
+#include "vhost.h"
+#include "autoindex.h"
+#include "fileCache.h"
+#include "prewarm.h"
+#include "contentStore.h"
+#include "sharedCache.h"
+#include "prefork.h"
+#include "profile.h"
 #include <string.h>
+#include <poll.h>
+#include <sys/signalfd.h>
 
 //
 // server.c: A very, very simple web server
 // Repeatedly handles HTTP requests sent to this port number.
 // Most of the work is done within routines written in request.c
 //
+// Settings come from config.c: compiled-in defaults, the command line and
+// optionally a configuration file. SIGHUP reopens the access log and reloads
+// that file; SIGTERM and SIGINT stop accepting, finish the queued requests
+// and flush the log before exiting.
+//
 
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s -c <config file>\n"
+                    "       %s <port> <threads> <queue_size> <block|dt|dh|random|codel|wfq>\n",
+            program, program);
+    exit(1);
+}
+
+//./server -c [config file]
 //./server [portnum] [threads] [queue_size] [schedalg]
-void getargs(int *port, int *poolSize, int *maxRequests, SchedAlg *schedAlg, int argc, char *argv[])
+void getargs(ServerConfig *config, const char **configPath, int argc, char *argv[])
 {
-    if (argc < 5)
+    char error[PATH_MAX + 128];
+
+    configDefaults(config);
+    *configPath = NULL;
+    if (argc == 3 && !strcmp(argv[1], "-c"))
     {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-        exit(1);
+        *configPath = argv[2];
+        if (configLoad(*configPath, config, error, sizeof(error)) < 0)
+        {
+            fprintf(stderr, "%s\n", error);
+            exit(1);
+        }
+        return;
+    }
+
+    if (argc != 5)
+    {
+        usage(argv[0]);
+    }
+    config->port = atoi(argv[1]);
+    config->threads = atoi(argv[2]);
+    config->queueSize = atoi(argv[3]);
+    if (config->port <= 0 || config->port > 65535 || (int)config->threads <= 0 ||
+        (int)config->queueSize <= 0 || configParseSchedAlg(argv[4], &config->schedAlg) < 0)
+    {
+        usage(argv[0]);
+    }
+}
+
+// Restart-only settings keep their running value; a changed one is reported
+#define KEEP_RUNNING(field, name)                                               \
+    do {                                                                        \
+        if (memcmp(&next.field, &config->field, sizeof(next.field)))            \
+        {                                                                       \
+            fprintf(stderr, "Reload: %s takes effect on restart\n", name);      \
+        }                                                                       \
+        memcpy(&next.field, &config->field, sizeof(next.field));                \
+    } while (0)
+
+//
+// Loads static files into the file cache before the listener opens, from the
+// directories of every site or from the hottest paths of the last access log.
+//
+static void prewarm(const ServerConfig *config)
+{
+    const char *dirs[VHOST_MAX * 16];
+    int threads = config->prewarmThreads > 0 ? config->prewarmThreads : (int)config->threads;
+    PrewarmStats stats;
+
+    if (config->prewarm == PREWARM_OFF || config->fileCache.maxBytes == 0)
+    {
+        return;
     }
-    *port = atoi(argv[1]);
-    *poolSize = atoi(argv[2]);
-    *maxRequests = atoi(argv[3]);
-    if (strcmp(argv[4], "block"))
+    if (config->prewarm == PREWARM_ROOTS)
     {
-        *schedAlg = BLOCK;
+        int count = vhostStaticDirs(dirs, sizeof(dirs) / sizeof(dirs[0]));
+        if (prewarmRoots(dirs, count, threads, &stats) < 0)
+        {
+            fprintf(stderr, "Prewarm: some directories could not be walked\n");
+        }
     }
-    else if (strcmp(argv[4], "dt"))
+    else if (config->accessLogPath[0] == '\0' || !strcmp(config->accessLogPath, ACCESS_LOG_STDOUT) ||
+             prewarmAccessLog(config->accessLogPath, threads, &stats) < 0)
     {
-        *schedAlg = DROP_TAIL;
+        fprintf(stderr, "Prewarm: no access log to read, starting cold\n");
+        return;
     }
-    else if (strcmp(argv[4], "dh"))
+    fprintf(stderr, "Prewarm: %lu of %lu files cached (%.1f MB), %lu read ahead, in %.0f ms on %d threads\n",
+            stats.cached, stats.files, stats.bytes / 1048576.0, stats.readAhead, stats.ms, stats.threads);
+}
+
+//
+// Reopens the access log and applies the configuration file again. A file
+// that fails validation is ignored as a whole; connections are never dropped.
+//
+static void reloadConfig(ThreadPool pool, ServerConfig *config, const char *configPath)
+{
+    ServerConfig next;
+    char error[PATH_MAX + 128];
+
+    accessLogReopen();
+    if (configPath == NULL)
     {
-        *schedAlg = DROP_HEAD;
+        return;
+    }
+    configDefaults(&next);
+    if (configLoad(configPath, &next, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "Reload rejected, configuration unchanged: %s\n", error);
+        return;
+    }
+
+    if (next.threads != config->threads && ThreadPoolResize(pool, next.threads) < 0)
+    {
+        fprintf(stderr, "Reload: could not resize the pool to %zu threads\n", next.threads);
+        next.threads = config->threads;
+    }
+    ThreadPoolSetMaxRequest(pool, next.queueSize);
+    ThreadPoolSetSchedAlg(pool, next.schedAlg, next.codelTargetMs, next.codelIntervalMs);
+    ThreadPoolSetBatch(pool, next.workerBatch);
+    ThreadPoolSetMaxSpin(pool, next.queueSpinUs * 1000ULL);
+    requestSetStaticMaxAge(next.staticMaxAge);
+    requestSetLimits(&next.requestLimits);
+    if (next.profileTiming != config->profileTiming)
+    {
+        // otherwise whatever the debug endpoint last set stays
+        profileSetTiming(next.profileTiming);
+    }
+    responseCacheSetLimits(&next.responseCache);
+    if (fileCacheSetLimits(&next.fileCache) < 0)
+    {
+        fprintf(stderr, "Reload: could not turn the file cache on\n");
+        next.fileCache = config->fileCache;
+    }
+    rateLimitSetLimits(next.rateLimit.ratePerSec, next.rateLimit.burst, next.rateLimit.maxConnections);
+
+    next.accessLog.path = config->accessLog.path;
+    KEEP_RUNNING(port, "port");
+    KEEP_RUNNING(documentRoot, "document_root");
+    KEEP_RUNNING(mimeTypes, "mime_types");
+    KEEP_RUNNING(routes, "route");
+    KEEP_RUNNING(autoindex, "autoindex");
+    KEEP_RUNNING(autoindexCacheDirs, "autoindex_cache_dirs");
+    KEEP_RUNNING(placement, "pin_workers/steer_by_cpu");
+    KEEP_RUNNING(priorityClasses, "priority_class");
+    KEEP_RUNNING(priorityDefaultWeight, "priority_default_weight");
+    KEEP_RUNNING(timerTickMs, "timer_tick_ms");
+    KEEP_RUNNING(timerSlots, "timer_slots");
+    KEEP_RUNNING(rateLimit.idleSec, "client_idle_sec");
+    KEEP_RUNNING(rateLimit.tableSize, "client_table_size");
+    KEEP_RUNNING(tcp, "tcp_*");
+    KEEP_RUNNING(tls, "tls_*");
+    KEEP_RUNNING(http2, "http2*");
+    KEEP_RUNNING(vhosts, "[vhost] sections");
+    KEEP_RUNNING(vhostCount, "[vhost] sections");
+    KEEP_RUNNING(accessLogPath, "access_log");
+    KEEP_RUNNING(prewarm, "prewarm");
+    KEEP_RUNNING(prewarmThreads, "prewarm_threads");
+    // the store and the shared segment are laid out once, before any worker
+    // maps them; resizing either means building it again
+    KEEP_RUNNING(contentStore, "content_store*");
+    KEEP_RUNNING(workerProcesses, "worker_processes");
+    KEEP_RUNNING(sharedCache, "shared_cache_*");
+    KEEP_RUNNING(accessLog, "access_log_*");
+    *config = next;
+    config->accessLog.path = config->accessLogPath[0] != '\0' ? config->accessLogPath : NULL;
+    fprintf(stderr, "Reloaded %s\n", configPath);
+}
+
+// A percentile of a latency histogram, as the bound of its bucket
+static void latencyText(const unsigned long *histogram, double fraction, char *text, size_t size)
+{
+    long us = priorityPercentile(histogram, fraction);
+    if (us < 0)
+    {
+        snprintf(text, size, ">%ld s", (64L << (PRIORITY_LATENCY_BUCKETS - 2)) / 1000000);
+    }
+    else if (us >= 1000)
+    {
+        snprintf(text, size, "<%ld ms", us / 1000);
     }
     else
     {
-        *schedAlg = RANDOM_DROP;
+        snprintf(text, size, "<%ld us", us);
     }
 }
 
-int main(int argc, char *argv[])
+//
+// Prints how each priority class fared, with the median and 99th percentile
+// of the time its requests waited for a worker and took overall
+//
+static void reportPriorityClasses(void)
 {
-    int listenfd, connfd, port = 8003, clientlen, poolSize = 2, maxRequests = 5;
-    SchedAlg schedAlg = BLOCK;
+    PriorityStats stats;
+    char latency[4][16];
+
+    for (int i = 0; i < priorityStats(i, &stats); i++)
+    {
+        if (stats.queued + stats.dropped == 0)
+        {
+            continue;
+        }
+        latencyText(stats.wait, 0.5, latency[0], sizeof(latency[0]));
+        latencyText(stats.wait, 0.99, latency[1], sizeof(latency[1]));
+        latencyText(stats.total, 0.5, latency[2], sizeof(latency[2]));
+        latencyText(stats.total, 0.99, latency[3], sizeof(latency[3]));
+        fprintf(stderr, "Priority class %s (weight %d): %lu served, %lu dropped; waited %s (p50) %s (p99), done in %s (p50) %s (p99)\n",
+                stats.name, stats.weight, stats.served, stats.dropped,
+                latency[0], latency[1], latency[2], latency[3]);
+    }
+}
+
+// What main sets up for the processes serving requests
+typedef struct ServerContext_t
+{
+    ServerConfig config;
+    const char *configPath;
+    int listenfd;
+    int signalfd;
+} ServerContext;
+
+//
+// Serves requests from the listening socket until SIGTERM or SIGINT: the
+// whole server when it runs as one process, one worker otherwise. Every
+// thread starts here, after any fork.
+//
+static void serveRequests(int worker, void *arg)
+{
+    ServerContext *server = arg;
+    ServerConfig *config = &server->config;
+    int connfd, clientlen;
+    int accepted[CONFIG_MAX_ACCEPT_BATCH];
     struct sockaddr_in clientaddr;
+    bool listing = config->autoindex;
 
-    getargs(&port, &poolSize, &maxRequests, &schedAlg, argc, argv);
-    ThreadPool pool = ThreadPoolCreate(poolSize, maxRequests, schedAlg);
+    if (accessLogInit(&config->accessLog) < 0)
+    {
+        unix_error("Access log error");
+    }
+    rateLimitAttach(worker);
+    for (int i = 0; i < config->vhostCount; i++)
+    {
+        listing |= config->vhosts[i].autoindex > 0;
+    }
+    if (listing && autoindexInit(config->autoindexCacheDirs) < 0)
+    {
+        unix_error("Autoindex error");
+    }
+    if (timerWheelInit(config->timerTickMs, config->timerSlots) < 0)
+    {
+        unix_error("Timer wheel error");
+    }
 
-    listenfd = Open_listenfd(port);
+    if (priorityInit(config->priorityClasses, config->priorityDefaultWeight) < 0)
+    {
+        unix_error("Priority classes error");
+    }
+    // SIGPROF and its timer belong to the process: set up after any fork
+    if (profileInit(config->profileTiming, worker, config->workerProcesses) < 0)
+    {
+        unix_error("Profiler error");
+    }
+    ThreadPool pool = ThreadPoolCreate(config->threads, config->queueSize, config->schedAlg, &config->placement);
+    ThreadPoolSetSchedAlg(pool, config->schedAlg, config->codelTargetMs, config->codelIntervalMs);
+    ThreadPoolSetBatch(pool, config->workerBatch);
+    ThreadPoolSetMaxSpin(pool, config->queueSpinUs * 1000ULL);
+    if (http2Init(&config->http2, pool) < 0)
+    {
+        unix_error("HTTP/2 thread error");
+    }
+    if (config->placement.pinWorkers || config->placement.steerByCpu)
+    {
+        // the acceptor takes the first slot after the workers
+        affinityPinThread(pthread_self(), affinityCpuAt(config->threads));
+    }
 
-    while (1)
+    bool running = true;
+    while (running)
     {
-        clientlen = sizeof(clientaddr);
-        connfd = Accept(listenfd, (SA *)&clientaddr, (socklen_t *)&clientlen);
-        ThreadPoolAddRequest(pool, connfd);
+        struct pollfd fds[2] = {{server->listenfd, POLLIN, 0}, {server->signalfd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0)
+        {
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            struct signalfd_siginfo info;
+            if (read(server->signalfd, &info, sizeof(info)) == sizeof(info))
+            {
+                if (info.ssi_signo == SIGHUP)
+                {
+                    reloadConfig(pool, config, server->configPath);
+                }
+                else
+                {
+                    running = false;
+                }
+            }
+            continue;
+        }
+
+        // drain what a burst left in the backlog and queue it in one go
+        int count = 0;
+        while (count < config->acceptBatch)
+        {
+            clientlen = sizeof(clientaddr);
+            if ((connfd = tcpAccept(server->listenfd, (SA *)&clientaddr, (socklen_t *)&clientlen)) < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    // out of descriptors or memory: shed load instead of exiting
+                    fprintf(stderr, "accept failed: %s\n", strerror(errno));
+                    usleep(10000);
+                }
+                break;
+            }
+            if (rateLimitAdmit(connfd, (SA *)&clientaddr, clientlen) != RATE_LIMIT_ADMIT)
+            {
+                requestReject(connfd, 429);
+                Close(connfd);
+                continue;
+            }
+            accepted[count++] = connfd;
+        }
+        ThreadPoolAddRequests(pool, accepted, count);
     }
 
+
+    Close(server->listenfd);
+    ListWaitStats waits;
+    ThreadPoolWaitStats(pool, &waits);
+    if (waits.spinHits + waits.spinMisses > 0)
+    {
+        fprintf(stderr, "Idle workers: %llu spins served a request, %llu gave up, %llu blocked, %.1f ms spinning\n",
+                waits.spinHits, waits.spinMisses, waits.parks, waits.spinNs / 1e6);
+    }
+    // streams hold workers: close them first so the workers can finish
+    http2Shutdown();
     ThreadPoolDestroy(pool);
+    reportPriorityClasses();
+    Http2Stats h2;
+    http2Stats(&h2);
+    if (h2.connections > 0)
+    {
+        fprintf(stderr, "HTTP/2: %lu connections, %lu streams; headers %llu bytes in (%llu as HTTP/1), %llu bytes out (%llu as HTTP/1)\n",
+                h2.connections, h2.streams, h2.requestHeaderBytes, h2.requestHeaderPlain,
+                h2.responseHeaderBytes, h2.responseHeaderPlain);
+    }
+    AutoindexStats listings;
+    autoindexShutdown();
+    autoindexStats(&listings);
+    if (listings.scans > 0)
+    {
+        fprintf(stderr, "Autoindex: %lu listings from kept pages, %lu pages built, %lu directory scans, %lu changes applied\n",
+                listings.hits, listings.renders, listings.scans, listings.events);
+    }
+    SharedCacheStats sharedFiles;
+    sharedCacheStats(&sharedFiles);
+    if (sharedFiles.hits + sharedFiles.misses > 0)
+    {
+        fprintf(stderr, "Shared cache: %lu hits, %lu misses, %lu reads raced a writer; %lu stores, %lu evictions by all workers\n",
+                sharedFiles.hits, sharedFiles.misses, sharedFiles.retries, sharedFiles.stores, sharedFiles.evictions);
+    }
+    FileCacheStats cachedFiles;
+    fileCacheStats(&cachedFiles);
+    if (cachedFiles.hits + cachedFiles.misses > 0)
+    {
+        fprintf(stderr, "File cache: %lu hits, %lu misses, %lu evictions; %lu files (%.1f MB) mapped\n",
+                cachedFiles.hits, cachedFiles.misses, cachedFiles.evictions, (unsigned long)cachedFiles.entries,
+                cachedFiles.bytes / 1048576.0);
+    }
+    ContentStoreStats stored;
+    contentStoreStats(&stored);
+    if (stored.hits + stored.reloads > 0)
+    {
+        fprintf(stderr, "Content store: %lu responses sent from it, %lu files copied in again after changing\n",
+                stored.hits, stored.reloads);
+    }
+    TlsStats handshakes;
+    tlsStats(&handshakes);
+    if (tlsEnabled())
+    {
+        fprintf(stderr, "TLS: %lu handshakes, %lu resumed, %lu failed; kernel TLS sending on %lu, receiving on %lu\n",
+                handshakes.handshakes, handshakes.resumed, handshakes.failed,
+                handshakes.ktlsSend, handshakes.ktlsReceive);
+    }
+    accessLogShutdown();
+}
+
+//
+// Prints what every worker process did, from the shared stats segment
+//
+static void reportWorkers(int workers)
+{
+    for (int i = 0; i < workers; i++)
+    {
+        PreforkStats stats;
+        preforkStats(i, &stats);
+        fprintf(stderr, "Worker %d: %lu requests (%lu 2xx, %lu 3xx, %lu 4xx, %lu 5xx), %.1f MB sent, started %lu times\n",
+                i, stats.requests, stats.status[2], stats.status[3], stats.status[4], stats.status[5],
+                stats.bytes / 1048576.0, stats.starts);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static ServerContext server;
+    ServerConfig *config = &server.config;
+    sigset_t signals;
+
+    getargs(config, &server.configPath, argc, argv);
+
+    // handled synchronously by the accept loop; blocked before any thread
+    // starts so that every thread inherits the mask
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if ((server.signalfd = signalfd(-1, &signals, SFD_CLOEXEC)) < 0)
+    {
+        unix_error("signalfd error");
+    }
+
+    // everything up to the listening socket is shared by the worker processes
+    if (config->mimeTypes[0] != '\0' && mimeInit(config->mimeTypes) < 0)
+    {
+        fprintf(stderr, "Using built-in MIME types, could not read %s\n", config->mimeTypes);
+    }
+    config->accessLog.path = config->accessLogPath[0] != '\0' ? config->accessLogPath : NULL;
+    // a client closing early must not kill the server on the next write
+    signal(SIGPIPE, SIG_IGN);
+    // built-in handlers, for "route = PREFIX handler NAME" lines
+    routeRegisterHandler("debug", profileHandler);
+    // the default site is made of the global settings, which sites inherit
+    static VhostConfig defaults;
+    strcpy(defaults.documentRoot, config->documentRoot);
+    strcpy(defaults.routes, config->routes);
+    defaults.autoindex = config->autoindex;
+    if (vhostInit(&defaults, config->vhosts, config->vhostCount) < 0)
+    {
+        unix_error("Virtual host error");
+    }
+    requestSetStaticMaxAge(config->staticMaxAge);
+    requestSetLimits(&config->requestLimits);
+    if (responseCacheInit(&config->responseCache) < 0)
+    {
+        unix_error("Response cache error");
+    }
+    for (int i = 0; i < config->vhostCount; i++)
+    {
+        responseCacheSetQuota(i + 1, config->vhosts[i].cacheBytes);
+    }
+    if (fileCacheInit(&config->fileCache) < 0)
+    {
+        unix_error("File cache error");
+    }
+    prewarm(config);
+    if (config->contentStore.paths[0] != '\0')
+    {
+        ContentStoreStats stored;
+        contentStoreInit(&config->contentStore);
+        contentStoreStats(&stored);
+        fprintf(stderr, "Content store: %lu files (%.1f MB) on huge pages, %lu of them hugetlbfs\n",
+                stored.files, stored.bytes / 1048576.0, stored.hugetlbFiles);
+    }
+    if (config->workerProcesses > 0 && sharedCacheInit(&config->sharedCache) < 0)
+    {
+        unix_error("Shared cache error");
+    }
+    if (preforkInit(config->workerProcesses) < 0)
+    {
+        unix_error("Stats segment error");
+    }
+    if (rateLimitInit(&config->rateLimit, config->workerProcesses) < 0)
+    {
+        unix_error("Rate limit table error");
+    }
+    if (tlsInit(&config->tls) < 0)
+    {
+        fprintf(stderr, "Could not set up TLS with %s\n", config->tls.certificate);
+        exit(1);
+    }
+    if ((server.listenfd = tcpOpenListener(config->port, &config->tcp)) < 0)
+    {
+        unix_error("Open_listenfd error");
+    }
+
+    if (config->workerProcesses == 0)
+    {
+        serveRequests(0, &server);
+        return 0;
+    }
+    if (preforkRun(config->workerProcesses, serveRequests, &server) < 0)
+    {
+        unix_error("Could not start the worker processes");
+    }
+    Close(server.listenfd);
+    reportWorkers(config->workerProcesses);
+    return 0;
 }
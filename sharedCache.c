@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include "sharedCache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define SHARED_WAYS 4
+#define SHARED_MIN_SETS 256
+/** Typical static file size, for sizing the slot table from the arena */
+#define SHARED_TYPICAL_FILE (16 * 1024)
+#define SHARED_NO_SLOT UINT32_MAX
+/** Copies a read makes before giving up on a slot being rewritten */
+#define SHARED_READ_TRIES 4
+
+typedef struct SharedSlot_t
+{
+    unsigned seq;           // odd while being written
+    uint32_t pathLen;
+    uint64_t hash;          // 0 = empty
+    uint64_t position;      // of its record, counted in bytes ever written
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+} SharedSlot;
+
+/* Heads every record of the arena; the path and the contents follow */
+typedef struct SharedRecord_t
+{
+    uint32_t slot;          // the slot it was written for, SHARED_NO_SLOT for padding
+    uint32_t length;        // of the whole record, a multiple of 8
+} SharedRecord;
+
+typedef struct SharedHeader_t
+{
+    pthread_mutex_t writer;     // robust and process-shared
+    uint64_t head;              // where the next record goes
+    uint64_t tail;              // the oldest record
+    unsigned long stores;
+    unsigned long evictions;
+} SharedHeader;
+
+/* What every process knows of the segment; the same after fork */
+static struct
+{
+    SharedHeader *header;
+    SharedSlot *slots;
+    size_t setMask;
+    char *arena;
+    size_t arenaBytes;
+    size_t maxEntryBytes;
+    pthread_key_t bufferKey;
+    unsigned long hits;         // of this process
+    unsigned long misses;
+    unsigned long retries;
+} shared;
+
+/* Where reads copy files to, maxEntryBytes long */
+static __thread char *sharedBuffer;
+
+/* FNV-1a, as for the MIME table; 0 marks empty slots */
+static uint64_t SharedHash(const char *path)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *path != '\0'; path++)
+    {
+        hash = (hash ^ (unsigned char)*path) * 1099511628211ULL;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+static int SharedMatches(const SharedSlot *slot, const struct stat *sbuf)
+{
+    return slot->ino == (uint64_t)sbuf->st_ino && slot->dev == (uint64_t)sbuf->st_dev &&
+           slot->size == (uint64_t)sbuf->st_size &&
+           slot->mtimeSec == sbuf->st_mtim.tv_sec && slot->mtimeNsec == sbuf->st_mtim.tv_nsec;
+}
+
+static const char *SharedRecordPath(uint64_t position)
+{
+    return shared.arena + position % shared.arenaBytes + sizeof(SharedRecord);
+}
+
+/* Empties slot; readers copying it see the sequence move and let go */
+static void SharedInvalidate(SharedSlot *slot)
+{
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->hash = 0;
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void SharedLock(void)
+{
+    if (pthread_mutex_lock(&shared.header->writer) == EOWNERDEAD)
+    {
+        // its last writer died midway: nothing it left is trusted
+        for (size_t i = 0; i < (shared.setMask + 1) * SHARED_WAYS; i++)
+        {
+            SharedSlot *slot = &shared.slots[i];
+            if (slot->seq & 1)
+            {
+                slot->hash = 0;
+                __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+            }
+            else if (slot->hash != 0)
+            {
+                SharedInvalidate(slot);
+            }
+        }
+        shared.header->head = shared.header->tail = 0;
+        pthread_mutex_consistent(&shared.header->writer);
+    }
+}
+
+/* Drops the oldest records until the arena is free up to end */
+static void SharedEvict(uint64_t end)
+{
+    SharedHeader *header = shared.header;
+
+    while (end - header->tail > shared.arenaBytes)
+    {
+        SharedRecord *record = (SharedRecord *)(shared.arena + header->tail % shared.arenaBytes);
+        if (record->slot != SHARED_NO_SLOT)
+        {
+            // a slot since rewritten points elsewhere and is left alone
+            SharedSlot *slot = &shared.slots[record->slot];
+            if (slot->hash != 0 && slot->position == header->tail)
+            {
+                SharedInvalidate(slot);
+                header->evictions++;
+            }
+        }
+        header->tail += record->length;
+    }
+}
+
+/* Makes room for a record of length bytes; records never wrap around */
+static uint64_t SharedReserve(uint32_t slot, uint32_t length)
+{
+    SharedHeader *header = shared.header;
+    size_t offset = header->head % shared.arenaBytes;
+
+    if (offset + length > shared.arenaBytes)
+    {
+        uint32_t pad = shared.arenaBytes - offset;
+        SharedEvict(header->head + pad);
+        *(SharedRecord *)(shared.arena + offset) = (SharedRecord){SHARED_NO_SLOT, pad};
+        header->head += pad;
+    }
+    SharedEvict(header->head + length);
+    *(SharedRecord *)(shared.arena + header->head % shared.arenaBytes) = (SharedRecord){slot, length};
+    header->head += length;
+    return header->head - length;
+}
+
+int sharedCacheInit(const SharedCacheConfig *config)
+{
+    pthread_mutexattr_t attr;
+    size_t sets = SHARED_MIN_SETS;
+
+    if (config->maxBytes == 0)
+    {
+        return 0;
+    }
+    while (sets * SHARED_WAYS < config->maxBytes / SHARED_TYPICAL_FILE)
+    {
+        sets *= 2;
+    }
+    size_t headerBytes = (sizeof(SharedHeader) + 63) & ~(size_t)63;
+    size_t slotBytes = sets * SHARED_WAYS * sizeof(SharedSlot);
+    size_t arenaBytes = (config->maxBytes + 7) & ~(size_t)7;
+    // anonymous shared memory stays shared across fork, and starts zeroed
+    char *segment = mmap(NULL, headerBytes + slotBytes + arenaBytes, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    shared.header = (SharedHeader *)segment;
+    shared.slots = (SharedSlot *)(segment + headerBytes);
+    shared.setMask = sets - 1;
+    shared.arena = segment + headerBytes + slotBytes;
+    shared.arenaBytes = arenaBytes;
+    // a file must leave room for others, or each store would flush the rest
+    shared.maxEntryBytes = config->maxEntryBytes < arenaBytes / 4 ? config->maxEntryBytes : arenaBytes / 4;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shared.header->writer, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_key_create(&shared.bufferKey, free);
+    return 0;
+}
+
+const char *sharedCacheRead(const char *path, const struct stat *sbuf, size_t *len)
+{
+    if (shared.header == NULL || sbuf->st_size == 0 || (size_t)sbuf->st_size > shared.maxEntryBytes)
+    {
+        return NULL;
+    }
+    if (sharedBuffer == NULL)
+    {
+        if ((sharedBuffer = malloc(shared.maxEntryBytes)) == NULL)
+        {
+            return NULL;
+        }
+        pthread_setspecific(shared.bufferKey, sharedBuffer);
+    }
+
+    uint64_t hash = SharedHash(path);
+    size_t pathLen = strlen(path);
+    SharedSlot *set = &shared.slots[(hash & shared.setMask) * SHARED_WAYS];
+    for (int way = 0; way < SHARED_WAYS; way++)
+    {
+        SharedSlot *slot = &set[way];
+        for (int tries = 0; tries < SHARED_READ_TRIES; tries++)
+        {
+            unsigned seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            SharedSlot copy = *slot;
+            if (seq & 1)
+            {
+                __atomic_fetch_add(&shared.retries, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            // anything read here may be torn until the sequence is checked,
+            // but the sizes are bounded first so the copy stays in the arena
+            if (copy.hash != hash || copy.pathLen != pathLen || copy.size != (uint64_t)sbuf->st_size ||
+                copy.position % shared.arenaBytes + sizeof(SharedRecord) + pathLen + copy.size > shared.arenaBytes)
+            {
+                break;
+            }
+            const char *record = SharedRecordPath(copy.position);
+            int same = memcmp(record, path, pathLen) == 0;
+            if (same)
+            {
+                memcpy(sharedBuffer, record + pathLen, copy.size);
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+            {
+                __atomic_fetch_add(&shared.retries, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            if (!same || !SharedMatches(&copy, sbuf))
+            {
+                break;
+            }
+            __atomic_fetch_add(&shared.hits, 1, __ATOMIC_RELAXED);
+            *len = copy.size;
+            return sharedBuffer;
+        }
+    }
+    __atomic_fetch_add(&shared.misses, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+void sharedCacheStore(const char *path, const struct stat *sbuf, const char *data, size_t len)
+{
+    size_t pathLen = strlen(path);
+
+    if (shared.header == NULL || len == 0 || len > shared.maxEntryBytes || len != (size_t)sbuf->st_size ||
+        pathLen >= PATH_MAX)
+    {
+        return;
+    }
+    uint64_t hash = SharedHash(path);
+    uint32_t length = (sizeof(SharedRecord) + pathLen + len + 7) & ~(size_t)7;
+    SharedSlot *set = &shared.slots[(hash & shared.setMask) * SHARED_WAYS];
+    SharedSlot *slot = NULL, *victim = NULL;
+
+    SharedLock();
+        for (int way = 0; way < SHARED_WAYS && slot == NULL; way++)
+        {
+            SharedSlot *candidate = &set[way];
+            if (candidate->hash == hash && candidate->pathLen == pathLen &&
+                !memcmp(SharedRecordPath(candidate->position), path, pathLen))
+            {
+                slot = candidate;
+            }
+            // an empty way, else the one written longest ago
+            else if (victim == NULL || (victim->hash != 0 &&
+                     (candidate->hash == 0 || candidate->position < victim->position)))
+            {
+                victim = candidate;
+            }
+        }
+        if (slot != NULL && SharedMatches(slot, sbuf))
+        {
+            // another worker stored it first
+            pthread_mutex_unlock(&shared.header->writer);
+            return;
+        }
+        if (slot == NULL)
+        {
+            slot = victim;
+            shared.header->evictions += slot->hash != 0;
+        }
+
+        uint32_t index = slot - shared.slots;
+        uint64_t position = SharedReserve(index, length);
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        char *record = (char *)SharedRecordPath(position);
+        memcpy(record, path, pathLen);
+        memcpy(record + pathLen, data, len);
+        slot->pathLen = pathLen;
+        slot->hash = hash;
+        slot->position = position;
+        slot->size = len;
+        slot->dev = sbuf->st_dev;
+        slot->ino = sbuf->st_ino;
+        slot->mtimeSec = sbuf->st_mtim.tv_sec;
+        slot->mtimeNsec = sbuf->st_mtim.tv_nsec;
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+        shared.header->stores++;
+    pthread_mutex_unlock(&shared.header->writer);
+}
+
+void sharedCacheStats(SharedCacheStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (shared.header == NULL)
+    {
+        return;
+    }
+    stats->hits = __atomic_load_n(&shared.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&shared.misses, __ATOMIC_RELAXED);
+    stats->retries = __atomic_load_n(&shared.retries, __ATOMIC_RELAXED);
+    stats->stores = __atomic_load_n(&shared.header->stores, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&shared.header->evictions, __ATOMIC_RELAXED);
+}
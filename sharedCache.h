@@ -0,0 +1,63 @@
+#ifndef SHARED_CACHE_H_
+#define SHARED_CACHE_H_
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/**
+* Shared cache
+*
+* Static files cached in one shared memory segment, mapped before the worker
+* processes fork, so a file read by one worker is a hit for all of them and
+* is held once however many workers there are.
+*
+* Reads take no lock: every slot is a seqlock, and a reader copies the file
+* out and retries if the slot changed meanwhile, so a worker that dies in the
+* middle of a read leaves nothing behind. Writes take a robust process-shared
+* mutex; when a writer dies holding it, the next one empties the cache rather
+* than trust what it left.
+*
+* The contents are kept in a ring arena written in order; making room drops
+* the oldest files. Slots are found by path in 4-way sets.
+*
+*   sharedCacheInit  - Maps the segment (before forking).
+*   sharedCacheRead  - Copies a cached file out, if current.
+*   sharedCacheStore - Caches a file that was just read.
+*   sharedCacheStats - Counters for monitoring.
+*/
+
+typedef struct SharedCacheConfig_t {
+    size_t maxBytes;        // size of the arena, 0 = off
+    size_t maxEntryBytes;   // larger files are not shared
+} SharedCacheConfig;
+
+typedef struct SharedCacheStats_t {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long stores;
+    unsigned long evictions;
+    unsigned long retries;      // reads that raced a writer and copied again
+} SharedCacheStats;
+
+/**
+* sharedCacheInit: Maps the segment; call it before the workers fork.
+* @return 0 on success (or when off), -1 on error
+*/
+int sharedCacheInit(const SharedCacheConfig *config);
+
+/**
+* sharedCacheRead: Copies the cached contents of path, whose current stat is
+*   sbuf, into a buffer of the calling thread.
+* @return the buffer (valid until the thread's next call), NULL on a miss
+*/
+const char *sharedCacheRead(const char *path, const struct stat *sbuf, size_t *len);
+
+/**
+* sharedCacheStore: Caches len bytes of data as the contents of path, as
+*   described by sbuf. Does nothing when the file is too large.
+*/
+void sharedCacheStore(const char *path, const struct stat *sbuf, const char *data, size_t len);
+
+void sharedCacheStats(SharedCacheStats *stats);
+
+#endif // SHARED_CACHE_H_
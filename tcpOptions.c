@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "tcpOptions.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static TcpOptions tcpActive = {
+    .backlog = 1024,
+    .deferAcceptSec = 0,
+    .fastOpenQueue = 0,
+    .noDelay = false,
+    .cork = false,
+    .sendBuffer = 0,
+    .receiveBuffer = 0,
+    .nonBlocking = false,
+};
+
+static void tcpTrySetsockopt(int fd, int level, int name, int value, const char *what)
+{
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0)
+    {
+        fprintf(stderr, "setsockopt %s failed: %s\n", what, strerror(errno));
+    }
+}
+
+int tcpOpenListener(int port, const TcpOptions *options)
+{
+    int listenfd, optval = 1;
+    struct sockaddr_in serveraddr;
+
+    tcpActive = *options;
+
+    // non-blocking so the acceptor can drain the backlog until EAGAIN
+    if ((listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        return -1;
+    }
+
+    /* Eliminates "Address already in use" error from bind. */
+    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0)
+    {
+        close(listenfd);
+        return -1;
+    }
+
+    if (tcpActive.deferAcceptSec > 0)
+    {
+        tcpTrySetsockopt(listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, tcpActive.deferAcceptSec, "TCP_DEFER_ACCEPT");
+    }
+    if (tcpActive.fastOpenQueue > 0)
+    {
+        tcpTrySetsockopt(listenfd, IPPROTO_TCP, TCP_FASTOPEN, tcpActive.fastOpenQueue, "TCP_FASTOPEN");
+    }
+    // buffer sizes set on the listener are inherited by accepted sockets and,
+    // unlike setting them after accept, also size the advertised window
+    if (tcpActive.receiveBuffer > 0)
+    {
+        tcpTrySetsockopt(listenfd, SOL_SOCKET, SO_RCVBUF, tcpActive.receiveBuffer, "SO_RCVBUF");
+    }
+    if (tcpActive.sendBuffer > 0)
+    {
+        tcpTrySetsockopt(listenfd, SOL_SOCKET, SO_SNDBUF, tcpActive.sendBuffer, "SO_SNDBUF");
+    }
+
+    memset(&serveraddr, 0, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serveraddr.sin_port = htons((unsigned short)port);
+    if (bind(listenfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) < 0 ||
+        listen(listenfd, tcpActive.backlog) < 0)
+    {
+        int saved = errno;
+        close(listenfd);
+        errno = saved;
+        return -1;
+    }
+    return listenfd;
+}
+
+int tcpAccept(int listenfd, struct sockaddr *addr, socklen_t *addrlen)
+{
+    int flags = SOCK_CLOEXEC | (tcpActive.nonBlocking ? SOCK_NONBLOCK : 0);
+    socklen_t len = *addrlen;
+    int fd;
+
+    while (true)
+    {
+        *addrlen = len;
+        fd = accept4(listenfd, addr, addrlen, flags);
+        if (fd >= 0)
+        {
+            break;
+        }
+        // the client gave up before we got to it: just take the next one
+        if (errno != EINTR && errno != ECONNABORTED && errno != EPROTO)
+        {
+            return -1;
+        }
+    }
+
+    // with cork also on, each response is still held back until tcpResponseEnd
+    if (tcpActive.noDelay)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+void tcpResponseBegin(int fd)
+{
+    if (tcpActive.cork)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
+    }
+}
+
+void tcpResponseEnd(int fd)
+{
+    if (tcpActive.cork)
+    {
+        int zero = 0;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef TCP_OPTIONS_H_
+#define TCP_OPTIONS_H_
+
+#include <sys/socket.h>
+#include "bool.h"
+
+/**
+* Listener and connection socket tuning
+*
+*   tcpOpenListener  - Opens the (non-blocking) listening socket with the
+*                      configured backlog, TCP_DEFER_ACCEPT and TCP Fast Open.
+*   tcpAccept        - accept4() (non-blocking, close-on-exec) plus the
+*                      per-connection options.
+*   tcpResponseBegin - Corks the socket so a response's headers and body
+*   tcpResponseEnd     leave in full segments; uncorking flushes at once.
+*
+* The options passed to tcpOpenListener stay in effect for tcpAccept and the
+* response helpers.
+*
+* bench/tcpKnobs.sh measures each knob on its own. Over loopback none moves
+* throughput or latency beyond run-to-run noise (the numbers are in the
+* script), so TCP_DEFER_ACCEPT and Fast Open, which change when and how
+* connections are accepted, are experimental and off by default; NODELAY,
+* CORK and non-blocking sockets stay on.
+*/
+
+typedef struct TcpOptions_t {
+    int backlog;          // listen() queue length
+    int deferAcceptSec;   // TCP_DEFER_ACCEPT: only wake us once data arrived (0 = off)
+    int fastOpenQueue;    // TCP_FASTOPEN queue length (0 = off)
+    bool noDelay;         // TCP_NODELAY on accepted sockets
+    bool cork;            // TCP_CORK around each response
+    int sendBuffer;       // SO_SNDBUF on accepted sockets (0 = kernel default)
+    int receiveBuffer;    // SO_RCVBUF on accepted sockets (0 = kernel default)
+    bool nonBlocking;     // accepted sockets are O_NONBLOCK; Rio waits with poll()
+} TcpOptions;
+
+/**
+* tcpOpenListener: Opens a listening socket on port.
+* @return the socket, -1 on error (errno set; a failing optional knob such as
+*   Fast Open is reported on stderr and skipped)
+*/
+int tcpOpenListener(int port, const TcpOptions *options);
+
+/**
+* tcpAccept: Accepts one connection and applies the per-connection options.
+*   Retries on EINTR and on connections aborted before they were accepted.
+* @return the connected socket, -1 on error (errno set; EAGAIN once the
+*   backlog is empty)
+*/
+int tcpAccept(int listenfd, struct sockaddr *addr, socklen_t *addrlen);
+
+void tcpResponseBegin(int fd);
+void tcpResponseEnd(int fd);
+
+#endif // TCP_OPTIONS_H_
@@ -0,0 +1,79 @@
+#!/bin/bash
+#
+# Connections over the queue bound must be answered or closed, and given back,
+# under every drop policy: none may be left open without a worker.
+#
+# One worker is held by a request whose last line is sent late, and eight
+# requests arrive behind it with room for one. Every client must get its
+# response, a 503 or a closed connection before timing out, and the server
+# must be back to the fds it had before.
+#
+# Usage: queueShed.sh <server binary> [port]
+#
+SERVER=$1
+PORT=${2:-18095}
+HOLD=1          # seconds the worker is held
+CLIENTS=8
+
+if [ ! -x "$SERVER" ]; then
+    echo "usage: $0 <server binary> [port]" >&2
+    exit 2
+fi
+
+DIR=$(mktemp -d)
+cleanup()
+{
+    exec 3>&-
+    [ -n "$PID" ] && kill "$PID" 2>/dev/null && wait "$PID" 2>/dev/null
+    rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+mkdir -p "$DIR/root"
+echo ok > "$DIR/root/small.txt"
+failed=0
+
+for policy in block dt dh random codel; do
+    cat > "$DIR/server.conf" <<CONF
+port = $PORT
+document_root = $DIR/root
+access_log = off
+threads = 1
+queue_size = 1
+schedalg = $policy
+CONF
+    "$SERVER" -c "$DIR/server.conf" > "$DIR/server.log" 2>&1 &
+    PID=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        curl -s -o /dev/null "http://127.0.0.1:$PORT/small.txt" && break
+        sleep 0.2
+    done
+    sleep 0.2
+    fds=$(ls /proc/$PID/fd | wc -l)
+
+    exec 3<>/dev/tcp/127.0.0.1/$PORT
+    printf 'GET /small.txt HTTP/1.0\r\n' >&3
+    sleep 0.2
+    for i in $(seq $CLIENTS); do
+        curl -s -o /dev/null --max-time $((HOLD + 3)) -w '%{http_code} %{time_total}\n' \
+            "http://127.0.0.1:$PORT/small.txt" > "$DIR/client.$i" 2>/dev/null &
+    done
+    sleep $HOLD
+    printf '\r\n' >&3
+    exec 3>&-
+    wait $(jobs -p | grep -v "^$PID$") 2>/dev/null
+    sleep 0.2
+
+    # 000 is a connection closed unanswered (dt), or one that timed out
+    codes=$(awk '{ print $1 }' "$DIR"/client.* | sort | uniq -c | tr -s ' \n' ' ')
+    timeouts=$(awk '$2 >= '$((HOLD + 3))' { n++ } END { print n + 0 }' "$DIR"/client.*)
+    left=$(( $(ls /proc/$PID/fd | wc -l) - fds ))
+    echo "$policy: responses$codes; $timeouts timed out, $left fds left open"
+    if [ $timeouts -ne 0 ] || [ $left -ne 0 ]; then
+        failed=1
+    fi
+    kill $PID
+    wait $PID 2>/dev/null
+    PID=
+done
+exit $failed
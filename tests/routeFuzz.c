@@ -0,0 +1,237 @@
+/*
+ * routeFuzz.c: Fuzz target for routeNormalize and routeLookup.
+ *
+ * To run, try:
+ *      ./routeFuzz [iterations [seed]]     random paths, as ctest does
+ *      ./routeFuzz - < input               one input, as AFL runs it
+ *      clang -g -O1 -fsanitize=fuzzer,address,undefined -DLIBFUZZER \
+ *          -o routeFuzz tests/routeFuzz.c route.c && ./routeFuzz
+ *
+ * Every input is checked against references written the obvious way rather
+ * than the fast one:
+ *
+ *   - routeNormalize must agree with decoding each segment first and then
+ *     resolving "." and ".." on a stack, in the result and in 400. Inputs as
+ *     long as ROUTE_PATH_MAX, which requests never pass it, need only not
+ *     grow.
+ *   - routeLookup must return the route a linear scan of the prefixes finds
+ *     (longest, whole segments only), and rest must be what follows it.
+ *
+ * A mismatch prints the input and aborts. The random paths are drawn from
+ * "/.a%2eF0fB", which spells dot segments, escapes good and bad, and the
+ * prefixes of the table below.
+ */
+
+#include "../route.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *prefixes[] = {
+    "/a", "/a/b", "/a/bb", "/a/b/a", "/.a", "/F0", "/a.F",
+};
+#define PREFIXES (sizeof(prefixes) / sizeof(prefixes[0]))
+
+static RouteTable *table;
+
+static void Handler(int fd, AccessLogEntry *entry, const char *path, const char *query)
+{
+}
+
+static void Fail(const char *what, const char *input, const char *got, const char *expected)
+{
+    fprintf(stderr, "routeFuzz: %s\n  input    \"%s\"\n  got      \"%s\"\n  expected \"%s\"\n",
+            what, input, got, expected);
+    abort();
+}
+
+static int HexDigit(char c)
+{
+    const char *digits = "0123456789abcdef0123456789ABCDEF";
+    const char *at = c != '\0' ? strchr(digits, c) : NULL;
+    return at != NULL ? (int)(at - digits) % 16 : -1;
+}
+
+/* Decodes every segment, then resolves them on a stack of segment starts */
+static int ReferenceNormalize(const char *path, char *out)
+{
+    static int stack[ROUTE_PATH_MAX];
+    char segment[ROUTE_PATH_MAX + 1];
+    int depth = 0;
+    size_t len = 0;
+    bool directory = false;
+
+    if (path[0] != '/')
+    {
+        return 400;
+    }
+    for (const char *p = path + 1; ; p++)
+    {
+        size_t n = 0;
+        for (; *p != '/' && *p != '\0'; p++)
+        {
+            char c = *p;
+            if (c == '%')
+            {
+                int high = HexDigit(p[1]);
+                int low = high < 0 ? -1 : HexDigit(p[2]);
+                if (low < 0)
+                {
+                    return 400;
+                }
+                c = (char)(high << 4 | low);
+                if (c == '\0' || c == '/')
+                {
+                    return 400;
+                }
+                p += 2;
+            }
+            segment[n++] = c;
+        }
+        segment[n] = '\0';
+
+        directory = n == 0 || !strcmp(segment, ".") || !strcmp(segment, "..");
+        if (!strcmp(segment, ".."))
+        {
+            if (depth == 0)
+            {
+                return 400;
+            }
+            len = stack[--depth];
+        }
+        else if (n > 0 && strcmp(segment, "."))
+        {
+            stack[depth++] = len;
+            out[len++] = '/';
+            memcpy(out + len, segment, n);
+            len += n;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+    }
+    if (len == 0 || directory)
+    {
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+/* The longest prefix of path ending at a segment boundary, "/" otherwise */
+static const char *ReferenceLookup(const char *path)
+{
+    const char *best = "/";
+    for (size_t i = 0; i < PREFIXES; i++)
+    {
+        size_t len = strlen(prefixes[i]);
+        if (!strncmp(path, prefixes[i], len) && (path[len] == '/' || path[len] == '\0') &&
+            len > strlen(best))
+        {
+            best = prefixes[i];
+        }
+    }
+    return best;
+}
+
+static void Setup(void)
+{
+    char routes[ROUTE_TEXT_MAX] = "";
+    routeRegisterHandler("fuzz", Handler);
+    for (size_t i = 0; i < PREFIXES; i++)
+    {
+        strcat(routes, prefixes[i]);
+        strcat(routes, " handler fuzz\n");
+    }
+    if ((table = routeTableCreate("/", routes)) == NULL)
+    {
+        perror("routeTableCreate");
+        exit(1);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+    static char input[2 * ROUTE_PATH_MAX], path[2 * ROUTE_PATH_MAX], expected[2 * ROUTE_PATH_MAX];
+    const char *rest;
+
+    if (table == NULL)
+    {
+        Setup();
+    }
+    if (size >= sizeof(input) || memchr(data, '\0', size) != NULL)
+    {
+        return 0;
+    }
+    memcpy(input, data, size);
+    input[size] = '\0';
+    strcpy(path, input);
+
+    int status = routeNormalize(path);
+    if (size >= ROUTE_PATH_MAX)
+    {
+        if (status == 0 && strlen(path) > size)
+        {
+            Fail("normalizing grew the path", input, path, "");
+        }
+        return 0;
+    }
+    int expectedStatus = ReferenceNormalize(input, expected);
+    if (status != expectedStatus)
+    {
+        Fail("status differs", input, status == 0 ? path : status == 400 ? "400" : "414",
+             expectedStatus == 0 ? expected : "400");
+    }
+    if (status != 0)
+    {
+        return 0;
+    }
+    if (strcmp(path, expected))
+    {
+        Fail("normalized path differs", input, path, expected);
+    }
+
+    const Route *route = routeLookup(table, path, &rest);
+    const char *prefix = ReferenceLookup(path);
+    if (strcmp(route->prefix, prefix))
+    {
+        Fail("route differs", path, route->prefix, prefix);
+    }
+    const char *expectedRest = path + (prefix[1] == '\0' ? 0 : strlen(prefix));
+    if (rest != expectedRest)
+    {
+        Fail("rest differs", path, rest, expectedRest);
+    }
+    return 0;
+}
+
+#ifndef LIBFUZZER
+int main(int argc, char *argv[])
+{
+    static unsigned char buf[2 * ROUTE_PATH_MAX];
+    const char *alphabet = "/.a%2eF0fB";
+
+    if (argc > 1 && !strcmp(argv[1], "-"))
+    {
+        size_t size = fread(buf, 1, sizeof(buf), stdin);
+        return LLVMFuzzerTestOneInput(buf, size);
+    }
+
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    srandom(argc > 2 ? atol(argv[2]) : 1);
+    for (long i = 0; i < iterations; i++)
+    {
+        // mostly short paths, where the segments collide; now and then one past the limit
+        size_t size = random() % 1000 == 0 ? ROUTE_PATH_MAX - 8 + random() % 16 : 1 + random() % 40;
+        buf[0] = random() % 20 ? '/' : alphabet[random() % strlen(alphabet)];
+        for (size_t j = 1; j < size; j++)
+        {
+            buf[j] = alphabet[random() % strlen(alphabet)];
+        }
+        LLVMFuzzerTestOneInput(buf, size);
+    }
+    printf("%ld paths checked\n", iterations);
+    return 0;
+}
+#endif
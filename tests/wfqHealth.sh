@@ -0,0 +1,65 @@
+#!/bin/bash
+#
+# A health check queued together with a slow bulk download under schedalg wfq
+# must be answered as soon as a worker is free, not after the download.
+#
+# Both workers are first held by requests whose last line is sent late, so
+# the download and the health check queue up together; when the two workers
+# come free at once, one must take the download and the other the check.
+#
+# Usage: wfqHealth.sh <server binary> [port]
+#
+SERVER=$1
+PORT=${2:-18090}
+HOLD=1          # seconds the workers are held
+LIMIT_MS=1500   # HOLD plus a request time
+
+if [ ! -x "$SERVER" ]; then
+    echo "usage: $0 <server binary> [port]" >&2
+    exit 2
+fi
+
+DIR=$(mktemp -d)
+cleanup()
+{
+    exec 3>&- 4>&-
+    [ -n "$PID" ] && kill "$PID" 2>/dev/null && wait "$PID" 2>/dev/null
+    rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+mkdir -p "$DIR/root/big"
+echo ok > "$DIR/root/health.txt"
+head -c 33554432 /dev/zero > "$DIR/root/big/f.bin"
+cat > "$DIR/server.conf" <<CONF
+port = $PORT
+document_root = $DIR/root
+access_log = off
+threads = 2
+queue_size = 64
+schedalg = wfq
+priority_class = bulk 4 8 path=/big
+priority_class = health 1 16 path=/health.txt
+CONF
+
+"$SERVER" -c "$DIR/server.conf" > "$DIR/server.log" 2>&1 &
+PID=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    curl -s -o /dev/null "http://127.0.0.1:$PORT/health.txt" && break
+    sleep 0.2
+done
+
+exec 3<>/dev/tcp/127.0.0.1/$PORT 4<>/dev/tcp/127.0.0.1/$PORT
+printf 'GET /health.txt HTTP/1.0\r\n' >&3
+printf 'GET /health.txt HTTP/1.0\r\n' >&4
+sleep 0.2
+(sleep $HOLD; printf '\r\n' >&3; printf '\r\n' >&4) &
+
+# the download reads at 64 KB/s and holds its worker for the whole run
+TIME=$(curl -s -Z --parallel-immediate --max-time $((HOLD + 5)) --limit-rate 64k \
+    -o /dev/null "http://127.0.0.1:$PORT/big/f.bin" \
+    -o /dev/null "http://127.0.0.1:$PORT/health.txt" \
+    -w '%{url_effective} %{time_total}\n' 2>/dev/null | awk '/health/ { print $2 }')
+wait_ms=$(echo "$TIME" | awk '{ printf "%d", $1 * 1000 }')
+echo "health check answered in ${wait_ms} ms beside a bulk download (limit ${LIMIT_MS} ms)"
+[ "$wait_ms" -lt "$LIMIT_MS" ]
@@ -0,0 +1,64 @@
+#!/bin/bash
+#
+# Under schedalg wfq a path= class must catch requests whose request line
+# arrives after the connection was opened, not only those sent with it.
+#
+# Clients connect, wait, and only then send a request for the health class's
+# path; each must be counted in that class, not in the default one.
+#
+# Usage: wfqLatePeek.sh <server binary> [port]
+#
+SERVER=$1
+PORT=${2:-18096}
+LATE=0.5        # seconds between connecting and sending the request
+CLIENTS=3
+
+if [ ! -x "$SERVER" ]; then
+    echo "usage: $0 <server binary> [port]" >&2
+    exit 2
+fi
+
+DIR=$(mktemp -d)
+cleanup()
+{
+    [ -n "$PID" ] && kill "$PID" 2>/dev/null && wait "$PID" 2>/dev/null
+    rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+mkdir -p "$DIR/root"
+echo ok > "$DIR/root/health.txt"
+cat > "$DIR/server.conf" <<CONF
+port = $PORT
+document_root = $DIR/root
+access_log = off
+threads = 2
+queue_size = 64
+schedalg = wfq
+priority_class = health 1 16 path=/health.txt
+CONF
+
+"$SERVER" -c "$DIR/server.conf" > "$DIR/server.log" 2>&1 &
+PID=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+    sleep 0.2
+done
+
+for i in $(seq $CLIENTS); do
+    (
+        exec 3<>/dev/tcp/127.0.0.1/$PORT
+        sleep $LATE
+        printf 'GET /health.txt HTTP/1.0\r\n\r\n' >&3
+        timeout 5 cat <&3 | head -1 > "$DIR/client.$i"
+    ) &
+done
+wait $(jobs -p | grep -v "^$PID$") 2>/dev/null
+
+kill -INT $PID
+wait $PID 2>/dev/null
+PID=
+answered=$(grep -l ' 200 ' "$DIR"/client.* | wc -l)
+served=$(sed -n 's/^Priority class health .*: \([0-9]*\) served.*/\1/p' "$DIR/server.log")
+echo "$answered of $CLIENTS late requests answered, ${served:-0} of them in the health class"
+[ "$answered" -eq $CLIENTS ] && [ "${served:-0}" -eq $CLIENTS ]
@@ -1,31 +1,393 @@
+#define _GNU_SOURCE
 #include "threadPool.h"
+#include "affinity.h"
+#include "rateLimit.h"
+#include "tls.h"
+#include "priority.h"
+#include <sched.h>
+
+/* CoDel (RFC 8289) state, applied to queueing delay instead of packets */
+typedef struct CoDel_t
+{
+    pthread_mutex_t mutex;
+    unsigned long long targetNs;
+    unsigned long long intervalNs;
+    unsigned long long firstAboveTime; // when delay may start being acted on, 0 = below target
+    unsigned long long dropNext;       // next drop time while in dropping state
+    unsigned int count;                // drops since entering dropping state
+    unsigned int lastCount;
+    bool dropping;
+    unsigned long dropped;
+} CoDel;
+
+typedef struct Worker_t
+{
+    ThreadPool pool;
+    size_t index;
+    int cpu;            // -1 when not pinned
+    List queue;         // where this worker takes requests from
+    List localRequests; // the worker's own queue when steering, NULL otherwise
+    bool retired;       // took a retire sentinel and exited, waiting to be joined
+} *Worker;
+
+/* queued instead of a connection to make one worker exit once it gets to it */
+#define RETIRE_SENTINEL -2
+/* queued for each connection a priority class holds: the worker taking one
+   serves whichever connection the classes pick (see priorityDequeue) */
+#define PRIORITY_TOKEN -3
+
 struct Pool_t
 {
-    size_t poolSize;
+    size_t poolSize;            // workers running, or about to after a resize
+    size_t threadCount;         // entries in threadArray and workers, retired ones included
+    size_t retiring;            // sentinels queued and not yet taken
     size_t maxRequest;
+    int batch;                  // requests a worker claims per dequeue
+    unsigned long long maxSpinNs; // idle workers spin up to this long before blocking
     SchedAlg schedAlg;
+    ThreadPoolPlacement placement;
     List waitingRequests;
     List inProgressRequests;
     pthread_t* threadArray;
+    Worker* workers;
+    sem_t workersReady;
+    int cpuToSlot[CPU_SETSIZE]; // placement slot of each CPU, -1 if no worker runs there
+    size_t nextSteer;           // round robin among workers sharing a CPU
+    CoDel codel;
 };
 
-static void* HandleRequest(void *pool)
+typedef struct WorkerStart_t
+{
+    ThreadPool pool;
+    size_t index;
+} WorkerStart;
+
+static unsigned long long NowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* integer square root, enough precision for the CoDel control law */
+static unsigned long long ISqrt(unsigned long long x)
+{
+    unsigned long long r = x, y = (x + 1) / 2;
+    while (y < r)
+    {
+        r = y;
+        y = (r + x / r) / 2;
+    }
+    return r;
+}
+
+static unsigned long long CoDelControlLaw(CoDel *codel, unsigned long long t)
+{
+    return t + codel->intervalNs / ISqrt(codel->count);
+}
+
+/**
+* CoDelShouldDrop: Decides whether a request that waited sojournNs in the
+*   queue should be shed. Drops start once the delay has stayed above target
+*   for a whole interval, and then come faster (interval / sqrt(count)) until
+*   the delay falls back under target.
+*/
+static bool CoDelShouldDrop(CoDel *codel, unsigned long long sojournNs)
 {
-    ThreadPool cur_pool = (ThreadPool)pool;
-    int fd = -1;
-    while(true)
+    unsigned long long now = NowNs();
+    bool okToDrop = false;
+    bool drop = false;
+
+    pthread_mutex_lock(&codel->mutex);
+        if (sojournNs < codel->targetNs)
+        {
+            codel->firstAboveTime = 0;
+        }
+        else if (codel->firstAboveTime == 0)
+        {
+            codel->firstAboveTime = now + codel->intervalNs;
+        }
+        else if (now >= codel->firstAboveTime)
+        {
+            okToDrop = true;
+        }
+
+        if (codel->dropping)
+        {
+            if (!okToDrop)
+            {
+                codel->dropping = false;
+            }
+            else if (now >= codel->dropNext)
+            {
+                drop = true;
+                codel->count++;
+                codel->dropNext = CoDelControlLaw(codel, codel->dropNext);
+            }
+        }
+        else if (okToDrop)
+        {
+            // resume near the previous drop rate if we left dropping recently
+            unsigned int delta = codel->count - codel->lastCount;
+            drop = true;
+            codel->dropping = true;
+            codel->count = (delta > 1 && now - codel->dropNext < 16 * codel->intervalNs) ? delta : 1;
+            codel->dropNext = CoDelControlLaw(codel, now);
+            codel->lastCount = codel->count;
+        }
+
+        if (drop)
+        {
+            codel->dropped++;
+        }
+    pthread_mutex_unlock(&codel->mutex);
+
+    return drop;
+}
+
+/* every connection the pool took ownership of is closed through here */
+static void CloseRequest(int fd)
+{
+    rateLimitRelease(fd);
+    tlsRelease(fd);
+    Close(fd);
+}
+
+/**
+* WorkerInit: Runs on the new (already pinned) thread, so the worker's state
+*   and its queue are allocated on the node it runs on.
+*/
+static Worker WorkerInit(ThreadPool pool, size_t index)
+{
+    Worker worker = affinityAllocLocal(sizeof(*worker));
+    if (worker == NULL)
+    {
+        unix_error("Worker allocation error");
+    }
+    worker->pool = pool;
+    worker->index = index;
+    worker->cpu = pool->placement.pinWorkers ? sched_getcpu() : -1;
+    worker->localRequests = pool->placement.steerByCpu ? listCreate() : NULL;
+    listSetMaxSpin(worker->localRequests, __atomic_load_n(&pool->maxSpinNs, __ATOMIC_RELAXED));
+    worker->retired = false;
+    worker->queue = worker->localRequests != NULL ? worker->localRequests : pool->waitingRequests;
+    return worker;
+}
+
+static void* HandleRequest(void *arg)
+{
+    WorkerStart *start = (WorkerStart *)arg;
+    ThreadPool cur_pool = start->pool;
+    Worker worker = WorkerInit(cur_pool, start->index);
+    cur_pool->workers[start->index] = worker;
+    free(start);
+    sem_post(&cur_pool->workersReady);
+
+    int fds[THREAD_POOL_MAX_BATCH];
+    unsigned long long enqueuedNs[THREAD_POOL_MAX_BATCH];
+    int connections[THREAD_POOL_MAX_BATCH];
+    int classes[THREAD_POOL_MAX_BATCH];
+    bool retire = false;
+    while(!retire)
     {
-        fd = listDequeue(cur_pool->waitingRequests);
-        listEnqueue(cur_pool->inProgressRequests,fd);
-        requestHandle(fd);
-        //TODO if we get new task here?
-        listRemove(cur_pool->inProgressRequests,fd);
-        Close(fd);
+        int max = __atomic_load_n(&cur_pool->batch, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&cur_pool->schedAlg, __ATOMIC_RELAXED) == WFQ)
+        {
+            // a token held behind a slow request keeps its connection, perhaps
+            // a health check, waiting while other workers park: one at a time
+            max = 1;
+        }
+        int count = listDequeueBatchTimed(worker->queue, fds, enqueuedNs, max);
+        int requests = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (fds[i] != RETIRE_SENTINEL)
+            {
+                fds[requests] = fds[i];
+                enqueuedNs[requests] = enqueuedNs[i];
+                requests++;
+            }
+            else if (!retire)
+            {
+                // finish the rest of the batch first, then exit
+                retire = true;
+                __atomic_fetch_sub(&cur_pool->retiring, 1, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                // one sentinel per worker: hand the extra one back
+                listEnqueue(worker->queue, RETIRE_SENTINEL);
+            }
+        }
+
+        // claimed requests count as in progress, so the queue bound still holds;
+        // tokens only count once they are resolved to a connection
+        int claimed = 0;
+        for (int i = 0; i < requests; i++)
+        {
+            if (fds[i] != PRIORITY_TOKEN)
+            {
+                connections[claimed] = fds[i];
+                claimed++;
+            }
+        }
+        listEnqueueBatch(cur_pool->inProgressRequests, connections, claimed);
+        for (int i = 0; i < requests; i++)
+        {
+            unsigned long long startNs = 0;
+            classes[i] = -1;
+            if (fds[i] == PRIORITY_TOKEN)
+            {
+                // a class limit may make this wait for another worker, never
+                // for a request this one holds
+                fds[i] = priorityDequeue(&enqueuedNs[i], &classes[i]);
+                listEnqueue(cur_pool->inProgressRequests, fds[i]);
+                startNs = NowNs();
+            }
+
+            // the sojourn is judged when the request starts, not when it was claimed
+            if (__atomic_load_n(&cur_pool->schedAlg, __ATOMIC_RELAXED) == CODEL && CoDelShouldDrop(&cur_pool->codel, NowNs() - enqueuedNs[i]))
+            {
+                requestReject(fds[i], 503);
+            }
+            else if (requestHandle(fds[i]))
+            {
+                // the connection now belongs to the HTTP/2 thread
+                listRemove(cur_pool->inProgressRequests,fds[i]);
+                if (classes[i] >= 0)
+                {
+                    priorityDone(classes[i], enqueuedNs[i], startNs);
+                }
+                continue;
+            }
+            listRemove(cur_pool->inProgressRequests,fds[i]);
+            CloseRequest(fds[i]);
+            if (classes[i] >= 0)
+            {
+                priorityDone(classes[i], enqueuedNs[i], startNs);
+            }
+        }
     }
+    __atomic_store_n(&worker->retired, true, __ATOMIC_RELEASE);
     return NULL;
 }
 
-ThreadPool ThreadPoolCreate(size_t poolSize, size_t maxRequest, SchedAlg schedAlg)
+/**
+* QueueFor: Picks the queue a new connection goes to. When steering, that is
+*   the queue of a worker on the CPU that processed the connection's packets,
+*   so its socket state is still in that CPU's cache.
+*/
+static List QueueFor(ThreadPool pool, int fd)
+{
+    if (!pool->placement.steerByCpu)
+    {
+        return pool->waitingRequests;
+    }
+
+    size_t cpus = affinityCpuCount();
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    size_t slot;
+    if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 &&
+        cpu >= 0 && cpu < CPU_SETSIZE && pool->cpuToSlot[cpu] >= 0)
+    {
+        slot = pool->cpuToSlot[cpu];
+    }
+    else
+    {
+        slot = pool->nextSteer % (cpus < pool->poolSize ? cpus : pool->poolSize);
+    }
+
+    // workers sharing the CPU at slot s are s, s + cpus, s + 2 * cpus, ...
+    size_t sharing = (pool->poolSize - slot + cpus - 1) / cpus;
+    size_t index = slot + cpus * (pool->nextSteer++ % sharing);
+    return pool->workers[index]->localRequests;
+}
+
+static size_t WaitingCount(ThreadPool pool)
+{
+    if (!pool->placement.steerByCpu)
+    {
+        // retire sentinels sit in the queue but are not requests
+        size_t waiting = listGetSize(pool->waitingRequests);
+        size_t retiring = __atomic_load_n(&pool->retiring, __ATOMIC_RELAXED);
+        return waiting > retiring ? waiting - retiring : 0;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < pool->poolSize; i++)
+    {
+        count += listGetSize(pool->workers[i]->localRequests);
+    }
+    return count;
+}
+
+/**
+* StartWorkers: Starts workers threadCount .. count - 1 and waits until all of
+*   them are ready. threadArray and workers must already hold count entries.
+*/
+static void StartWorkers(ThreadPool pool, size_t count)
+{
+    size_t first = pool->threadCount;
+    for (size_t i = first; i < count; i++)
+    {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (pool->placement.pinWorkers)
+        {
+            int cpu = affinityCpuAt(i);
+            affinitySetAttr(&attr, cpu);
+            if (i < (size_t)affinityCpuCount())
+            {
+                pool->cpuToSlot[cpu] = i;
+            }
+        }
+        WorkerStart *start = malloc(sizeof(*start));
+        start->pool = pool;
+        start->index = i;
+        pthread_create(&(pool->threadArray[i]), &attr, HandleRequest, start);
+        pthread_attr_destroy(&attr);
+    }
+    for (size_t i = first; i < count; i++)
+    {
+        // SIGPROF from the sampling profiler interrupts sem_wait despite SA_RESTART
+        while (sem_wait(&pool->workersReady) < 0 && errno == EINTR)
+        {
+        }
+    }
+    pool->threadCount = count;
+}
+
+static void FreeWorker(Worker worker)
+{
+    listDestroy(worker->localRequests);
+    affinityFreeLocal(worker, sizeof(*worker));
+}
+
+/**
+* ReapWorkers: Joins the workers that took a retire sentinel and compacts the
+*   arrays. Only used without steering, where worker indexes carry no meaning.
+*/
+static void ReapWorkers(ThreadPool pool)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < pool->threadCount; i++)
+    {
+        if (__atomic_load_n(&pool->workers[i]->retired, __ATOMIC_ACQUIRE))
+        {
+            pthread_join(pool->threadArray[i], NULL);
+            FreeWorker(pool->workers[i]);
+            continue;
+        }
+        pool->threadArray[kept] = pool->threadArray[i];
+        pool->workers[kept] = pool->workers[i];
+        pool->workers[kept]->index = kept;
+        kept++;
+    }
+    pool->threadCount = kept;
+}
+
+ThreadPool ThreadPoolCreate(size_t poolSize, size_t maxRequest, SchedAlg schedAlg,
+                            const ThreadPoolPlacement *placement)
 {
     ThreadPool new_pool = (ThreadPool)malloc(sizeof(*new_pool));
     if (new_pool == NULL)
@@ -33,55 +395,269 @@ ThreadPool ThreadPoolCreate(size_t poolSize, size_t maxRequest, SchedAlg schedAl
         return NULL;
     }
     new_pool->poolSize = poolSize;
+    new_pool->threadCount = 0;
+    new_pool->retiring = 0;
     new_pool->maxRequest = maxRequest;
+    new_pool->batch = THREAD_POOL_DEFAULT_BATCH;
+    new_pool->maxSpinNs = 0;
     new_pool->schedAlg = schedAlg;
+    // queued and in-progress requests, plus what per-thread node caches hold
+    listReserve(2 * (maxRequest + poolSize));
     new_pool->waitingRequests = listCreate();
     new_pool->inProgressRequests = listCreate();
-    new_pool->threadArray = (pthread_t*)malloc(poolSize*sizeof(pthread_t));
-    for (size_t i = 0; i < poolSize; i++)
+    memset(&new_pool->codel, 0, sizeof(new_pool->codel));
+    pthread_mutex_init(&new_pool->codel.mutex, NULL);
+    new_pool->codel.targetNs = CODEL_TARGET_MS * 1000000ULL;
+    new_pool->codel.intervalNs = CODEL_INTERVAL_MS * 1000000ULL;
+    memset(&new_pool->placement, 0, sizeof(new_pool->placement));
+    if (placement != NULL)
+    {
+        new_pool->placement = *placement;
+    }
+    if (new_pool->placement.steerByCpu)
+    {
+        new_pool->placement.pinWorkers = true;
+    }
+    new_pool->nextSteer = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
     {
-        pthread_create(&(new_pool->threadArray[i]), NULL, HandleRequest, new_pool);
+        new_pool->cpuToSlot[cpu] = -1;
     }
+    new_pool->threadArray = (pthread_t*)malloc(poolSize*sizeof(pthread_t));
+    new_pool->workers = (Worker*)calloc(poolSize, sizeof(Worker));
+    sem_init(&new_pool->workersReady, 0, 0);
+    StartWorkers(new_pool, poolSize);
     return new_pool;
 }
 
+int ThreadPoolResize(ThreadPool pool, size_t poolSize)
+{
+    if (poolSize == 0 || pool->placement.steerByCpu)
+    {
+        return -1;
+    }
+
+    ReapWorkers(pool);
+    if (poolSize > pool->poolSize)
+    {
+        size_t count = pool->threadCount + (poolSize - pool->poolSize);
+        pthread_t *threads = realloc(pool->threadArray, count * sizeof(pthread_t));
+        if (threads == NULL)
+        {
+            return -1;
+        }
+        pool->threadArray = threads;
+        Worker *workers = realloc(pool->workers, count * sizeof(Worker));
+        if (workers == NULL)
+        {
+            return -1;
+        }
+        pool->workers = workers;
+        StartWorkers(pool, count);
+    }
+    else
+    {
+        // a worker retires between requests, so nothing in progress is cut off
+        for (size_t i = poolSize; i < pool->poolSize; i++)
+        {
+            __atomic_fetch_add(&pool->retiring, 1, __ATOMIC_RELAXED);
+            listEnqueue(pool->waitingRequests, RETIRE_SENTINEL);
+        }
+    }
+    __atomic_store_n(&pool->poolSize, poolSize, __ATOMIC_RELAXED);
+    return 0;
+}
+
+size_t ThreadPoolSize(ThreadPool pool)
+{
+    return __atomic_load_n(&pool->poolSize, __ATOMIC_RELAXED);
+}
+
+void ThreadPoolSetMaxRequest(ThreadPool pool, size_t maxRequest)
+{
+    pool->maxRequest = maxRequest;
+    listReserve(2 * (maxRequest + pool->poolSize));
+}
+
+void ThreadPoolSetBatch(ThreadPool pool, int batch)
+{
+    if (batch < 1)
+    {
+        batch = 1;
+    }
+    if (batch > THREAD_POOL_MAX_BATCH)
+    {
+        batch = THREAD_POOL_MAX_BATCH;
+    }
+    __atomic_store_n(&pool->batch, batch, __ATOMIC_RELAXED);
+}
+
+void ThreadPoolSetMaxSpin(ThreadPool pool, unsigned long long maxSpinNs)
+{
+    __atomic_store_n(&pool->maxSpinNs, maxSpinNs, __ATOMIC_RELAXED);
+    listSetMaxSpin(pool->waitingRequests, maxSpinNs);
+    if (pool->placement.steerByCpu)
+    {
+        for (size_t i = 0; i < pool->threadCount; i++)
+        {
+            listSetMaxSpin(pool->workers[i]->localRequests, maxSpinNs);
+        }
+    }
+}
+
+void ThreadPoolWaitStats(ThreadPool pool, ListWaitStats *stats)
+{
+    listGetWaitStats(pool->waitingRequests, stats);
+    if (pool->placement.steerByCpu)
+    {
+        for (size_t i = 0; i < pool->threadCount; i++)
+        {
+            ListWaitStats local;
+            listGetWaitStats(pool->workers[i]->localRequests, &local);
+            stats->spinHits += local.spinHits;
+            stats->spinMisses += local.spinMisses;
+            stats->parks += local.parks;
+            stats->spinNs += local.spinNs;
+        }
+    }
+}
+
+void ThreadPoolSetSchedAlg(ThreadPool pool, SchedAlg schedAlg, int targetMs, int intervalMs)
+{
+    pthread_mutex_lock(&pool->codel.mutex);
+        pool->codel.targetNs = targetMs * 1000000ULL;
+        pool->codel.intervalNs = intervalMs * 1000000ULL;
+        if (pool->schedAlg != CODEL && schedAlg == CODEL)
+        {
+            // start from a clean state rather than where CoDel was last left
+            pool->codel.firstAboveTime = 0;
+            pool->codel.dropping = false;
+            pool->codel.count = pool->codel.lastCount = 0;
+        }
+    pthread_mutex_unlock(&pool->codel.mutex);
+    __atomic_store_n(&pool->schedAlg, schedAlg, __ATOMIC_RELAXED);
+}
+
 void ThreadPoolDestroy(ThreadPool pool)
 {
-    listDestroy(pool->waitingRequests);
-    listDestroy(pool->inProgressRequests);
-    for (size_t i = 0; i < pool->poolSize; i++)
+    // queue one sentinel per worker behind the waiting requests, so those are
+    // still served, then wait for every worker to finish
+    if (!pool->placement.steerByCpu)
+    {
+        // any worker may take any sentinel from the shared queue, so they are
+        // counted rather than addressed: one per worker not already retiring
+        for (size_t i = 0; i < pool->poolSize; i++)
+        {
+            __atomic_fetch_add(&pool->retiring, 1, __ATOMIC_RELAXED);
+            listEnqueue(pool->waitingRequests, RETIRE_SENTINEL);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < pool->threadCount; i++)
+        {
+            Worker worker = pool->workers[i];
+            if (!__atomic_load_n(&worker->retired, __ATOMIC_ACQUIRE))
+            {
+                __atomic_fetch_add(&pool->retiring, 1, __ATOMIC_RELAXED);
+                listEnqueue(worker->queue, RETIRE_SENTINEL);
+            }
+        }
+    }
+    for (size_t i = 0; i < pool->threadCount; i++)
     {
-        pthread_cancel(pool->threadArray[i]);
+        pthread_join(pool->threadArray[i], NULL);
+        FreeWorker(pool->workers[i]);
     }
     
+    listDestroy(pool->waitingRequests);
+    listDestroy(pool->inProgressRequests);
+    sem_destroy(&pool->workersReady);
+    free(pool->workers);
+    pthread_mutex_destroy(&pool->codel.mutex);
     free(pool->threadArray);
     free(pool);
 }
 
 void ThreadPoolAddRequest(ThreadPool pool,int fd)
 {
-    
-    if(listGetSize(pool->inProgressRequests) + listGetSize(pool->waitingRequests) >  pool->maxRequest)
+    List queue = QueueFor(pool, fd);
+    if (__atomic_load_n(&pool->schedAlg, __ATOMIC_RELAXED) == WFQ)
+    {
+        // the classes hold the connection and bound their own queues; the
+        // pool queue carries a token to wake a worker
+        if (priorityEnqueue(fd, pool->maxRequest) < 0)
+        {
+            requestReject(fd, 503);
+            CloseRequest(fd);
+        }
+        else
+        {
+            listEnqueue(queue, PRIORITY_TOKEN);
+        }
+        return;
+    }
+    if(listGetSize(pool->inProgressRequests) + WaitingCount(pool) >  pool->maxRequest)
     {
-        switch (pool->schedAlg)
+        switch (__atomic_load_n(&pool->schedAlg, __ATOMIC_RELAXED))
         {
         case DROP_TAIL:
         {
-            Close(fd);
+            CloseRequest(fd);
             break;
         }
         case DROP_HEAD:
+        case CODEL:
         {
-            
+            // the queue bound still holds: shed the oldest waiting request
+            int oldest = listTryDequeue(queue);
+            if (oldest == RETIRE_SENTINEL)
+            {
+                listEnqueue(queue, oldest);
+            }
+            else if (oldest != -1)
+            {
+                requestReject(oldest, 503);
+                CloseRequest(oldest);
+            }
+            listEnqueue(queue,fd);
             break;
         }
-        
+
         default:
+        {
+            // block and random: the acceptor (or the HTTP/2 thread) must not
+            // wait here, so the new connection is turned away; every shed fd
+            // goes through CloseRequest to give back its client's slot
+            requestReject(fd, 503);
+            CloseRequest(fd);
             break;
         }
+        }
     }
     else
     {
-        listEnqueue(pool->waitingRequests,fd);
+        listEnqueue(queue,fd);
     }
-}
\ No newline at end of file
+}
+
+void ThreadPoolAddRequests(ThreadPool pool, const int *fds, int count)
+{
+    int queued = 0;
+    if (!pool->placement.steerByCpu && __atomic_load_n(&pool->schedAlg, __ATOMIC_RELAXED) != WFQ)
+    {
+        // everything that fits under the bound goes in with one lock acquisition
+        size_t busy = listGetSize(pool->inProgressRequests) + WaitingCount(pool);
+        size_t room = busy <= pool->maxRequest ? pool->maxRequest - busy + 1 : 0;
+        int fits = room < (size_t)count ? (int)room : count;
+        if (fits > 0 && listEnqueueBatch(pool->waitingRequests, fds, fits) == LIST_SUCCESS)
+        {
+            queued = fits;
+        }
+    }
+    // the overflow follows the scheduling policy one connection at a time
+    for (int i = queued; i < count; i++)
+    {
+        ThreadPoolAddRequest(pool, fds[i]);
+    }
+}
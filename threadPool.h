@@ -9,15 +9,86 @@
 typedef struct Pool_t* ThreadPool;
 
 typedef enum SchedAlg_t {
-    BLOCK,
-    DROP_TAIL,
-    DROP_HEAD,
-    RANDOM_DROP
+    BLOCK,      // past the queue bound, new connections get 503 rather than wait
+    DROP_TAIL,  // past the bound, new connections are closed
+    DROP_HEAD,  // past the bound, the oldest waiting connection gets 503
+    RANDOM_DROP,// as BLOCK
+    CODEL,      // shed from the head once queueing delay stays above a target
+    WFQ         // priority classes served by deficit round robin (see priority.h)
 } SchedAlg;
 
-ThreadPool ThreadPoolCreate(size_t poolSize, size_t maxRequest, SchedAlg schedAlg);
+/* CoDel defaults: acceptable standing queue delay and the window it may persist */
+#define CODEL_TARGET_MS 5
+#define CODEL_INTERVAL_MS 100
+
+/* Requests a worker claims per queue lock acquisition (see ThreadPoolSetBatch) */
+#define THREAD_POOL_DEFAULT_BATCH 1
+#define THREAD_POOL_MAX_BATCH 64
+
+/* Where worker threads run and which worker gets each connection */
+typedef struct ThreadPoolPlacement_t {
+    bool pinWorkers;  // pin worker i to CPU slot i (see affinity.h), per-worker data on its node
+    bool steerByCpu;  // queue each connection on a worker pinned to the CPU that received it
+                      // (SO_INCOMING_CPU); workers then only serve their own queue.
+                      // Implies pinWorkers.
+} ThreadPoolPlacement;
+
+/**
+* ThreadPoolCreate: Starts poolSize workers and returns once all of them are
+*   ready. placement may be NULL for unpinned workers sharing one queue.
+*/
+ThreadPool ThreadPoolCreate(size_t poolSize, size_t maxRequest, SchedAlg schedAlg,
+                            const ThreadPoolPlacement *placement);
+
+/**
+* ThreadPoolDestroy: Lets the workers finish the requests already queued,
+*   then joins them and frees the pool.
+*/
 void ThreadPoolDestroy(ThreadPool pool);
 void ThreadPoolAddRequest(ThreadPool pool,int fd);
 
+/**
+* ThreadPoolAddRequests: Same as calling ThreadPoolAddRequest for each of fds,
+*   but the ones that fit under the queue bound are queued with a single lock
+*   acquisition and wakeup.
+*/
+void ThreadPoolAddRequests(ThreadPool pool, const int *fds, int count);
+
+/**
+* ThreadPoolResize: Changes the number of workers while the pool runs. New
+*   workers are started at once; surplus ones exit after their current request.
+*   Call from the thread that adds requests.
+* @return
+*   0 on success
+*   -1 for a size of 0, when steering by CPU (workers own queues), or out of memory
+*/
+int ThreadPoolResize(ThreadPool pool, size_t poolSize);
+
+/* Workers the pool runs, or is about to after a resize; callable from any thread */
+size_t ThreadPoolSize(ThreadPool pool);
+
+/* Live counterparts of the ThreadPoolCreate arguments, for reconfiguration */
+void ThreadPoolSetMaxRequest(ThreadPool pool, size_t maxRequest);
+void ThreadPoolSetSchedAlg(ThreadPool pool, SchedAlg schedAlg, int targetMs, int intervalMs);
+
+/**
+* ThreadPoolSetBatch: Lets each worker claim up to batch waiting requests at
+*   once (clamped to 1 .. THREAD_POOL_MAX_BATCH). Idle workers still get a
+*   share of a burst each; larger batches trade fairness for fewer wakeups,
+*   and a request claimed behind a slow one waits for it however many
+*   workers are idle (see bench/workerBatch.sh).
+*/
+void ThreadPoolSetBatch(ThreadPool pool, int batch);
+
+/**
+* ThreadPoolSetMaxSpin: Lets idle workers spin up to maxSpinNs for the next
+*   request before blocking, when requests have recently been arriving that
+*   often (see listSetMaxSpin). 0, the default, always blocks at once.
+*/
+void ThreadPoolSetMaxSpin(ThreadPool pool, unsigned long long maxSpinNs);
+
+/* How idle workers waited: spins that paid off, spins wasted, blocking waits */
+void ThreadPoolWaitStats(ThreadPool pool, ListWaitStats *stats);
+
 
 #endif // THREADS_POOL_H_
\ No newline at end of file
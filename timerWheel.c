@@ -0,0 +1,164 @@
+#include "timerWheel.h"
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+static struct
+{
+    Timer **slots;          // each bucket is a doubly linked list
+    long slotCount;
+    long cursor;            // bucket handled by the next tick
+    int tickMs;
+    pthread_mutex_t mutex;
+    pthread_t thread;
+} timerWheel = {
+    .slots = NULL,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void timerUnlink(Timer *timer)
+{
+    if (timer->prev != NULL)
+    {
+        timer->prev->next = timer->next;
+    }
+    else
+    {
+        timerWheel.slots[timer->slot] = timer->next;
+    }
+    if (timer->next != NULL)
+    {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = timer->prev = NULL;
+    timer->slot = -1;
+}
+
+/**
+* timerTick: Expires the timers due in the current bucket and advances.
+*/
+static void timerTick(void)
+{
+    pthread_mutex_lock(&timerWheel.mutex);
+        Timer *timer = timerWheel.slots[timerWheel.cursor];
+        while (timer != NULL)
+        {
+            Timer *next = timer->next;
+            if (timer->rounds > 0)
+            {
+                timer->rounds--;
+            }
+            else
+            {
+                timerUnlink(timer);
+                timer->expired = 1;
+                shutdown(timer->fd, SHUT_RD);
+            }
+            timer = next;
+        }
+        timerWheel.cursor = (timerWheel.cursor + 1) % timerWheel.slotCount;
+    pthread_mutex_unlock(&timerWheel.mutex);
+}
+
+static void *timerWheelMain(void *arg)
+{
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (true)
+    {
+        // absolute sleeps keep the wheel from drifting behind real time
+        next.tv_nsec += timerWheel.tickMs * 1000000L;
+        while (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0)
+        {
+        }
+        timerTick();
+    }
+    return arg;
+}
+
+int timerWheelInit(int tickMs, int slots)
+{
+    timerWheel.tickMs = tickMs > 0 ? tickMs : 100;
+    timerWheel.slotCount = slots > 0 ? slots : 512;
+    timerWheel.cursor = 0;
+    timerWheel.slots = calloc(timerWheel.slotCount, sizeof(Timer *));
+    if (timerWheel.slots == NULL)
+    {
+        return -1;
+    }
+    if (pthread_create(&timerWheel.thread, NULL, timerWheelMain, NULL) != 0)
+    {
+        free(timerWheel.slots);
+        timerWheel.slots = NULL;
+        return -1;
+    }
+    pthread_detach(timerWheel.thread);
+    return 0;
+}
+
+void timerInit(Timer *timer)
+{
+    timer->next = timer->prev = NULL;
+    timer->fd = -1;
+    timer->rounds = 0;
+    timer->slot = -1;
+    timer->expired = 0;
+}
+
+void timerArm(Timer *timer, int fd, int timeoutMs)
+{
+    if (timerWheel.slots == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&timerWheel.mutex);
+        if (timer->slot >= 0)
+        {
+            timerUnlink(timer);
+        }
+        timer->expired = 0;
+        if (timeoutMs > 0)
+        {
+            // +1 tick: the current bucket may be about to fire
+            unsigned long ticks = (timeoutMs + timerWheel.tickMs - 1) / timerWheel.tickMs + 1;
+            timer->fd = fd;
+            timer->rounds = ticks / timerWheel.slotCount;
+            timer->slot = (timerWheel.cursor + ticks) % timerWheel.slotCount;
+            timer->prev = NULL;
+            timer->next = timerWheel.slots[timer->slot];
+            if (timer->next != NULL)
+            {
+                timer->next->prev = timer;
+            }
+            timerWheel.slots[timer->slot] = timer;
+        }
+    pthread_mutex_unlock(&timerWheel.mutex);
+}
+
+void timerCancel(Timer *timer)
+{
+    if (timerWheel.slots == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&timerWheel.mutex);
+        if (timer->slot >= 0)
+        {
+            timerUnlink(timer);
+        }
+    pthread_mutex_unlock(&timerWheel.mutex);
+}
+
+bool timerExpired(Timer *timer)
+{
+    return __atomic_load_n(&timer->expired, __ATOMIC_ACQUIRE) != 0;
+}
@@ -0,0 +1,56 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include "bool.h"
+
+/**
+* Connection deadlines
+*
+* A hashed timing wheel: timers are kept in per-tick buckets of a circular
+* array, so arming and cancelling are O(1) and each tick only looks at the
+* timers due in that bucket. A background thread advances the wheel; when a
+* connection's deadline passes, its read side is shut down, which wakes the
+* worker blocked reading from it (the read returns end-of-file). The worker
+* then checks timerExpired to tell a timeout from a client that hung up.
+*
+* Timers are owned by the caller (typically on the worker's stack) and must be
+* cancelled before the descriptor is closed.
+*
+*   timerWheelInit - Starts the wheel thread.
+*   timerArm       - (Re)arms a timer for fd.
+*   timerCancel    - Disarms a timer; no shutdown happens after it returns.
+*   timerExpired   - Whether the timer fired since it was last armed.
+*/
+
+typedef struct Timer_t {
+    struct Timer_t *next;
+    struct Timer_t *prev;
+    int fd;
+    unsigned long rounds;  // full wheel turns left before it is due
+    long slot;             // bucket index, -1 when not armed
+    int expired;
+} Timer;
+
+/**
+* timerWheelInit: Starts the wheel with the given tick (timer resolution)
+*   and number of buckets.
+* @return 0 on success, -1 if the thread could not be started
+*/
+int timerWheelInit(int tickMs, int slots);
+
+/**
+* timerInit: Prepares a timer for use. Must be called once before timerArm.
+*/
+void timerInit(Timer *timer);
+
+/**
+* timerArm: Arms timer to shut down fd's read side in timeoutMs (rounded up
+*   to the tick). Re-arming an armed timer moves it. timeoutMs <= 0 disarms.
+*/
+void timerArm(Timer *timer, int fd, int timeoutMs);
+
+void timerCancel(Timer *timer);
+
+bool timerExpired(Timer *timer);
+
+#endif // TIMER_WHEEL_H_
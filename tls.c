@@ -0,0 +1,339 @@
+#include "tls.h"
+#include "segel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/resource.h>
+
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+typedef struct TlsConn_t
+{
+    SSL *ssl;           // NULL for a descriptor without a session
+    bool ktlsSend;
+    bool ktlsReceive;
+} TlsConn;
+
+static struct
+{
+    SSL_CTX *ctx;       // NULL when TLS is off
+    TlsConn *conns;     // indexed by descriptor, touched only by the fd's worker
+    size_t fdCount;
+    TlsStats stats;     // updated atomically
+} tls;
+
+static TlsConn *TlsLookup(int fd)
+{
+    if (fd < 0 || (size_t)fd >= tls.fdCount || tls.conns[fd].ssl == NULL)
+    {
+        return NULL;
+    }
+    return &tls.conns[fd];
+}
+
+/**
+* TlsWait: Waits for what the last operation on ssl asked for.
+* @return 0 to retry the operation, -1 when err is not a retryable one
+*/
+static int TlsWait(int fd, int err)
+{
+    struct pollfd pfd;
+    if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
+    {
+        return -1;
+    }
+    pfd.fd = fd;
+    pfd.events = err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT;
+    while (poll(&pfd, 1, -1) < 0)
+    {
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* read() for the Rio package: through the session for TLS descriptors */
+static ssize_t TlsRead(int fd, void *buf, size_t n)
+{
+    TlsConn *conn = TlsLookup(fd);
+    if (conn == NULL)
+    {
+        return read(fd, buf, n);
+    }
+
+    while (true)
+    {
+        ERR_clear_error();
+        int rc = SSL_read(conn->ssl, buf, n > INT_MAX ? INT_MAX : (int)n);
+        if (rc > 0)
+        {
+            return rc;
+        }
+        int err = SSL_get_error(conn->ssl, rc);
+        if (err == SSL_ERROR_ZERO_RETURN)
+        {
+            return 0;
+        }
+        if (TlsWait(fd, err) < 0)
+        {
+            // a socket shut down under us (timeout) reads as a plain EOF
+            if (err == SSL_ERROR_SYSCALL && errno == 0)
+            {
+                return 0;
+            }
+            if (err != SSL_ERROR_SYSCALL)
+            {
+                errno = EIO;
+            }
+            return -1;
+        }
+    }
+}
+
+/* write() for the Rio package, writing all of buf for TLS descriptors */
+static ssize_t TlsWrite(int fd, const void *buf, size_t n)
+{
+    TlsConn *conn = TlsLookup(fd);
+    if (conn == NULL)
+    {
+        return write(fd, buf, n);
+    }
+
+    size_t written = 0;
+    while (written < n)
+    {
+        size_t want = n - written;
+        ERR_clear_error();
+        int rc = SSL_write(conn->ssl, (const char *)buf + written, want > INT_MAX ? INT_MAX : (int)want);
+        if (rc > 0)
+        {
+            written += rc;
+            continue;
+        }
+        int err = SSL_get_error(conn->ssl, rc);
+        if (TlsWait(fd, err) < 0)
+        {
+            // a failed session means the client is gone, like a broken pipe
+            if (err != SSL_ERROR_SYSCALL || errno != ECONNRESET)
+            {
+                errno = EPIPE;
+            }
+            return -1;
+        }
+    }
+    return written;
+}
+
+int tlsInit(const TlsConfig *config)
+{
+    struct rlimit limit;
+    const char *key = config->key[0] != '\0' ? config->key : config->certificate;
+
+    if (config->certificate[0] == '\0')
+    {
+        return 0;
+    }
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL)
+    {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    if (SSL_CTX_use_certificate_chain_file(ctx, config->certificate) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+
+    // clients dropping the connection without close_notify are the norm for
+    // HTTP/1.0, where the close itself ends the response
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF | SSL_OP_NO_RENEGOTIATION);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    // resumption: one ticket per connection is enough for a client to come
+    // back once; the session cache serves clients that do not take tickets
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"webServer", 9);
+    if (!config->sessionTickets)
+    {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+    SSL_CTX_set_num_tickets(ctx, 1);
+    if (config->sessionCacheSize > 0)
+    {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, config->sessionCacheSize);
+    }
+    else
+    {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    if (config->ktls)
+    {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+
+    tls.fdCount = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    {
+        tls.fdCount = limit.rlim_cur;
+    }
+    tls.conns = calloc(tls.fdCount, sizeof(TlsConn));
+    if (tls.conns == NULL)
+    {
+        perror("TLS connection table");
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+    tls.ctx = ctx;
+    rio_settransport(TlsRead, TlsWrite);
+    return 0;
+}
+
+bool tlsEnabled(void)
+{
+    return tls.ctx != NULL;
+}
+
+int tlsAccept(int fd)
+{
+    if (tls.ctx == NULL)
+    {
+        return 0;
+    }
+    if (fd < 0 || (size_t)fd >= tls.fdCount)
+    {
+        return -1;
+    }
+
+    SSL *ssl = SSL_new(tls.ctx);
+    if (ssl == NULL || SSL_set_fd(ssl, fd) != 1)
+    {
+        SSL_free(ssl);
+        __atomic_fetch_add(&tls.stats.failed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    while (true)
+    {
+        ERR_clear_error();
+        int rc = SSL_accept(ssl);
+        if (rc == 1)
+        {
+            break;
+        }
+        if (TlsWait(fd, SSL_get_error(ssl, rc)) < 0)
+        {
+            SSL_free(ssl);
+            __atomic_fetch_add(&tls.stats.failed, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    }
+
+    TlsConn *conn = &tls.conns[fd];
+    conn->ssl = ssl;
+    conn->ktlsSend = BIO_get_ktls_send(SSL_get_wbio(ssl));
+    conn->ktlsReceive = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+    __atomic_fetch_add(&tls.stats.handshakes, 1, __ATOMIC_RELAXED);
+    if (SSL_session_reused(ssl))
+    {
+        __atomic_fetch_add(&tls.stats.resumed, 1, __ATOMIC_RELAXED);
+    }
+    if (conn->ktlsSend)
+    {
+        __atomic_fetch_add(&tls.stats.ktlsSend, 1, __ATOMIC_RELAXED);
+    }
+    if (conn->ktlsReceive)
+    {
+        __atomic_fetch_add(&tls.stats.ktlsReceive, 1, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+void tlsRelease(int fd)
+{
+    TlsConn *conn = TlsLookup(fd);
+    if (conn == NULL)
+    {
+        return;
+    }
+    // one attempt, without waiting for the client's close_notify
+    ERR_clear_error();
+    SSL_shutdown(conn->ssl);
+    SSL_free(conn->ssl);
+    conn->ssl = NULL;
+}
+
+bool tlsRawReadable(int fd)
+{
+    TlsConn *conn = TlsLookup(fd);
+    return conn == NULL || conn->ktlsReceive;
+}
+
+bool tlsRawWritable(int fd)
+{
+    TlsConn *conn = TlsLookup(fd);
+    return conn == NULL || conn->ktlsSend;
+}
+
+void tlsStats(TlsStats *stats)
+{
+    stats->handshakes = __atomic_load_n(&tls.stats.handshakes, __ATOMIC_RELAXED);
+    stats->resumed = __atomic_load_n(&tls.stats.resumed, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&tls.stats.failed, __ATOMIC_RELAXED);
+    stats->ktlsSend = __atomic_load_n(&tls.stats.ktlsSend, __ATOMIC_RELAXED);
+    stats->ktlsReceive = __atomic_load_n(&tls.stats.ktlsReceive, __ATOMIC_RELAXED);
+}
+
+#else // !HAVE_OPENSSL
+
+int tlsInit(const TlsConfig *config)
+{
+    if (config->certificate[0] == '\0')
+    {
+        return 0;
+    }
+    fprintf(stderr, "TLS support was not compiled in (build with HAVE_OPENSSL)\n");
+    return -1;
+}
+
+bool tlsEnabled(void)
+{
+    return false;
+}
+
+int tlsAccept(int fd)
+{
+    return 0;
+}
+
+void tlsRelease(int fd)
+{
+}
+
+bool tlsRawReadable(int fd)
+{
+    return true;
+}
+
+bool tlsRawWritable(int fd)
+{
+    return true;
+}
+
+void tlsStats(TlsStats *stats)
+{
+    stats->handshakes = stats->resumed = stats->failed = 0;
+    stats->ktlsSend = stats->ktlsReceive = 0;
+}
+
+#endif // HAVE_OPENSSL
@@ -0,0 +1,73 @@
+#ifndef TLS_H_
+#define TLS_H_
+
+#include <limits.h>
+#include <sys/types.h>
+#include "bool.h"
+
+/**
+* TLS termination
+*
+* Optional HTTPS on the listening port, built when OpenSSL is available
+* (HAVE_OPENSSL). Each connection's handshake runs on the worker that serves
+* it; afterwards the Rio package reads and writes through the connection's
+* TLS session, so request handling is the same as for plaintext.
+*
+* Returning clients resume their session (tickets, and a server-side cache
+* for clients without ticket support) and skip the full handshake. When the
+* kernel supports TLS (the tls module) the record layer is handed to it after
+* the handshake; the socket can then still be written directly, so responses
+* keep their zero-copy paths (splice, write from the file mapping) and the
+* kernel encrypts on the way out. Without kTLS those paths copy through user
+* space instead.
+*
+*   tlsInit         - Loads the certificate and key; TLS stays off without them.
+*   tlsEnabled      - Whether connections are TLS.
+*   tlsAccept       - Runs the handshake on a new connection.
+*   tlsRelease      - Ends a connection's session before its socket is closed.
+*   tlsRawReadable  - Whether the socket may be read directly (plaintext or kTLS).
+*   tlsRawWritable  - Whether the socket may be written directly (plaintext or kTLS).
+*   tlsStats        - Counters for monitoring.
+*/
+
+typedef struct TlsConfig_t {
+    char certificate[PATH_MAX];   // PEM certificate chain, "" = TLS off
+    char key[PATH_MAX];           // PEM private key, "" = in the certificate file
+    bool sessionTickets;          // stateless resumption with session tickets
+    int sessionCacheSize;         // server-side session cache entries, 0 = off
+    bool ktls;                    // offload the record layer to the kernel when it can
+} TlsConfig;
+
+typedef struct TlsStats_t {
+    unsigned long handshakes;     // completed ones
+    unsigned long resumed;        // of those, abbreviated handshakes
+    unsigned long failed;
+    unsigned long ktlsSend;       // connections whose sending was offloaded
+    unsigned long ktlsReceive;    // connections whose receiving was offloaded
+} TlsStats;
+
+/**
+* tlsInit: Sets up TLS for all connections when config names a certificate.
+*   Problems with the certificate or key are reported on stderr.
+* @return 0 on success (or TLS off), -1 on error
+*/
+int tlsInit(const TlsConfig *config);
+
+bool tlsEnabled(void);
+
+/**
+* tlsAccept: Runs the TLS handshake on fd, waiting as needed; the caller bounds
+*   the wait (see timerArm). Does nothing when TLS is off.
+* @return 0 on success, -1 if the handshake failed
+*/
+int tlsAccept(int fd);
+
+/* Sends close_notify (best effort) and frees fd's session, if it has one */
+void tlsRelease(int fd);
+
+bool tlsRawReadable(int fd);
+bool tlsRawWritable(int fd);
+
+void tlsStats(TlsStats *stats);
+
+#endif // TLS_H_
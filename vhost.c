@@ -0,0 +1,204 @@
+#include "vhost.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/** Longest host name (RFC 1035), anything longer goes to the default site */
+#define VHOST_NAME_MAX 255
+
+typedef struct VhostSlot_t
+{
+    size_t hash;
+    const char *name;       // NULL for an empty slot
+    const Vhost *host;
+} VhostSlot;
+
+static struct
+{
+    Vhost fallback;
+    Vhost *hosts;
+    VhostSlot *slots;
+    size_t slotCount;       // a power of two, at least twice the names
+} vhosts = {.fallback = {"", "./public", NULL, -1, true, false, 0}};
+
+/* FNV-1a, as for the MIME table */
+static size_t VhostHash(const char *name)
+{
+    size_t hash = 14695981039346656037ULL;
+    for (; *name != '\0'; name++)
+    {
+        hash = (hash ^ (unsigned char)*name) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void VhostInsert(const char *name, const Vhost *host)
+{
+    size_t hash = VhostHash(name);
+    size_t i = hash & (vhosts.slotCount - 1);
+    while (vhosts.slots[i].name != NULL)
+    {
+        if (vhosts.slots[i].hash == hash && !strcmp(vhosts.slots[i].name, name))
+        {
+            return;     // claimed by an earlier site
+        }
+        i = (i + 1) & (vhosts.slotCount - 1);
+    }
+    vhosts.slots[i].hash = hash;
+    vhosts.slots[i].name = name;
+    vhosts.slots[i].host = host;
+}
+
+int vhostInit(const VhostConfig *defaults, const VhostConfig *hosts, int count)
+{
+    size_t names = 0;
+    char *copy;
+
+    if ((copy = strdup(defaults->documentRoot)) == NULL)
+    {
+        return -1;
+    }
+    vhosts.fallback.documentRoot = copy;
+    vhosts.fallback.autoindex = defaults->autoindex > 0;
+    if ((vhosts.fallback.routes = routeTableCreate(defaults->documentRoot, defaults->routes)) == NULL)
+    {
+        return -1;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *p = hosts[i].names;
+        while (*p != '\0')
+        {
+            p += strspn(p, " ");
+            if (*p != '\0')
+            {
+                names++;
+                p += strcspn(p, " ");
+            }
+        }
+    }
+    vhosts.slotCount = 16;
+    while (vhosts.slotCount < 2 * names)
+    {
+        vhosts.slotCount *= 2;
+    }
+    vhosts.slots = calloc(vhosts.slotCount, sizeof(VhostSlot));
+    vhosts.hosts = calloc(count, sizeof(Vhost));
+    if (vhosts.slots == NULL || vhosts.hosts == NULL)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        Vhost *host = &vhosts.hosts[i];
+        // the names are cut out of one copy, which the table keeps pointing into
+        if ((copy = strdup(hosts[i].names)) == NULL ||
+            (host->documentRoot = strdup(hosts[i].documentRoot)) == NULL ||
+            (host->routes = routeTableCreate(hosts[i].documentRoot, hosts[i].routes)) == NULL)
+        {
+            return -1;
+        }
+        host->staticMaxAge = hosts[i].staticMaxAge;
+        host->cgi = hosts[i].cgi;
+        host->autoindex = hosts[i].autoindex < 0 ? vhosts.fallback.autoindex : hosts[i].autoindex;
+        host->cachePartition = i + 1;
+        host->name = NULL;
+        for (char *name = strtok(copy, " "); name != NULL; name = strtok(NULL, " "))
+        {
+            if (host->name == NULL)
+            {
+                host->name = name;
+            }
+            VhostInsert(name, host);
+        }
+    }
+    return 0;
+}
+
+/* Adds the static directories of table to dirs, skipping those already in */
+static int VhostAddDirs(const RouteTable *table, const char **dirs, int count, int max)
+{
+    const char *found[max];
+    int n = routeStaticDirs(table, found, max);
+
+    for (int i = 0; i < n && count < max; i++)
+    {
+        int j = 0;
+        while (j < count && strcmp(dirs[j], found[i]) != 0)
+        {
+            j++;
+        }
+        if (j == count)
+        {
+            dirs[count++] = found[i];
+        }
+    }
+    return count;
+}
+
+int vhostStaticDirs(const char **dirs, int max)
+{
+    int count = VhostAddDirs(vhosts.fallback.routes, dirs, 0, max);
+    for (size_t i = 0; vhosts.slots != NULL && i < vhosts.slotCount; i++)
+    {
+        // every site has a slot per name, and the first one is enough
+        const Vhost *host = vhosts.slots[i].host;
+        if (host != NULL && !strcmp(vhosts.slots[i].name, host->name))
+        {
+            count = VhostAddDirs(host->routes, dirs, count, max);
+        }
+    }
+    return count;
+}
+
+const Vhost *vhostLookup(const char *host)
+{
+    char name[VHOST_NAME_MAX + 1];
+    size_t len = 0;
+
+    if (vhosts.slots == NULL || *host == '\0')
+    {
+        return &vhosts.fallback;
+    }
+
+    // "Example.COM.:8080" is example.com; an IPv6 literal keeps its brackets
+    const char *end = *host == '[' ? strchr(host, ']') : strchr(host, ':');
+    if (end == NULL)
+    {
+        end = host + strlen(host);
+    }
+    else if (*host == '[')
+    {
+        end++;
+    }
+    if (end - host > VHOST_NAME_MAX)
+    {
+        return &vhosts.fallback;
+    }
+    for (; host < end; host++)
+    {
+        name[len++] = tolower((unsigned char)*host);
+    }
+    if (len > 0 && name[len - 1] == '.')
+    {
+        len--;
+    }
+    name[len] = '\0';
+
+    size_t hash = VhostHash(name);
+    for (size_t i = hash & (vhosts.slotCount - 1); vhosts.slots[i].name != NULL;
+         i = (i + 1) & (vhosts.slotCount - 1))
+    {
+        if (vhosts.slots[i].hash == hash && !strcmp(vhosts.slots[i].name, name))
+        {
+            return vhosts.slots[i].host;
+        }
+    }
+    return &vhosts.fallback;
+}
@@ -0,0 +1,74 @@
+#ifndef VHOST_H_
+#define VHOST_H_
+
+#include <stddef.h>
+#include <limits.h>
+#include "bool.h"
+#include "route.h"
+
+/**
+* Virtual hosts
+*
+* Several sites served by one process, sharing its worker pool. The Host
+* header of a request (without the port) picks the site, which brings its own
+* document root, routes, policies and response cache partition. Requests without a
+* Host header, or for a name no site claims, are served by the default site:
+* document_root and the global settings.
+*
+* The names are put into an open-addressing hash table once at startup, so
+* routing costs one hash of the Host value and usually a single probe.
+*
+*   vhostInit   - Builds the table from the configured sites.
+*   vhostLookup - Finds the site for a Host header value.
+*   vhostStaticDirs - Lists the static directories of every site.
+*/
+
+/** Most sites one process serves besides the default one */
+#define VHOST_MAX 32
+/** Room for a site's names, space separated */
+#define VHOST_NAMES_MAX 512
+
+typedef struct VhostConfig_t {
+    char names[VHOST_NAMES_MAX];  // lower case, space separated
+    char documentRoot[PATH_MAX];
+    char routes[ROUTE_TEXT_MAX];  // "route" lines on top of documentRoot at "/"
+    int staticMaxAge;             // Cache-Control max-age of static files, -1 = static_max_age
+    bool cgi;                     // run CGI programs, off answers them with 403
+    int autoindex;                // list directories without home.html, -1 = autoindex
+    size_t cacheBytes;            // the site's response cache partition, 0 = not cached
+} VhostConfig;
+
+typedef struct Vhost_t {
+    const char *name;             // first configured name, "" for the default site
+    const char *documentRoot;
+    const RouteTable *routes;
+    int staticMaxAge;             // -1 = the global setting
+    bool cgi;
+    bool autoindex;
+    int cachePartition;           // 0 for the default site, then one per site in order
+} Vhost;
+
+/**
+* vhostInit: Sets up the default site from defaults (its document root,
+*   routes and autoindex; the settings sites inherit) and the count configured
+*   ones. Names must be unique (configLoad checks).
+* @return 0 on success, -1 when out of memory or a route names an unknown
+*   handler
+*/
+int vhostInit(const VhostConfig *defaults, const VhostConfig *hosts, int count);
+
+/**
+* vhostLookup: The site serving host, a Host header value ("" when absent).
+*   Case, the port and a trailing dot are ignored.
+* @return the site, the default one when no site claims the name
+*/
+const Vhost *vhostLookup(const char *host);
+
+/**
+* vhostStaticDirs: Stores the directories static files are served from, of
+*   every site, into dirs (each once), up to max.
+* @return how many were stored
+*/
+int vhostStaticDirs(const char **dirs, int max);
+
+#endif // VHOST_H_